@@ -0,0 +1,837 @@
+#include "ChunkManager.h"
+#include "TraingleTable.h"
+#include <cmath>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+
+namespace {
+
+	// A node is split when the camera is closer than SPLIT_DISTANCE node sizes and merged again beyond
+	// MERGE_DISTANCE, so a camera hovering at a boundary does not flip the level every frame
+	const float SPLIT_DISTANCE = 1.0f;
+	const float MERGE_DISTANCE = 1.25f;
+
+	// Upper bound of the transition patch vertices in one coarse face cell: at most 16 crossings
+	const int SEAM_CELL_VERTICES = 48;
+
+	// Meshlets are cut from runs of triangles in blocks of MESHLET_BLOCK^3 cells. Non-indexed, so there is no vertex
+	// limit, see the class comment
+	const size_t MESHLET_TRIANGLES = 124;
+	const int MESHLET_BLOCK = 4;
+
+	// Arena budget per column of chunk cells and iso-level: the wave surface crosses a column in one to three cells,
+	// of up to 4 triangles each; measured chunks average a sixth of this
+	const size_t SURFACE_COLUMN_VERTICES = 24;
+
+	struct Neighbour {
+		int face;
+		int dx;
+		int dz;
+	};
+
+	const Neighbour neighbours[4] = { { 1, -1, 0 }, { 2, 1, 0 }, { 4, 0, -1 }, { 8, 0, 1 } };
+
+	ChunkKey parentOf(const ChunkKey& key) {
+		// >> floors negative coordinates too
+		return { key.x >> 1, key.z >> 1, key.lod + 1 };
+	}
+
+	int cornerOffset(int corner, int axis) {
+		return axis == 0 ? cornerOffsetX(corner) : axis == 1 ? cornerOffsetY(corner) : cornerOffsetZ(corner);
+	}
+
+	// Field samples of one chunk: (cells + 1)^3 grid points at the chunk's stride, in chunk grid units.
+	// Points outside the chunk come from the sampler.
+	struct ChunkSamples {
+		const std::vector<float>& values;
+		int points;
+		std::function<float(glm::ivec3)> outside;
+
+		bool inside(glm::ivec3 p) const {
+			return p.x >= 0 && p.y >= 0 && p.z >= 0 && p.x < points && p.y < points && p.z < points;
+		}
+
+		float at(glm::ivec3 p) const {
+			return inside(p) ? values[p.x + (size_t)points * (p.y + (size_t)points * p.z)] : outside(p);
+		}
+
+		// Same differences as cornerGradient: central inside the chunk, one-sided on its faces
+		glm::vec3 gradient(glm::ivec3 p) const {
+			glm::vec3 g;
+			for (int axis = 0; axis < 3; axis++) {
+				glm::ivec3 lower = p;
+				glm::ivec3 upper = p;
+				lower[axis]--;
+				upper[axis]++;
+				if (!inside(lower))
+					g[axis] = at(upper) - at(p);
+				else if (!inside(upper))
+					g[axis] = at(p) - at(lower);
+				else
+					g[axis] = (at(upper) - at(lower)) * 0.5f;
+			}
+			return g;
+		}
+	};
+
+	// A surface crossing on the grid edge from point p along axis, one (fine) or two (coarse) grid steps long
+	struct GridEdge {
+		glm::ivec3 p;
+		int axis;
+		int length;
+
+		bool operator==(const GridEdge& other) const = default;
+	};
+
+	typedef std::pair<GridEdge, GridEdge> Segment;
+
+	// The directed boundary edges of a cube's triangles that lie in its face normal to axis at offset side, in
+	// the triangles' winding. The cube has its corner 0 at base and edges step grid points long.
+	void cubeFaceSegments(const ChunkSamples& samples, glm::ivec3 base, int step, float iso, int axis, int side, std::vector<Segment>& out) {
+
+		auto cornerPoint = [&](int corner) {
+			return base + step * glm::ivec3(cornerOffsetX(corner), cornerOffsetY(corner), cornerOffsetZ(corner));
+		};
+
+		int caseIndex = 0;
+		for (int corner = 0; corner < 8; corner++) {
+			if (samples.at(cornerPoint(corner)) > iso)
+				caseIndex |= 1 << corner;
+		}
+
+		const int* edges = tConnectionTable[caseIndex];
+		int numEdges = tTriangleCount[caseIndex] * 3;
+
+		auto onFace = [&](int edge) {
+			return cornerOffset(edgeCornerA(edge), axis) == side && cornerOffset(edgeCornerB(edge), axis) == side;
+		};
+		auto gridEdge = [&](int edge) {
+			glm::ivec3 a = cornerPoint(edgeCornerA(edge));
+			glm::ivec3 b = cornerPoint(edgeCornerB(edge));
+			int edgeAxis = a.x != b.x ? 0 : a.y != b.y ? 1 : 2;
+			return GridEdge{ glm::min(a, b), edgeAxis, step };
+		};
+
+		for (int i = 0; i < numEdges; i++) {
+			int from = edges[i];
+			int to = edges[i - i % 3 + (i + 1) % 3];
+			if (!onFace(from) || !onFace(to))
+				continue;
+
+			// An edge shared by two of the cube's triangles is inside its patch
+			bool shared = false;
+			for (int j = 0; j < numEdges && !shared; j++) {
+				shared = edges[j] == to && edges[j - j % 3 + (j + 1) % 3] == from;
+			}
+			if (!shared)
+				out.push_back({ gridEdge(from), gridEdge(to) });
+		}
+
+	}
+
+	// Fills the gap between the chunk's face contour and the coarser neighbour's on face (axis, side) with
+	// transition patches, one per cell of the neighbour's face. The patch boundary runs against both contours,
+	// the fine one from the chunk's boundary cells and the coarse one from the neighbour's cells (sampled at twice
+	// the stride across the face), and along the cell's edges between them; the loops are fanned into triangles.
+	// Returns the number of vertices written, at most capacity.
+	size_t appendSeam(const ChunkSamples& samples, int cells, int axis, int side, float iso, PackedVertex* out, size_t capacity) {
+
+		int u = axis == 0 ? 2 : 0;
+		int v = 1;
+		int face = side ? cells : 0;
+
+		auto point = [&](int a, int b) {
+			glm::ivec3 p;
+			p[axis] = face;
+			p[u] = a;
+			p[v] = b;
+			return p;
+		};
+
+		auto vertex = [&](const GridEdge& edge, glm::vec3& position, glm::vec3& gradient) {
+			glm::ivec3 q = edge.p;
+			q[edge.axis] += edge.length;
+			float d0 = samples.at(edge.p);
+			float d1 = samples.at(q);
+			position = createVert(glm::vec3(edge.p) * voxel_size, glm::vec3(q) * voxel_size, d0, d1, iso);
+			float t = std::abs(d1 - d0) > 1e-9 ? (iso - d0) / (d1 - d0) : 0.5f;
+			gradient = glm::mix(samples.gradient(edge.p), samples.gradient(q), t);
+		};
+
+		std::vector<Segment> fine;
+		std::vector<Segment> coarse;
+		std::vector<Segment> loopEdges;
+		std::vector<GridEdge> loop;
+		size_t count = 0;
+
+		for (int cv = 0; cv < cells; cv += 2) {
+			for (int cu = 0; cu < cells; cu += 2) {
+
+				fine.clear();
+				coarse.clear();
+				for (int i = 0; i < 2; i++) {
+					for (int j = 0; j < 2; j++) {
+						glm::ivec3 base = point(cu + i, cv + j);
+						base[axis] = side ? cells - 1 : 0;
+						cubeFaceSegments(samples, base, 1, iso, axis, side, fine);
+					}
+				}
+				glm::ivec3 coarseBase = point(cu, cv);
+				coarseBase[axis] = side ? cells : -2;
+				cubeFaceSegments(samples, coarseBase, 2, iso, axis, 1 - side, coarse);
+
+				if (fine.empty() && coarse.empty())
+					continue;
+
+				// Both contours reversed: the patch meets each side's mesh along a shared edge
+				loopEdges.clear();
+				for (const Segment& s : fine)
+					loopEdges.push_back({ s.second, s.first });
+				for (const Segment& s : coarse)
+					loopEdges.push_back({ s.second, s.first });
+
+				// Along each edge of the cell, the crossing a contour ends at is joined to the one the other starts from
+				size_t contourEdges = loopEdges.size();
+				GridEdge sides[4][3];
+				glm::ivec3 corners[4] = { point(cu, cv), point(cu, cv + 2), point(cu, cv), point(cu + 2, cv) };
+				for (int k = 0; k < 4; k++) {
+					int edgeAxis = k < 2 ? u : v;
+					glm::ivec3 middle = corners[k];
+					middle[edgeAxis]++;
+					sides[k][0] = { corners[k], edgeAxis, 1 };
+					sides[k][1] = { middle, edgeAxis, 1 };
+					sides[k][2] = { corners[k], edgeAxis, 2 };
+
+					const GridEdge* from = nullptr;
+					const GridEdge* to = nullptr;
+					for (const GridEdge& e : sides[k]) {
+						bool s = false;
+						bool t = false;
+						for (size_t i = 0; i < contourEdges; i++) {
+							s = s || loopEdges[i].first == e;
+							t = t || loopEdges[i].second == e;
+						}
+						if (t && !s)
+							from = &e;
+						if (s && !t)
+							to = &e;
+					}
+					if (from && to)
+						loopEdges.push_back({ *from, *to });
+				}
+
+				// Trace the loops and fan them out
+				std::vector<bool> used(loopEdges.size(), false);
+				for (size_t first = 0; first < loopEdges.size(); first++) {
+					if (used[first])
+						continue;
+
+					loop.clear();
+					size_t current = first;
+					bool closed = false;
+					while (!used[current]) {
+						used[current] = true;
+						loop.push_back(loopEdges[current].first);
+						const GridEdge& next = loopEdges[current].second;
+						if (next == loopEdges[first].first) {
+							closed = true;
+							break;
+						}
+						auto found = std::find_if(loopEdges.begin(), loopEdges.end(), [&](const Segment& s) { return s.first == next; });
+						if (found == loopEdges.end())
+							break;
+						current = found - loopEdges.begin();
+					}
+
+					if (!closed || loop.size() < 3 || count + (loop.size() - 2) * 3 > capacity)
+						continue;
+
+					glm::vec3 positions[16];
+					glm::vec3 gradients[16];
+					size_t n = std::min(loop.size(), (size_t)16);
+					for (size_t i = 0; i < n; i++)
+						vertex(loop[i], positions[i], gradients[i]);
+
+					for (size_t i = 1; i + 1 < n; i++) {
+						size_t triangle[3] = { 0, i, i + 1 };
+						glm::vec3 faceNormal = cross(positions[0] - positions[i], positions[0] - positions[i + 1]);
+						for (size_t k : triangle) {
+							glm::vec3 normal = gradients[k] == glm::vec3(0.0f) ? faceNormal : gradients[k];
+							out[count++] = packVertex(positions[k], normal, mesh_extent);
+						}
+					}
+				}
+
+			}
+		}
+
+		return count;
+
+	}
+
+}
+
+ChunkManager::ChunkManager(int chunkCells, int radius, int lodCount, Sampler sampler, bool animated, glm::vec3 worldOrigin) {
+
+	if (chunkCells <= 0 || chunkCells % 4 != 0 || lodCount < 1) {
+		throw std::runtime_error("Chunk size must be a multiple of 4\n");
+	}
+
+	this->chunkCells = chunkCells;
+	this->radius = radius;
+	this->lodCount = lodCount;
+	this->sampler = sampler;
+	this->animated = animated;
+	this->worldOrigin = worldOrigin;
+
+	// A chunk has coarser neighbours on two faces at most
+	size_t seamVertices = (size_t)2 * (chunkCells / 2) * (chunkCells / 2) * SEAM_CELL_VERTICES;
+	maxChunkVertices = ((size_t)chunkCells * chunkCells * chunkCells * 15 + seamVertices) * iso_level_count;
+
+	numSlots = slotCount(radius, lodCount);
+	arenaSize = arenaVerticesFor(chunkCells, numSlots);
+	freeRanges[0] = arenaSize;
+
+	for (int slot = static_cast<int>(numSlots) - 1; slot >= 0; slot--) {
+		freeSlots.push_back(slot);
+	}
+
+}
+
+size_t ChunkManager::slotCount(int radius, int lodCount) {
+
+	// The roots, plus the 4x4 nodes at most that split on each finer level (3 more chunks each), in view;
+	// the rest of the pool caches chunks that went out of range
+	size_t inView = (size_t)(2 * radius + 1) * (2 * radius + 1) + (size_t)(lodCount - 1) * 16 * 3;
+	return inView * 2;
+
+}
+
+size_t ChunkManager::arenaVerticesFor(int chunkCells, size_t slots) {
+	return slots * chunkCells * chunkCells * SURFACE_COLUMN_VERTICES * iso_level_count;
+}
+
+size_t ChunkManager::maxDraws(int chunkCells, int radius, int lodCount) {
+
+	// Ranges are whole meshlets, but every level's cells and its two seams are cut separately, so each can end in a
+	// partial meshlet
+	size_t slots = slotCount(radius, lodCount);
+	return arenaVerticesFor(chunkCells, slots) / (MESHLET_TRIANGLES * 3) + slots * 3 * iso_level_count;
+
+}
+
+void ChunkManager::activate() {
+
+	// march() reads its grid from globals; chunks carry their boundary samples, so the grid is chunkCells + 1 points
+	setMarchGrid(chunkCells + 1, FIELD_LAYOUT_LINEAR);
+
+}
+
+void ChunkManager::invalidate() {
+
+	for (auto& entry : chunks) {
+		entry.second.meshed = false;
+	}
+
+}
+
+void ChunkManager::setOccluded(const std::vector<uint32_t>& slots) {
+
+	occludedSlots = slots;
+	std::sort(occludedSlots.begin(), occludedSlots.end());
+
+}
+
+glm::ivec3 ChunkManager::chunkSampleOrigin(const ChunkKey& key) const {
+
+	int cells = nodeCells(key.lod);
+	return glm::ivec3(key.x * cells, -cells / 2, key.z * cells);
+
+}
+
+// Bounds of a chunk in mesh position space
+glm::vec3 ChunkManager::chunkBoxMin(const ChunkKey& key) const {
+	return worldOrigin + glm::vec3(chunkSampleOrigin(key)) * voxel_size;
+}
+
+glm::vec3 ChunkManager::chunkBoxMax(const ChunkKey& key) const {
+	return chunkBoxMin(key) + glm::vec3(nodeCells(key.lod) * voxel_size);
+}
+
+float ChunkManager::nodeDistance(const ChunkKey& key, glm::vec3 camera) const {
+
+	// Chebyshev distance in grid points from the camera to the node's box
+	float size = static_cast<float>(nodeCells(key.lod));
+	float dx = std::max({ key.x * size - camera.x, camera.x - (key.x + 1) * size, 0.0f });
+	float dz = std::max({ key.z * size - camera.z, camera.z - (key.z + 1) * size, 0.0f });
+	float dy = std::max(std::abs(camera.y) - size * 0.5f, 0.0f);
+	return std::max({ dx, dy, dz });
+
+}
+
+void ChunkManager::selectChunks(glm::vec3 camera, std::vector<std::pair<ChunkKey, int>>& selected) {
+
+	int top = lodCount - 1;
+	int rootX = static_cast<int>(std::floor(camera.x / nodeCells(top)));
+	int rootZ = static_cast<int>(std::floor(camera.z / nodeCells(top)));
+
+	auto inRange = [&](const ChunkKey& key) {
+		int shift = top - key.lod;
+		return std::abs((key.x >> shift) - rootX) <= radius && std::abs((key.z >> shift) - rootZ) <= radius;
+	};
+
+	// Quadtree over the roots around the camera, split by distance
+	std::unordered_set<ChunkKey, ChunkKeyHash> split;
+
+	std::function<void(const ChunkKey&)> refine = [&](const ChunkKey& key) {
+		if (key.lod == 0)
+			return;
+		float limit = (splitNodes.count(key) ? MERGE_DISTANCE : SPLIT_DISTANCE) * nodeCells(key.lod);
+		if (nodeDistance(key, camera) >= limit)
+			return;
+		split.insert(key);
+		for (int i = 0; i < 4; i++)
+			refine({ key.x * 2 + (i & 1), key.z * 2 + (i >> 1), key.lod - 1 });
+	};
+
+	for (int z = rootZ - radius; z <= rootZ + radius; z++) {
+		for (int x = rootX - radius; x <= rootX + radius; x++) {
+			refine({ x, z, top });
+		}
+	}
+
+	// Balance: the neighbours of a split node must exist at its level, so leaves differ by one level at most
+	auto exists = [&](const ChunkKey& key) {
+		return inRange(key) && (key.lod == top || split.count(parentOf(key)) > 0);
+	};
+
+	std::function<void(const ChunkKey&)> ensure = [&](const ChunkKey& key) {
+		if (key.lod == top)
+			return;
+		ChunkKey parent = parentOf(key);
+		ensure(parent);
+		split.insert(parent);
+	};
+
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		std::vector<ChunkKey> nodes(split.begin(), split.end());
+		for (const ChunkKey& key : nodes) {
+			for (const Neighbour& n : neighbours) {
+				ChunkKey neighbour = { key.x + n.dx, key.z + n.dz, key.lod };
+				if (inRange(neighbour) && !exists(neighbour)) {
+					ensure(neighbour);
+					changed = true;
+				}
+			}
+		}
+	}
+
+	// The leaves are the chunks; a neighbour position in range that is not a node is covered by a coarser leaf
+	std::function<void(const ChunkKey&)> collect = [&](const ChunkKey& key) {
+		if (split.count(key)) {
+			for (int i = 0; i < 4; i++)
+				collect({ key.x * 2 + (i & 1), key.z * 2 + (i >> 1), key.lod - 1 });
+			return;
+		}
+		int seams = 0;
+		for (const Neighbour& n : neighbours) {
+			ChunkKey neighbour = { key.x + n.dx, key.z + n.dz, key.lod };
+			if (inRange(neighbour) && !exists(neighbour))
+				seams |= n.face;
+		}
+		selected.push_back({ key, seams });
+	};
+
+	for (int z = rootZ - radius; z <= rootZ + radius; z++) {
+		for (int x = rootX - radius; x <= rootX + radius; x++) {
+			collect({ x, z, top });
+		}
+	}
+
+	// Nearest first, so a short pool fills the area around the camera before the edges
+	std::sort(selected.begin(), selected.end(), [&](const std::pair<ChunkKey, int>& a, const std::pair<ChunkKey, int>& b) {
+		return nodeDistance(a.first, camera) < nodeDistance(b.first, camera);
+	});
+
+	splitNodes = std::move(split);
+
+}
+
+int ChunkManager::allocateSlot() {
+
+	if (freeSlots.empty() && !evictLeastRecent()) {
+		return -1;
+	}
+
+	int slot = freeSlots.back();
+	freeSlots.pop_back();
+	return slot;
+
+}
+
+// Evicts the least recently used chunk, unless it is in view this update. Its range is only written again by
+// upload(), once the previous frame has drawn it.
+bool ChunkManager::evictLeastRecent() {
+
+	if (lru.empty()) {
+		return false;
+	}
+
+	auto victim = chunks.find(lru.back());
+	if (victim->second.lastUsed == updateCount) {
+		return false;
+	}
+
+	freeSlots.push_back(victim->second.slot);
+	releaseRange(victim->second);
+	lru.pop_back();
+	chunks.erase(victim);
+	return true;
+
+}
+
+size_t ChunkManager::allocateRange(size_t vertices) {
+
+	for (auto range = freeRanges.begin(); range != freeRanges.end(); ++range) {
+		if (range->second >= vertices) {
+			size_t first = range->first;
+			size_t rest = range->second - vertices;
+			freeRanges.erase(range);
+			if (rest > 0) {
+				freeRanges[first + vertices] = rest;
+			}
+			return first;
+		}
+	}
+
+	return NO_RANGE;
+
+}
+
+void ChunkManager::releaseRange(Chunk& chunk) {
+
+	if (chunk.capacity == 0) {
+		return;
+	}
+
+	size_t first = chunk.firstVertex;
+	size_t count = chunk.capacity;
+	chunk.capacity = 0;
+
+	auto next = freeRanges.lower_bound(first);
+	if (next != freeRanges.end() && first + count == next->first) {
+		count += next->second;
+		next = freeRanges.erase(next);
+	}
+	if (next != freeRanges.begin()) {
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == first) {
+			previous->second += count;
+			return;
+		}
+	}
+	freeRanges[first] = count;
+
+}
+
+void ChunkManager::meshChunk(const ChunkKey& key, Chunk& chunk, int seams, double time, std::vector<PackedVertex>& vertices) {
+
+	int samplesPerAxis = chunkCells + 1;
+	size_t numSamples = (size_t)samplesPerAxis * samplesPerAxis * samplesPerAxis;
+	int stride = 1 << key.lod;
+
+	thread_local std::vector<float> samples;
+	thread_local std::vector<PackedVertex> scratch;
+	thread_local std::vector<PackedVertex> compacted;
+
+	samples.resize(numSamples);
+	glm::ivec3 origin = chunkSampleOrigin(key);
+
+	bool uniform = true;
+	for (int z = 0; z < samplesPerAxis; z++) {
+		for (int y = 0; y < samplesPerAxis; y++) {
+			for (int x = 0; x < samplesPerAxis; x++) {
+				size_t i = x + (size_t)samplesPerAxis * (y + (size_t)samplesPerAxis * z);
+				samples[i] = sampler(origin.x + x * stride, origin.y + y * stride, origin.z + z * stride, time);
+				uniform = uniform && samples[i] == samples[0];
+			}
+		}
+	}
+
+	vertices.clear();
+	chunk.vertexCount = 0;
+	chunk.meshlets.clear();
+	chunk.meshedTime = time;
+	chunk.meshed = true;
+	chunk.seams = seams;
+
+	// Open sea and open air have no surface, and neither has a face between them and a coarser chunk
+	if (uniform) {
+		return;
+	}
+
+	size_t streamVertices = marchStreamVertices();
+	scratch.resize(streamVertices * iso_level_count);
+
+	for (int z = 0; z < chunkCells; z++) {
+		for (int y = 0; y < chunkCells; y++) {
+			for (int x = 0; x < chunkCells; x++) {
+				march(x, y, z, samples.data(), &scratch[(x + (size_t)samplesPerAxis * (y + (size_t)samplesPerAxis * z)) * 15]);
+			}
+		}
+	}
+
+	// Compact the live triangles so the draw skips the empty ones, block by block
+	compacted.resize(maxChunkVertices);
+	PackedVertex* out = compacted.data();
+	size_t count = 0;
+
+	for (int level = 0; level < iso_level_count; level++) {
+		size_t levelStart = count;
+		for (int bz = 0; bz < chunkCells; bz += MESHLET_BLOCK) {
+			for (int by = 0; by < chunkCells; by += MESHLET_BLOCK) {
+				for (int bx = 0; bx < chunkCells; bx += MESHLET_BLOCK) {
+					for (int z = bz; z < bz + MESHLET_BLOCK; z++) {
+						for (int y = by; y < by + MESHLET_BLOCK; y++) {
+							for (int x = bx; x < bx + MESHLET_BLOCK; x++) {
+								const PackedVertex* cell = &scratch[level * streamVertices + (x + (size_t)samplesPerAxis * (y + (size_t)samplesPerAxis * z)) * 15];
+								for (int t = 0; t < 15; t += 3) {
+									const PackedVertex& a = cell[t];
+									const PackedVertex& b = cell[t + 1];
+									const PackedVertex& c = cell[t + 2];
+									if (a.x == b.x && a.y == b.y && a.z == b.z && a.x == c.x && a.y == c.y && a.z == c.z) {
+										continue;
+									}
+									out[count++] = a;
+									out[count++] = b;
+									out[count++] = c;
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+		appendMeshlets(out, levelStart, count, chunk.meshlets);
+	}
+
+	// Transition patches towards coarser neighbours, which sample the far side of the face at twice the stride
+	ChunkSamples chunkSamples{ samples, samplesPerAxis, [&](glm::ivec3 p) {
+		return sampler(origin.x + p.x * stride, origin.y + p.y * stride, origin.z + p.z * stride, time);
+	} };
+
+	for (int level = 0; level < iso_level_count; level++) {
+		for (const Neighbour& n : neighbours) {
+			if (seams & n.face) {
+				int axis = n.dx != 0 ? 0 : 2;
+				int side = n.dx + n.dz > 0 ? 1 : 0;
+				size_t seamStart = count;
+				count += appendSeam(chunkSamples, chunkCells, axis, side, iso_levels[level], out + count, maxChunkVertices - count);
+				appendMeshlets(out, seamStart, count, chunk.meshlets);
+			}
+		}
+	}
+
+	chunk.vertexCount = static_cast<uint32_t>(count);
+	vertices.assign(out, out + count);
+
+}
+
+void ChunkManager::appendMeshlets(const PackedVertex* vertices, size_t first, size_t end, std::vector<Meshlet>& meshlets) {
+
+	for (size_t start = first; start < end; start += MESHLET_TRIANGLES * 3) {
+		size_t stop = std::min(start + MESHLET_TRIANGLES * 3, end);
+
+		Meshlet meshlet;
+		meshlet.firstVertex = static_cast<uint32_t>(start);
+		meshlet.vertexCount = static_cast<uint32_t>(stop - start);
+		meshlet.boxMin = glm::vec3(std::numeric_limits<float>::max());
+		meshlet.boxMax = glm::vec3(-std::numeric_limits<float>::max());
+		meshlet.cone = glm::vec4(0.0f, 0.0f, 0.0f, 2.0f);
+
+		glm::vec3 faceNormals[MESHLET_TRIANGLES];
+		size_t faces = 0;
+		glm::vec3 axis(0.0f);
+
+		for (size_t v = start; v < stop; v += 3) {
+			glm::vec3 p[3];
+			glm::vec3 shading(0.0f);
+			for (int k = 0; k < 3; k++) {
+				p[k] = unpackPosition(vertices[v + k], mesh_extent);
+				shading += unpackNormal(vertices[v + k]);
+				meshlet.boxMin = glm::min(meshlet.boxMin, p[k]);
+				meshlet.boxMax = glm::max(meshlet.boxMax, p[k]);
+			}
+
+			// Turned to the side of the vertex normals, which point into the solid, rather than trusting the winding
+			glm::vec3 n = glm::cross(p[0] - p[1], p[0] - p[2]);
+			float area = glm::length(n);
+			if (!(area > 0.0f)) {
+				continue;
+			}
+			n /= area;
+			if (glm::dot(n, shading) < 0.0f) {
+				n = -n;
+			}
+			faceNormals[faces++] = n;
+			axis += n;
+		}
+
+		// A cone wider than a hemisphere always has a triangle facing the camera, so it is left out
+		float axisLength = glm::length(axis);
+		if (faces > 0 && axisLength > 0.0f) {
+			axis /= axisLength;
+			float minCos = 1.0f;
+			for (size_t i = 0; i < faces; i++) {
+				minCos = std::min(minCos, glm::dot(axis, faceNormals[i]));
+			}
+			if (minCos > 0.0f) {
+				meshlet.cone = glm::vec4(axis, std::sqrt(std::max(1.0f - minCos * minCos, 0.0f)));
+			}
+		}
+
+		meshlets.push_back(meshlet);
+	}
+
+}
+
+void ChunkManager::update(glm::vec3 cameraPos, const Frustum* frustum, double time, ThreadPool& pool) {
+
+	if (arena == nullptr) {
+		throw std::runtime_error("Chunk arena not set\n");
+	}
+
+	updateCount++;
+
+	std::vector<std::pair<ChunkKey, int>> wanted;
+	selectChunks((cameraPos - worldOrigin) / voxel_size, wanted);
+
+	for (const auto& entry : wanted) {
+		auto found = chunks.find(entry.first);
+		if (found != chunks.end()) {
+			found->second.lastUsed = updateCount;
+			lru.splice(lru.begin(), lru, found->second.lruEntry);
+		}
+	}
+
+	if (frustum) {
+		wanted.erase(std::remove_if(wanted.begin(), wanted.end(), [&](const std::pair<ChunkKey, int>& entry) {
+			return !frustumIntersectsBox(*frustum, chunkBoxMin(entry.first), chunkBoxMax(entry.first));
+		}), wanted.end());
+	}
+
+	struct Job {
+		ChunkKey key;
+		Chunk* chunk;
+		int seams;
+		std::vector<PackedVertex> vertices;
+	};
+	std::vector<Job> jobs;
+
+	for (const auto& entry : wanted) {
+		const ChunkKey& key = entry.first;
+		auto found = chunks.find(key);
+		if (found == chunks.end()) {
+			int slot = allocateSlot();
+			if (slot < 0) {
+				continue;
+			}
+			lru.push_front(key);
+			Chunk& chunk = chunks[key];
+			chunk.slot = slot;
+			chunk.lastUsed = updateCount;
+			chunk.lruEntry = lru.begin();
+			found = chunks.find(key);
+		}
+
+		// A chunk is remeshed when its neighbours' levels change, since its transition patches depend on them
+		Chunk& chunk = found->second;
+		bool occluded = std::binary_search(occludedSlots.begin(), occludedSlots.end(), static_cast<uint32_t>(chunk.slot));
+		if (!chunk.meshed || chunk.seams != entry.second || (animated && chunk.meshedTime != time && !occluded)) {
+			jobs.push_back({ key, &chunk, entry.second, {} });
+		}
+	}
+
+	// Every chunk is an independent job; the calling thread helps until they are all done
+	std::atomic<size_t> done{ 0 };
+	for (Job& job : jobs) {
+		pool.submit([this, &job, &done, time] {
+			meshChunk(job.key, *job.chunk, job.seams, time, job.vertices);
+			done++;
+		});
+	}
+	pool.helpUntil([&] { return done.load() == jobs.size(); });
+
+	// Ranges being rewritten, and the ranges of evicted chunks, may still be drawn by the previous frame, so the
+	// meshes wait in staging for upload()
+	for (Job& job : jobs) {
+		staged.push_back({ job.key, std::move(job.vertices) });
+	}
+
+	meshedCount = jobs.size();
+
+	drawnChunks.clear();
+	for (const auto& entry : wanted) {
+		drawnChunks.push_back(entry.first);
+	}
+
+}
+
+void ChunkManager::upload() {
+
+	const size_t meshletVertices = MESHLET_TRIANGLES * 3;
+
+	for (const StagedMesh& mesh : staged) {
+		Chunk& chunk = chunks.at(mesh.key);
+		size_t count = mesh.vertices.size();
+
+		// A mesh that outgrew its range moves to a new one, in whole meshlets so it can grow a little in place
+		if (count > chunk.capacity) {
+			releaseRange(chunk);
+			size_t capacity = (count + meshletVertices - 1) / meshletVertices * meshletVertices;
+			size_t first = allocateRange(capacity);
+			while (first == NO_RANGE && evictLeastRecent()) {
+				first = allocateRange(capacity);
+			}
+			// Evicting every chunk out of view made no room; the chunk is left out and meshed again next update
+			if (first == NO_RANGE) {
+				chunk.vertexCount = 0;
+				chunk.meshlets.clear();
+				chunk.meshed = false;
+				continue;
+			}
+			chunk.firstVertex = first;
+			chunk.capacity = capacity;
+		}
+
+		std::copy(mesh.vertices.begin(), mesh.vertices.end(), arena + chunk.firstVertex);
+	}
+	staged.clear();
+
+	drawList.clear();
+	for (const ChunkKey& key : drawnChunks) {
+		auto found = chunks.find(key);
+		if (found == chunks.end() || found->second.vertexCount == 0) {
+			continue;
+		}
+		const Chunk& chunk = found->second;
+		glm::vec3 origin = chunkBoxMin(key);
+		float scale = static_cast<float>(1 << key.lod);
+		for (const Meshlet& meshlet : chunk.meshlets) {
+			MeshDraw draw;
+			draw.origin = glm::vec4(origin, scale);
+			draw.boxMin = glm::vec4(origin + meshlet.boxMin * scale, 0.0f);
+			draw.boxMax = glm::vec4(origin + meshlet.boxMax * scale, 0.0f);
+			draw.cone = meshlet.cone;
+			draw.firstVertex = static_cast<uint32_t>(chunk.firstVertex + meshlet.firstVertex);
+			draw.vertexCount = meshlet.vertexCount;
+			draw.occlusionId = static_cast<uint32_t>(chunk.slot);
+			drawList.push_back(draw);
+		}
+	}
+
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <functional>
+#include <cstdint>
+
+#include "VKConfig.h"
+#include "TaskGraph.h"
+#include "Frustum.h"
+
+// Chunk x, z at level of detail lod; a chunk at lod l samples the field every 2^l grid points
+struct ChunkKey {
+	int x;
+	int z;
+	int lod;
+
+	bool operator==(const ChunkKey& other) const = default;
+};
+
+struct ChunkKeyHash {
+	size_t operator()(const ChunkKey& key) const {
+		return (size_t)key.x * 73856093u ^ (size_t)key.z * 19349663u ^ (size_t)key.lod * 83492791u;
+	}
+};
+
+// Streams an unbounded field as a quadtree of chunks around the camera. Every chunk has chunkCells^3 cells;
+// a chunk at lod l spans 2^l times as many grid points, so distant chunks cost as much as near ones and the
+// triangle count grows with the number of levels rather than with the view distance. Levels are picked per
+// chunk from its distance to the camera, with hysteresis, and balanced so neighbours differ by at most one level.
+//
+// Where a chunk borders a coarser one, it adds a transition patch in the shared face that joins its own face
+// contour to the coarser chunk's, so the seams have no cracks. Like transvoxel's transition cells the patch
+// belongs to the finer chunk, but it is traced from the regular marching cubes triangulation of both sides
+// instead of separate transition tables.
+//
+// Chunks are meshed on the CPU with march() and kept in a pool with a fixed number of slots, one per chunk; when the
+// pool is full the least recently used chunk outside the view is evicted. Every chunk's compacted mesh takes a range
+// of one vertex arena, rounded up to whole meshlets and moved only when it outgrows it. The arena is sized for a
+// surface a few cells deep across every chunk, not for every cell; when it runs full, chunks outside the view are
+// evicted too, and what still does not fit is left out until the next update. Chunk (x, z, l) covers
+// grid points x * chunkCells * 2^l .. (x + 1) * chunkCells * 2^l along x (z likewise) and one chunk row centred on
+// sea level along y.
+//
+// The arena is shared by all frames in flight, so update() builds meshes in staging memory while the previous frame
+// draws, and upload() places them in the arena once that draw has finished.
+//
+// Every chunk mesh is cut into meshlets of up to MESHLET_TRIANGLES consecutive triangles, each drawn on its own with
+// a bounding box and a normal cone, so the GPU cull pass can drop the pieces of a chunk that are off screen or turned
+// away from the camera. The triangles are laid out in 4x4x4 cell blocks, which keeps every meshlet a compact patch.
+// Only the usual triangle limit of a meshlet is kept, not its 64 unique vertices: shader.vert pulls non-indexed
+// vertices by gl_VertexIndex and every draw is a vertex range, so a meshlet is up to 372 vertices of triangle soup.
+// Unique vertices would take an index buffer and indexed indirect draws through cull.comp for the chunks alone,
+// while the limit only decides how finely they are culled.
+class ChunkManager {
+
+public:
+
+	// Field value at world grid point (x, y, z) at the given time
+	typedef std::function<float(int x, int y, int z, double time)> Sampler;
+
+	// worldOrigin is where world grid point 0 lands in mesh position space; animated fields are remeshed every update.
+	// chunkCells must be a multiple of 4, so the grid points of neighbouring levels line up.
+	ChunkManager(int chunkCells, int radius, int lodCount, Sampler sampler, bool animated, glm::vec3 worldOrigin);
+
+	// Vertices of the arena the chunk meshes are written into; the arena must stay mapped while the manager lives
+	size_t arenaVertices() const { return arenaSize; }
+	void setArena(PackedVertex* arena) { this->arena = arena; }
+
+	// Points march() at the chunk grid; call from the main thread before the first update
+	void activate();
+
+	// Drops every cached mesh, e.g. after the iso-levels changed
+	void invalidate();
+
+	// Picks the chunks around cameraPos and meshes missing and stale ones on the pool, into staging memory.
+	// Chunks outside frustum (mesh position space, none when null) are neither meshed nor drawn, but stay resident.
+	void update(glm::vec3 cameraPos, const Frustum* frustum, double time, ThreadPool& pool);
+
+	// Copies the meshes staged by update() into the arena and rebuilds the draw list; call after every update(), once
+	// no submitted draw reads the arena any more
+	bool hasStaged() const { return !staged.empty(); }
+	void upload();
+
+	// Slots whose draws failed the GPU occlusion test (MeshDraw::occlusionId is the chunk's slot). Until the next
+	// call, animated chunks in those slots are not remeshed; they are still drawn, so the test sees them again.
+	void setOccluded(const std::vector<uint32_t>& slots);
+
+	// One draw per meshlet of every chunk in view
+	const std::vector<MeshDraw>& draws() const { return drawList; }
+	size_t maxDraws() const { return maxDraws(chunkCells, radius, lodCount); }
+	size_t residentChunks() const { return chunks.size(); }
+	size_t meshedLastUpdate() const { return meshedCount; }
+
+	// Most draws of a manager with these settings, for draw buffers created before it
+	static size_t maxDraws(int chunkCells, int radius, int lodCount);
+
+private:
+
+	// Vertex range of a chunk mesh relative to its first vertex, bounds relative to the chunk origin at scale 1 and the
+	// normal cone as in MeshDraw::cone
+	struct Meshlet {
+		uint32_t firstVertex;
+		uint32_t vertexCount;
+		glm::vec3 boxMin;
+		glm::vec3 boxMax;
+		glm::vec4 cone;
+	};
+
+	struct Chunk {
+		int slot = -1;
+		size_t firstVertex = 0;    // of its range of the arena
+		size_t capacity = 0;       // vertices of the range, 0 without one
+		uint32_t vertexCount = 0;
+		std::vector<Meshlet> meshlets;
+		double meshedTime = 0.0;
+		bool meshed = false;
+		int seams = 0;             // faces with a coarser neighbour the mesh was built for, see Face
+		uint64_t lastUsed = 0;
+		std::list<ChunkKey>::iterator lruEntry;
+	};
+
+	// Chunk faces, as bits of Chunk::seams
+	enum Face { FACE_NEG_X = 1, FACE_POS_X = 2, FACE_NEG_Z = 4, FACE_POS_Z = 8 };
+
+	int chunkCells;
+	int radius;
+	int lodCount;
+	Sampler sampler;
+	bool animated;
+	glm::vec3 worldOrigin;
+
+	size_t maxChunkVertices;   // of a chunk with a triangle in every cell and both seams
+	size_t numSlots;
+	size_t arenaSize;
+	PackedVertex* arena = nullptr;
+	std::map<size_t, size_t> freeRanges;   // first vertex to vertex count, merged with their neighbours
+
+	// Meshes built by the last update(), waiting for upload()
+	struct StagedMesh {
+		ChunkKey key;
+		std::vector<PackedVertex> vertices;
+	};
+	std::vector<StagedMesh> staged;
+	std::vector<ChunkKey> drawnChunks;   // in view of the last update, in draw order
+
+	std::unordered_map<ChunkKey, Chunk, ChunkKeyHash> chunks;
+	std::list<ChunkKey> lru;   // most recently used first
+	std::vector<int> freeSlots;
+	std::unordered_set<ChunkKey, ChunkKeyHash> splitNodes;   // quadtree nodes split last update, for hysteresis
+	std::vector<MeshDraw> drawList;
+	std::vector<uint32_t> occludedSlots;   // sorted
+	size_t meshedCount = 0;
+	uint64_t updateCount = 0;
+
+	int nodeCells(int lod) const { return chunkCells << lod; }
+	float nodeDistance(const ChunkKey& key, glm::vec3 camera) const;
+	void selectChunks(glm::vec3 camera, std::vector<std::pair<ChunkKey, int>>& selected);
+
+	glm::ivec3 chunkSampleOrigin(const ChunkKey& key) const;
+	glm::vec3 chunkBoxMin(const ChunkKey& key) const;
+	glm::vec3 chunkBoxMax(const ChunkKey& key) const;
+	int allocateSlot();
+	bool evictLeastRecent();
+
+	// First fit; returns NO_RANGE when no free range is large enough
+	static const size_t NO_RANGE = ~(size_t)0;
+	size_t allocateRange(size_t vertices);
+	void releaseRange(Chunk& chunk);
+
+	// Slots in the pool, and vertices in the arena, of a manager with these settings
+	static size_t slotCount(int radius, int lodCount);
+	static size_t arenaVerticesFor(int chunkCells, size_t slots);
+
+	// Meshes a chunk into vertices, relative to its first vertex
+	void meshChunk(const ChunkKey& key, Chunk& chunk, int seams, double time, std::vector<PackedVertex>& vertices);
+
+	// Cuts vertices first .. end of a chunk mesh into meshlets
+	static void appendMeshlets(const PackedVertex* vertices, size_t first, size_t end, std::vector<Meshlet>& meshlets);
+
+};
@@ -0,0 +1,222 @@
+#include "FieldGenerator.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+// Calls fn(index, cell_x, cell_y, cell_z) for every cell, with coordinates relative to the grid centre.
+// cell_y runs along the slowest axis and cell_z along the middle one, as in the original generators.
+template <typename Fn>
+static void forEachCell(int gridSize, int layout, Fn fn) {
+
+	for (int z = 0; z < gridSize; z++) {
+		for (int y = 0; y < gridSize; y++) {
+			for (int x = 0; x < gridSize; x++) {
+				fn(fieldIndex(layout, x, y, z, gridSize), x - gridSize / 2, z - gridSize / 2, y - gridSize / 2);
+			}
+		}
+	}
+
+}
+
+void sphereField(int gridSize, int layout, float radius, std::vector<float>& out) {
+
+	out.assign(fieldCellCount(layout, gridSize), 0.0f);
+
+	forEachCell(gridSize, layout, [&](size_t i, int cell_x, int cell_y, int cell_z) {
+
+		float dist = sqrt(cell_x * cell_x + cell_y * cell_y + cell_z * cell_z);
+
+		out[i] = dist > radius ? 0.0f : 1.0f;
+	});
+
+}
+
+void randomField(int gridSize, int layout, std::minstd_rand& rng, std::vector<float>& out) {
+
+	std::uniform_real_distribution<float> random(0.0f, 1.0f);
+	out.assign(fieldCellCount(layout, gridSize), 0.0f);
+
+	forEachCell(gridSize, layout, [&](size_t i, int, int, int) {
+		out[i] = random(rng) > 0.3f ? 1.0f : 0.0f;
+	});
+
+}
+
+float waveSample(int x, int y, int z, double time) {
+
+	return y < (sin(x + time * 3.0) + cos(z + time * 3.0)) ? 1.0f : 0.0f;
+
+}
+
+void waveField(int gridSize, int layout, double time, std::vector<float>& out) {
+
+	out.assign(fieldCellCount(layout, gridSize), 0.0f);
+
+	forEachCell(gridSize, layout, [&](size_t i, int cell_x, int cell_y, int cell_z) {
+		out[i] = waveSample(cell_x, cell_z, cell_y, time);
+	});
+
+}
+
+void growthField(int gridSize, int layout, std::minstd_rand& rng, const std::vector<float>& previous, std::vector<float>& out) {
+
+	std::uniform_real_distribution<float> random(0.0f, 1.0f);
+	out.assign(fieldCellCount(layout, gridSize), 0.0f);
+
+	forEachCell(gridSize, layout, [&](size_t i, int cell_x, int cell_y, int cell_z) {
+
+		float fieldStrength = 0.0;
+
+		if (previous[i] == 1.0) {
+			fieldStrength = 1.0;
+		}
+		else if (random(rng) > 0.999) {
+			fieldStrength = 1.0f;
+		}
+
+		if (abs(cell_x) >= gridSize / 2 - 1 || abs(cell_y) >= gridSize / 2 - 1 || abs(cell_z) >= gridSize / 2 - 1) {
+			fieldStrength = 0.0;
+		}
+
+		out[i] = fieldStrength;
+	});
+
+}
+
+FieldProducer::FieldProducer(int gridSize, int layout, double simulationRate) {
+
+	this->gridSize = gridSize;
+	this->layout = layout;
+	numCells = fieldCellCount(layout, gridSize);
+	tickInterval = std::chrono::duration<double>(1.0 / simulationRate);
+
+	for (auto& slot : ring.slots) {
+		slot.data.resize(numCells);
+	}
+	previous.assign(numCells, 0.0f);
+
+}
+
+FieldProducer::~FieldProducer() {
+
+	stop();
+
+}
+
+void FieldProducer::start() {
+
+	running = true;
+	worker = std::thread(&FieldProducer::run, this);
+
+}
+
+void FieldProducer::stop() {
+
+	running = false;
+	if (worker.joinable()) {
+		worker.join();
+	}
+
+}
+
+void FieldProducer::setFieldMode(int mode, bool reset) {
+
+	fieldMode.store(mode, std::memory_order_relaxed);
+	if (reset) {
+		resetRequested.store(true, std::memory_order_release);
+	}
+
+}
+
+bool FieldProducer::consumeLatest(float* dst) {
+
+	FieldFrame* frame = ring.latest();
+	if (frame == nullptr) {
+		return false;
+	}
+
+	memcpy(dst, frame->data.data(), sizeof(float) * numCells);
+	ring.pop();
+
+	return true;
+
+}
+
+bool FieldProducer::generate(int mode, bool first, double time, std::vector<float>& out) {
+
+	switch (mode) {
+	case 0:
+		if (!first) { return false; }
+		sphereField(gridSize, layout, 4.0f, out);
+		return true;
+	case 1:
+		sphereField(gridSize, layout, 4.0f * std::abs(sin(time)), out);
+		return true;
+	case 2:
+		if (!first) { return false; }
+		randomField(gridSize, layout, rng, out);
+		return true;
+	case 3:
+		waveField(gridSize, layout, time, out);
+		return true;
+	case 4:
+		if (first) {
+			std::fill(out.begin(), out.end(), 0.0f);
+		}
+		else {
+			growthField(gridSize, layout, rng, previous, out);
+		}
+		return true;
+	case FIELD_MODE_VOLUME:
+		// Samples land in the ring slot straight from the mapped file. A single volume is read once per reset,
+		// a series advances one timestep per tick and loops.
+		if (!volume || (!first && volume->timesteps() == 1)) { return false; }
+		volumeStep = first ? 0 : (volumeStep + 1) % volume->timesteps();
+		volume->read(volumeStep, layout, out.data());
+		return true;
+	case FIELD_MODE_POINTS:
+	case FIELD_MODE_REPLAY:
+	case FIELD_MODE_MODEL:
+		return false;
+	default:
+		return false;
+	}
+
+}
+
+void FieldProducer::run() {
+
+	auto startTime = std::chrono::steady_clock::now();
+	auto nextTick = startTime;
+
+	while (running.load(std::memory_order_relaxed)) {
+
+		std::this_thread::sleep_until(nextTick);
+		nextTick = std::max(nextTick + std::chrono::duration_cast<std::chrono::steady_clock::duration>(tickInterval), std::chrono::steady_clock::now());
+
+		FieldFrame* frame = ring.beginWrite();
+		if (frame == nullptr) {
+			// The renderer has not drained the ring yet; try again next tick
+			continue;
+		}
+
+		bool first = resetRequested.exchange(false, std::memory_order_acquire);
+		int mode = fieldMode.load(std::memory_order_relaxed);
+		double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+		if (!generate(mode, first, time, frame->data)) {
+			continue;
+		}
+
+		if (mode == 4) {
+			// Growth mode evolves from the last frame it produced
+			previous = frame->data;
+		}
+		frame->fieldMode = mode;
+		frame->time = time;
+		frame->sequence = sequence++;
+
+		ring.commitWrite();
+	}
+
+}
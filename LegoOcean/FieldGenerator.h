@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <memory>
+#include <cstdint>
+
+#include "SPSCRing.h"
+#include "FieldLayout.h"
+#include "VolumeFile.h"
+
+// Procedural scalar fields, stored in the given FieldLayout (see fieldIndex)
+void sphereField(int gridSize, int layout, float radius, std::vector<float>& out);
+void randomField(int gridSize, int layout, std::minstd_rand& rng, std::vector<float>& out);
+void waveField(int gridSize, int layout, double time, std::vector<float>& out);
+void growthField(int gridSize, int layout, std::minstd_rand& rng, const std::vector<float>& previous, std::vector<float>& out);
+
+// The wave field at world grid point (x, y, z), y up and sea level at y = 0; unbounded, used by the chunked ocean
+float waveSample(int x, int y, int z, double time);
+
+// Producer mode that reads the field from a VolumeSeries instead of generating it (5 is the shader's CPU mode)
+const int FIELD_MODE_VOLUME = 6;
+
+// Mode in which the producer stays idle because the renderer splats a point cloud into the field itself
+const int FIELD_MODE_POINTS = 7;
+
+// Mode in which the producer stays idle because the renderer replays a field recording (FieldRecording.h)
+const int FIELD_MODE_REPLAY = 8;
+
+// Mode in which the producer stays idle because the renderer copies in a model's signed distance field (MeshVoxelizer.h)
+const int FIELD_MODE_MODEL = 9;
+
+struct FieldFrame {
+	std::vector<float> data;
+	int fieldMode = 0;
+	double time = 0.0;
+	uint64_t sequence = 0;
+};
+
+// Generates field frames on its own thread and hands them to the render thread through an SPSC ring.
+// Static modes (0 and 2) are produced once per reset; animated modes produce one frame per simulation tick.
+class FieldProducer {
+
+public:
+
+	FieldProducer(int gridSize, int layout, double simulationRate);
+	~FieldProducer();
+
+	void start();
+	void stop();
+
+	// Called from the render thread (keyboard callback)
+	void setFieldMode(int mode, bool reset);
+
+	// Volume read in FIELD_MODE_VOLUME, sampled at this producer's grid size; call before start
+	void setVolume(std::shared_ptr<VolumeSeries> volume) { this->volume = volume; }
+
+	// Copies the newest completed frame into dst and drops any older ones; returns false if nothing new arrived
+	bool consumeLatest(float* dst);
+
+private:
+
+	static const size_t RING_SIZE = 4;
+
+	int gridSize;
+	int layout;
+	size_t numCells;
+	std::chrono::duration<double> tickInterval;
+
+	SPSCRing<FieldFrame, RING_SIZE> ring;
+	std::vector<float> previous;
+	std::minstd_rand rng;
+	uint64_t sequence = 0;
+	std::shared_ptr<VolumeSeries> volume;
+	int volumeStep = 0;
+
+	std::atomic<int> fieldMode{ 0 };
+	std::atomic<bool> resetRequested{ true };
+	std::atomic<bool> running{ false };
+	std::thread worker;
+
+	void run();
+	bool generate(int mode, bool first, double time, std::vector<float>& out);
+
+};
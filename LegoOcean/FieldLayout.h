@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Memory layouts for the scalar field. Shaders/field_layout.glsl mirrors these functions for the GPU.
+//
+// LINEAR:  x + y*N + z*N^2. z-neighbours are N^2 floats apart.
+// BRICKED: the grid is cut into 4x4x4 bricks stored contiguously (256 bytes each), cells inside a brick
+//          in Morton (Z-curve) order, bricks in linear order. 7 of the 8 corners a cell reads usually
+//          share its brick, so the corner fetch touches ~1 cache line pair instead of 4 rows/slices.
+enum FieldLayout {
+	FIELD_LAYOUT_LINEAR = 0,
+	FIELD_LAYOUT_BRICKED = 1
+};
+
+const uint32_t FIELD_BRICK_SIZE = 4;
+const uint32_t FIELD_BRICK_CELLS = FIELD_BRICK_SIZE * FIELD_BRICK_SIZE * FIELD_BRICK_SIZE;
+
+// Spreads the low 10 bits of v so there are two zero bits between each of them
+inline uint32_t mortonPart1By2(uint32_t v) {
+
+	v &= 0x000003ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+
+}
+
+inline uint32_t mortonCompact1By2(uint32_t v) {
+
+	v &= 0x09249249;
+	v = (v | (v >> 2)) & 0x030c30c3;
+	v = (v | (v >> 4)) & 0x0300f00f;
+	v = (v | (v >> 8)) & 0xff0000ff;
+	v = (v | (v >> 16)) & 0x000003ff;
+	return v;
+
+}
+
+inline uint32_t mortonEncode(uint32_t x, uint32_t y, uint32_t z) {
+	return mortonPart1By2(x) | (mortonPart1By2(y) << 1) | (mortonPart1By2(z) << 2);
+}
+
+inline void mortonDecode(uint32_t code, uint32_t& x, uint32_t& y, uint32_t& z) {
+	x = mortonCompact1By2(code);
+	y = mortonCompact1By2(code >> 1);
+	z = mortonCompact1By2(code >> 2);
+}
+
+inline uint32_t fieldBricksPerAxis(uint32_t gridSize) {
+	return (gridSize + FIELD_BRICK_SIZE - 1) / FIELD_BRICK_SIZE;
+}
+
+// Number of floats the field buffer needs; bricked grids are padded up to whole bricks
+inline size_t fieldCellCount(int layout, uint32_t gridSize) {
+
+	if (layout == FIELD_LAYOUT_BRICKED) {
+		size_t bricks = fieldBricksPerAxis(gridSize);
+		return bricks * bricks * bricks * FIELD_BRICK_CELLS;
+	}
+	return (size_t)gridSize * gridSize * gridSize;
+
+}
+
+inline size_t fieldIndex(int layout, uint32_t x, uint32_t y, uint32_t z, uint32_t gridSize) {
+
+	if (layout == FIELD_LAYOUT_BRICKED) {
+		size_t bricks = fieldBricksPerAxis(gridSize);
+		size_t brick = (x >> 2) + bricks * ((y >> 2) + bricks * (z >> 2));
+		return brick * FIELD_BRICK_CELLS + mortonEncode(x & 3, y & 3, z & 3);
+	}
+	return x + (size_t)gridSize * (y + (size_t)gridSize * z);
+
+}
+
+inline void fieldCoords(int layout, size_t index, uint32_t gridSize, uint32_t& x, uint32_t& y, uint32_t& z) {
+
+	if (layout == FIELD_LAYOUT_BRICKED) {
+		size_t bricks = fieldBricksPerAxis(gridSize);
+		size_t brick = index / FIELD_BRICK_CELLS;
+		mortonDecode(static_cast<uint32_t>(index % FIELD_BRICK_CELLS), x, y, z);
+		x += static_cast<uint32_t>(brick % bricks) * FIELD_BRICK_SIZE;
+		y += static_cast<uint32_t>((brick / bricks) % bricks) * FIELD_BRICK_SIZE;
+		z += static_cast<uint32_t>(brick / (bricks * bricks)) * FIELD_BRICK_SIZE;
+		return;
+	}
+	x = static_cast<uint32_t>(index % gridSize);
+	y = static_cast<uint32_t>((index / gridSize) % gridSize);
+	z = static_cast<uint32_t>(index / ((size_t)gridSize * gridSize));
+
+}
@@ -0,0 +1,480 @@
+#include "FieldRecording.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+	const uint32_t RECORDING_VERSION = 1;
+
+	const size_t LZ_MIN_MATCH = 4;
+	const size_t LZ_MAX_OFFSET = 65535;
+	const int LZ_HASH_BITS = 16;
+
+	uint32_t read32(const uint8_t* bytes) {
+		uint32_t value;
+		memcpy(&value, bytes, 4);
+		return value;
+	}
+
+	// The part of a length past the 15 its token nibble holds
+	void writeLength(std::vector<uint8_t>& out, size_t length) {
+		for (; length >= 255; length -= 255) {
+			out.push_back(255);
+		}
+		out.push_back(static_cast<uint8_t>(length));
+	}
+
+	// A sequence without a match ends the block
+	void writeSequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t literalCount, size_t offset, size_t matchLength) {
+
+		size_t match = matchLength == 0 ? 0 : matchLength - LZ_MIN_MATCH;
+		out.push_back(static_cast<uint8_t>(std::min<size_t>(literalCount, 15) << 4 | std::min<size_t>(match, 15)));
+		if (literalCount >= 15) {
+			writeLength(out, literalCount - 15);
+		}
+		out.insert(out.end(), literals, literals + literalCount);
+
+		if (matchLength == 0) {
+			return;
+		}
+		out.push_back(static_cast<uint8_t>(offset));
+		out.push_back(static_cast<uint8_t>(offset >> 8));
+		if (match >= 15) {
+			writeLength(out, match - 15);
+		}
+
+	}
+
+	size_t maskBytes(size_t bricks) {
+		return (bricks + 7) / 8;
+	}
+
+}
+
+void lzCompress(const uint8_t* in, size_t size, std::vector<uint8_t>& out) {
+
+	// Position + 1 of the last 4 bytes seen with each hash, 0 for none
+	std::vector<uint32_t> table(size_t(1) << LZ_HASH_BITS, 0);
+
+	size_t anchor = 0;
+	size_t i = 0;
+
+	while (i + LZ_MIN_MATCH <= size) {
+		uint32_t sequence = read32(in + i);
+		uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+		size_t candidate = table[hash];
+		table[hash] = static_cast<uint32_t>(i + 1);
+
+		if (candidate != 0 && i - (candidate - 1) <= LZ_MAX_OFFSET && read32(in + candidate - 1) == sequence) {
+			size_t match = candidate - 1;
+			size_t length = LZ_MIN_MATCH;
+			while (i + length < size && in[match + length] == in[i + length]) {
+				length++;
+			}
+			writeSequence(out, in + anchor, i - anchor, i - match, length);
+			i += length;
+			anchor = i;
+		}
+		else {
+			// Steps grow the longer nothing matches, so data that does not compress passes quickly
+			i += 1 + ((i - anchor) >> 6);
+		}
+	}
+
+	writeSequence(out, in + anchor, size - anchor, 0, 0);
+
+}
+
+void lzDecompress(const uint8_t* in, size_t size, uint8_t* out, size_t rawSize) {
+
+	const uint8_t* end = in + size;
+	size_t written = 0;
+
+	auto length = [&](size_t value) {
+		if (value == 15) {
+			uint8_t more;
+			do {
+				if (in == end) {
+					throw std::runtime_error("Damaged field recording\n");
+				}
+				more = *in++;
+				value += more;
+			} while (more == 255);
+		}
+		return value;
+	};
+
+	while (true) {
+		if (in == end) {
+			throw std::runtime_error("Damaged field recording\n");
+		}
+		uint8_t token = *in++;
+
+		size_t literals = length(token >> 4);
+		if (literals > static_cast<size_t>(end - in) || literals > rawSize - written) {
+			throw std::runtime_error("Damaged field recording\n");
+		}
+		memcpy(out + written, in, literals);
+		in += literals;
+		written += literals;
+
+		if (in == end) {
+			break;
+		}
+
+		if (end - in < 2) {
+			throw std::runtime_error("Damaged field recording\n");
+		}
+		size_t offset = in[0] | static_cast<size_t>(in[1]) << 8;
+		in += 2;
+		size_t match = length(token & 15) + LZ_MIN_MATCH;
+		if (offset == 0 || offset > written || match > rawSize - written) {
+			throw std::runtime_error("Damaged field recording\n");
+		}
+
+		// Matches closer than their length repeat what they have just written
+		uint8_t* target = out + written;
+		const uint8_t* source = target - offset;
+		if (offset >= match) {
+			memcpy(target, source, match);
+		}
+		else {
+			for (size_t k = 0; k < match; k++) {
+				target[k] = source[k];
+			}
+		}
+		written += match;
+	}
+
+	if (written != rawSize) {
+		throw std::runtime_error("Damaged field recording\n");
+	}
+
+}
+
+FieldRecorder::FieldRecorder(const std::string& path, int gridSize, int layout) : path(path), stream(path, std::ios::binary) {
+
+	if (!stream) {
+		throw std::runtime_error("Failed to create " + path + "\n");
+	}
+
+	this->gridSize = gridSize;
+	this->layout = layout;
+	size_t bricks = fieldBricksPerAxis(gridSize);
+	brickCount = bricks * bricks * bricks;
+
+	FieldRecordingHeader header{};
+	memcpy(header.magic, "LOFR", 4);
+	header.version = RECORDING_VERSION;
+	header.gridSize = gridSize;
+	stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	for (auto& slot : ring.slots) {
+		slot.data.resize(fieldCellCount(layout, gridSize));
+	}
+	// The padding of the last bricks is never written, so it stays 0 in both
+	previous.assign(brickCount * FIELD_BRICK_CELLS, 0);
+	current.assign(brickCount * FIELD_BRICK_CELLS, 0);
+
+	writer = std::thread(&FieldRecorder::writeLoop, this);
+
+}
+
+FieldRecorder::~FieldRecorder() {
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	writer.join();
+
+}
+
+void FieldRecorder::record(const float* field) {
+
+	Pending* slot;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		drained.wait(lock, [&] { return (slot = ring.beginWrite()) != nullptr; });
+	}
+
+	memcpy(slot->data.data(), field, sizeof(float) * slot->data.size());
+	slot->time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		ring.commitWrite();
+	}
+	wake.notify_one();
+	recorded++;
+
+}
+
+void FieldRecorder::writeLoop() {
+
+	bool failed = false;
+
+	while (true) {
+		Pending* frame;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || ring.size() > 0; });
+			frame = ring.front();
+			if (frame == nullptr) {
+				return;
+			}
+		}
+
+		// After a write error the frames are still taken, so record() never waits for good
+		if (!failed) {
+			try {
+				encode(*frame);
+			}
+			catch (const std::exception& e) {
+				std::cerr << "Recording to " << path << " stopped: " << e.what();
+				failed = true;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			ring.pop();
+		}
+		drained.notify_one();
+	}
+
+}
+
+void FieldRecorder::encode(const Pending& frame) {
+
+	if (layout == FIELD_LAYOUT_BRICKED) {
+		memcpy(current.data(), frame.data.data(), sizeof(float) * current.size());
+	}
+	else {
+		for (int z = 0; z < gridSize; z++) {
+			for (int y = 0; y < gridSize; y++) {
+				const float* row = &frame.data[(size_t)gridSize * (y + (size_t)gridSize * z)];
+				for (int x = 0; x < gridSize; x++) {
+					memcpy(&current[fieldIndex(FIELD_LAYOUT_BRICKED, x, y, z, gridSize)], &row[x], sizeof(float));
+				}
+			}
+		}
+	}
+
+	size_t mask = maskBytes(brickCount);
+	raw.assign(mask, 0);
+
+	std::vector<uint32_t> changed;
+	for (size_t brick = 0; brick < brickCount; brick++) {
+		if (memcmp(&current[brick * FIELD_BRICK_CELLS], &previous[brick * FIELD_BRICK_CELLS], sizeof(uint32_t) * FIELD_BRICK_CELLS) != 0) {
+			raw[brick >> 3] |= static_cast<uint8_t>(1u << (brick & 7));
+			changed.push_back(static_cast<uint32_t>(brick));
+		}
+	}
+
+	size_t plane = changed.size() * FIELD_BRICK_CELLS;
+	raw.resize(mask + plane * 4);
+	uint8_t* planes = raw.data() + mask;
+	for (size_t c = 0; c < changed.size(); c++) {
+		const uint32_t* now = &current[changed[c] * FIELD_BRICK_CELLS];
+		const uint32_t* before = &previous[changed[c] * FIELD_BRICK_CELLS];
+		for (uint32_t i = 0; i < FIELD_BRICK_CELLS; i++) {
+			uint32_t delta = now[i] ^ before[i];
+			size_t at = c * FIELD_BRICK_CELLS + i;
+			planes[at] = static_cast<uint8_t>(delta);
+			planes[plane + at] = static_cast<uint8_t>(delta >> 8);
+			planes[plane * 2 + at] = static_cast<uint8_t>(delta >> 16);
+			planes[plane * 3 + at] = static_cast<uint8_t>(delta >> 24);
+		}
+	}
+
+	stored.clear();
+	lzCompress(raw.data(), raw.size(), stored);
+
+	FieldRecordingFrame header{};
+	header.storedBytes = static_cast<uint32_t>(stored.size());
+	header.rawBytes = static_cast<uint32_t>(raw.size());
+	header.time = frame.time;
+	stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	stream.write(reinterpret_cast<const char*>(stored.data()), stored.size());
+	if (!stream) {
+		throw std::runtime_error("Failed to write " + path + "\n");
+	}
+
+	std::swap(previous, current);
+
+}
+
+FieldReplay::FieldReplay(const std::string& path) {
+
+	file.reset(new MappedFile(path));
+
+	FieldRecordingHeader header;
+	if (file->size() < sizeof(header)) {
+		throw std::runtime_error(path + " is not a field recording\n");
+	}
+	memcpy(&header, file->data(), sizeof(header));
+	if (memcmp(header.magic, "LOFR", 4) != 0 || header.version != RECORDING_VERSION || header.gridSize == 0 || header.gridSize > 1024) {
+		throw std::runtime_error(path + " is not a field recording\n");
+	}
+
+	size = static_cast<int>(header.gridSize);
+	size_t bricks = fieldBricksPerAxis(size);
+	brickCount = bricks * bricks * bricks;
+	size_t maxRaw = maskBytes(brickCount) + brickCount * FIELD_BRICK_CELLS * sizeof(uint32_t);
+
+	// Only the frame headers are read here. A recording cut short, by a crash say, plays up to its last whole frame.
+	size_t offset = sizeof(header);
+	while (file->size() - offset >= sizeof(FieldRecordingFrame)) {
+		FieldRecordingFrame frame;
+		memcpy(&frame, file->data() + offset, sizeof(frame));
+		if (frame.storedBytes > file->size() - offset - sizeof(frame)) {
+			break;
+		}
+		if (frame.rawBytes > maxRaw) {
+			throw std::runtime_error("Damaged field recording " + path + "\n");
+		}
+		offsets.push_back(offset);
+		offset += sizeof(frame) + frame.storedBytes;
+	}
+
+	if (offsets.empty()) {
+		throw std::runtime_error(path + " has no frames\n");
+	}
+
+	for (auto& slot : ring.slots) {
+		slot.bits.resize(brickCount * FIELD_BRICK_CELLS);
+	}
+	previous.assign(brickCount * FIELD_BRICK_CELLS, 0);
+
+	reader = std::thread(&FieldReplay::readLoop, this);
+
+}
+
+FieldReplay::~FieldReplay() {
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	reader.join();
+
+}
+
+double FieldReplay::next(int layout, float* out) {
+
+	Decoded* frame;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		filled.wait(lock, [&] { return (frame = ring.front()) != nullptr; });
+	}
+
+	if (layout == FIELD_LAYOUT_BRICKED) {
+		memcpy(out, frame->bits.data(), sizeof(float) * frame->bits.size());
+	}
+	else {
+		for (int z = 0; z < size; z++) {
+			for (int y = 0; y < size; y++) {
+				float* row = &out[(size_t)size * (y + (size_t)size * z)];
+				for (int x = 0; x < size; x++) {
+					memcpy(&row[x], &frame->bits[fieldIndex(FIELD_LAYOUT_BRICKED, x, y, z, size)], sizeof(float));
+				}
+			}
+		}
+	}
+	double time = frame->time;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		ring.pop();
+	}
+	wake.notify_one();
+
+	return time;
+
+}
+
+void FieldReplay::readLoop() {
+
+	while (true) {
+		Decoded* slot;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return stopping || (slot = ring.beginWrite()) != nullptr; });
+			if (stopping) {
+				return;
+			}
+		}
+
+		// A damaged frame repeats the one before, and the error is reported
+		try {
+			decode(cursor, *slot);
+		}
+		catch (const std::exception& e) {
+			std::cerr << "Frame " << cursor << ": " << e.what();
+			slot->bits = previous;
+		}
+
+		// Every loop starts again from the first frame, which is stored against zero
+		cursor++;
+		if (cursor == offsets.size()) {
+			cursor = 0;
+			std::fill(previous.begin(), previous.end(), 0);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			ring.commitWrite();
+		}
+		filled.notify_one();
+	}
+
+}
+
+void FieldReplay::decode(size_t frame, Decoded& out) {
+
+	const uint8_t* bytes = file->data() + offsets[frame];
+	FieldRecordingFrame header;
+	memcpy(&header, bytes, sizeof(header));
+	out.time = header.time;
+
+	raw.resize(header.rawBytes);
+	lzDecompress(bytes + sizeof(header), header.storedBytes, raw.data(), raw.size());
+	file->release(offsets[frame], sizeof(header) + header.storedBytes);
+
+	size_t mask = maskBytes(brickCount);
+	if (raw.size() < mask) {
+		throw std::runtime_error("Damaged field recording\n");
+	}
+	size_t changed = 0;
+	for (size_t i = 0; i < mask; i++) {
+		for (uint8_t bits = raw[i]; bits != 0; bits &= bits - 1) {
+			changed++;
+		}
+	}
+	size_t plane = changed * FIELD_BRICK_CELLS;
+	if (raw.size() != mask + plane * 4) {
+		throw std::runtime_error("Damaged field recording\n");
+	}
+
+	const uint8_t* planes = raw.data() + mask;
+	size_t c = 0;
+	for (size_t brick = 0; brick < brickCount; brick++) {
+		if ((raw[brick >> 3] >> (brick & 7) & 1) == 0) {
+			continue;
+		}
+		uint32_t* samples = &previous[brick * FIELD_BRICK_CELLS];
+		for (uint32_t i = 0; i < FIELD_BRICK_CELLS; i++) {
+			size_t at = c * FIELD_BRICK_CELLS + i;
+			samples[i] ^= planes[at] | static_cast<uint32_t>(planes[plane + at]) << 8 | static_cast<uint32_t>(planes[plane * 2 + at]) << 16 | static_cast<uint32_t>(planes[plane * 3 + at]) << 24;
+		}
+		c++;
+	}
+
+	out.bits = previous;
+
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+
+#include "SPSCRing.h"
+#include "FieldLayout.h"
+#include "VolumeFile.h"
+
+// Header of a field recording (.lofr), followed by its frames in order
+struct FieldRecordingHeader {
+	char magic[4];       // "LOFR"
+	uint32_t version;
+	uint32_t gridSize;
+	uint32_t reserved;
+};
+
+// Header of one frame, followed by storedBytes of lzCompress'ed payload. The payload is the field in
+// FIELD_LAYOUT_BRICKED order, as the bits of every sample XOR the frame before (zero before the first):
+//  - one bit per brick, lowest bit first, set for the bricks that changed
+//  - the changed bricks' 64 samples, cut into byte planes: the lowest byte of every sample, then the next ones
+// Unchanged bricks are left out, and the planes keep the sign and exponent bytes, which rarely change, together.
+struct FieldRecordingFrame {
+	uint32_t storedBytes;
+	uint32_t rawBytes;   // of the payload once decompressed
+	double time;         // seconds from the start of the recording to record()
+};
+
+static_assert(sizeof(FieldRecordingHeader) == 16, "FieldRecordingHeader is written as is");
+static_assert(sizeof(FieldRecordingFrame) == 16, "FieldRecordingFrame is written as is");
+
+// Byte-oriented LZ77 in the layout of LZ4 blocks: every sequence is a token with the literal count in the high
+// nibble and the match length - 4 in the low one (15 continues in bytes of 255), the literals, and a 16-bit
+// little-endian offset back to the match. The last sequence has literals only. Appends to out.
+void lzCompress(const uint8_t* in, size_t size, std::vector<uint8_t>& out);
+
+// Decodes exactly rawSize bytes into out; throws if the data is damaged
+void lzDecompress(const uint8_t* in, size_t size, uint8_t* out, size_t rawSize);
+
+// Writes the fields handed to record() to a recording. A writer thread delta-encodes and compresses them while the
+// caller goes on, through a ring of a few frames; record() only waits when the writer falls that far behind, so no
+// frame is lost.
+class FieldRecorder {
+
+public:
+
+	FieldRecorder(const std::string& path, int gridSize, int layout);
+	~FieldRecorder();   // writes the frames still queued
+
+	FieldRecorder(const FieldRecorder&) = delete;
+	FieldRecorder& operator=(const FieldRecorder&) = delete;
+
+	// Queues field, fieldCellCount(layout, gridSize) floats
+	void record(const float* field);
+
+	uint64_t frames() const { return recorded; }
+
+private:
+
+	struct Pending {
+		std::vector<float> data;
+		double time = 0.0;
+	};
+
+	static const size_t RING_SIZE = 4;
+
+	std::string path;
+	std::ofstream stream;
+	int gridSize;
+	int layout;
+	size_t brickCount;
+	uint64_t recorded = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	SPSCRing<Pending, RING_SIZE> ring;
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable drained;
+	bool stopping = false;
+
+	// Writer thread only
+	std::vector<uint32_t> previous;
+	std::vector<uint32_t> current;
+	std::vector<uint8_t> raw;
+	std::vector<uint8_t> stored;
+
+	void writeLoop();
+	void encode(const Pending& frame);
+
+};
+
+// Plays a recording back one frame per next() call, in order and looping, however fast the caller goes. The file is
+// memory-mapped; a read-ahead thread decodes the next frames into a ring while the caller meshes the current one,
+// and hands the pages it has decoded back to the OS, so recordings far larger than RAM play.
+class FieldReplay {
+
+public:
+
+	explicit FieldReplay(const std::string& path);
+	~FieldReplay();
+
+	FieldReplay(const FieldReplay&) = delete;
+	FieldReplay& operator=(const FieldReplay&) = delete;
+
+	int gridSize() const { return size; }
+	size_t frames() const { return offsets.size(); }
+
+	// Copies the next frame into out, fieldCellCount(layout, gridSize()) floats, and returns its recorded time;
+	// waits for the read-ahead when it is behind. Called from a single thread.
+	double next(int layout, float* out);
+
+private:
+
+	struct Decoded {
+		std::vector<uint32_t> bits;   // bricked
+		double time = 0.0;
+	};
+
+	static const size_t RING_SIZE = 4;
+
+	std::unique_ptr<MappedFile> file;
+	int size = 0;
+	size_t brickCount = 0;
+	std::vector<size_t> offsets;   // of every frame header
+
+	SPSCRing<Decoded, RING_SIZE> ring;
+	std::thread reader;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable filled;
+	bool stopping = false;
+
+	// Read-ahead thread only
+	size_t cursor = 0;
+	std::vector<uint32_t> previous;
+	std::vector<uint8_t> raw;
+
+	void readLoop();
+	void decode(size_t frame, Decoded& out);
+
+};
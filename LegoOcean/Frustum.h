@@ -0,0 +1,42 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+// View frustum as six planes, xyz the inward normal and w the offset, in the space of the matrix it was taken from
+struct Frustum {
+	glm::vec4 planes[6];
+};
+
+// Planes of a clip matrix such as P * V * M (Gribb-Hartmann), for the zero-to-one clip depth VKConfig.h sets up
+inline Frustum extractFrustum(const glm::mat4& clip) {
+
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++) {
+		rows[i] = glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+	}
+
+	Frustum frustum;
+	frustum.planes[0] = rows[3] + rows[0];
+	frustum.planes[1] = rows[3] - rows[0];
+	frustum.planes[2] = rows[3] + rows[1];
+	frustum.planes[3] = rows[3] - rows[1];
+	frustum.planes[4] = rows[2];
+	frustum.planes[5] = rows[3] - rows[2];
+	return frustum;
+
+}
+
+// False when the box is entirely outside one of the planes. Boxes near the frustum's edges that miss it may still
+// pass, which only costs a draw.
+inline bool frustumIntersectsBox(const Frustum& frustum, glm::vec3 boxMin, glm::vec3 boxMax) {
+
+	for (const glm::vec4& plane : frustum.planes) {
+		// The box corner furthest along the plane normal
+		glm::vec3 corner(plane.x >= 0.0f ? boxMax.x : boxMin.x, plane.y >= 0.0f ? boxMax.y : boxMin.y, plane.z >= 0.0f ? boxMax.z : boxMin.z);
+		if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+			return false;
+		}
+	}
+	return true;
+
+}
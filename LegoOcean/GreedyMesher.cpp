@@ -0,0 +1,198 @@
+#include "GreedyMesher.h"
+#include "FieldLayout.h"
+#include <algorithm>
+#include <bit>
+
+namespace {
+
+	bool testBit(const uint64_t* bits, int i) {
+		return (bits[i >> 6] >> (i & 63)) & 1u;
+	}
+
+	// Whether bits first .. first + count - 1 are all set
+	bool testRun(const uint64_t* bits, int first, int count) {
+		for (int i = first; i < first + count; i++) {
+			if (!testBit(bits, i)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void clearRun(uint64_t* bits, int first, int count) {
+		for (int i = first; i < first + count; i++) {
+			bits[i >> 6] &= ~(1ull << (i & 63));
+		}
+	}
+
+	// Index of the first set bit, -1 when there is none
+	int firstBit(const uint64_t* bits, size_t words) {
+		for (size_t w = 0; w < words; w++) {
+			if (bits[w] != 0) {
+				return static_cast<int>(w * 64 + std::countr_zero(bits[w]));
+			}
+		}
+		return -1;
+	}
+
+	// Length of the run of set bits starting at first
+	int runLength(const uint64_t* bits, int first, int size) {
+		int end = first;
+		while (end < size && testBit(bits, end)) {
+			end++;
+		}
+		return end - first;
+	}
+
+}
+
+GreedyMesher::GreedyMesher(int gridSize, int layout, float voxelSize, float extent)
+	: gridSize(gridSize), layout(layout), voxelSize(voxelSize), extent(extent) {
+
+	rowWords = ((size_t)gridSize + 63) / 64;
+	occupancy.assign(rowWords * gridSize * gridSize, 0);
+	for (int d = 0; d < 6; d++) {
+		sliceMasks[d].assign(rowWords * gridSize, 0);
+	}
+
+}
+
+void GreedyMesher::buildOccupancy(const float* field, float iso, int zBegin, int zEnd) {
+
+	for (int z = zBegin; z < zEnd; z++) {
+		for (int y = 0; y < gridSize; y++) {
+			uint64_t* bits = &occupancy[((size_t)y + (size_t)gridSize * z) * rowWords];
+			std::fill(bits, bits + rowWords, 0);
+			for (int x = 0; x < gridSize; x++) {
+				if (field[fieldIndex(layout, x, y, z, gridSize)] > iso) {
+					bits[x >> 6] |= 1ull << (x & 63);
+				}
+			}
+		}
+	}
+
+}
+
+bool GreedyMesher::occupied(int x, int y, int z) const {
+
+	if (x < 0 || y < 0 || z < 0 || x >= gridSize || y >= gridSize || z >= gridSize) {
+		return false;
+	}
+	return testBit(row(y, z), x);
+
+}
+
+void GreedyMesher::meshDirection(int direction) {
+
+	int axis = direction / 2;
+	int step = (direction & 1) ? 1 : -1;
+	std::vector<uint64_t>& mask = sliceMasks[direction];
+	faceVertices[direction].clear();
+
+	for (int slice = 0; slice < gridSize; slice++) {
+
+		// Slice rows are z (y for the z axis), bits are x (y for the x axis)
+		for (int r = 0; r < gridSize; r++) {
+			uint64_t* bits = &mask[(size_t)r * rowWords];
+
+			if (axis == 0) {
+				std::fill(bits, bits + rowWords, 0);
+				for (int y = 0; y < gridSize; y++) {
+					if (occupied(slice, y, r) && !occupied(slice + step, y, r)) {
+						bits[y >> 6] |= 1ull << (y & 63);
+					}
+				}
+				continue;
+			}
+
+			// Rows along x line up with the occupancy rows, so a whole row is exposed or not a word at a time
+			int y = axis == 1 ? slice : r;
+			int z = axis == 1 ? r : slice;
+			int ny = axis == 1 ? slice + step : y;
+			int nz = axis == 1 ? z : slice + step;
+			bool outside = ny < 0 || ny >= gridSize || nz < 0 || nz >= gridSize;
+			const uint64_t* solid = row(y, z);
+			const uint64_t* neighbour = outside ? nullptr : row(ny, nz);
+			for (size_t w = 0; w < rowWords; w++) {
+				bits[w] = solid[w] & ~(neighbour ? neighbour[w] : 0);
+			}
+		}
+
+		// Greedy merge: take the first run of a row, grow it over the following rows that contain all of it
+		for (int r = 0; r < gridSize; r++) {
+			uint64_t* bits = &mask[(size_t)r * rowWords];
+			int c0;
+			while ((c0 = firstBit(bits, rowWords)) >= 0) {
+				int width = runLength(bits, c0, gridSize);
+				int height = 1;
+				while (r + height < gridSize && testRun(&mask[(size_t)(r + height) * rowWords], c0, width)) {
+					clearRun(&mask[(size_t)(r + height) * rowWords], c0, width);
+					height++;
+				}
+				clearRun(bits, c0, width);
+				emitQuad(direction, slice, c0, c0 + width, r, r + height);
+			}
+		}
+	}
+
+}
+
+void GreedyMesher::emitQuad(int direction, int slice, int c0, int c1, int r0, int r1) {
+
+	int axis = direction / 2;
+	bool positive = direction & 1;
+	int columnAxis = axis == 0 ? 1 : 0;
+	int rowAxis = axis == 2 ? 1 : 2;
+	float plane = static_cast<float>(slice + (positive ? 1 : 0));
+
+	auto corner = [&](int c, int r) {
+		glm::vec3 p;
+		p[axis] = plane;
+		p[columnAxis] = static_cast<float>(c);
+		p[rowAxis] = static_cast<float>(r);
+		return p * voxelSize;
+	};
+
+	// Up the field, into the solid, like the marching cubes gradient and the normals raymarch.frag and cull.comp use
+	glm::vec3 outward(0.0f);
+	outward[axis] = positive ? 1.0f : -1.0f;
+	glm::vec3 normal = -outward;
+
+	glm::vec3 p00 = corner(c0, r0);
+	glm::vec3 p10 = corner(c1, r0);
+	glm::vec3 p11 = corner(c1, r1);
+	glm::vec3 p01 = corner(c0, r1);
+
+	// Counter-clockwise seen from outside the solid
+	bool flip = glm::dot(glm::cross(p10 - p00, p11 - p00), outward) < 0.0f;
+	glm::vec3 quad[6] = { p00, flip ? p11 : p10, flip ? p10 : p11, p00, flip ? p01 : p11, flip ? p11 : p01 };
+
+	std::vector<PackedVertex>& out = faceVertices[direction];
+	for (const glm::vec3& p : quad) {
+		out.push_back(packVertex(p, normal, extent));
+	}
+
+}
+
+size_t GreedyMesher::gather(PackedVertex* out, size_t maxVertices) const {
+
+	size_t count = 0;
+	for (int d = 0; d < 6; d++) {
+		// Whole triangles only
+		size_t n = std::min(faceVertices[d].size(), (maxVertices - count) / 3 * 3);
+		std::copy(faceVertices[d].begin(), faceVertices[d].begin() + n, out + count);
+		count += n;
+	}
+	return count;
+
+}
+
+size_t GreedyMesher::vertexCount() const {
+
+	size_t count = 0;
+	for (int d = 0; d < 6; d++) {
+		count += faceVertices[d].size();
+	}
+	return count;
+
+}
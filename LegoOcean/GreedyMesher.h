@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "VertexFormat.h"
+
+// Greedy mesher for blocky scenes: every grid point above the iso-value is a solid voxel spanning one cell,
+// (x, y, z) .. (x + 1, y + 1, z + 1) * voxelSize, and its faces open to empty space are merged into the largest
+// rectangles that stay in their slice. Occupancy is kept as bit rows along x; each of the six face directions
+// sweeps its slices as bitmask rows and merges runs row by row, so a flat wall costs two triangles whatever
+// its size. The output is a plain triangle list for the regular graphics pipeline.
+//
+// buildOccupancy may run for disjoint z ranges in parallel, and so may the six meshDirection calls once it is done.
+class GreedyMesher {
+
+public:
+
+	GreedyMesher(int gridSize, int layout, float voxelSize, float extent);
+
+	// Sets the occupancy bits of z slices zBegin .. zEnd - 1 from the field
+	void buildOccupancy(const float* field, float iso, int zBegin, int zEnd);
+
+	// Merges the exposed faces pointing along direction axis * 2 + (positive ? 1 : 0), axes x, y, z
+	void meshDirection(int direction);
+
+	// Copies the six directions' triangles to out, up to maxVertices; returns the number of vertices written
+	size_t gather(PackedVertex* out, size_t maxVertices) const;
+
+	size_t vertexCount() const;
+
+private:
+
+	int gridSize;
+	int layout;
+	float voxelSize;
+	float extent;
+	size_t rowWords;
+
+	std::vector<uint64_t> occupancy;            // rowWords words per (y, z) row, bit x
+	std::vector<uint64_t> sliceMasks[6];        // scratch of each direction, rowWords words per slice row
+	std::vector<PackedVertex> faceVertices[6];
+
+	bool occupied(int x, int y, int z) const;
+	const uint64_t* row(int y, int z) const { return &occupancy[((size_t)y + (size_t)gridSize * z) * rowWords]; }
+
+	void emitQuad(int direction, int slice, int c0, int c1, int r0, int r1);
+
+};
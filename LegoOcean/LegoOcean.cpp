@@ -2,7 +2,27 @@
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "TraingleTable.h"
+#include "FieldGenerator.h"
+#include "TaskGraph.h"
+#include "MeshValidation.h"
+#include "ChunkManager.h"
+#include "GreedyMesher.h"
+#include "PointCloud.h"
+#include "MeshExport.h"
+#include "FieldRecording.h"
+#include "MeshVoxelizer.h"
+#include "Frustum.h"
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <ctime>
 
 namespace win {
 	int width = 3840;
@@ -16,14 +36,81 @@ namespace camera {
 	glm::vec3 fwd = glm::vec3(0.0f, 0.0f, 1.0f);
 	float angle = 0;
 	float Xangle = 0;
+	Frustum frustum;      // in mesh position space
+	bool culling = true;
+	bool occlusion = true;   // against the previous frame's depth, see VulkanClass::recordOcclusionCulling
 }
 
 namespace field {
-	int fieldMode = 0;
-	bool first = true;
+	double simulationRate = 60.0;
+	int layout = FIELD_LAYOUT_LINEAR;
+	std::vector<float> isoLevels = { 0.0f };
+	float isoStep = 0.05f;
+	std::unique_ptr<FieldProducer> producer;
+	std::shared_ptr<VolumeSeries> volume;   // --volume, played in FIELD_MODE_VOLUME
+	std::unique_ptr<FieldRecorder> recorder;   // --record: every new field the meshers get
+	std::unique_ptr<FieldReplay> replay;       // --replay, played in FIELD_MODE_REPLAY
+	bool replaying = false;
+}
+
+// --points: a point cloud splatted into the field in FIELD_MODE_POINTS, and again whenever the kernel changes
+namespace points {
+	std::unique_ptr<PointCloud> cloud;
+	SplatSettings settings;
+	bool gpu = false;     // splat.comp instead of the thread pool
+	bool active = false;
+	bool dirty = false;
+}
+
+// --model: a mesh voxelized into a signed distance field in FIELD_MODE_MODEL. It is voxelized once, on the first
+// frame that needs it, and copied into the field whenever the mode is entered again.
+namespace model {
+	std::unique_ptr<MeshVoxelizer> mesh;
+	std::vector<float> field;
+	float band = 3.0f;    // grid cells
+	bool active = false;
+	bool dirty = false;
+}
+
+// Field mode 3: an unbounded wave ocean streamed in chunks around the camera
+namespace ocean {
+	int chunkCells = 16;
+	int radius = 2;
+	int lodCount = 4;
+	std::unique_ptr<ChunkManager> chunks;
+	bool active = false;
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+}
+
+// Greedy quads of the occupied voxels instead of marching cubes, meshed on the thread pool
+namespace greedy {
+	bool active = false;
+	std::unique_ptr<GreedyMesher> mesher;
+}
+
+// Snapshots of the drawn mesh, written on a background thread from a copy the GPU makes after meshing, so no frame
+// waits for them. X exports one, --export-every one every few seconds.
+namespace meshExport {
+	std::unique_ptr<MeshExporter> exporter;
+	std::string pattern = "mesh_%Y%m%d_%H%M%S.ply";   // strftime fields are filled in
+	double interval = 0.0;   // seconds, 0 for none
+	std::chrono::steady_clock::time_point next;
+	bool requested = false;
+	std::string path;        // of the copy in flight
 }
 
 bool CPU = false;
+bool bricks = false;   // draw the grid as instanced bricks instead of meshing it
+bool rayMarch = false; // ray-march the field in a full-screen pass instead of meshing it
+
+bool greedyMeshing() {
+	return greedy::active && !ocean::active && !bricks && !rayMarch;
+}
+
+// Host marching cubes into the vertex buffer
+bool cpuMarching() {
+	return CPU && !ocean::active && !bricks && !rayMarch && !greedy::active;
+}
 
 Transform transform;
 ComputeUniforms computeUniform;
@@ -34,6 +121,55 @@ namespace hostSwapChain {
 	uint32_t currentFrame = 0;
 }
 
+namespace frame {
+	std::unique_ptr<ThreadPool> pool;
+	TaskGraph graph;
+	bool acquired = false;
+	bool dumpTimings = false;
+	bool logHash = false;
+	uint64_t number = 0;
+}
+
+
+// Switches between the fixed grid and the streamed ocean; both mesh with march(), so its grid follows
+void setOcean(bool active) {
+
+	if (active == ocean::active) {
+		return;
+	}
+
+	// shader.vert tints the ocean's crests
+	ocean::active = active;
+	transform.wave = active ? 1 : 0;
+
+	if (active) {
+		// The chunks and their arena are only created the first time the ocean is switched on
+		if (!ocean::chunks) {
+			ocean::chunks.reset(new ChunkManager(ocean::chunkCells, ocean::radius, ocean::lodCount, waveSample, true, glm::vec3(0.0f)));
+			vk->createChunkArena(ocean::chunks->arenaVertices());
+			ocean::chunks->setArena(reinterpret_cast<PackedVertex*>(vk->chunkArenaMap));
+		}
+		ocean::chunks->activate();
+	}
+	else {
+		setMarchGrid(vk->gridSize, field::layout);
+		vk->drawChunks = false;
+	}
+
+}
+
+// The producer fills the field in every mode but FIELD_MODE_POINTS, FIELD_MODE_REPLAY and FIELD_MODE_MODEL, where it
+// idles and the cloud is splatted, the recording played or the model's distance field copied in instead
+void setFieldMode(int mode, bool reset) {
+
+	field::producer->setFieldMode(mode, reset);
+	points::active = mode == FIELD_MODE_POINTS && points::cloud;
+	points::dirty = points::active;
+	field::replaying = mode == FIELD_MODE_REPLAY && field::replay;
+	model::active = mode == FIELD_MODE_MODEL && model::mesh;
+	model::dirty = model::active;
+
+}
 
 void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
 
@@ -77,47 +213,80 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
 		camera::fwd = glm::vec3(camera::fwd.x, sin(camera::Xangle), cos(camera::Xangle));
 	}
 	if (key == GLFW_KEY_0 && action == GLFW_RELEASE) {
-		field::fieldMode = 0;
-		field::first = true;
-		transform.wave = 0;
+		setFieldMode(0, true);
+		setOcean(false);
 	}
 	if (key == GLFW_KEY_1) {
-		field::fieldMode = 1;
-		transform.wave = 0;
+		setFieldMode(1, false);
+		setOcean(false);
 	}
 	if (key == GLFW_KEY_2 && action == GLFW_RELEASE) {
-		field::fieldMode = 2;
-		field::first = true;
-		transform.wave = 0;
+		setFieldMode(2, true);
+		setOcean(false);
 	}
 	if (key == GLFW_KEY_3) {
-		field::fieldMode = 3;
-		transform.wave = 1;
+		setFieldMode(3, false);
+		setOcean(true);
 	}
 	if (key == GLFW_KEY_4) {
-		field::fieldMode = 4;
-		field::first = true;
-		transform.wave = 0;
+		setFieldMode(4, true);
+		setOcean(false);
+	}
+	if (key == GLFW_KEY_6 && action == GLFW_RELEASE && field::volume) {
+		setFieldMode(FIELD_MODE_VOLUME, true);
+		setOcean(false);
+	}
+	if (key == GLFW_KEY_7 && action == GLFW_RELEASE && points::cloud) {
+		setFieldMode(FIELD_MODE_POINTS, true);
+		setOcean(false);
+	}
+	if (key == GLFW_KEY_8 && action == GLFW_RELEASE && field::replay) {
+		setFieldMode(FIELD_MODE_REPLAY, true);
+		setOcean(false);
+	}
+	if (key == GLFW_KEY_9 && action == GLFW_RELEASE && model::mesh) {
+		setFieldMode(FIELD_MODE_MODEL, true);
+		setOcean(false);
+	}
+	if (key == GLFW_KEY_K && action == GLFW_RELEASE) {
+		points::settings.kernel = (points::settings.kernel + 1) % SPLAT_KERNEL_COUNT;
+		points::dirty = points::active;
+	}
+	if ((key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET) && action != GLFW_RELEASE) {
+		points::settings.radius = glm::clamp(points::settings.radius + (key == GLFW_KEY_RIGHT_BRACKET ? 0.5f : -0.5f), 0.5f, static_cast<float>(SPLAT_MAX_RADIUS));
+		points::dirty = points::dirty || (points::active && points::settings.kernel == SPLAT_GAUSSIAN);
+	}
+	if (key == GLFW_KEY_G && action == GLFW_RELEASE) {
+		greedy::active = !greedy::active;
+	}
+	if (key == GLFW_KEY_B && action == GLFW_RELEASE) {
+		bricks = !bricks;
+		vk->brickMode = bricks;
+	}
+	if (key == GLFW_KEY_R && action == GLFW_RELEASE) {
+		rayMarch = !rayMarch;
+		vk->rayMarchMode = rayMarch;
+	}
+	if (key == GLFW_KEY_T && action == GLFW_RELEASE) {
+		frame::dumpTimings = true;
+	}
+	if (key == GLFW_KEY_X && action == GLFW_RELEASE) {
+		meshExport::requested = true;
+	}
+	if ((key == GLFW_KEY_EQUAL || key == GLFW_KEY_MINUS) && action != GLFW_RELEASE) {
+		// Shifts every iso-level; both meshers pick the new values up on the next frame
+		for (float& level : field::isoLevels) {
+			level += key == GLFW_KEY_EQUAL ? field::isoStep : -field::isoStep;
+		}
+		setIsoLevels(field::isoLevels.data(), static_cast<int>(field::isoLevels.size()));
+		if (ocean::chunks) {
+			ocean::chunks->invalidate();
+		}
 	}
 	if (key == GLFW_KEY_5 && action == GLFW_RELEASE) {
 		CPU = !CPU;
 
-		std::vector<Particle> vertices;
-
-		for (int i = 0; i < vk->NUM_PARTICLES; i++) {
-			for (int j = 0; j < 15; j++) {
-				Particle vert;
-
-				vert.pos = glm::vec4(0.0f);
-				vert.normal = glm::vec4(0.0f);
-
-				vertices.push_back(vert);
-			}
-		}
-
-		memcpy(vk->posBufferMap[1], vertices.data(), sizeof(Particle) * vk->NUM_PARTICLES * 15.0);
-
-		transform.wave = 0;
+		memset(vk->posBufferMap[1], 0, sizeof(PackedVertex) * vk->vertexCount());
 	}
 }
 
@@ -127,261 +296,626 @@ void windowResizeCallback(GLFWwindow* window, int width, int height) {
 
 }
 
-void diagnostics() {
+void splatPoints() {
+
+	if (points::gpu) {
+		SplatPlacement placement = points::cloud->fit(vk->gridSize, points::settings);
+		SplatUniforms uniforms;
+		uniforms.offset = placement.offset;
+		uniforms.scale = placement.scale;
+		uniforms.pointCount = static_cast<uint32_t>(points::cloud->size());
+		uniforms.gridSize = vk->gridSize;
+		uniforms.fieldLayout = vk->fieldLayout;
+		uniforms.kernel = points::settings.kernel;
+		uniforms.radius = points::settings.radius;
+		vk->splatPoints(uniforms);
+	}
+	else {
+		points::cloud->splat(points::settings, vk->gridSize, vk->fieldLayout, *frame::pool, reinterpret_cast<float*>(vk->posBufferMap[0]));
+	}
+
+}
+
+void advectField() {
+
+	float* data = reinterpret_cast<float*>(vk->posBufferMap[0]);
 
-	Particle* buffer = reinterpret_cast<Particle*>(vk->posBufferMap[1]);
+	// Fields are generated on the producer thread; take the newest finished one, if any
+	bool produced = field::producer->consumeLatest(data);
 
-	for (int i = 0; i < vk->NUM_PARTICLES; i++) {
+	// A replay hands over the next recorded frame every frame, however long frames take, so every run meshes the
+	// same sequence
+	if (field::replaying) {
+		field::replay->next(vk->fieldLayout, data);
+		produced = true;
+	}
 
-		//if (buffer[i].pos[3] == 0) {
-		//	std::cout << "0 ";
-		//}
-		//else {
-		//	std::cout << "1 ";
-		//}
-		/*std::cout << buffer[i].normal[3] << " ";
+	// A frame the producer finished before the switch to the cloud overwrites the splat, so it is splatted again
+	bool splatted = false;
+	if (points::active && (points::dirty || produced)) {
+		splatPoints();
+		points::dirty = false;
+		splatted = true;
+	}
 
-		if ((i) % 10 == 0) {
-			std::cout << "|";
+	bool voxelized = false;
+	if (model::active && (model::dirty || produced)) {
+		if (model::field.empty()) {
+			model::field.resize(vk->fieldCells);
+			VoxelizeStats stats = model::mesh->voxelize(vk->gridSize, vk->fieldLayout, model::band, *frame::pool, model::field.data());
+			std::cout << "voxelized " << model::mesh->size() << " triangles in " << stats.ms << " ms, " << stats.nearPoints << " grid points near the surface\n";
 		}
-		if ((i) % 100 == 0) {
-			std::cout << "\n";
-		}*/
+		memcpy(data, model::field.data(), model::field.size() * sizeof(float));
+		model::dirty = false;
+		voxelized = true;
+	}
 
-		std::cout << buffer[i].pos.x << " | "  << buffer[i].pos.y << " | " << buffer[i].pos.z << "\n";
+	// GPU splats land in the field after this frame's compute pass, too late to be recorded here
+	if (field::recorder && (produced || splatted || voxelized) && !(splatted && points::gpu)) {
+		field::recorder->record(data);
 	}
 
 }
 
-void advectField() {
+void meshSlab(int slab, int numSlabs) {
+
+	if (!cpuMarching()) {
+		return;
+	}
 
-	std::vector<float> data;
 	float* buffer = reinterpret_cast<float*>(vk->posBufferMap[0]);
-	std::vector<Particle> vertices;
-	float t_before;
+	PackedVertex* vertices = reinterpret_cast<PackedVertex*>(vk->posBufferMap[1]);
 
-	switch (field::fieldMode) {
-	case 0:
-		if (!field::first) { break; }
-		for (size_t i = 0; i < vk->NUM_PARTICLES; i++) {
+	size_t units = marchUnitCount();
+	size_t begin = units * slab / numSlabs;
+	size_t end = units * (slab + 1) / numSlabs;
 
-			int cell_x = (i % vk->gridSize) - vk->gridSize / 2;
-			int cell_y = (i / vk->gridSize2) - vk->gridSize / 2;
-			int cell_z = (i / vk->gridSize) % vk->gridSize - vk->gridSize / 2;
+	marchUnits(begin, end, [&](unsigned int x, unsigned int y, unsigned int z) {
+		// Culled tiles keep their vertices from before
+		if (!vk->gridTileMeshed(y / FIELD_BRICK_SIZE, z / FIELD_BRICK_SIZE))
+			return;
+		march(x, y, z, buffer, &vertices[(x + (size_t)vk->gridSize * (y + (size_t)vk->gridSize * z)) * 15]);
+	});
 
-			float dist = sqrt(cell_x * cell_x + cell_y * cell_y + cell_z * cell_z);
+}
 
-			float fieldStrength = 1.0f;
+void greedyOccupancy(int slab, int numSlabs) {
 
-			if (dist > 4) {
-				fieldStrength = 0.0f;
-			}
+	if (!greedyMeshing()) {
+		return;
+	}
 
-			data.push_back(fieldStrength);
-		}
+	float* buffer = reinterpret_cast<float*>(vk->posBufferMap[0]);
+	greedy::mesher->buildOccupancy(buffer, iso_levels[0], vk->gridSize * slab / numSlabs, vk->gridSize * (slab + 1) / numSlabs);
 
-		field::first = false;
-		memcpy(vk->posBufferMap[0], data.data(), sizeof(float) * vk->NUM_PARTICLES);
-		break;
-	case 1:
-		for (size_t i = 0; i < vk->NUM_PARTICLES; i++) {
+}
 
-			int cell_x = (i % vk->gridSize) - vk->gridSize/2;
-			int cell_y = (i / vk->gridSize2) - vk->gridSize/2;
-			int cell_z = (i / vk->gridSize) % vk->gridSize - vk->gridSize/2;
+void greedyDirection(int direction) {
 
-			float dist = sqrt(cell_x * cell_x + cell_y * cell_y + cell_z * cell_z);
+	if (greedyMeshing()) {
+		greedy::mesher->meshDirection(direction);
+	}
 
-			float fieldStrength = 1.0f;
+}
 
-			if (dist > 4 * abs(sin(glfwGetTime()))) {
-				fieldStrength = 0.0f;
-			}
+// The greedy mesh has no fixed slots per cell; it is packed at the front of the vertex buffer and drawn whole
+void greedyGather() {
 
-			data.push_back(fieldStrength);
-		}
+	if (!greedyMeshing()) {
+		return;
+	}
 
-		memcpy(vk->posBufferMap[0], data.data(), sizeof(float) * vk->NUM_PARTICLES);
-		break;
-	case 2:
-		if (!field::first) { break; }
-		for (size_t i = 0; i < vk->NUM_PARTICLES; i++) {
+	size_t count = greedy::mesher->gather(reinterpret_cast<PackedVertex*>(vk->posBufferMap[1]), vk->vertexCount());
 
-			float fieldStrength = 0.0;
+	MeshDraw draw;
+	draw.origin = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	draw.boxMin = glm::vec4(0.0f);
+	draw.boxMax = glm::vec4(glm::vec3(mesh_extent), 0.0f);
+	draw.firstVertex = 0;
+	draw.vertexCount = static_cast<uint32_t>(count);
+	draw.occlusionId = 0;
+	vk->meshDraws.assign(1, draw);
 
-			float random = ((float)rand() / float(RAND_MAX));
-			if (random > 0.3) {
-				fieldStrength = 1.0f;
-			}
+}
 
-			data.push_back(fieldStrength);
-		}
+void updateCamera() {
 
-		field::first = false;
-		memcpy(vk->posBufferMap[0], data.data(), sizeof(float) * vk->NUM_PARTICLES);
-		break;
-	case 3: 
-		for (size_t i = 0; i < vk->NUM_PARTICLES; i++) {
+	transform.M = glm::scale(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::mat4(1.0f);
+	transform.V = glm::lookAt(camera::pos, camera::pos + camera::fwd, glm::vec3(0.0f, 1.0f, 0.0f));
+	transform.P = glm::perspective(glm::radians(45.0f), win::width / (float)win::height, 0.1f, 1000.0f);
+	transform.meshBounds = glm::vec4(0.0f, 0.0f, 0.0f, mesh_extent);
+	transform.eye = glm::inverse(transform.M) * glm::vec4(camera::pos, 1.0f);
+	transform.isoStreamVertices = ocean::active ? 0 : static_cast<int>(marchStreamVertices());
+	vk->transform = transform;
 
-			int cell_x = (i % vk->gridSize) - vk->gridSize / 2;
-			int cell_y = (i / vk->gridSize2) - vk->gridSize / 2;
-			int cell_z = (i / vk->gridSize) % vk->gridSize - vk->gridSize / 2;
+	camera::frustum = extractFrustum(transform.P * transform.V * transform.M);
 
-			float fieldStrength = 0.0;
+}
 
-			if (cell_z < (sin(cell_x + glfwGetTime()*3.0) + cos(cell_y + glfwGetTime() * 3.0))) {
-				fieldStrength = 1.0;
-			}
+void updateComputeUniforms() {
 
+	computeUniform.deltaTime = glfwGetTime() / 1000.0;
+	if (CPU || ocean::active || greedyMeshing())
+		computeUniform.fieldMode = 5;
+	else
+		computeUniform.fieldMode = 0;
+	computeUniform.meshExtent = mesh_extent;
+	computeUniform.gridSize = vk->gridSize;
+	computeUniform.fieldLayout = vk->fieldLayout;
+	computeUniform.isoLevelCount = iso_level_count;
+	for (int i = 0; i < iso_level_count; i++) {
+		computeUniform.isoLevels[i] = iso_levels[i];
+	}
 
-			data.push_back(fieldStrength);
-		}
+	vk->computeUniform = computeUniform;
 
-		memcpy(vk->posBufferMap[0], data.data(), sizeof(float) * vk->NUM_PARTICLES);
-		break;
-	case 4:
-		if (field::first) {
-			for (size_t i = 0; i < vk->NUM_PARTICLES; i++) {
+}
 
-				float fieldStrength = 0.0;
+void streamChunks() {
 
-				data.push_back(fieldStrength);
-			}
+	if (!ocean::active) {
+		return;
+	}
 
-			field::first = false;
-			memcpy(vk->posBufferMap[0], data.data(), sizeof(float) * vk->NUM_PARTICLES);
-		}
-		else {
+	// Chunks are remeshed at the simulation rate, not every frame
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - ocean::startTime).count();
+	double time = std::floor(elapsed * field::simulationRate) / field::simulationRate;
+	glm::vec3 cameraPos = glm::vec3(transform.eye);
 
-			for (size_t i = 0; i < vk->NUM_PARTICLES; i++) {
+	// A snapshot covers every chunk in range, not only the visible ones
+	bool snapshot = vk->meshReadbackState == MESH_READBACK_REQUESTED;
+	ocean::chunks->setOccluded(vk->occludedChunks && !snapshot ? vk->occludedIds : std::vector<uint32_t>());
+	ocean::chunks->update(cameraPos, camera::culling && !snapshot ? &camera::frustum : nullptr, time, *frame::pool);
 
-				int cell_x = (i % vk->gridSize) - vk->gridSize / 2;
-				int cell_y = (i / vk->gridSize2) - vk->gridSize / 2;
-				int cell_z = (i / vk->gridSize) % vk->gridSize - vk->gridSize / 2;
+}
 
-				float fieldStrength = 0.0;
-				 
-				if (buffer[i] == 1.0) {
-					fieldStrength = 1.0;
-				}
-				else {
-					float random = ((float)rand() / float(RAND_MAX));
-					if (random > 0.999) {
-						fieldStrength = 1.0f;
-					}
-				}
+void uploadChunks() {
 
-				if (abs(cell_x) >= vk->gridSize/2-1 || abs(cell_y) >= vk->gridSize / 2 - 1 || abs(cell_z) >= vk->gridSize / 2 - 1) {
-					fieldStrength = 0.0;
-				}
+	if (!ocean::active) {
+		return;
+	}
 
-				data.push_back(fieldStrength);
-			}
+	ocean::chunks->upload();
+	vk->meshDraws = ocean::chunks->draws();
+	vk->drawChunks = true;
 
-			field::first = false;
-			memcpy(vk->posBufferMap[0], data.data(), sizeof(float) * vk->NUM_PARTICLES);
-		}
-		break;
-	case 5:
-		CPU = !CPU;
-		break;
-	default:
-		//pass
-		break;
+}
+
+// The buffers the host writes are shared by all frames in flight. Every task writing one the previous frame may still
+// draw from depends on this one: the field in ray-march mode, the vertex buffer when meshing on the CPU, the chunk arena.
+void awaitPreviousDraw() {
+
+	bool rayMarchField = rayMarch && !bricks && !ocean::active;
+	bool chunkUpload = ocean::active && ocean::chunks->hasStaged();
+	if (rayMarchField || cpuMarching() || greedyMeshing() || chunkUpload) {
+		vk->waitForPreviousDraw(hostSwapChain::currentFrame);
 	}
 
-	if (CPU) {
-		t_before = glfwGetTime();
-		for (int i = 0; i < vk->NUM_PARTICLES; i++) {
-			for (int j = 0; j < 15; j++) {
-				Particle vert = march(i, j, buffer);
+}
 
-				vertices.push_back(vert);
-			}
-		}
+// Picks the grid tiles both meshers skip and the vertex ranges to draw
+void cullGrid() {
 
-		//std::cout << "CPU TIME - " << glfwGetTime() - t_before << "\n";
+	if (ocean::active) {
+		return;
+	}
 
-		memcpy(vk->posBufferMap[1], vertices.data(), sizeof(Particle) * vk->NUM_PARTICLES * 15.0);
+	// A snapshot meshes the whole grid
+	if (vk->meshReadbackState == MESH_READBACK_REQUESTED) {
+		vk->occludedIds.clear();
+		vk->cullGrid(nullptr);
+		return;
 	}
 
+	vk->cullGrid(camera::culling ? &camera::frustum : nullptr);
+
 }
 
-void display() {
+void recordFrame() {
 
-	vkWaitForFences(vk->getLogicalDevice(), 1, &vk->inFlightFence[hostSwapChain::currentFrame], VK_TRUE, UINT32_MAX);
+	if (frame::acquired) {
+		vk->recordFrame(hostSwapChain::currentFrame);
+	}
 
-	float t_before = glfwGetTime();
+}
 
-	vk->dispatch(hostSwapChain::currentFrame);
+void buildFrameGraph() {
 
-	vkWaitForFences(vk->getLogicalDevice(), 1, &vk->computeInFlightFences[hostSwapChain::currentFrame], VK_TRUE, UINT64_MAX);
+	// Host work of one frame. Command recording overlaps field upload and CPU meshing;
+	// submission happens on the main thread once the whole graph has finished.
+	TaskGraph::TaskId cameraTask = frame::graph.addTask("camera", updateCamera);
+	TaskGraph::TaskId uniformTask = frame::graph.addTask("compute uniforms", updateComputeUniforms);
+	TaskGraph::TaskId chunkTask = frame::graph.addTask("chunks", streamChunks, { cameraTask });
+	TaskGraph::TaskId cullTask = frame::graph.addTask("cull", cullGrid, { cameraTask });
 
-	if (!CPU) {
-		//std::cout << "GPU TIME - " << glfwGetTime() - t_before << "\n";
+	// Chunks are meshed into staging memory while the previous frame draws
+	TaskGraph::TaskId drawnTask = frame::graph.addTask("previous draw", awaitPreviousDraw, { chunkTask });
+	TaskGraph::TaskId uploadTask = frame::graph.addTask("chunk upload", uploadChunks, { chunkTask, drawnTask });
+
+	TaskGraph::TaskId fieldTask = frame::graph.addTask("field", advectField, { drawnTask });
+
+	int numSlabs = frame::pool->size() + 1;
+	for (int slab = 0; slab < numSlabs; slab++) {
+		frame::graph.addTask("mesh slab " + std::to_string(slab), [slab, numSlabs] { meshSlab(slab, numSlabs); }, { drawnTask, fieldTask, cullTask });
 	}
 
-	vk->draw(hostSwapChain::currentFrame);
+	// The greedy mesh's size decides the draw, so recording waits for it; the tasks are no-ops in the other modes
+	std::vector<TaskGraph::TaskId> occupancyTasks;
+	for (int slab = 0; slab < numSlabs; slab++) {
+		occupancyTasks.push_back(frame::graph.addTask("occupancy slab " + std::to_string(slab), [slab, numSlabs] { greedyOccupancy(slab, numSlabs); }, { fieldTask }));
+	}
+	std::vector<TaskGraph::TaskId> gatherDependencies = { drawnTask, cullTask };
+	for (int direction = 0; direction < 6; direction++) {
+		gatherDependencies.push_back(frame::graph.addTask("greedy " + std::to_string(direction), [direction] { greedyDirection(direction); }, occupancyTasks));
+	}
+	TaskGraph::TaskId gatherTask = frame::graph.addTask("greedy gather", greedyGather, gatherDependencies);
+
+	frame::graph.addTask("record", recordFrame, { cameraTask, uniformTask, uploadTask, cullTask, gatherTask });
+
+}
+
+void display() {
+
+	if (frame::acquired) {
+		vk->dispatch(hostSwapChain::currentFrame);
+		vk->draw(hostSwapChain::currentFrame);
+	}
 
 	hostSwapChain::currentFrame = (hostSwapChain::currentFrame + 1) % vk->getMaxFramesInFlight();
 
 }
 
+// Hash of the mesh the last finished frame drew, for comparing runs and backends
+void logMeshHash() {
+
+	// The vertex buffer is shared by all frames in flight, so let the GPU finish writing it first
+	vkDeviceWaitIdle(vk->getLogicalDevice());
+
+	std::vector<MeshTriangle> triangles = canonicalizeMesh(reinterpret_cast<PackedVertex*>(vk->posBufferMap[1]), vk->vertexCount());
+	std::cout << "frame " << frame::number << " " << (CPU ? "cpu" : "gpu") << " mesh " << std::hex << std::setfill('0') << std::setw(16) << meshHash(triangles) << std::dec
+		<< " " << triangles.size() << " triangles\n";
+
+}
+
+// Hands a finished mesh copy to the exporter, and asks for the next one when a snapshot is due
+void pumpMeshExport() {
+
+	if (vk->meshReadbackState == MESH_READBACK_READY) {
+		const PackedVertex* vertices = reinterpret_cast<const PackedVertex*>(vk->meshReadbackMap);
+		std::vector<MeshExportRange> ranges;
+		for (const MeshDraw& draw : vk->meshReadbackDraws) {
+			ranges.push_back({ vertices + draw.firstVertex, draw.vertexCount, draw.origin });
+		}
+
+		// EXPORTING is set first, since a small export can finish and set IDLE before start() returns
+		std::string path = meshExport::path;
+		vk->meshReadbackState = MESH_READBACK_EXPORTING;
+		bool started = meshExport::exporter->start(path, std::move(ranges), vk->meshReadbackExtent, [path](const MeshExportStats& stats) {
+			if (stats.error.empty()) {
+				std::cout << "exported " << path << ": " << stats.triangles << " triangles, " << stats.vertices << " vertices, " << stats.bytes << " bytes in " << stats.ms << " ms\n";
+			}
+			else {
+				std::cout << "export of " << path << " failed: " << stats.error;
+			}
+			vk->meshReadbackState = MESH_READBACK_IDLE;
+		});
+		// The copy stays ready while the exporter is still busy, and is handed over again next frame
+		if (!started) {
+			vk->meshReadbackState = MESH_READBACK_READY;
+		}
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	if (meshExport::interval > 0.0 && now >= meshExport::next) {
+		meshExport::requested = true;
+		meshExport::next = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(meshExport::interval));
+	}
+
+	// A snapshot due while the last one is still being written waits for it
+	if (!meshExport::requested || vk->meshReadbackState != MESH_READBACK_IDLE) {
+		return;
+	}
+	meshExport::requested = false;
+
+	if ((bricks || rayMarch) && !ocean::active) {
+		std::cout << "no mesh to export in brick or ray-march mode\n";
+		return;
+	}
+
+	std::time_t time = std::time(nullptr);
+	std::tm local{};
+#ifdef _WIN32
+	localtime_s(&local, &time);
+#else
+	localtime_r(&time, &local);
+#endif
+	char path[512];
+	if (std::strftime(path, sizeof(path), meshExport::pattern.c_str(), &local) == 0) {
+		std::cout << "export path " << meshExport::pattern << " is too long\n";
+		return;
+	}
+	meshExport::path = path;
+	vk->meshReadbackState = MESH_READBACK_REQUESTED;
+
+}
+
 void idle() {
 
-	transform.M = glm::scale(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::mat4(1.0f);
-	transform.V = glm::lookAt(camera::pos, camera::pos + camera::fwd, glm::vec3(0.0f, 1.0f, 0.0f));
-	transform.P = glm::perspective(glm::radians(45.0f), win::width / (float)win::height, 0.1f, 1000.0f);
-	vk->transform = transform;
+	// Fence waits and image acquisition stay on the main thread, since a stale swapchain is recreated through GLFW
+	frame::acquired = vk->acquireFrame(hostSwapChain::currentFrame);
 
-	vk->updateTransform();
-	
-	computeUniform.deltaTime = glfwGetTime() / 1000.0;
-	if (CPU)
-		computeUniform.fieldMode = 5;
-	else
-		computeUniform.fieldMode = 0;
+	// Before the frame graph, which meshes everything for a requested copy
+	pumpMeshExport();
 
-	vk->computeUniform = computeUniform;
+	if (frame::logHash && frame::number > 0) {
+		logMeshHash();
+	}
+	frame::number++;
 
-	vk->updateCompute();
+	frame::graph.run(*frame::pool);
 
-	advectField();
+	if (frame::dumpTimings) {
+		frame::graph.dumpTimings(std::cout);
+		frame::dumpTimings = false;
+	}
 
 }
 
-int main() {
+// Runs a fixed number of frames without a window and reports how long they took
+void runHeadless(int numFrames) {
 
-	glfwInit();
+	std::vector<double> frameMs;
+	frameMs.reserve(numFrames);
 
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+	auto start = std::chrono::steady_clock::now();
+	auto last = start;
 
-	GLFWwindow* window = glfwCreateWindow(win::width, win::height, "Lego Ocean", 0, nullptr);
+	for (int i = 0; i < numFrames; i++) {
 
-	vk.reset(new VulkanClass (window));
+		idle();
+		display();
+
+		auto now = std::chrono::steady_clock::now();
+		frameMs.push_back(std::chrono::duration<double, std::milli>(now - last).count());
+		last = now;
+
+	}
+
+	vkDeviceWaitIdle(vk->getLogicalDevice());
+	double totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::sort(frameMs.begin(), frameMs.end());
+
+	std::cout << "HEADLESS - " << numFrames << " frames, " << vk->gridSize << "^3 grid, " << (bricks ? "brick rendering" : rayMarch ? "ray marching" : greedy::active ? "greedy meshing" : CPU ? "CPU meshing" : "GPU meshing") << "\n";
+	std::cout << "total " << totalMs << " ms, " << totalMs / numFrames << " ms/frame, " << numFrames * 1000.0 / totalMs << " fps\n";
+	if (!frameMs.empty()) {
+		std::cout << "frame ms: median " << frameMs[frameMs.size() / 2] << ", p95 " << frameMs[frameMs.size() * 95 / 100] << ", max " << frameMs.back() << "\n";
+	}
+	frame::graph.dumpTimings(std::cout);
+
+}
+
+int main(int argc, char** argv) {
+
+	bool headless = false;
+	int headlessFrames = 1000;
+	int fieldMode = 0;
+	std::vector<std::string> volumePaths;
+	std::string pointsPath;
+	std::string recordPath;
+	std::string modelPath;
+	int gridSize = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--bricked") == 0) {
+			field::layout = FIELD_LAYOUT_BRICKED;
+		}
+		if (strcmp(argv[i], "--headless") == 0) {
+			headless = true;
+		}
+		if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			headlessFrames = std::max(atoi(argv[++i]), 1);
+		}
+		if (strcmp(argv[i], "--field") == 0 && i + 1 < argc) {
+			fieldMode = atoi(argv[++i]);
+		}
+		if (strcmp(argv[i], "--cpu") == 0) {
+			CPU = true;
+		}
+		if (strcmp(argv[i], "--greedy") == 0) {
+			greedy::active = true;
+		}
+		if (strcmp(argv[i], "--bricks") == 0) {
+			bricks = true;
+		}
+		if (strcmp(argv[i], "--raymarch") == 0) {
+			rayMarch = true;
+		}
+		if (strcmp(argv[i], "--log-hash") == 0) {
+			// The hash covers the whole grid, and culled tiles keep stale vertices
+			frame::logHash = true;
+			camera::culling = false;
+			camera::occlusion = false;
+		}
+		if (strcmp(argv[i], "--no-cull") == 0) {
+			camera::culling = false;
+		}
+		if (strcmp(argv[i], "--no-occlusion") == 0) {
+			camera::occlusion = false;
+		}
+		if (strcmp(argv[i], "--volume") == 0 && i + 1 < argc) {
+			std::stringstream list(argv[++i]);
+			std::string path;
+			while (std::getline(list, path, ',')) {
+				volumePaths.push_back(path);
+			}
+			fieldMode = FIELD_MODE_VOLUME;
+		}
+		if (strcmp(argv[i], "--convert-volume") == 0 && i + 2 < argc) {
+			VolumeFile source(argv[i + 1]);
+			source.writeBricked(argv[i + 2]);
+			return 0;
+		}
+		if (strcmp(argv[i], "--points") == 0 && i + 1 < argc) {
+			pointsPath = argv[++i];
+			fieldMode = FIELD_MODE_POINTS;
+		}
+		if (strcmp(argv[i], "--splat-kernel") == 0 && i + 1 < argc) {
+			const char* kernels[SPLAT_KERNEL_COUNT] = { "nearest", "trilinear", "gaussian" };
+			i++;
+			for (int kernel = 0; kernel < SPLAT_KERNEL_COUNT; kernel++) {
+				if (strcmp(argv[i], kernels[kernel]) == 0) {
+					points::settings.kernel = kernel;
+				}
+			}
+		}
+		if (strcmp(argv[i], "--splat-radius") == 0 && i + 1 < argc) {
+			points::settings.radius = glm::clamp(static_cast<float>(atof(argv[++i])), 0.5f, static_cast<float>(SPLAT_MAX_RADIUS));
+		}
+		if (strcmp(argv[i], "--gpu-splat") == 0) {
+			points::gpu = true;
+		}
+		if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+			modelPath = argv[++i];
+			fieldMode = FIELD_MODE_MODEL;
+		}
+		if (strcmp(argv[i], "--sdf-band") == 0 && i + 1 < argc) {
+			model::band = glm::clamp(static_cast<float>(atof(argv[++i])), 1.0f, 16.0f);
+		}
+		if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc) {
+			gridSize = std::max(atoi(argv[++i]), 2);
+		}
+		if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			recordPath = argv[++i];
+		}
+		if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			field::replay.reset(new FieldReplay(argv[++i]));
+			std::cout << field::replay->frames() << " frames of a " << field::replay->gridSize() << "^3 field from " << argv[i] << "\n";
+			fieldMode = FIELD_MODE_REPLAY;
+		}
+		if (strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+			meshExport::pattern = argv[++i];
+			MeshExportFormat format;
+			if (!MeshExporter::formatFor(meshExport::pattern, format)) {
+				throw std::runtime_error("Unknown mesh export format " + meshExport::pattern + ", expected .ply, .obj or .gltf\n");
+			}
+		}
+		if (strcmp(argv[i], "--export-every") == 0 && i + 1 < argc) {
+			meshExport::interval = std::max(atof(argv[++i]), 0.0);
+		}
+		if (strcmp(argv[i], "--iso") == 0 && i + 1 < argc) {
+			field::isoLevels = { static_cast<float>(atof(argv[++i])) };
+		}
+		if (strcmp(argv[i], "--iso-levels") == 0 && i + 1 < argc) {
+			field::isoLevels.clear();
+			std::stringstream list(argv[++i]);
+			std::string level;
+			while (std::getline(list, level, ',') && field::isoLevels.size() < MAX_ISO_LEVELS) {
+				field::isoLevels.push_back(static_cast<float>(atof(level.c_str())));
+			}
+			if (field::isoLevels.empty()) {
+				field::isoLevels.push_back(0.0f);
+			}
+		}
+	}
+
+	GLFWwindow* window = nullptr;
+
+	if (headless) {
+		vk.reset(new VulkanClass(win::width, win::height));
+	}
+	else {
+		glfwInit();
+
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+
+		window = glfwCreateWindow(win::width, win::height, "Lego Ocean", 0, nullptr);
+
+		vk.reset(new VulkanClass (window));
+	}
+
+	vk->occlusionCulling = camera::occlusion;
+	vk->clusterCulling = camera::culling;
+	vk->brickMode = bricks;
+	vk->rayMarchMode = rayMarch;
 	vk->createTransformBuffer(sizeof(transform));
 	vk->createTransformDescriptorSet();
+	// A replay meshes at the grid size it was recorded at
+	vk->setGrid(field::replay ? field::replay->gridSize() : gridSize > 0 ? gridSize : vk->gridSize, field::layout, static_cast<int>(field::isoLevels.size()));
 	vk->createPosBuffer();
+	setMarchGrid(vk->gridSize, field::layout);
+	greedy::mesher.reset(new GreedyMesher(vk->gridSize, field::layout, voxel_size, mesh_extent));
+	setIsoLevels(field::isoLevels.data(), static_cast<int>(field::isoLevels.size()));
 	vk->createComputeDescriptorSet();
 
-	glfwSetKeyCallback(window, keyboardCallback);
-	glfwSetWindowSizeCallback(window, windowResizeCallback);
+	field::producer.reset(new FieldProducer(vk->gridSize, field::layout, field::simulationRate));
+	if (!volumePaths.empty()) {
+		field::volume = std::make_shared<VolumeSeries>(volumePaths, vk->gridSize);
+		field::producer->setVolume(field::volume);
+	}
+	if (!pointsPath.empty()) {
+		points::cloud.reset(new PointCloud(pointsPath));
+		std::cout << points::cloud->size() << " points from " << pointsPath << "\n";
+		if (points::gpu) {
+			vk->createPointSplatting(points::cloud->data().data(), points::cloud->size());
+		}
+	}
+	if (!modelPath.empty()) {
+		model::mesh.reset(new MeshVoxelizer(modelPath));
+		std::cout << model::mesh->size() << " triangles from " << modelPath << "\n";
+	}
+	if (!recordPath.empty()) {
+		field::recorder.reset(new FieldRecorder(recordPath, vk->gridSize, field::layout));
+	}
+	setFieldMode(fieldMode, true);
+	field::producer->start();
 
-	while (!glfwWindowShouldClose(window)) {
+	// Worst case of the grid is one draw per tile row of every z slab and iso-level
+	size_t gridDraws = (size_t)vk->isoLevelCount * vk->gridSize * vk->gridTilesPerAxis();
+	vk->createDrawBuffers(std::max(gridDraws, ChunkManager::maxDraws(ocean::chunkCells, ocean::radius, ocean::lodCount)));
+	setOcean(fieldMode == 3);
 
-		idle();
-		display();
+	meshExport::exporter.reset(new MeshExporter());
+	meshExport::next = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(meshExport::interval));
+
+	unsigned int numThreads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+	frame::pool.reset(new ThreadPool(numThreads));
+	buildFrameGraph();
+
+	if (headless) {
+		runHeadless(headlessFrames);
+	}
+	else {
+		glfwSetKeyCallback(window, keyboardCallback);
+		glfwSetWindowSizeCallback(window, windowResizeCallback);
 
-		//diagnostics();
+		while (!glfwWindowShouldClose(window)) {
 
-		glfwPollEvents();
+			idle();
+			display();
 
+			glfwPollEvents();
+
+		}
 	}
 
+	field::producer->stop();
+	frame::pool.reset();
+
+	// Finishes a running export, which reads the readback buffer
+	meshExport::exporter.reset();
+
+	if (field::recorder) {
+		uint64_t frames = field::recorder->frames();
+		field::recorder.reset();
+		std::cout << "recorded " << frames << " frames to " << recordPath << "\n";
+	}
+	ocean::chunks.reset();
+
 	vkDeviceWaitIdle(vk->getLogicalDevice());
 
 	vk.reset();
 
 	return 0;
 
-}
\ No newline at end of file
+}
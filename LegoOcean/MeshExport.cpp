@@ -0,0 +1,447 @@
+#include "MeshExport.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+namespace {
+
+	// Bytes handed to the stream at a time
+	const size_t EXPORT_CHUNK_BYTES = 1 << 20;
+
+	bool hostIsBigEndian() {
+		uint16_t probe = 1;
+		uint8_t first;
+		memcpy(&first, &probe, 1);
+		return first == 0;
+	}
+
+	// Appends to a file through a fixed buffer, so the stream sees a few large writes instead of one per value
+	class ChunkedWriter {
+
+	public:
+
+		explicit ChunkedWriter(const std::string& path) : path(path), stream(path, std::ios::binary) {
+			if (!stream) {
+				throw std::runtime_error("Failed to create " + path + "\n");
+			}
+			buffer.reserve(EXPORT_CHUNK_BYTES);
+		}
+
+		void bytes(const void* data, size_t size) {
+			if (buffer.size() + size > EXPORT_CHUNK_BYTES) {
+				flush();
+			}
+			const char* begin = static_cast<const char*>(data);
+			buffer.insert(buffer.end(), begin, begin + size);
+		}
+
+		void text(std::string_view value) {
+			bytes(value.data(), value.size());
+		}
+
+		// 32-bit floats or integers, little-endian whatever the host
+		void words(const void* data, size_t count) {
+			if (!hostIsBigEndian()) {
+				bytes(data, count * 4);
+				return;
+			}
+			const uint8_t* word = static_cast<const uint8_t*>(data);
+			for (size_t i = 0; i < count; i++, word += 4) {
+				uint8_t swapped[4] = { word[3], word[2], word[1], word[0] };
+				bytes(swapped, 4);
+			}
+		}
+
+		// Shortest text that reads back as the same value
+		template <typename T>
+		void number(T value) {
+			char digits[32];
+			std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+			bytes(digits, result.ptr - digits);
+		}
+
+		size_t offset() const { return written + buffer.size(); }
+
+		// Overwrites text written earlier, once its value is known
+		void patch(size_t at, std::string_view value) {
+			flush();
+			stream.seekp(at);
+			stream.write(value.data(), value.size());
+			stream.seekp(0, std::ios::end);
+		}
+
+		// Returns the file size
+		size_t close() {
+			flush();
+			stream.close();
+			if (stream.fail()) {
+				throw std::runtime_error("Failed to write " + path + "\n");
+			}
+			return written;
+		}
+
+	private:
+
+		std::string path;
+		std::ofstream stream;
+		std::vector<char> buffer;
+		size_t written = 0;
+
+		void flush() {
+			stream.write(buffer.data(), buffer.size());
+			if (!stream) {
+				throw std::runtime_error("Failed to write " + path + "\n");
+			}
+			written += buffer.size();
+			buffer.clear();
+		}
+
+	};
+
+	// A vertex as exported: its final position and its packed normal
+	struct VertexKey {
+		float x, y, z;
+		int8_t nx, ny;
+		bool operator==(const VertexKey& other) const {
+			return x == other.x && y == other.y && z == other.z && nx == other.nx && ny == other.ny;
+		}
+	};
+
+	struct VertexKeyHash {
+		size_t operator()(const VertexKey& key) const {
+			uint32_t bits[3];
+			memcpy(bits, &key.x, 12);
+			uint64_t h = bits[0] * 0x9E3779B97F4A7C15ull;
+			h = (h ^ bits[1]) * 0x9E3779B97F4A7C15ull;
+			h = (h ^ bits[2]) * 0x9E3779B97F4A7C15ull;
+			h ^= static_cast<uint64_t>(static_cast<uint8_t>(key.nx) | static_cast<uint8_t>(key.ny) << 8) << 32;
+			return static_cast<size_t>(h ^ (h >> 29));
+		}
+	};
+
+	bool samePosition(const PackedVertex& a, const PackedVertex& b) {
+		return a.x == b.x && a.y == b.y && a.z == b.z;
+	}
+
+	// Walks the triangles of every range, calling vertex(index, position, normal) the first time a vertex is seen and
+	// then triangle(a, b, c) with the indices of its corners
+	template <typename VertexFn, typename TriangleFn>
+	void forEachTriangle(const std::vector<MeshExportRange>& ranges, float extent, VertexFn vertex, TriangleFn triangle) {
+
+		std::unordered_map<VertexKey, uint32_t, VertexKeyHash> indices;
+
+		for (const MeshExportRange& range : ranges) {
+			glm::vec3 origin = glm::vec3(range.origin);
+			float scale = range.origin.w;
+
+			for (size_t i = 0; i + 2 < range.count; i += 3) {
+				const PackedVertex* v = range.vertices + i;
+				if (samePosition(v[0], v[1]) || samePosition(v[1], v[2]) || samePosition(v[0], v[2])) {
+					continue;
+				}
+
+				uint32_t corners[3];
+				for (int k = 0; k < 3; k++) {
+					glm::vec3 position = origin + unpackPosition(v[k], extent) * scale;
+					VertexKey key = { position.x, position.y, position.z, v[k].nx, v[k].ny };
+					auto found = indices.try_emplace(key, static_cast<uint32_t>(indices.size()));
+					if (found.second) {
+						vertex(found.first->second, position, unpackNormal(v[k]));
+					}
+					corners[k] = found.first->second;
+				}
+				triangle(corners[0], corners[1], corners[2]);
+			}
+		}
+
+	}
+
+	void writePly(const std::string& path, const std::vector<MeshExportRange>& ranges, float extent, MeshExportStats& stats) {
+
+		ChunkedWriter out(path);
+
+		// The counts are fixed-width so they can be filled in once known
+		out.text("ply\nformat binary_little_endian 1.0\ncomment LegoOcean mesh export\nelement vertex ");
+		size_t vertexCountAt = out.offset();
+		out.text("0000000000\nproperty float x\nproperty float y\nproperty float z\n"
+			"property float nx\nproperty float ny\nproperty float nz\nelement face ");
+		size_t faceCountAt = out.offset();
+		out.text("0000000000\nproperty list uchar uint vertex_indices\nend_header\n");
+
+		// Faces follow all the vertices in the file, so they wait in memory
+		std::vector<uint32_t> faces;
+		forEachTriangle(ranges, extent,
+			[&](uint32_t, glm::vec3 position, glm::vec3 normal) {
+				float values[6] = { position.x, position.y, position.z, normal.x, normal.y, normal.z };
+				out.words(values, 6);
+				stats.vertices++;
+			},
+			[&](uint32_t a, uint32_t b, uint32_t c) {
+				faces.insert(faces.end(), { a, b, c });
+			});
+
+		for (size_t i = 0; i < faces.size(); i += 3) {
+			uint8_t corners = 3;
+			out.bytes(&corners, 1);
+			out.words(&faces[i], 3);
+		}
+		stats.triangles = faces.size() / 3;
+
+		char count[16];
+		snprintf(count, sizeof(count), "%010zu", stats.vertices);
+		out.patch(vertexCountAt, count);
+		snprintf(count, sizeof(count), "%010zu", stats.triangles);
+		out.patch(faceCountAt, count);
+
+		stats.bytes = out.close();
+
+	}
+
+	void writeObj(const std::string& path, const std::vector<MeshExportRange>& ranges, float extent, MeshExportStats& stats) {
+
+		ChunkedWriter out(path);
+		out.text("# LegoOcean mesh export\n");
+
+		// A vertex is always seen before the first face using it, so both stream out in one pass
+		forEachTriangle(ranges, extent,
+			[&](uint32_t, glm::vec3 position, glm::vec3 normal) {
+				out.text("v ");
+				out.number(position.x);
+				out.text(" ");
+				out.number(position.y);
+				out.text(" ");
+				out.number(position.z);
+				out.text("\nvn ");
+				out.number(normal.x);
+				out.text(" ");
+				out.number(normal.y);
+				out.text(" ");
+				out.number(normal.z);
+				out.text("\n");
+				stats.vertices++;
+			},
+			[&](uint32_t a, uint32_t b, uint32_t c) {
+				out.text("f");
+				for (uint32_t index : { a + 1, b + 1, c + 1 }) {
+					out.text(" ");
+					out.number(index);
+					out.text("//");
+					out.number(index);
+				}
+				out.text("\n");
+				stats.triangles++;
+			});
+
+		stats.bytes = out.close();
+
+	}
+
+	std::string toText(float value) {
+		char digits[32];
+		std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+		return std::string(digits, result.ptr);
+	}
+
+	void writeGltf(const std::string& path, const std::vector<MeshExportRange>& ranges, float extent, MeshExportStats& stats) {
+
+		// The buffer goes next to the .gltf, with the same name
+		std::string binPath = path.substr(0, path.find_last_of('.')) + ".bin";
+		size_t slash = binPath.find_last_of("/\\");
+		std::string binName = slash == std::string::npos ? binPath : binPath.substr(slash + 1);
+
+		// Interleaved position and normal, then the indices, which wait in memory until the vertices are done
+		ChunkedWriter bin(binPath);
+		std::vector<uint32_t> indices;
+		glm::vec3 low(0.0f), high(0.0f);
+
+		forEachTriangle(ranges, extent,
+			[&](uint32_t index, glm::vec3 position, glm::vec3 normal) {
+				float values[6] = { position.x, position.y, position.z, normal.x, normal.y, normal.z };
+				bin.words(values, 6);
+				low = index == 0 ? position : glm::min(low, position);
+				high = index == 0 ? position : glm::max(high, position);
+				stats.vertices++;
+			},
+			[&](uint32_t a, uint32_t b, uint32_t c) {
+				indices.insert(indices.end(), { a, b, c });
+			});
+
+		bin.words(indices.data(), indices.size());
+		stats.triangles = indices.size() / 3;
+		stats.bytes = bin.close();
+
+		ChunkedWriter out(path);
+		out.text("{\n\t\"asset\": { \"version\": \"2.0\", \"generator\": \"LegoOcean\" },\n\t\"scene\": 0,\n");
+
+		// Buffers and views may not be empty, so an empty mesh is a scene without nodes
+		if (stats.triangles == 0) {
+			out.text("\t\"scenes\": [ { \"nodes\": [] } ]\n}\n");
+			stats.bytes += out.close();
+			return;
+		}
+
+		size_t vertexBytes = stats.vertices * 24;
+		std::string json =
+			"\t\"scenes\": [ { \"nodes\": [ 0 ] } ],\n"
+			"\t\"nodes\": [ { \"mesh\": 0 } ],\n"
+			"\t\"meshes\": [ { \"primitives\": [ { \"attributes\": { \"POSITION\": 0, \"NORMAL\": 1 }, \"indices\": 2 } ] } ],\n"
+			"\t\"buffers\": [ { \"uri\": \"" + binName + "\", \"byteLength\": " + std::to_string(stats.bytes) + " } ],\n"
+			"\t\"bufferViews\": [\n"
+			"\t\t{ \"buffer\": 0, \"byteOffset\": 0, \"byteLength\": " + std::to_string(vertexBytes) + ", \"byteStride\": 24, \"target\": 34962 },\n"
+			"\t\t{ \"buffer\": 0, \"byteOffset\": " + std::to_string(vertexBytes) + ", \"byteLength\": " + std::to_string(indices.size() * 4) + ", \"target\": 34963 }\n"
+			"\t],\n"
+			"\t\"accessors\": [\n"
+			"\t\t{ \"bufferView\": 0, \"byteOffset\": 0, \"componentType\": 5126, \"count\": " + std::to_string(stats.vertices) + ", \"type\": \"VEC3\", "
+			"\"min\": [ " + toText(low.x) + ", " + toText(low.y) + ", " + toText(low.z) + " ], "
+			"\"max\": [ " + toText(high.x) + ", " + toText(high.y) + ", " + toText(high.z) + " ] },\n"
+			"\t\t{ \"bufferView\": 0, \"byteOffset\": 12, \"componentType\": 5126, \"count\": " + std::to_string(stats.vertices) + ", \"type\": \"VEC3\" },\n"
+			"\t\t{ \"bufferView\": 1, \"byteOffset\": 0, \"componentType\": 5125, \"count\": " + std::to_string(indices.size()) + ", \"type\": \"SCALAR\" }\n"
+			"\t]\n"
+			"}\n";
+		out.text(json);
+		stats.bytes += out.close();
+
+	}
+
+}
+
+MeshExporter::MeshExporter() {
+
+	worker = std::thread(&MeshExporter::workerLoop, this);
+
+}
+
+MeshExporter::~MeshExporter() {
+
+	// A queued export still runs, its caller may be waiting for done
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	worker.join();
+
+}
+
+bool MeshExporter::formatFor(const std::string& path, MeshExportFormat& format) {
+
+	size_t dot = path.find_last_of('.');
+	if (dot == std::string::npos) {
+		return false;
+	}
+
+	std::string extension = path.substr(dot + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+	if (extension == "ply") {
+		format = MESH_EXPORT_PLY;
+	}
+	else if (extension == "obj") {
+		format = MESH_EXPORT_OBJ;
+	}
+	else if (extension == "gltf") {
+		format = MESH_EXPORT_GLTF;
+	}
+	else {
+		return false;
+	}
+	return true;
+
+}
+
+bool MeshExporter::busy() {
+
+	std::lock_guard<std::mutex> lock(mutex);
+	return pending || running;
+
+}
+
+bool MeshExporter::start(const std::string& path, std::vector<MeshExportRange> ranges, float extent, std::function<void(const MeshExportStats&)> done) {
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (pending || running) {
+			return false;
+		}
+		pending = true;
+		jobPath = path;
+		jobRanges = std::move(ranges);
+		jobExtent = extent;
+		jobDone = std::move(done);
+	}
+	wake.notify_one();
+	return true;
+
+}
+
+MeshExportStats MeshExporter::write(const std::string& path, const std::vector<MeshExportRange>& ranges, float extent) {
+
+	MeshExportFormat format;
+	if (!formatFor(path, format)) {
+		throw std::runtime_error("Unknown mesh export format " + path + ", expected .ply, .obj or .gltf\n");
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	MeshExportStats stats;
+	switch (format) {
+	case MESH_EXPORT_PLY:
+		writePly(path, ranges, extent, stats);
+		break;
+	case MESH_EXPORT_OBJ:
+		writeObj(path, ranges, extent, stats);
+		break;
+	case MESH_EXPORT_GLTF:
+		writeGltf(path, ranges, extent, stats);
+		break;
+	}
+
+	stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+
+}
+
+void MeshExporter::workerLoop() {
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		wake.wait(lock, [this] { return stopping || pending; });
+		if (!pending) {
+			return;
+		}
+
+		pending = false;
+		running = true;
+		std::string path = std::move(jobPath);
+		std::vector<MeshExportRange> ranges = std::move(jobRanges);
+		float extent = jobExtent;
+		std::function<void(const MeshExportStats&)> done = std::move(jobDone);
+
+		lock.unlock();
+		MeshExportStats stats;
+		try {
+			stats = write(path, ranges, extent);
+		}
+		catch (const std::exception& e) {
+			stats.error = e.what();
+		}
+
+		// Not busy by the time done runs, so it may start the next export
+		lock.lock();
+		running = false;
+		lock.unlock();
+		if (done) {
+			done(stats);
+		}
+		lock.lock();
+	}
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+#include "glm/glm.hpp"
+#include "VertexFormat.h"
+
+enum MeshExportFormat {
+	MESH_EXPORT_PLY = 0,   // binary little-endian, float x, y, z, nx, ny, nz and uint indices
+	MESH_EXPORT_OBJ = 1,   // text, v, vn and f lines
+	MESH_EXPORT_GLTF = 2   // .gltf with the interleaved vertices and uint indices in a .bin next to it
+};
+
+// Vertices in triangle-list order, three per slot, placed like a MeshDraw: position = origin.xyz + unpacked * origin.w
+struct MeshExportRange {
+	const PackedVertex* vertices;
+	size_t count;
+	glm::vec4 origin;
+};
+
+struct MeshExportStats {
+	size_t triangles = 0;
+	size_t vertices = 0;
+	size_t bytes = 0;
+	double ms = 0.0;
+	std::string error;   // empty when the export succeeded
+};
+
+// Writes meshes to disk on a background thread. Slots whose three vertices share a position (the empty slots of the
+// vertex buffer) and other zero-area triangles are skipped, and vertices with the same position and normal are
+// written once per distinct origin. Everything is streamed through a 1 MiB buffer, so memory grows with the
+// unique vertices, not with the file.
+class MeshExporter {
+
+public:
+
+	MeshExporter();
+	~MeshExporter();
+
+	MeshExporter(const MeshExporter&) = delete;
+	MeshExporter& operator=(const MeshExporter&) = delete;
+
+	// Picks the format from the extension of path: .ply, .obj or .gltf
+	static bool formatFor(const std::string& path, MeshExportFormat& format);
+
+	bool busy();
+
+	// Exports ranges to path on the background thread and then calls done there; extent is the mesh extent the
+	// vertices were packed with, and they must stay valid until done is called. Returns false, and does nothing,
+	// while the previous export is running.
+	bool start(const std::string& path, std::vector<MeshExportRange> ranges, float extent, std::function<void(const MeshExportStats&)> done);
+
+	// Exports on the calling thread; throws on I/O errors
+	static MeshExportStats write(const std::string& path, const std::vector<MeshExportRange>& ranges, float extent);
+
+private:
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool pending = false;
+	bool running = false;
+	bool stopping = false;
+	std::string jobPath;
+	std::vector<MeshExportRange> jobRanges;
+	float jobExtent = 0.0f;
+	std::function<void(const MeshExportStats&)> jobDone;
+
+	void workerLoop();
+
+};
@@ -0,0 +1,252 @@
+#include "MeshValidation.h"
+#include <unordered_map>
+#include <algorithm>
+#include <tuple>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+
+	auto vertexKey(const PackedVertex& v) {
+		return std::make_tuple(v.x, v.y, v.z, v.nx, v.ny);
+	}
+
+	bool samePosition(const PackedVertex& a, const PackedVertex& b) {
+		return a.x == b.x && a.y == b.y && a.z == b.z;
+	}
+
+	int positionError(const PackedVertex& a, const PackedVertex& b) {
+		return std::max({ std::abs(a.x - b.x), std::abs(a.y - b.y), std::abs(a.z - b.z) });
+	}
+
+	float normalErrorDegrees(const PackedVertex& a, const PackedVertex& b) {
+		if (a.nx == b.nx && a.ny == b.ny) {
+			return 0.0f;
+		}
+		float cosine = std::clamp(glm::dot(unpackNormal(a), unpackNormal(b)), -1.0f, 1.0f);
+		return glm::degrees(std::acos(cosine));
+	}
+
+	// Buckets are far wider than the tolerance, so a match is always in the same or a neighbouring bucket
+	const int BUCKET_SHIFT = 6;
+
+	glm::ivec3 bucketOf(const MeshTriangle& triangle) {
+		glm::ivec3 sum(0);
+		for (const PackedVertex& v : triangle) {
+			sum += glm::ivec3(v.x, v.y, v.z);
+		}
+		return (sum / 3) >> BUCKET_SHIFT;
+	}
+
+	uint64_t bucketKey(glm::ivec3 bucket) {
+		return (uint64_t)(bucket.x & 0x1fffff) | ((uint64_t)(bucket.y & 0x1fffff) << 21) | ((uint64_t)(bucket.z & 0x1fffff) << 42);
+	}
+
+	glm::ivec3 centreOf(const MeshTriangle& triangle) {
+		glm::ivec3 sum(0);
+		for (const PackedVertex& v : triangle) {
+			sum += glm::ivec3(v.x, v.y, v.z);
+		}
+		return sum / 3;
+	}
+
+	glm::vec3 meanNormal(const MeshTriangle& triangle) {
+		return unpackNormal(triangle[0]) + unpackNormal(triangle[1]) + unpackNormal(triangle[2]);
+	}
+
+}
+
+std::vector<MeshTriangle> canonicalizeMesh(const PackedVertex* vertices, size_t numVertices) {
+
+	std::vector<MeshTriangle> triangles;
+
+	for (size_t i = 0; i + 2 < numVertices; i += 3) {
+		if (samePosition(vertices[i], vertices[i + 1]) && samePosition(vertices[i], vertices[i + 2])) {
+			continue;
+		}
+
+		// Rotating keeps the winding, so front and back faces stay distinguishable
+		int first = 0;
+		for (int k = 1; k < 3; k++) {
+			if (vertexKey(vertices[i + k]) < vertexKey(vertices[i + first])) {
+				first = k;
+			}
+		}
+		triangles.push_back({ vertices[i + first], vertices[i + (first + 1) % 3], vertices[i + (first + 2) % 3] });
+	}
+
+	std::sort(triangles.begin(), triangles.end(), [](const MeshTriangle& a, const MeshTriangle& b) {
+		for (int k = 0; k < 3; k++) {
+			if (vertexKey(a[k]) != vertexKey(b[k])) {
+				return vertexKey(a[k]) < vertexKey(b[k]);
+			}
+		}
+		return false;
+	});
+
+	return triangles;
+
+}
+
+uint64_t meshHash(const std::vector<MeshTriangle>& triangles) {
+
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	// Fed field by field in a fixed byte order, so the hash does not depend on struct layout or endianness
+	auto feed = [&hash](uint32_t value, int bytes) {
+		for (int b = 0; b < bytes; b++) {
+			hash ^= (value >> (8 * b)) & 0xff;
+			hash *= 0x100000001b3ull;
+		}
+	};
+
+	for (const MeshTriangle& triangle : triangles) {
+		for (const PackedVertex& v : triangle) {
+			feed(v.x, 2);
+			feed(v.y, 2);
+			feed(v.z, 2);
+			feed((uint8_t)v.nx, 1);
+			feed((uint8_t)v.ny, 1);
+		}
+	}
+
+	return hash;
+
+}
+
+MeshComparison compareMeshes(const std::vector<MeshTriangle>& a, const std::vector<MeshTriangle>& b, int positionTolerance, float normalToleranceDegrees) {
+
+	MeshComparison result;
+	result.trianglesA = a.size();
+	result.trianglesB = b.size();
+
+	auto sameTriangle = [](const MeshTriangle& x, const MeshTriangle& y) {
+		return vertexKey(x[0]) == vertexKey(y[0]) && vertexKey(x[1]) == vertexKey(y[1]) && vertexKey(x[2]) == vertexKey(y[2]);
+	};
+	if (std::equal(a.begin(), a.end(), b.begin(), b.end(), sameTriangle)) {
+		result.equivalent = true;
+		return result;
+	}
+
+	std::unordered_map<uint64_t, std::vector<size_t>> buckets;
+	for (size_t i = 0; i < b.size(); i++) {
+		buckets[bucketKey(bucketOf(b[i]))].push_back(i);
+	}
+
+	std::vector<bool> used(b.size(), false);
+
+	for (const MeshTriangle& triangle : a) {
+
+		glm::ivec3 bucket = bucketOf(triangle);
+		bool matched = false;
+
+		for (int dz = -1; dz <= 1 && !matched; dz++) {
+			for (int dy = -1; dy <= 1 && !matched; dy++) {
+				for (int dx = -1; dx <= 1 && !matched; dx++) {
+
+					auto found = buckets.find(bucketKey(bucket + glm::ivec3(dx, dy, dz)));
+					if (found == buckets.end()) {
+						continue;
+					}
+
+					for (size_t candidate : found->second) {
+						if (used[candidate]) {
+							continue;
+						}
+
+						// Quantization can change which vertex sorts first, so try every rotation
+						for (int rotation = 0; rotation < 3 && !matched; rotation++) {
+							int maxPosition = 0;
+							float maxNormal = 0.0f;
+							for (int k = 0; k < 3; k++) {
+								const PackedVertex& other = b[candidate][(k + rotation) % 3];
+								maxPosition = std::max(maxPosition, positionError(triangle[k], other));
+								maxNormal = std::max(maxNormal, normalErrorDegrees(triangle[k], other));
+							}
+
+							if (maxPosition <= positionTolerance && maxNormal <= normalToleranceDegrees) {
+								used[candidate] = true;
+								matched = true;
+								result.maxPositionError = std::max(result.maxPositionError, maxPosition);
+								result.maxNormalErrorDegrees = std::max(result.maxNormalErrorDegrees, maxNormal);
+							}
+						}
+
+						if (matched) {
+							break;
+						}
+					}
+
+				}
+			}
+		}
+
+		if (!matched) {
+			result.unmatchedA++;
+		}
+
+	}
+
+	result.unmatchedB = b.size() - (a.size() - result.unmatchedA);
+	result.equivalent = result.unmatchedA == 0 && result.unmatchedB == 0;
+
+	return result;
+
+}
+
+NormalSignComparison compareNormalSigns(const std::vector<MeshTriangle>& a, const std::vector<MeshTriangle>& b, int maxDistance) {
+
+	NormalSignComparison result;
+
+	// Buckets as wide as the search distance, so the closest centre is in the same or a neighbouring bucket
+	int bucketSize = std::max(maxDistance, 1);
+	std::unordered_map<uint64_t, std::vector<size_t>> buckets;
+	for (size_t i = 0; i < b.size(); i++) {
+		buckets[bucketKey(centreOf(b[i]) / bucketSize)].push_back(i);
+	}
+
+	for (const MeshTriangle& triangle : a) {
+
+		glm::ivec3 centre = centreOf(triangle);
+		glm::ivec3 bucket = centre / bucketSize;
+		int64_t closestDistance = (int64_t)maxDistance * maxDistance;
+		const MeshTriangle* closest = nullptr;
+
+		for (int dz = -1; dz <= 1; dz++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+
+					auto found = buckets.find(bucketKey(bucket + glm::ivec3(dx, dy, dz)));
+					if (found == buckets.end()) {
+						continue;
+					}
+
+					for (size_t candidate : found->second) {
+						glm::ivec3 d = centreOf(b[candidate]) - centre;
+						int64_t distance = (int64_t)d.x * d.x + (int64_t)d.y * d.y + (int64_t)d.z * d.z;
+						if (distance <= closestDistance) {
+							closestDistance = distance;
+							closest = &b[candidate];
+						}
+					}
+
+				}
+			}
+		}
+
+		if (closest) {
+			result.compared++;
+			if (glm::dot(meanNormal(triangle), meanNormal(*closest)) > 0.0f) {
+				result.agreeing++;
+			}
+		}
+
+	}
+
+	// On smooth surfaces normals of opposite signs agree next to nowhere. Noise a voxel wide has no surface both
+	// meshers follow, and pairs up about half agreeing either way, so it does not count against the sign.
+	result.sameSign = result.agreeing * 4 >= result.compared;
+
+	return result;
+
+}
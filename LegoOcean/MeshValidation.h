@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "VertexFormat.h"
+
+typedef std::array<PackedVertex, 3> MeshTriangle;
+
+// Drops degenerate triangles (the empty slots both meshers write), rotates every triangle so its
+// smallest vertex comes first without changing the winding, and sorts the list. Two meshers that
+// emit the same surface in a different order or from different slots end up with the same list.
+std::vector<MeshTriangle> canonicalizeMesh(const PackedVertex* vertices, size_t numVertices);
+
+// FNV-1a over a canonical triangle list; stable across runs, platforms and vertex order
+uint64_t meshHash(const std::vector<MeshTriangle>& triangles);
+
+struct MeshComparison {
+	size_t trianglesA = 0;
+	size_t trianglesB = 0;
+	size_t unmatchedA = 0;
+	size_t unmatchedB = 0;
+	int maxPositionError = 0;        // unorm16 steps, over matched triangles
+	float maxNormalErrorDegrees = 0.0f;
+	bool equivalent = false;
+};
+
+// Pairs every triangle of a with one of b whose vertices are within positionTolerance unorm16 steps
+// and whose normals are within normalToleranceDegrees (any rotation, same winding).
+// The meshes are equivalent when every triangle found a partner.
+MeshComparison compareMeshes(const std::vector<MeshTriangle>& a, const std::vector<MeshTriangle>& b, int positionTolerance = 4, float normalToleranceDegrees = 3.0f);
+
+struct NormalSignComparison {
+	size_t compared = 0;   // triangles of a with a triangle of b close by
+	size_t agreeing = 0;   // of those, the ones whose normals are less than 90 degrees apart
+	bool sameSign = false;
+};
+
+// For meshes of the same field by different meshers, e.g. greedy boxes and marching cubes, which share no triangles:
+// pairs every triangle of a with the triangle of b whose centre is closest, within maxDistance unorm16 steps, and
+// compares their normals. The normals have opposite signs when fewer than a quarter of the pairs agree.
+NormalSignComparison compareNormalSigns(const std::vector<MeshTriangle>& a, const std::vector<MeshTriangle>& b, int maxDistance);
@@ -0,0 +1,440 @@
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include "MeshVoxelizer.h"
+#include "assimp/Importer.hpp"
+#include "assimp/scene.h"
+#include "assimp/postprocess.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+	// Rows of the parity pass per job
+	const size_t VOXELIZE_JOB_ROWS = 256;
+
+	// The parity rays run this far off the grid points, so they do not graze the edges of models that are aligned
+	// to the grid
+	const float RAY_NUDGE_U = 0.0131f;
+	const float RAY_NUDGE_V = 0.0077f;
+
+	// From the centre of a brick to its grid points
+	const float BRICK_HALF = (FIELD_BRICK_SIZE - 1) * 0.5f;
+	const float BRICK_HALF_DIAGONAL = BRICK_HALF * 1.7320508f;
+
+	std::string lowerExtension(const std::string& path) {
+		size_t dot = path.find_last_of('.');
+		size_t slash = path.find_last_of("/\\");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+			return std::string();
+		}
+		std::string extension = path.substr(dot + 1);
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return extension;
+	}
+
+	float boxDistanceSquared(const glm::vec3& p, const glm::vec3& low, const glm::vec3& high) {
+		glm::vec3 d = glm::max(glm::max(low - p, p - high), glm::vec3(0.0f));
+		return glm::dot(d, d);
+	}
+
+	// Closest point to p on triangle abc, by the Voronoi region of p (Ericson, Real-Time Collision Detection 5.1.5)
+	glm::vec3 closestOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+
+		glm::vec3 ab = b - a;
+		glm::vec3 ac = c - a;
+		glm::vec3 ap = p - a;
+		float d1 = glm::dot(ab, ap);
+		float d2 = glm::dot(ac, ap);
+		if (d1 <= 0.0f && d2 <= 0.0f) { return a; }
+
+		glm::vec3 bp = p - b;
+		float d3 = glm::dot(ab, bp);
+		float d4 = glm::dot(ac, bp);
+		if (d3 >= 0.0f && d4 <= d3) { return b; }
+
+		float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) { return a + ab * (d1 / (d1 - d3)); }
+
+		glm::vec3 cp = p - c;
+		float d5 = glm::dot(ab, cp);
+		float d6 = glm::dot(ac, cp);
+		if (d6 >= 0.0f && d5 <= d6) { return c; }
+
+		float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) { return a + ac * (d2 / (d2 - d6)); }
+
+		float va = d3 * d6 - d5 * d4;
+		if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) { return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6))); }
+
+		float denominator = 1.0f / (va + vb + vc);
+		return a + ab * (vb * denominator) + ac * (vc * denominator);
+
+	}
+
+}
+
+MeshVoxelizer::MeshVoxelizer(const std::string& path) {
+
+	if (lowerExtension(path) == "obj") {
+		loadObj(path);
+	}
+	else {
+		loadScene(path);
+	}
+
+	if (triangles.empty()) {
+		throw std::runtime_error("No triangles in " + path + "\n");
+	}
+
+	low = glm::vec3(std::numeric_limits<float>::max());
+	high = glm::vec3(std::numeric_limits<float>::lowest());
+	for (const glm::vec3& corner : triangles) {
+		low = glm::min(low, corner);
+		high = glm::max(high, corner);
+	}
+
+	build();
+
+}
+
+void MeshVoxelizer::loadObj(const std::string& path) {
+
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string warning;
+	std::string error;
+
+	// Materials are looked up next to the model; a missing .mtl is only a warning
+	size_t slash = path.find_last_of("/\\");
+	std::string directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warning, &error, path.c_str(), directory.c_str(), true)) {
+		throw std::runtime_error("Could not read " + path + ": " + error + "\n");
+	}
+
+	for (const tinyobj::shape_t& shape : shapes) {
+		size_t index = 0;
+		for (unsigned char corners : shape.mesh.num_face_vertices) {
+			if (corners == 3) {
+				for (size_t k = 0; k < 3; k++) {
+					size_t vertex = 3 * static_cast<size_t>(shape.mesh.indices[index + k].vertex_index);
+					triangles.push_back(glm::vec3(attrib.vertices[vertex], attrib.vertices[vertex + 1], attrib.vertices[vertex + 2]));
+				}
+			}
+			index += corners;
+		}
+	}
+
+}
+
+void MeshVoxelizer::loadScene(const std::string& path) {
+
+	// Node transforms are baked into the vertices, so the scene is a flat list of meshes
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_PreTransformVertices);
+	if (!scene || !scene->mRootNode) {
+		throw std::runtime_error("Could not read " + path + ": " + importer.GetErrorString() + "\n");
+	}
+
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++) {
+		const aiMesh* mesh = scene->mMeshes[m];
+		for (unsigned int f = 0; f < mesh->mNumFaces; f++) {
+			// Points and lines stay as they are after triangulation
+			const aiFace& face = mesh->mFaces[f];
+			if (face.mNumIndices != 3) {
+				continue;
+			}
+			for (unsigned int k = 0; k < 3; k++) {
+				const aiVector3D& vertex = mesh->mVertices[face.mIndices[k]];
+				triangles.push_back(glm::vec3(vertex.x, vertex.y, vertex.z));
+			}
+		}
+	}
+
+}
+
+void MeshVoxelizer::build() {
+
+	size_t count = size();
+	std::vector<uint32_t> order(count);
+	std::vector<glm::vec3> centroids(count);
+	for (size_t i = 0; i < count; i++) {
+		order[i] = static_cast<uint32_t>(i);
+		centroids[i] = (triangles[i * 3] + triangles[i * 3 + 1] + triangles[i * 3 + 2]) / 3.0f;
+	}
+
+	// A median split halves every range, so the tree is balanced and the query stacks stay shallow
+	nodes.clear();
+	struct Range {
+		uint32_t node;
+		uint32_t begin;
+		uint32_t end;
+	};
+	std::vector<Range> stack = { { 0, 0, static_cast<uint32_t>(count) } };
+	nodes.push_back(Node());
+	while (!stack.empty()) {
+		Range range = stack.back();
+		stack.pop_back();
+
+		glm::vec3 boxLow(std::numeric_limits<float>::max());
+		glm::vec3 boxHigh(std::numeric_limits<float>::lowest());
+		glm::vec3 centreLow = boxLow;
+		glm::vec3 centreHigh = boxHigh;
+		for (uint32_t i = range.begin; i < range.end; i++) {
+			for (int k = 0; k < 3; k++) {
+				boxLow = glm::min(boxLow, triangles[order[i] * 3 + k]);
+				boxHigh = glm::max(boxHigh, triangles[order[i] * 3 + k]);
+			}
+			centreLow = glm::min(centreLow, centroids[order[i]]);
+			centreHigh = glm::max(centreHigh, centroids[order[i]]);
+		}
+		nodes[range.node].low = boxLow;
+		nodes[range.node].high = boxHigh;
+
+		if (range.end - range.begin <= LEAF_TRIANGLES) {
+			nodes[range.node].first = range.begin;
+			nodes[range.node].count = range.end - range.begin;
+			continue;
+		}
+
+		glm::vec3 spread = centreHigh - centreLow;
+		int axis = spread.x > spread.y && spread.x > spread.z ? 0 : spread.y > spread.z ? 1 : 2;
+		uint32_t middle = range.begin + (range.end - range.begin) / 2;
+		std::nth_element(order.begin() + range.begin, order.begin() + middle, order.begin() + range.end,
+			[&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+		// The two children are stored next to each other
+		uint32_t left = static_cast<uint32_t>(nodes.size());
+		uint32_t right = left + 1;
+		nodes.push_back(Node());
+		nodes.push_back(Node());
+		nodes[range.node].count = 0;
+		nodes[range.node].first = left;
+		stack.push_back({ right, middle, range.end });
+		stack.push_back({ left, range.begin, middle });
+	}
+
+	std::vector<glm::vec3> sorted(triangles.size());
+	for (size_t i = 0; i < count; i++) {
+		for (int k = 0; k < 3; k++) {
+			sorted[i * 3 + k] = triangles[order[i] * 3 + k];
+		}
+	}
+	triangles.swap(sorted);
+
+}
+
+float MeshVoxelizer::closestSquared(const glm::vec3& p, float limit) const {
+
+	// Nodes are pushed with the squared distance to their box, so one that is further than the best found since
+	// is dropped without touching it
+	struct Entry {
+		uint32_t node;
+		float distance;
+	};
+	float best = limit;
+	Entry stack[64];
+	int top = 0;
+	stack[top++] = { 0, boxDistanceSquared(p, nodes[0].low, nodes[0].high) };
+	while (top > 0) {
+		Entry entry = stack[--top];
+		if (entry.distance >= best) {
+			continue;
+		}
+		const Node& node = nodes[entry.node];
+		if (node.count > 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; i++) {
+				glm::vec3 d = p - closestOnTriangle(p, triangles[i * 3], triangles[i * 3 + 1], triangles[i * 3 + 2]);
+				best = std::min(best, glm::dot(d, d));
+			}
+			continue;
+		}
+		// The nearer child goes on top, so it is searched first and tightens the bound for the other
+		Entry left = { node.first, boxDistanceSquared(p, nodes[node.first].low, nodes[node.first].high) };
+		Entry right = { node.first + 1, boxDistanceSquared(p, nodes[node.first + 1].low, nodes[node.first + 1].high) };
+		stack[top++] = left.distance <= right.distance ? right : left;
+		stack[top++] = left.distance <= right.distance ? left : right;
+	}
+	return best;
+
+}
+
+void MeshVoxelizer::crossings(const glm::vec3& p, int axis, std::vector<float>& out) const {
+
+	int u = (axis + 1) % 3;
+	int v = (axis + 2) % 3;
+	uint32_t stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const Node& node = nodes[stack[--top]];
+		if (p[u] < node.low[u] || p[u] > node.high[u] || p[v] < node.low[v] || p[v] > node.high[v]) {
+			continue;
+		}
+		if (node.count > 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; i++) {
+				const glm::vec3& a = triangles[i * 3];
+				const glm::vec3& b = triangles[i * 3 + 1];
+				const glm::vec3& c = triangles[i * 3 + 2];
+				// Barycentric weights of the line's foot in the triangle projected along axis; strict, so a line
+				// through a shared edge crosses neither side rather than both
+				float wa = (b[u] - p[u]) * (c[v] - p[v]) - (b[v] - p[v]) * (c[u] - p[u]);
+				float wb = (c[u] - p[u]) * (a[v] - p[v]) - (c[v] - p[v]) * (a[u] - p[u]);
+				float wc = (a[u] - p[u]) * (b[v] - p[v]) - (a[v] - p[v]) * (b[u] - p[u]);
+				if ((wa > 0.0f && wb > 0.0f && wc > 0.0f) || (wa < 0.0f && wb < 0.0f && wc < 0.0f)) {
+					out.push_back((wa * a[axis] + wb * b[axis] + wc * c[axis]) / (wa + wb + wc));
+				}
+			}
+			continue;
+		}
+		stack[top++] = node.first;
+		stack[top++] = node.first + 1;
+	}
+
+}
+
+VoxelPlacement MeshVoxelizer::fit(int gridSize, float band) const {
+
+	glm::vec3 extent = high - low;
+	float largest = std::max(extent.x, std::max(extent.y, extent.z));
+	float margin = band + 1.0f;
+	float room = std::max(static_cast<float>(gridSize - 1) - 2.0f * margin, 1.0f);
+
+	VoxelPlacement placement;
+	placement.scale = largest > 0.0f ? room / largest : 1.0f;
+	placement.offset = glm::vec3(static_cast<float>(gridSize - 1) * 0.5f) - (low + high) * 0.5f * placement.scale;
+	return placement;
+
+}
+
+VoxelizeStats MeshVoxelizer::voxelize(int gridSize, int layout, float band, ThreadPool& pool, float* out) const {
+
+	auto start = std::chrono::steady_clock::now();
+
+	VoxelPlacement placement = fit(gridSize, band);
+	auto toModel = [&](const glm::vec3& grid) { return (grid - placement.offset) / placement.scale; };
+	size_t n = gridSize;
+
+	// Inside votes: every axis adds 1 to the grid points an odd number of crossings lie before. The rows of one axis
+	// touch disjoint grid points, so the axes run one after the other and their rows in parallel.
+	std::vector<uint8_t> votes(n * n * n, 0);
+	size_t rows = n * n;
+	size_t numJobs = (rows + VOXELIZE_JOB_ROWS - 1) / VOXELIZE_JOB_ROWS;
+	for (int axis = 0; axis < 3; axis++) {
+		int u = (axis + 1) % 3;
+		int v = (axis + 2) % 3;
+		std::atomic<size_t> done{ 0 };
+		for (size_t job = 0; job < numJobs; job++) {
+			pool.submit([&, job, axis, u, v] {
+				std::vector<float> hits;
+				for (size_t row = job * VOXELIZE_JOB_ROWS; row < std::min(rows, (job + 1) * VOXELIZE_JOB_ROWS); row++) {
+					glm::vec3 grid(0.0f);
+					grid[u] = static_cast<float>(row % n) + RAY_NUDGE_U;
+					grid[v] = static_cast<float>(row / n) + RAY_NUDGE_V;
+
+					hits.clear();
+					crossings(toModel(grid), axis, hits);
+					for (float& hit : hits) {
+						hit = hit * placement.scale + placement.offset[axis];
+					}
+					std::sort(hits.begin(), hits.end());
+
+					size_t before = 0;
+					for (size_t i = 0; i < n; i++) {
+						while (before < hits.size() && hits[before] < static_cast<float>(i)) {
+							before++;
+						}
+						if (before & 1) {
+							size_t point[3];
+							point[axis] = i;
+							point[u] = row % n;
+							point[v] = row / n;
+							votes[point[0] + n * (point[1] + n * point[2])]++;
+						}
+					}
+				}
+				done++;
+			});
+		}
+		pool.helpUntil([&] { return done.load() == numJobs; });
+	}
+
+	// Bricks within band of a triangle's bounds; the rest of the grid is at least band from the surface
+	size_t bricks = fieldBricksPerAxis(gridSize);
+	std::vector<uint8_t> near(bricks * bricks * bricks, 0);
+	for (size_t i = 0; i < size(); i++) {
+		glm::vec3 triangleLow = glm::min(triangles[i * 3], glm::min(triangles[i * 3 + 1], triangles[i * 3 + 2])) * placement.scale + placement.offset - band;
+		glm::vec3 triangleHigh = glm::max(triangles[i * 3], glm::max(triangles[i * 3 + 1], triangles[i * 3 + 2])) * placement.scale + placement.offset + band;
+		glm::ivec3 first = glm::clamp(glm::ivec3(glm::floor(triangleLow)) / static_cast<int>(FIELD_BRICK_SIZE), glm::ivec3(0), glm::ivec3(static_cast<int>(bricks) - 1));
+		glm::ivec3 last = glm::clamp(glm::ivec3(glm::floor(triangleHigh)) / static_cast<int>(FIELD_BRICK_SIZE), glm::ivec3(0), glm::ivec3(static_cast<int>(bricks) - 1));
+		for (int z = first.z; z <= last.z; z++) {
+			for (int y = first.y; y <= last.y; y++) {
+				for (int x = first.x; x <= last.x; x++) {
+					near[x + bricks * (y + bricks * z)] = 1;
+				}
+			}
+		}
+	}
+
+	// Bricked fields are padded to whole bricks; the padding is outside, like the rest of the margin
+	std::fill(out, out + fieldCellCount(layout, gridSize), -band);
+
+	// One job per layer of bricks
+	float limit = band / placement.scale;
+	limit *= limit;
+	std::atomic<size_t> nearPoints{ 0 };
+	std::atomic<size_t> done{ 0 };
+	for (size_t layer = 0; layer < bricks; layer++) {
+		pool.submit([&, layer] {
+			size_t looked = 0;
+			for (size_t brick = layer * bricks * bricks; brick < (layer + 1) * bricks * bricks; brick++) {
+				size_t bx = (brick % bricks) * FIELD_BRICK_SIZE;
+				size_t by = (brick / bricks % bricks) * FIELD_BRICK_SIZE;
+				size_t bz = layer * FIELD_BRICK_SIZE;
+
+				// Triangle bounds are loose for large or slanted triangles; a brick whose centre is further than band
+				// plus its half diagonal from the surface has no grid point within band
+				bool searched = near[brick] != 0;
+				if (searched) {
+					glm::vec3 centre = glm::vec3(static_cast<float>(bx), static_cast<float>(by), static_cast<float>(bz)) + BRICK_HALF;
+					float reach = (band + BRICK_HALF_DIAGONAL) / placement.scale;
+					searched = closestSquared(toModel(centre), reach * reach) < reach * reach;
+				}
+				for (size_t z = bz; z < std::min(bz + FIELD_BRICK_SIZE, n); z++) {
+					for (size_t y = by; y < std::min(by + FIELD_BRICK_SIZE, n); y++) {
+						// The distance changes by at most one cell from one grid point to the next, so the previous
+						// one bounds the search
+						float previous = band;
+						for (size_t x = bx; x < std::min(bx + FIELD_BRICK_SIZE, n); x++) {
+							float distance = band;
+							if (searched) {
+								glm::vec3 grid(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z));
+								float bound = (previous + 1.01f) / placement.scale;
+								distance = std::min(std::sqrt(closestSquared(toModel(grid), std::min(bound * bound, limit))) * placement.scale, band);
+								previous = distance;
+								looked++;
+							}
+							bool inside = votes[x + n * (y + n * z)] >= 2;
+							out[fieldIndex(layout, static_cast<uint32_t>(x), static_cast<uint32_t>(y), static_cast<uint32_t>(z), gridSize)] = inside ? distance : -distance;
+						}
+					}
+				}
+			}
+			nearPoints += looked;
+			done++;
+		});
+	}
+	pool.helpUntil([&] { return done.load() == bricks; });
+
+	VoxelizeStats stats;
+	stats.nearPoints = nearPoints.load();
+	stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "glm/glm.hpp"
+#include "FieldLayout.h"
+#include "TaskGraph.h"
+
+// Places a model in the grid: grid point = position * scale + offset
+struct VoxelPlacement {
+	glm::vec3 offset = glm::vec3(0.0f);
+	float scale = 1.0f;
+};
+
+struct VoxelizeStats {
+	size_t nearPoints = 0;   // grid points whose distance was looked up in the BVH
+	double ms = 0.0;
+};
+
+// The triangles of a model, turned into a signed distance field. .obj files are read with tiny_obj_loader, anything
+// else with assimp, every mesh of the scene in its node's transform. Faces are triangulated and all triangles kept in
+// one bounding volume hierarchy, split at the median centroid of the longest axis down to a few triangles per leaf.
+class MeshVoxelizer {
+
+public:
+
+	explicit MeshVoxelizer(const std::string& path);
+
+	size_t size() const { return triangles.size() / 3; }
+
+	glm::vec3 boundsMin() const { return low; }
+	glm::vec3 boundsMax() const { return high; }
+
+	// Fits the bounds into the grid with a uniform scale, leaving room for the band and one more empty grid point on
+	// every side so the surface closes
+	VoxelPlacement fit(int gridSize, float band) const;
+
+	// Writes the signed distance to the surface into out, fieldCellCount(layout, gridSize) floats, in grid cells and
+	// positive inside so the surface is the 0 iso-level; it is clamped to +-band. Inside is decided per grid point by
+	// the parity of the surface crossings along x, y and z, two of three votes winning, so models with small holes
+	// still fill. Only the 4x4x4 bricks within band of a triangle's bounds search the BVH for the closest point; the
+	// others are set to +-band from the votes. Rows and bricks are split over the pool.
+	VoxelizeStats voxelize(int gridSize, int layout, float band, ThreadPool& pool, float* out) const;
+
+private:
+
+	struct Node {
+		glm::vec3 low;
+		glm::vec3 high;
+		uint32_t first;   // first triangle of a leaf, or the first of an inner node's two children (the second follows it)
+		uint32_t count;   // triangles of a leaf, 0 for an inner node
+	};
+
+	static const uint32_t LEAF_TRIANGLES = 4;
+
+	std::vector<glm::vec3> triangles;   // three corners each, in BVH order
+	std::vector<Node> nodes;
+	glm::vec3 low = glm::vec3(0.0f);
+	glm::vec3 high = glm::vec3(0.0f);
+
+	void loadObj(const std::string& path);
+	void loadScene(const std::string& path);
+	void build();
+
+	// Squared distance from p to the closest triangle, if closer than sqrt(limit); limit otherwise
+	float closestSquared(const glm::vec3& p, float limit) const;
+
+	// Appends where the line through p along axis crosses triangles, as the coordinate along the axis
+	void crossings(const glm::vec3& p, int axis, std::vector<float>& out) const;
+
+};
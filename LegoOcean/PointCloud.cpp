@@ -0,0 +1,505 @@
+#include "PointCloud.h"
+#include "VolumeFile.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+	// Private grid tiles of the CPU splat, 16^3 grid points each
+	const int SPLAT_TILE = 16;
+	const int SPLAT_TILE_CELLS = SPLAT_TILE * SPLAT_TILE * SPLAT_TILE;
+
+	// Fewest points worth a job, so small clouds do not pay for a set of tiles per thread
+	const size_t SPLAT_MIN_JOB_POINTS = 1 << 16;
+
+	bool hostIsBigEndian() {
+		uint16_t probe = 1;
+		uint8_t first;
+		memcpy(&first, &probe, 1);
+		return first == 0;
+	}
+
+	std::string lowerExtension(const std::string& path) {
+		size_t dot = path.find_last_of('.');
+		size_t slash = path.find_last_of("/\\");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+			return std::string();
+		}
+		std::string extension = path.substr(dot + 1);
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return extension;
+	}
+
+	// Bytes of a PLY scalar type, 0 if unknown
+	size_t plyTypeSize(const std::string& type) {
+		if (type == "char" || type == "uchar" || type == "int8" || type == "uint8") return 1;
+		if (type == "short" || type == "ushort" || type == "int16" || type == "uint16") return 2;
+		if (type == "int" || type == "uint" || type == "int32" || type == "uint32" || type == "float" || type == "float32") return 4;
+		if (type == "double" || type == "float64") return 8;
+		return 0;
+	}
+
+	double readPlyValue(const uint8_t* bytes, const std::string& type, bool swap) {
+
+		uint8_t raw[8];
+		size_t size = plyTypeSize(type);
+		for (size_t i = 0; i < size; i++) {
+			raw[i] = bytes[swap ? size - 1 - i : i];
+		}
+
+		if (type == "float" || type == "float32") { float v; memcpy(&v, raw, 4); return v; }
+		if (type == "double" || type == "float64") { double v; memcpy(&v, raw, 8); return v; }
+		if (type == "char" || type == "int8") { int8_t v; memcpy(&v, raw, 1); return v; }
+		if (type == "uchar" || type == "uint8") { return raw[0]; }
+		if (type == "short" || type == "int16") { int16_t v; memcpy(&v, raw, 2); return v; }
+		if (type == "ushort" || type == "uint16") { uint16_t v; memcpy(&v, raw, 2); return v; }
+		if (type == "int" || type == "int32") { int32_t v; memcpy(&v, raw, 4); return v; }
+		uint32_t v;
+		memcpy(&v, raw, 4);
+		return v;
+
+	}
+
+	// Grid points one point spreads its weight over. Every kernel is separable, so the weight of grid point
+	// low + (i, j, k) is weights[0][i] * weights[1][j] * weights[2][k]; the gaussian also drops the grid points whose
+	// squared distances add up to more than radius^2.
+	struct Footprint {
+		glm::ivec3 low = glm::ivec3(0);
+		glm::ivec3 count = glm::ivec3(0);
+		float weights[3][2 * SPLAT_MAX_RADIUS + 1];
+		float distances[3][2 * SPLAT_MAX_RADIUS + 1];
+	};
+
+	void pointFootprint(const SplatSettings& settings, glm::vec3 g, Footprint& footprint) {
+
+		for (int axis = 0; axis < 3; axis++) {
+			float* weights = footprint.weights[axis];
+
+			if (settings.kernel == SPLAT_NEAREST) {
+				footprint.low[axis] = static_cast<int>(std::floor(g[axis] + 0.5f));
+				footprint.count[axis] = 1;
+				weights[0] = 1.0f;
+			}
+			else if (settings.kernel == SPLAT_TRILINEAR) {
+				float base = std::floor(g[axis]);
+				float f = g[axis] - base;
+				footprint.low[axis] = static_cast<int>(base);
+				footprint.count[axis] = 2;
+				weights[0] = 1.0f - f;
+				weights[1] = f;
+			}
+			else {
+				// exp(-d^2 / 2 sigma^2) with sigma = radius / 2 factors into one exponential per axis
+				float falloff = 2.0f / (settings.radius * settings.radius);
+				int low = static_cast<int>(std::ceil(g[axis] - settings.radius));
+				int high = static_cast<int>(std::floor(g[axis] + settings.radius));
+				footprint.low[axis] = low;
+				footprint.count[axis] = high - low + 1;
+				for (int i = 0; i < footprint.count[axis]; i++) {
+					float d = static_cast<float>(low + i) - g[axis];
+					weights[i] = std::exp(-d * d * falloff);
+					footprint.distances[axis][i] = d * d;
+				}
+			}
+		}
+
+	}
+
+	// Calls add(x, y, z, weight) for every grid point of the footprint inside a gridSize^3 grid
+	template <typename Add>
+	void splatFootprintPoints(const SplatSettings& settings, const Footprint& footprint, int gridSize, Add add) {
+
+		bool gaussian = settings.kernel == SPLAT_GAUSSIAN;
+		float limit = settings.radius * settings.radius;
+
+		for (int k = 0; k < footprint.count.z; k++) {
+			int z = footprint.low.z + k;
+			if (static_cast<unsigned>(z) >= static_cast<unsigned>(gridSize)) {
+				continue;
+			}
+			for (int j = 0; j < footprint.count.y; j++) {
+				int y = footprint.low.y + j;
+				if (static_cast<unsigned>(y) >= static_cast<unsigned>(gridSize)) {
+					continue;
+				}
+				float weightYZ = footprint.weights[1][j] * footprint.weights[2][k];
+				float distanceYZ = gaussian ? footprint.distances[1][j] + footprint.distances[2][k] : 0.0f;
+				for (int i = 0; i < footprint.count.x; i++) {
+					int x = footprint.low.x + i;
+					if (static_cast<unsigned>(x) >= static_cast<unsigned>(gridSize) || (gaussian && distanceYZ + footprint.distances[0][i] > limit)) {
+						continue;
+					}
+					add(x, y, z, weightYZ * footprint.weights[0][i]);
+				}
+			}
+		}
+
+	}
+
+}
+
+float splatFootprint(const SplatSettings& settings) {
+
+	switch (settings.kernel) {
+	case SPLAT_NEAREST: return 0.5f;
+	case SPLAT_TRILINEAR: return 1.0f;
+	default: return settings.radius;
+	}
+
+}
+
+PointCloud::PointCloud(const std::string& path) {
+
+	MappedFile file(path);
+	std::string extension = lowerExtension(path);
+
+	if (file.size() >= 4 && memcmp(file.data(), "ply", 3) == 0 && (file.data()[3] == '\n' || file.data()[3] == '\r')) {
+		readPly(file.data(), file.size());
+	}
+	else if (extension == "xyz" || extension == "txt" || extension == "pts" || extension == "csv") {
+		readText(file.data(), file.size());
+	}
+	else {
+		readRaw(file.data(), file.size());
+	}
+
+	if (positions.empty()) {
+		throw std::runtime_error("No points in " + path + "\n");
+	}
+
+	low = glm::vec3(std::numeric_limits<float>::max());
+	high = glm::vec3(-std::numeric_limits<float>::max());
+	for (size_t i = 0; i < positions.size(); i += 3) {
+		glm::vec3 p = glm::vec3(positions[i], positions[i + 1], positions[i + 2]);
+		low = glm::min(low, p);
+		high = glm::max(high, p);
+	}
+
+}
+
+void PointCloud::readPly(const uint8_t* bytes, size_t size) {
+
+	const char* text = reinterpret_cast<const char*>(bytes);
+	const char* headerEnd = nullptr;
+	for (const char* marker = text; (marker = static_cast<const char*>(memchr(marker, 'e', size - (marker - text)))) != nullptr; marker++) {
+		if (static_cast<size_t>(text + size - marker) >= 10 && memcmp(marker, "end_header", 10) == 0 && (marker == text || marker[-1] == '\n')) {
+			headerEnd = marker + 10;
+			break;
+		}
+	}
+	if (headerEnd == nullptr) {
+		throw std::runtime_error("PLY header has no end_header\n");
+	}
+	// The body starts after the line break that ends the header
+	const char* body = static_cast<const char*>(memchr(headerEnd, '\n', size - (headerEnd - text)));
+	if (body == nullptr) {
+		throw std::runtime_error("PLY file ends in its header\n");
+	}
+	body++;
+
+	struct Property {
+		std::string name;
+		std::string type;
+		bool list = false;
+	};
+	struct Element {
+		std::string name;
+		size_t count = 0;
+		std::vector<Property> properties;
+	};
+
+	std::string format;
+	std::vector<Element> elements;
+	std::istringstream header(std::string(text, headerEnd));
+	std::string line;
+	while (std::getline(header, line)) {
+		std::istringstream words(line);
+		std::string keyword;
+		words >> keyword;
+		if (keyword == "format") {
+			words >> format;
+		}
+		else if (keyword == "element") {
+			Element element;
+			words >> element.name >> element.count;
+			elements.push_back(element);
+		}
+		else if (keyword == "property" && !elements.empty()) {
+			Property property;
+			words >> property.type;
+			if (property.type == "list") {
+				std::string countType;
+				property.list = true;
+				words >> countType >> property.type;
+			}
+			words >> property.name;
+			elements.back().properties.push_back(property);
+		}
+	}
+
+	bool ascii = format == "ascii";
+	if (!ascii && format != "binary_little_endian" && format != "binary_big_endian") {
+		throw std::runtime_error("Unsupported PLY format " + format + "\n");
+	}
+	bool swap = !ascii && (format == "binary_big_endian") != hostIsBigEndian();
+
+	const uint8_t* end = bytes + size;
+	const uint8_t* cursor = reinterpret_cast<const uint8_t*>(body);
+
+	for (const Element& element : elements) {
+
+		// Fixed-size records can be skipped without parsing them; lists only in ascii, a line per record
+		size_t recordSize = 0;
+		bool hasList = false;
+		int axis[3] = { -1, -1, -1 };
+		std::vector<size_t> offsets;
+		for (size_t i = 0; i < element.properties.size(); i++) {
+			const Property& property = element.properties[i];
+			offsets.push_back(recordSize);
+			hasList = hasList || property.list;
+			recordSize += plyTypeSize(property.type);
+			if (plyTypeSize(property.type) == 0) {
+				throw std::runtime_error("Unknown PLY property type " + property.type + "\n");
+			}
+			for (int a = 0; a < 3; a++) {
+				if (!property.list && property.name == std::string(1, static_cast<char>('x' + a))) {
+					axis[a] = static_cast<int>(i);
+				}
+			}
+		}
+
+		bool vertices = element.name == "vertex";
+		if (vertices && (axis[0] < 0 || axis[1] < 0 || axis[2] < 0)) {
+			throw std::runtime_error("PLY vertex element has no x, y and z\n");
+		}
+
+		if (ascii) {
+			if (vertices && hasList) {
+				throw std::runtime_error("PLY vertex element with list properties\n");
+			}
+			if (vertices) {
+				positions.resize(element.count * 3);
+			}
+			for (size_t record = 0; record < element.count; record++) {
+				const uint8_t* lineEnd = static_cast<const uint8_t*>(memchr(cursor, '\n', end - cursor));
+				lineEnd = lineEnd ? lineEnd : end;
+				if (vertices) {
+					const char* field = reinterpret_cast<const char*>(cursor);
+					const char* fieldEnd = reinterpret_cast<const char*>(lineEnd);
+					for (int i = 0; i <= std::max(axis[0], std::max(axis[1], axis[2])); i++) {
+						while (field < fieldEnd && (*field == ' ' || *field == '\t')) {
+							field++;
+						}
+						double value = 0.0;
+						auto result = std::from_chars(field, fieldEnd, value);
+						if (result.ec != std::errc()) {
+							throw std::runtime_error("Malformed PLY vertex\n");
+						}
+						field = result.ptr;
+						for (int a = 0; a < 3; a++) {
+							if (axis[a] == i) {
+								positions[record * 3 + a] = static_cast<float>(value);
+							}
+						}
+					}
+				}
+				if (lineEnd == end && record + 1 < element.count) {
+					throw std::runtime_error("PLY file ends early\n");
+				}
+				cursor = lineEnd == end ? end : lineEnd + 1;
+			}
+		}
+		else {
+			if (hasList) {
+				if (vertices) {
+					throw std::runtime_error("PLY vertex element with list properties\n");
+				}
+				// Faces and the like follow the vertices in practice, and nothing after them is needed
+				break;
+			}
+			if (static_cast<size_t>(end - cursor) / recordSize < element.count) {
+				throw std::runtime_error("PLY file ends early\n");
+			}
+			if (vertices) {
+				positions.resize(element.count * 3);
+				const Property* properties = element.properties.data();
+				bool packedFloats = !swap && properties[axis[0]].type == "float" && properties[axis[1]].type == "float" && properties[axis[2]].type == "float"
+					&& offsets[axis[1]] == offsets[axis[0]] + 4 && offsets[axis[2]] == offsets[axis[0]] + 8;
+				for (size_t record = 0; record < element.count; record++) {
+					const uint8_t* source = cursor + record * recordSize;
+					if (packedFloats) {
+						memcpy(&positions[record * 3], source + offsets[axis[0]], sizeof(float) * 3);
+						continue;
+					}
+					for (int a = 0; a < 3; a++) {
+						positions[record * 3 + a] = static_cast<float>(readPlyValue(source + offsets[axis[a]], properties[axis[a]].type, swap));
+					}
+				}
+			}
+			cursor += recordSize * element.count;
+		}
+
+		if (vertices) {
+			return;
+		}
+
+	}
+
+	throw std::runtime_error("PLY file has no vertex element\n");
+
+}
+
+void PointCloud::readText(const uint8_t* bytes, size_t size) {
+
+	const char* cursor = reinterpret_cast<const char*>(bytes);
+	const char* end = cursor + size;
+
+	while (cursor < end) {
+
+		const char* lineEnd = static_cast<const char*>(memchr(cursor, '\n', end - cursor));
+		lineEnd = lineEnd ? lineEnd : end;
+
+		// Lines with fewer than three leading numbers, like comments or the point count of .pts, are skipped
+		float values[3];
+		int found = 0;
+		const char* field = cursor;
+		while (found < 3) {
+			while (field < lineEnd && (*field == ' ' || *field == '\t' || *field == ',' || *field == ';' || *field == '\r')) {
+				field++;
+			}
+			auto result = std::from_chars(field, lineEnd, values[found]);
+			if (result.ec != std::errc()) {
+				break;
+			}
+			field = result.ptr;
+			found++;
+		}
+		if (found == 3) {
+			positions.insert(positions.end(), values, values + 3);
+		}
+
+		cursor = lineEnd + 1;
+	}
+
+}
+
+void PointCloud::readRaw(const uint8_t* bytes, size_t size) {
+
+	positions.resize(size / (sizeof(float) * 3) * 3);
+	memcpy(positions.data(), bytes, sizeof(float) * positions.size());
+
+	if (hostIsBigEndian()) {
+		for (float& value : positions) {
+			uint8_t raw[4];
+			memcpy(raw, &value, 4);
+			std::reverse(raw, raw + 4);
+			memcpy(&value, raw, 4);
+		}
+	}
+
+}
+
+SplatPlacement PointCloud::fit(int gridSize, const SplatSettings& settings) const {
+
+	glm::vec3 extent = high - low;
+	float largest = std::max(extent.x, std::max(extent.y, extent.z));
+	float margin = splatFootprint(settings) + 1.0f;
+	float room = std::max(static_cast<float>(gridSize - 1) - 2.0f * margin, 1.0f);
+
+	SplatPlacement placement;
+	placement.scale = largest > 0.0f ? room / largest : 1.0f;
+	placement.offset = glm::vec3(static_cast<float>(gridSize - 1) * 0.5f) - (low + high) * 0.5f * placement.scale;
+	return placement;
+
+}
+
+void PointCloud::splat(const SplatSettings& settings, int gridSize, int layout, ThreadPool& pool, float* out) const {
+
+	SplatPlacement placement = fit(gridSize, settings);
+
+	// Bricked fields are padded to whole bricks; the padding is written as 0 along with the rest
+	int paddedSize = layout == FIELD_LAYOUT_BRICKED ? static_cast<int>(fieldBricksPerAxis(gridSize) * FIELD_BRICK_SIZE) : gridSize;
+	int tilesPerAxis = (paddedSize + SPLAT_TILE - 1) / SPLAT_TILE;
+	size_t tileCount = (size_t)tilesPerAxis * tilesPerAxis * tilesPerAxis;
+
+	size_t numPoints = size();
+	size_t numJobs = std::max<size_t>(std::min<size_t>(pool.size() + 1, numPoints / SPLAT_MIN_JOB_POINTS), 1);
+	std::vector<std::vector<std::unique_ptr<float[]>>> tiles(numJobs);
+
+	std::atomic<size_t> done{ 0 };
+	for (size_t job = 0; job < numJobs; job++) {
+		pool.submit([&, job] {
+			std::vector<std::unique_ptr<float[]>>& own = tiles[job];
+			own.resize(tileCount);
+
+			// Neighbouring grid points mostly share a tile, so the last one is kept at hand
+			size_t lastTile = tileCount;
+			float* cells = nullptr;
+			auto add = [&](int x, int y, int z, float weight) {
+				// Only called for grid points inside the grid, so the coordinates are not negative
+				unsigned ux = x, uy = y, uz = z;
+				size_t tile = (ux / SPLAT_TILE) + tilesPerAxis * ((uy / SPLAT_TILE) + (size_t)tilesPerAxis * (uz / SPLAT_TILE));
+				if (tile != lastTile) {
+					if (!own[tile]) {
+						own[tile].reset(new float[SPLAT_TILE_CELLS]());
+					}
+					lastTile = tile;
+					cells = own[tile].get();
+				}
+				cells[(ux % SPLAT_TILE) + SPLAT_TILE * ((uy % SPLAT_TILE) + SPLAT_TILE * (uz % SPLAT_TILE))] += weight;
+			};
+
+			Footprint footprint;
+			for (size_t i = numPoints * job / numJobs; i < numPoints * (job + 1) / numJobs; i++) {
+				glm::vec3 p = glm::vec3(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+				pointFootprint(settings, p * placement.scale + placement.offset, footprint);
+				splatFootprintPoints(settings, footprint, gridSize, add);
+			}
+			done++;
+		});
+	}
+	pool.helpUntil([&] { return done.load() == numJobs; });
+
+	// Reduction: every tile sums the copies the jobs touched into out
+	size_t numReductions = std::min(tileCount, (size_t)(pool.size() + 1) * 4);
+	done = 0;
+	for (size_t reduction = 0; reduction < numReductions; reduction++) {
+		pool.submit([&, reduction] {
+			for (size_t tile = tileCount * reduction / numReductions; tile < tileCount * (reduction + 1) / numReductions; tile++) {
+				int tx = static_cast<int>(tile % tilesPerAxis) * SPLAT_TILE;
+				int ty = static_cast<int>(tile / tilesPerAxis % tilesPerAxis) * SPLAT_TILE;
+				int tz = static_cast<int>(tile / tilesPerAxis / tilesPerAxis) * SPLAT_TILE;
+
+				std::vector<const float*> copies;
+				for (const auto& own : tiles) {
+					if (own[tile]) {
+						copies.push_back(own[tile].get());
+					}
+				}
+
+				for (int z = tz; z < std::min(tz + SPLAT_TILE, paddedSize); z++) {
+					for (int y = ty; y < std::min(ty + SPLAT_TILE, paddedSize); y++) {
+						for (int x = tx; x < std::min(tx + SPLAT_TILE, paddedSize); x++) {
+							int cell = (x - tx) + SPLAT_TILE * ((y - ty) + SPLAT_TILE * (z - tz));
+							float sum = 0.0f;
+							for (const float* copy : copies) {
+								sum += copy[cell];
+							}
+							out[fieldIndex(layout, x, y, z, gridSize)] = sum;
+						}
+					}
+				}
+			}
+			done++;
+		});
+	}
+	pool.helpUntil([&] { return done.load() == numReductions; });
+
+}
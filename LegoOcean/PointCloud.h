@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "glm/glm.hpp"
+#include "FieldLayout.h"
+#include "TaskGraph.h"
+
+// How every point spreads its unit weight over the grid points around it
+enum SplatKernel {
+	SPLAT_NEAREST = 0,    // all of it on the closest grid point
+	SPLAT_TRILINEAR = 1,  // over the 8 corners of the cell it falls in
+	SPLAT_GAUSSIAN = 2    // exp(-d^2 / 2 sigma^2) on every grid point within radius, sigma = radius / 2
+};
+
+const int SPLAT_KERNEL_COUNT = 3;
+
+// Largest SPLAT_GAUSSIAN radius, in grid cells
+const int SPLAT_MAX_RADIUS = 8;
+
+// Weights are accumulated in fixed point on the GPU, SPLAT_FIXED_POINT units per point; splat.comp mirrors this
+const float SPLAT_FIXED_POINT = 256.0f;
+
+struct SplatSettings {
+	int kernel = SPLAT_TRILINEAR;
+	float radius = 2.0f;  // in grid cells, SPLAT_GAUSSIAN only; 0.5 to SPLAT_MAX_RADIUS
+};
+
+// Places a cloud in the grid: grid point = position * scale + offset
+struct SplatPlacement {
+	glm::vec3 offset = glm::vec3(0.0f);
+	float scale = 1.0f;
+};
+
+// Grid points from a point cloud's centre that a kernel can reach
+float splatFootprint(const SplatSettings& settings);
+
+// Positions of a point cloud, read through a memory map. The format is picked from the file:
+//  - PLY (ascii, binary_little_endian or binary_big_endian) with float or double x, y, z on the vertex element;
+//    other properties and elements are skipped
+//  - .xyz, .txt, .pts and .csv: text, the first three numbers of every line
+//  - anything else is a raw stream of little-endian float32 x, y, z triples
+class PointCloud {
+
+public:
+
+	explicit PointCloud(const std::string& path);
+
+	size_t size() const { return positions.size() / 3; }
+
+	// x, y, z of every point in turn, as uploaded for splat.comp
+	const std::vector<float>& data() const { return positions; }
+
+	glm::vec3 boundsMin() const { return low; }
+	glm::vec3 boundsMax() const { return high; }
+
+	// Fits the bounds into the grid with a uniform scale, leaving room for the kernel and one more empty grid point on
+	// every side so the surface closes
+	SplatPlacement fit(int gridSize, const SplatSettings& settings) const;
+
+	// Splats every point into out, fieldCellCount(layout, gridSize) floats; the value of a grid point is the sum of
+	// the weights it received. The points are split over the pool, each job adding into private tiles of the grid
+	// that it allocates on first touch, then every tile's copies are summed into out, the tiles in parallel.
+	void splat(const SplatSettings& settings, int gridSize, int layout, ThreadPool& pool, float* out) const;
+
+private:
+
+	std::vector<float> positions;
+	glm::vec3 low = glm::vec3(0.0f);
+	glm::vec3 high = glm::vec3(0.0f);
+
+	void readPly(const uint8_t* bytes, size_t size);
+	void readText(const uint8_t* bytes, size_t size);
+	void readRaw(const uint8_t* bytes, size_t size);
+
+};
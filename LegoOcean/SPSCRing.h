@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+
+// Lock-free single producer / single consumer ring of preallocated slots.
+// The producer fills the slot returned by beginWrite() in place and publishes it with commitWrite();
+// the consumer reads front() and releases it with pop(). No slot is ever touched by both threads at once.
+template <typename T, size_t Capacity>
+class SPSCRing {
+
+	static_assert((Capacity & (Capacity - 1)) == 0, "SPSCRing capacity must be a power of two");
+
+public:
+
+	std::array<T, Capacity> slots;
+
+	// Producer side: the next free slot, or nullptr when the consumer has not caught up yet
+	T* beginWrite() {
+		size_t head = writeIndex.load(std::memory_order_relaxed);
+		if (head - readIndex.load(std::memory_order_acquire) == Capacity) {
+			return nullptr;
+		}
+		return &slots[head & (Capacity - 1)];
+	}
+
+	void commitWrite() {
+		writeIndex.store(writeIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Consumer side
+	size_t size() const {
+		return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_relaxed);
+	}
+
+	T* front() {
+		if (size() == 0) {
+			return nullptr;
+		}
+		return &slots[readIndex.load(std::memory_order_relaxed) & (Capacity - 1)];
+	}
+
+	void pop() {
+		readIndex.store(readIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Drops every completed slot except the newest one and returns it (nullptr when empty)
+	T* latest() {
+		size_t available = size();
+		if (available == 0) {
+			return nullptr;
+		}
+		readIndex.store(readIndex.load(std::memory_order_relaxed) + available - 1, std::memory_order_release);
+		return front();
+	}
+
+private:
+
+	alignas(64) std::atomic<size_t> writeIndex{ 0 };
+	alignas(64) std::atomic<size_t> readIndex{ 0 };
+
+};
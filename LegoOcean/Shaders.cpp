@@ -5,41 +5,52 @@ Shader::Shader() {
 
 }
 
-Shader::Shader(const std::string ShaderName, VkDevice device) {
+Shader::Shader(const std::string ShaderName, VkDevice device) : Shader(ShaderName, device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT) {
 
-    vertexShaderSource = readFile("./Shaders/" + ShaderName + "_vert.spv");
-    fragmentShaderSource = readFile("./Shaders/" + ShaderName + "_frag.spv");
-    computeShaderSource = readFile("./Shaders/" + ShaderName + "_comp.spv");
+}
 
-    vertexShader = createShaderModule(vertexShaderSource, device, ShaderName);
-    fragmentShader = createShaderModule(fragmentShaderSource, device, ShaderName);
-    computeShader = createShaderModule(computeShaderSource, device, ShaderName);
+Shader::Shader(const std::string ShaderName, VkDevice device, VkShaderStageFlags stages) {
 
     this->device = device;
 
-    VkPipelineShaderStageCreateInfo vshaderInfo{};
-    vshaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vshaderInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vshaderInfo.module = vertexShader;
-    vshaderInfo.pName = "main";
+    if (stages & VK_SHADER_STAGE_VERTEX_BIT) {
+        vertexShaderSource = readFile("./Shaders/" + ShaderName + "_vert.spv");
+        vertexShader = createShaderModule(vertexShaderSource, device, ShaderName);
 
-    shaderStageInfos.push_back(vshaderInfo);
-    
-    VkPipelineShaderStageCreateInfo fshaderInfo{};
-    fshaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fshaderInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fshaderInfo.module = fragmentShader;
-    fshaderInfo.pName = "main";
+        VkPipelineShaderStageCreateInfo vshaderInfo{};
+        vshaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        vshaderInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        vshaderInfo.module = vertexShader;
+        vshaderInfo.pName = "main";
 
-    shaderStageInfos.push_back(fshaderInfo);
+        shaderStageInfos.push_back(vshaderInfo);
+    }
 
-    VkPipelineShaderStageCreateInfo cshaderInfo{};
-    cshaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    cshaderInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-    cshaderInfo.module = computeShader;
-    cshaderInfo.pName = "main";
+    if (stages & VK_SHADER_STAGE_FRAGMENT_BIT) {
+        fragmentShaderSource = readFile("./Shaders/" + ShaderName + "_frag.spv");
+        fragmentShader = createShaderModule(fragmentShaderSource, device, ShaderName);
 
-    computeShaderStageInfo = cshaderInfo;
+        VkPipelineShaderStageCreateInfo fshaderInfo{};
+        fshaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        fshaderInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        fshaderInfo.module = fragmentShader;
+        fshaderInfo.pName = "main";
+
+        shaderStageInfos.push_back(fshaderInfo);
+    }
+
+    if (stages & VK_SHADER_STAGE_COMPUTE_BIT) {
+        computeShaderSource = readFile("./Shaders/" + ShaderName + "_comp.spv");
+        computeShader = createShaderModule(computeShaderSource, device, ShaderName);
+
+        VkPipelineShaderStageCreateInfo cshaderInfo{};
+        cshaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        cshaderInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        cshaderInfo.module = computeShader;
+        cshaderInfo.pName = "main";
+
+        computeShaderStageInfo = cshaderInfo;
+    }
 
 }
 
@@ -55,8 +66,9 @@ std::vector<char> Shader::readFile(const std::string& filename) {
 
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
+    // The .spv files are built from the GLSL sources by Shaders/compile.bat, which the pre-build event runs
     if (!file.is_open()) {
-        throw std::runtime_error("failed to open file!");
+        throw std::runtime_error("failed to open file " + filename + ", run Shaders/compile.bat to build it\n");
     }
 
     size_t fileSize = (size_t)file.tellg();
@@ -12,14 +12,16 @@ public:
 	std::vector<VkPipelineShaderStageCreateInfo> shaderStageInfos;
 	VkPipelineShaderStageCreateInfo computeShaderStageInfo;
 
-	VkShaderModule vertexShader;
-	VkShaderModule fragmentShader;
-	VkShaderModule computeShader;
+	VkShaderModule vertexShader = VK_NULL_HANDLE;
+	VkShaderModule fragmentShader = VK_NULL_HANDLE;
+	VkShaderModule computeShader = VK_NULL_HANDLE;
 
 	VkDevice device;
 
 	Shader();
 	Shader(const std::string ShaderName, VkDevice device);
+	// Loads only the given stages, e.g. VK_SHADER_STAGE_COMPUTE_BIT for a compute-only shader
+	Shader(const std::string ShaderName, VkDevice device, VkShaderStageFlags stages);
 	~Shader();
 	static std::vector<char> readFile(const std::string& filename);
 	VkShaderModule createShaderModule(std::vector<char> code, VkDevice device, std::string ShaderName);
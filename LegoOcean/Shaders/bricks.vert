@@ -0,0 +1,73 @@
+#version 450
+
+// Brick render mode: one instance per brick from bricks.comp, 36 vertices of a cube each. Faces buried against a
+// neighbour or facing away from the camera collapse to a point, so only the visible ones are rasterized.
+layout(location = 0) in uvec2 inBrick; // x | y << 16, z | open faces << 16
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec3 worldPos;
+layout(location = 2) out vec3 normal;
+
+layout(binding=0) uniform Transform {
+    mat4 M;
+    mat4 V;
+    mat4 P;
+    vec4 meshBounds;
+    vec4 eye;
+    int wave;
+    int isoStreamVertices;
+} transform;
+
+// Spacing of the grid points in mesh position space, as in shader.comp
+const float voxel_size = 10.0;
+
+// Two triangles per face, faces in the order -x, +x, -y, +y, -z, +z of the face mask
+const vec3 faceNormals[6] = vec3[](
+    vec3(-1.0, 0.0, 0.0), vec3(1.0, 0.0, 0.0),
+    vec3(0.0, -1.0, 0.0), vec3(0.0, 1.0, 0.0),
+    vec3(0.0, 0.0, -1.0), vec3(0.0, 0.0, 1.0)
+);
+
+// Corners of a face's quad in the two axes across it, as two triangles
+const vec2 quadCorners[6] = vec2[](
+    vec2(-0.5, -0.5), vec2(0.5, -0.5), vec2(0.5, 0.5),
+    vec2(-0.5, -0.5), vec2(0.5, 0.5), vec2(-0.5, 0.5)
+);
+
+// A few classic brick colours, picked per brick
+const vec3 brickColors[6] = vec3[](
+    vec3(0.79, 0.10, 0.09),
+    vec3(0.05, 0.34, 0.66),
+    vec3(0.98, 0.78, 0.04),
+    vec3(0.14, 0.48, 0.20),
+    vec3(0.95, 0.95, 0.93),
+    vec3(0.33, 0.35, 0.36)
+);
+
+void main() {
+    uvec3 cell = uvec3(inBrick.x & 0xffffu, inBrick.x >> 16, inBrick.y & 0xffffu);
+    uint faces = inBrick.y >> 16;
+
+    int face = gl_VertexIndex / 6;
+    vec3 n = faceNormals[face];
+    vec3 centre = transform.meshBounds.xyz + vec3(cell) * voxel_size;
+
+    // Back faces are dropped here rather than by the rasterizer, which does not know the cube's winding
+    bool visible = (faces & (1u << face)) != 0u && dot(n, transform.eye.xyz - (centre + n * (0.5 * voxel_size))) > 0.0;
+    if (!visible) {
+        gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+        return;
+    }
+
+    // The two axes across the face
+    int axis = face / 2;
+    vec3 u = axis == 0 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+    vec3 v = axis == 2 ? vec3(0.0, 1.0, 0.0) : vec3(0.0, 0.0, 1.0);
+    vec2 corner = quadCorners[gl_VertexIndex % 6];
+    vec3 position = centre + (n * 0.5 + u * corner.x + v * corner.y) * voxel_size;
+
+    gl_Position = transform.P * transform.V * transform.M * vec4(position, 1.0);
+    worldPos = (transform.M * vec4(position, 1.0)).xyz;
+    normal = n;
+    fragColor = brickColors[(cell.x * 7u + cell.y * 13u + cell.z * 31u) % 6u];
+}
@@ -1,4 +1,25 @@
-C:\VulkanSDK\1.3.275.0\Bin\glslc.exe .\Shaders\shader.vert -o .\Shaders\shader_vert.spv
-C:\VulkanSDK\1.3.275.0\Bin\glslc.exe .\Shaders\shader.frag -o .\Shaders\shader_frag.spv
-C:\VulkanSDK\1.3.275.0\Bin\glslc.exe .\Shaders\shader.comp -o .\Shaders\shader_comp.spv
-pause
\ No newline at end of file
+@echo off
+rem Compiles every shader to the SPIR-V the app loads; the pre-build event runs it, so the binaries always match the
+rem sources. Fails the build when glslc is missing or a shader does not compile, rather than leaving stale binaries.
+
+set GLSLC=%VULKAN_SDK%\Bin\glslc.exe
+if not exist "%GLSLC%" set GLSLC=C:\VulkanSDK\1.3.275.0\Bin\glslc.exe
+if not exist "%GLSLC%" (
+	echo compile.bat: glslc.exe not found, install the Vulkan SDK or set VULKAN_SDK
+	exit /b 1
+)
+
+cd /d "%~dp0"
+
+"%GLSLC%" shader.vert -o shader_vert.spv || exit /b 1
+"%GLSLC%" shader.frag -o shader_frag.spv || exit /b 1
+"%GLSLC%" shader.comp -o shader_comp.spv || exit /b 1
+"%GLSLC%" hiz.comp -o hiz_comp.spv || exit /b 1
+"%GLSLC%" cull.comp -o cull_comp.spv || exit /b 1
+"%GLSLC%" bricks.vert -o bricks_vert.spv || exit /b 1
+"%GLSLC%" bricks.comp -o bricks_comp.spv || exit /b 1
+"%GLSLC%" raymarch.vert -o raymarch_vert.spv || exit /b 1
+"%GLSLC%" raymarch.frag -o raymarch_frag.spv || exit /b 1
+"%GLSLC%" raymarch.comp -o raymarch_comp.spv || exit /b 1
+"%GLSLC%" splat.comp -o splat_comp.spv || exit /b 1
+"%GLSLC%" splat_resolve.comp -o splat_resolve_comp.spv || exit /b 1
@@ -0,0 +1,30 @@
+// GPU side of FieldLayout.h. Both copies must produce the same indices.
+
+const int FIELD_LAYOUT_LINEAR = 0;
+const int FIELD_LAYOUT_BRICKED = 1;
+
+uint mortonPart1By2( uint v )
+{
+	v &= 0x000003ffu;
+	v = (v | (v << 16)) & 0x030000ffu;
+	v = (v | (v << 8)) & 0x0300f00fu;
+	v = (v | (v << 4)) & 0x030c30c3u;
+	v = (v | (v << 2)) & 0x09249249u;
+	return v;
+}
+
+uint mortonEncode( uvec3 p )
+{
+	return mortonPart1By2(p.x) | (mortonPart1By2(p.y) << 1) | (mortonPart1By2(p.z) << 2);
+}
+
+uint fieldIndex( int layout, uvec3 p, uint gridSize )
+{
+	if( layout == FIELD_LAYOUT_BRICKED )
+	{
+		uint bricks = (gridSize + 3u) / 4u;
+		uvec3 b = p >> 2;
+		return (b.x + bricks * (b.y + bricks * b.z)) * 64u + mortonEncode(p & 3u);
+	}
+	return p.x + gridSize * (p.y + gridSize * p.z);
+}
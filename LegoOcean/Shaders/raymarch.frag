@@ -0,0 +1,189 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "field_layout.glsl"
+
+// Ray-march render mode: finds the first crossing of the first iso-level along the pixel's ray straight from the
+// field buffer, without a mesh. The field is interpolated trilinearly between grid points, which is the surface
+// marching cubes approximates. The ray walks the 4x4x4 field bricks and only samples those whose value range
+// (raymarch.comp) contains the iso-value. Shaded like shader.frag, with the normal from central differences.
+layout(location = 0) noperspective in vec4 farPoint;
+
+layout(location = 0) out vec4 outColor;
+
+layout(set = 0, binding = 0) uniform Transform {
+    mat4 M;
+    mat4 V;
+    mat4 P;
+    vec4 meshBounds;
+    vec4 eye;
+    int wave;
+    int isoStreamVertices;
+} transform;
+
+// Same push constants as shader.comp
+layout(push_constant) uniform PushConstants {
+    float deltaTime;
+    int firstTime;
+    int fieldMode;
+    float meshExtent;
+    int gridSize;
+    int fieldLayout;
+    int isoLevelCount;
+    float isoLevels[4]; // MAX_ISO_LEVELS
+} ubo;
+
+layout(std430, set = 1, binding = 0) readonly buffer Field {
+    float data[ ];
+};
+
+layout(std430, set = 1, binding = 5) readonly buffer FieldRanges {
+    vec2 ranges[ ];
+};
+
+// Spacing of the grid points in mesh position space, as in shader.comp
+const float voxel_size = 10.0;
+
+// Sample spacing inside a brick, in cells
+const float marchStep = 0.25;
+
+vec3 lightPos = vec3(-10, 10, 40);
+
+float fieldAt(ivec3 p) {
+    return data[fieldIndex(ubo.fieldLayout, uvec3(p), uint(ubo.gridSize))];
+}
+
+// Trilinear field value at g, in grid point units
+float sampleField(vec3 g) {
+    g = clamp(g, vec3(0.0), vec3(float(ubo.gridSize - 1)));
+    ivec3 cell = min(ivec3(floor(g)), ivec3(ubo.gridSize - 2));
+    vec3 f = g - vec3(cell);
+
+    float c00 = mix(fieldAt(cell), fieldAt(cell + ivec3(1, 0, 0)), f.x);
+    float c10 = mix(fieldAt(cell + ivec3(0, 1, 0)), fieldAt(cell + ivec3(1, 1, 0)), f.x);
+    float c01 = mix(fieldAt(cell + ivec3(0, 0, 1)), fieldAt(cell + ivec3(1, 0, 1)), f.x);
+    float c11 = mix(fieldAt(cell + ivec3(0, 1, 1)), fieldAt(cell + ivec3(1, 1, 1)), f.x);
+    return mix(mix(c00, c10, f.y), mix(c01, c11, f.y), f.z);
+}
+
+// Ray parameter of the first crossing in [t, tEnd], or a negative value when there is none
+float marchBrick(vec3 origin, vec3 dir, float t, float tEnd, float iso) {
+    float value = sampleField(origin + dir * t) - iso;
+    while (t < tEnd) {
+        float tNext = min(t + marchStep, tEnd);
+        float next = sampleField(origin + dir * tNext) - iso;
+        if ((value > 0.0) != (next > 0.0)) {
+            // Refine between the two samples by regula falsi
+            float a = t;
+            float b = tNext;
+            float va = value;
+            float vb = next;
+            for (int i = 0; i < 4; i++) {
+                float m = a + (b - a) * va / (va - vb);
+                float vm = sampleField(origin + dir * m) - iso;
+                if ((vm > 0.0) == (va > 0.0)) {
+                    a = m;
+                    va = vm;
+                }
+                else {
+                    b = m;
+                    vb = vm;
+                }
+            }
+            return a + (b - a) * va / (va - vb);
+        }
+        t = tNext;
+        value = next;
+    }
+    return -1.0;
+}
+
+void main() {
+    float iso = ubo.isoLevels[0];
+    int size = ubo.gridSize;
+    int bricks = (size + 3) / 4;
+
+    // Ray in grid point units; mesh positions are meshBounds.xyz + grid point * voxel_size
+    vec3 origin = (transform.eye.xyz - transform.meshBounds.xyz) / voxel_size;
+    vec3 dir = normalize(farPoint.xyz / farPoint.w - transform.eye.xyz);
+    // Keeps the reciprocals finite for axis-aligned rays
+    dir = mix(dir, vec3(1e-6), lessThan(abs(dir), vec3(1e-6)));
+    vec3 invDir = 1.0 / dir;
+
+    // Clip to the cells of the grid
+    vec3 t0 = -origin * invDir;
+    vec3 t1 = (vec3(float(size - 1)) - origin) * invDir;
+    vec3 tLow = min(t0, t1);
+    vec3 tHigh = max(t0, t1);
+    float t = max(max(max(tLow.x, tLow.y), tLow.z), 0.0);
+    float tFar = min(min(tHigh.x, tHigh.y), tHigh.z);
+    if (t >= tFar) {
+        discard;
+    }
+
+    // Walk the bricks along the ray with a 3D DDA
+    vec3 entry = origin + dir * t;
+    ivec3 brick = clamp(ivec3(floor(entry / 4.0)), ivec3(0), ivec3(bricks - 1));
+    ivec3 stepDir = ivec3(sign(dir));
+    vec3 tDelta = abs(4.0 * invDir);
+    vec3 tNext = ((vec3(brick) + max(vec3(stepDir), vec3(0.0))) * 4.0 - origin) * invDir;
+
+    float tHit = -1.0;
+    for (int i = 0; i < 3 * bricks + 3 && t < tFar; i++) {
+        float tExit = min(min(min(tNext.x, tNext.y), tNext.z), tFar);
+
+        vec2 range = ranges[brick.x + bricks * (brick.y + bricks * brick.z)];
+        if (range.x <= iso && range.y > iso) {
+            tHit = marchBrick(origin, dir, t, tExit, iso);
+            if (tHit >= 0.0) {
+                break;
+            }
+        }
+
+        t = tExit;
+        if (tNext.x <= tNext.y && tNext.x <= tNext.z) {
+            brick.x += stepDir.x;
+            tNext.x += tDelta.x;
+        }
+        else if (tNext.y <= tNext.z) {
+            brick.y += stepDir.y;
+            tNext.y += tDelta.y;
+        }
+        else {
+            brick.z += stepDir.z;
+            tNext.z += tDelta.z;
+        }
+        if (any(lessThan(brick, ivec3(0))) || any(greaterThanEqual(brick, ivec3(bricks)))) {
+            break;
+        }
+    }
+
+    if (tHit < 0.0) {
+        discard;
+    }
+
+    vec3 g = origin + dir * tHit;
+    vec3 position = transform.meshBounds.xyz + g * voxel_size;
+
+    // Points up the field like the mesh normals of shader.comp
+    const float h = 0.5;
+    vec3 gradient = vec3(
+        sampleField(g + vec3(h, 0.0, 0.0)) - sampleField(g - vec3(h, 0.0, 0.0)),
+        sampleField(g + vec3(0.0, h, 0.0)) - sampleField(g - vec3(0.0, h, 0.0)),
+        sampleField(g + vec3(0.0, 0.0, h)) - sampleField(g - vec3(0.0, 0.0, h)));
+    vec3 normal = length(gradient) > 0.0 ? normalize(gradient) : -dir;
+
+    vec3 worldPos = (transform.M * vec4(position, 1.0)).xyz;
+    vec4 clip = transform.P * transform.V * vec4(worldPos, 1.0);
+    gl_FragDepth = clip.z / clip.w;
+
+    // Colours of shader.vert for the first iso-level
+    vec3 color = vec3(0.0, 0.0, 1.0);
+    if (transform.wave > 0 && worldPos.y <= 45) {
+        color = vec3(1.0);
+    }
+
+    vec4 diffuse = max(0, dot(normal, normalize(lightPos - worldPos))) * vec4(color, 1.0);
+    vec4 ambient = 0.1 * vec4(color, 1.0);
+    outColor = ambient + diffuse;
+}
@@ -0,0 +1,22 @@
+#version 450
+
+// Ray-march render mode: one triangle covering the screen, no vertex buffers. Each corner carries the point on the
+// far plane it unprojects to, in mesh position space; the homogeneous point is affine in screen position, so it
+// interpolates exactly without perspective correction.
+layout(location = 0) noperspective out vec4 farPoint;
+
+layout(binding=0) uniform Transform {
+    mat4 M;
+    mat4 V;
+    mat4 P;
+    vec4 meshBounds;
+    vec4 eye;
+    int wave;
+    int isoStreamVertices;
+} transform;
+
+void main() {
+    vec2 ndc = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2) * 2.0 - 1.0;
+    farPoint = inverse(transform.P * transform.V * transform.M) * vec4(ndc, 1.0, 1.0);
+    gl_Position = vec4(ndc, 0.0, 1.0);
+}
@@ -1,91 +1,56 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
 
-layout(location = 1) in vec4 inPosition;
-layout(location = 2) in vec4 inNorm;
+#include "vertex_format.glsl"
+
+// Vertices are pulled from the vertex buffer by index and decoded here, so the pipeline has no vertex input
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec3 worldPos;
 layout(location = 2) out vec3 normal;
 
-vec3 positions[36] = vec3[](
-    //Front
-    vec3(-0.5, 0.5, -0.5),
-    vec3(0.5, 0.5, -0.5),
-    vec3(-0.5, -0.5,  -0.5),
-
-    vec3(0.5, 0.5, -0.5),
-    vec3(0.5, -0.5, -0.5),
-    vec3(-0.5, -0.5, -0.5),
-
-    //Back
-    vec3(0.5, -0.5, 0.5),
-    vec3(0.5, 0.5, 0.5),
-    vec3(-0.5, 0.5,  0.5),
-
-    vec3(-0.5, -0.5, 0.5),
-    vec3(0.5, -0.5, 0.5),
-    vec3(-0.5, 0.5, 0.5),
-
-    //Top
-    vec3(0.5, -0.5, 0.5),
-    vec3(0.5, -0.5, -0.5),
-    vec3(-0.5, -0.5, -0.5),
-
-    vec3(0.5, -0.5, 0.5),
-    vec3(-0.5, -0.5, -0.5),
-    vec3(-0.5, -0.5, 0.5),
-
-    //bottom
-    vec3(0.5, 0.5, 0.5),
-    vec3(0.5, 0.5, -0.5),
-    vec3(-0.5, 0.5, -0.5),
-
-    vec3(0.5, 0.5, 0.5),
-    vec3(-0.5, 0.5, -0.5),
-    vec3(-0.5, 0.5, 0.5),
-
-    //Right
-    vec3(0.5, -0.5, 0.5),
-    vec3(0.5, 0.5, 0.5),
-    vec3(0.5, 0.5, -0.5),
-
-    vec3(0.5, -0.5, 0.5),
-    vec3(0.5, 0.5, -0.5),
-    vec3(0.5, -0.5, -0.5),
-
-    //Left
-    vec3(-0.5, -0.5, 0.5),
-    vec3(-0.5, 0.5, 0.5),
-    vec3(-0.5, 0.5, -0.5),
-
-    vec3(-0.5, -0.5, 0.5),
-    vec3(-0.5, 0.5, -0.5),
-    vec3(-0.5, -0.5, -0.5)
-);
-
 vec3 colors[3] = vec3[](
     vec3(1.0, 0.0, 0.0),
     vec3(0.0, 1.0, 0.0),
     vec3(0.0, 0.0, 1.0)
 );
 
+// Extra iso-surfaces (stream 1 and up) are tinted so nested levels can be told apart
+vec3 isoColors[3] = vec3[](
+    vec3(1.0, 0.6, 0.2),
+    vec3(0.3, 0.9, 0.4),
+    vec3(0.9, 0.3, 0.8)
+);
+
 layout(binding=0) uniform Transform {
     mat4 M;
     mat4 V;
     mat4 P;
+    vec4 meshBounds;
+    vec4 eye;
     int wave;
+    int isoStreamVertices;
 } transform;
 
+// The grid's vertex buffer or the chunk arena, whichever the frame draws from
+layout(std430, set = 1, binding = 0) readonly buffer Vertices {
+    Vertex vertices[];
+};
+
+// Per draw: MeshDraw origin (xyz) and scale (w); draw i is instance i
+layout(std430, set = 1, binding = 1) readonly buffer Origins {
+    vec4 origins[];
+};
+
 void main() {
+    Vertex vertex = vertices[gl_VertexIndex];
+    vec4 origin = origins[gl_InstanceIndex];
+
     gl_PointSize = 10.0f;
-    vec3 offset;
-    offset.x = (int(inPosition.w) % 10) - 5;
-    offset.y = (int(inPosition.w) / 100) - 5;
-    offset.z = (int(inPosition.w) / 10) % 10 - 5;
-    //gl_Position = transform.P * transform.V * transform.M * vec4(positions[gl_VertexIndex] + offset, 1.0);
-    gl_Position = transform.P * transform.V * transform.M * vec4(inPosition.xyz, 1.0);
-    worldPos = (transform.M * vec4(inPosition.xyz, 1.0)).xyz;
-    normal = inNorm.xyz;
+    vec3 position = transform.meshBounds.xyz + origin.xyz + unpackPosition(vertex) * transform.meshBounds.w * origin.w;
+    gl_Position = transform.P * transform.V * transform.M * vec4(position, 1.0);
+    worldPos = (transform.M * vec4(position, 1.0)).xyz;
+    normal = unpackNormal(vertex);
 
     if (transform.wave > 0) {
         if (worldPos.y > 45) {
@@ -98,4 +63,9 @@ void main() {
     else {
         fragColor = colors[2];
     }
+
+    int isoLevel = transform.isoStreamVertices > 0 ? gl_VertexIndex / transform.isoStreamVertices : 0;
+    if (isoLevel > 0) {
+        fragColor = isoColors[min(isoLevel - 1, 2)];
+    }
 }
\ No newline at end of file
@@ -0,0 +1,48 @@
+// GPU side of VertexFormat.h: shader.comp packs mesh vertices with it and shader.vert pulls and unpacks them, so a
+// change of vertex encoding stays in this file and PackedVertex. Both copies must produce the same bytes.
+
+// Matches PackedVertex: unorm16 x,y | unorm16 z, octahedral normal as snorm8 x,y
+struct Vertex {
+	uint posXY;
+	uint posZNormal;
+};
+
+vec2 octEncode( vec3 n )
+{
+	float sum = abs(n.x) + abs(n.y) + abs(n.z);
+	if( !(sum > 0.0) )
+		return vec2(0.0);
+	n /= sum;
+	if( n.z < 0.0 )
+		return (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return n.xy;
+}
+
+vec3 octDecode( vec2 e )
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if( n.z < 0.0 )
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
+// pos is in 0 .. extent on every axis
+Vertex packVertex( vec3 pos, vec3 normal, float extent )
+{
+	vec3 q = clamp(pos / extent, 0.0, 1.0);
+	Vertex v;
+	v.posXY = packUnorm2x16(q.xy);
+	v.posZNormal = (packUnorm2x16(vec2(q.z, 0.0)) & 0xffffu) | (packSnorm4x8(vec4(octEncode(normal), 0.0, 0.0)) << 16);
+	return v;
+}
+
+// Position as a fraction of the extent it was packed with
+vec3 unpackPosition( Vertex v )
+{
+	return vec3(unpackUnorm2x16(v.posXY), unpackUnorm2x16(v.posZNormal).x);
+}
+
+vec3 unpackNormal( Vertex v )
+{
+	return octDecode(unpackSnorm4x8(v.posZNormal >> 16).xy);
+}
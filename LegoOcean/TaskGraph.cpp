@@ -0,0 +1,191 @@
+#include "TaskGraph.h"
+#include <iomanip>
+
+namespace {
+	thread_local int workerIndex = -1;
+}
+
+ThreadPool::ThreadPool(unsigned int numThreads) {
+
+	// One extra queue for jobs submitted from threads outside the pool
+	for (unsigned int i = 0; i <= numThreads; i++) {
+		queues.emplace_back(new Queue());
+	}
+
+	for (unsigned int i = 0; i < numThreads; i++) {
+		workers.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+
+}
+
+ThreadPool::~ThreadPool() {
+
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		running = false;
+	}
+	wake.notify_all();
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+
+}
+
+int ThreadPool::currentThread() const {
+
+	return workerIndex >= 0 ? workerIndex : static_cast<int>(workers.size());
+
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+
+	Queue& queue = *queues[currentThread()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(std::move(job));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		queued++;
+	}
+	wake.notify_one();
+
+}
+
+bool ThreadPool::tryRun(size_t self) {
+
+	std::function<void()> job;
+
+	{
+		Queue& own = *queues[self];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.jobs.empty()) {
+			job = std::move(own.jobs.back());
+			own.jobs.pop_back();
+		}
+	}
+
+	for (size_t i = 1; !job && i < queues.size(); i++) {
+		Queue& victim = *queues[(self + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.jobs.empty()) {
+			job = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+		}
+	}
+
+	if (!job) {
+		return false;
+	}
+
+	queued--;
+	job();
+
+	return true;
+
+}
+
+void ThreadPool::workerLoop(size_t index) {
+
+	workerIndex = static_cast<int>(index);
+
+	while (running) {
+		if (tryRun(index)) {
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wake.wait(lock, [this] { return queued > 0 || !running; });
+	}
+
+}
+
+void ThreadPool::helpUntil(const std::function<bool()>& done) {
+
+	size_t self = currentThread();
+
+	while (!done()) {
+		if (!tryRun(self)) {
+			std::this_thread::yield();
+		}
+	}
+
+}
+
+TaskGraph::TaskId TaskGraph::addTask(const std::string& name, std::function<void()> work, const std::vector<TaskId>& dependencies) {
+
+	TaskId id = tasks.size();
+
+	tasks.emplace_back(new Task());
+	tasks[id]->name = name;
+	tasks[id]->work = std::move(work);
+	tasks[id]->dependencyCount = static_cast<int>(dependencies.size());
+
+	for (TaskId dependency : dependencies) {
+		tasks[dependency]->successors.push_back(id);
+	}
+
+	return id;
+
+}
+
+void TaskGraph::execute(ThreadPool& pool, TaskId id) {
+
+	Task& task = *tasks[id];
+
+	task.thread = pool.currentThread();
+	task.startMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - runStart).count();
+	task.work();
+	task.endMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - runStart).count();
+	task.totalMs += task.endMs - task.startMs;
+
+	for (TaskId successor : task.successors) {
+		if (tasks[successor]->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			pool.submit([this, &pool, successor] { execute(pool, successor); });
+		}
+	}
+
+	remaining.fetch_sub(1, std::memory_order_release);
+
+}
+
+void TaskGraph::run(ThreadPool& pool) {
+
+	runStart = std::chrono::steady_clock::now();
+	remaining = tasks.size();
+
+	for (auto& task : tasks) {
+		task->pending = task->dependencyCount;
+	}
+
+	for (TaskId id = 0; id < tasks.size(); id++) {
+		if (tasks[id]->dependencyCount == 0) {
+			pool.submit([this, &pool, id] { execute(pool, id); });
+		}
+	}
+
+	pool.helpUntil([this] { return remaining.load(std::memory_order_acquire) == 0; });
+
+	lastRunMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - runStart).count();
+	runs++;
+
+}
+
+void TaskGraph::dumpTimings(std::ostream& out) const {
+
+	out << "TASK GRAPH - " << tasks.size() << " tasks, last run " << lastRunMs << " ms, " << runs << " runs\n";
+	out << std::left << std::setw(24) << "task" << std::right << std::setw(8) << "thread" << std::setw(12) << "start ms" << std::setw(12) << "time ms" << std::setw(12) << "avg ms" << "\n";
+
+	for (const auto& task : tasks) {
+		out << std::left << std::setw(24) << task->name << std::right << std::setw(8) << task->thread
+			<< std::fixed << std::setprecision(3)
+			<< std::setw(12) << task->startMs
+			<< std::setw(12) << task->endMs - task->startMs
+			<< std::setw(12) << (runs > 0 ? task->totalMs / runs : 0.0) << "\n";
+	}
+
+	out << std::defaultfloat;
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <chrono>
+
+// Fixed pool of worker threads, each with its own job deque. Workers pop from the back of their own
+// deque and steal from the front of the others when it runs dry.
+class ThreadPool {
+
+public:
+
+	ThreadPool(unsigned int numThreads);
+	~ThreadPool();
+
+	void submit(std::function<void()> job);
+
+	// Runs queued jobs on the calling thread until done() returns true
+	void helpUntil(const std::function<bool()>& done);
+
+	unsigned int size() const { return static_cast<unsigned int>(workers.size()); }
+
+	// Index of the calling worker, or size() for threads outside the pool
+	int currentThread() const;
+
+private:
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> jobs;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+
+	std::atomic<bool> running{ true };
+	std::atomic<size_t> queued{ 0 };
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+
+	bool tryRun(size_t self);
+	void workerLoop(size_t index);
+
+};
+
+// A set of named tasks with explicit dependencies, executed on a ThreadPool.
+// The graph is built once and can be run every frame; each run records per-task timings.
+class TaskGraph {
+
+public:
+
+	typedef size_t TaskId;
+
+	TaskId addTask(const std::string& name, std::function<void()> work, const std::vector<TaskId>& dependencies = {});
+
+	// Blocks until every task has finished; the calling thread executes tasks as well
+	void run(ThreadPool& pool);
+
+	void dumpTimings(std::ostream& out) const;
+
+private:
+
+	struct Task {
+		std::string name;
+		std::function<void()> work;
+		std::vector<TaskId> successors;
+		int dependencyCount = 0;
+		std::atomic<int> pending{ 0 };
+
+		double startMs = 0.0;
+		double endMs = 0.0;
+		int thread = 0;
+		double totalMs = 0.0;
+	};
+
+	std::vector<std::unique_ptr<Task>> tasks;
+	std::atomic<size_t> remaining{ 0 };
+	std::chrono::steady_clock::time_point runStart;
+	double lastRunMs = 0.0;
+	size_t runs = 0;
+
+	void execute(ThreadPool& pool, TaskId id);
+
+};
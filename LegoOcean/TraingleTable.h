@@ -1,290 +1,91 @@
 #pragma once
 
 #include "VKConfig.h"
+#include "FieldLayout.h"
+#include "MarchingCubesTables.h"
 #include "glm/glm.hpp"
 #include <iostream>
 #include "glm/gtc/matrix_transform.hpp"
 
-const int tConnectionTable[256][15] = {
-	{-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{0,8,3,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{0,1,9,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{1,8,3,9,8,1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{1,2,10,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{0,8,3,1,2,10,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{9,2,10,0,2,9,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{2,8,3,2,10,8,10,9,8,-1,-1,-1,-1,-1,-1},
-	{3,11,2,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{0,11,2,8,11,0,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{1,9,0,2,3,11,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{1,11,2,1,9,11,9,8,11,-1,-1,-1,-1,-1,-1},
-	{3,10,1,11,10,3,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{0,10,1,0,8,10,8,11,10,-1,-1,-1,-1,-1,-1},
-	{3,9,0,3,11,9,11,10,9,-1,-1,-1,-1,-1,-1},
-	{9,8,10,10,8,11,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{4,7,8,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{4,3,0,7,3,4,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{0,1,9,8,4,7,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{4,1,9,4,7,1,7,3,1,-1,-1,-1,-1,-1,-1},
-	{1,2,10,8,4,7,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{3,4,7,3,0,4,1,2,10,-1,-1,-1,-1,-1,-1},
-	{9,2,10,9,0,2,8,4,7,-1,-1,-1,-1,-1,-1},
-	{2,10,9,2,9,7,2,7,3,7,9,4,-1,-1,-1},
-	{8,4,7,3,11,2,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{11,4,7,11,2,4,2,0,4,-1,-1,-1,-1,-1,-1},
-	{9,0,1,8,4,7,2,3,11,-1,-1,-1,-1,-1,-1},
-	{4,7,11,9,4,11,9,11,2,9,2,1,-1,-1,-1},
-	{3,10,1,3,11,10,7,8,4,-1,-1,-1,-1,-1,-1},
-	{1,11,10,1,4,11,1,0,4,7,11,4,-1,-1,-1},
-	{4,7,8,9,0,11,9,11,10,11,0,3,-1,-1,-1},
-	{4,7,11,4,11,9,9,11,10,-1,-1,-1,-1,-1,-1},
-	{9,5,4,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{9,5,4,0,8,3,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{0,5,4,1,5,0,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{8,5,4,8,3,5,3,1,5,-1,-1,-1,-1,-1,-1},
-	{1,2,10,9,5,4,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{3,0,8,1,2,10,4,9,5,-1,-1,-1,-1,-1,-1},
-	{5,2,10,5,4,2,4,0,2,-1,-1,-1,-1,-1,-1},
-	{2,10,5,3,2,5,3,5,4,3,4,8,-1,-1,-1},
-	{9,5,4,2,3,11,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{0,11,2,0,8,11,4,9,5,-1,-1,-1,-1,-1,-1},
-	{0,5,4,0,1,5,2,3,11,-1,-1,-1,-1,-1,-1},
-	{2,1,5,2,5,8,2,8,11,4,8,5,-1,-1,-1},
-	{10,3,11,10,1,3,9,5,4,-1,-1,-1,-1,-1,-1},
-	{4,9,5,0,8,1,8,10,1,8,11,10,-1,-1,-1},
-	{5,4,0,5,0,11,5,11,10,11,0,3,-1,-1,-1},
-	{5,4,8,5,8,10,10,8,11,-1,-1,-1,-1,-1,-1},
-	{9,7,8,5,7,9,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{9,3,0,9,5,3,5,7,3,-1,-1,-1,-1,-1,-1},
-	{0,7,8,0,1,7,1,5,7,-1,-1,-1,-1,-1,-1},
-	{1,5,3,3,5,7,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{9,7,8,9,5,7,10,1,2,-1,-1,-1,-1,-1,-1},
-	{10,1,2,9,5,0,5,3,0,5,7,3,-1,-1,-1},
-	{8,0,2,8,2,5,8,5,7,10,5,2,-1,-1,-1},
-	{2,10,5,2,5,3,3,5,7,-1,-1,-1,-1,-1,-1},
-	{7,9,5,7,8,9,3,11,2,-1,-1,-1,-1,-1,-1},
-	{9,5,7,9,7,2,9,2,0,2,7,11,-1,-1,-1},
-	{2,3,11,0,1,8,1,7,8,1,5,7,-1,-1,-1},
-	{11,2,1,11,1,7,7,1,5,-1,-1,-1,-1,-1,-1},
-	{9,5,8,8,5,7,10,1,3,10,3,11,-1,-1,-1},
-	{5,7,0,5,0,9,7,11,0,1,0,10,11,10,0},
-	{11,10,0,11,0,3,10,5,0,8,0,7,5,7,0},
-	{11,10,5,7,11,5,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{10,6,5,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{0,8,3,5,10,6,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{9,0,1,5,10,6,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{1,8,3,1,9,8,5,10,6,-1,-1,-1,-1,-1,-1},
-	{1,6,5,2,6,1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{1,6,5,1,2,6,3,0,8,-1,-1,-1,-1,-1,-1},
-	{9,6,5,9,0,6,0,2,6,-1,-1,-1,-1,-1,-1},
-	{5,9,8,5,8,2,5,2,6,3,2,8,-1,-1,-1},
-	{2,3,11,10,6,5,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{11,0,8,11,2,0,10,6,5,-1,-1,-1,-1,-1,-1},
-	{0,1,9,2,3,11,5,10,6,-1,-1,-1,-1,-1,-1},
-	{5,10,6,1,9,2,9,11,2,9,8,11,-1,-1,-1},
-	{6,3,11,6,5,3,5,1,3,-1,-1,-1,-1,-1,-1},
-	{0,8,11,0,11,5,0,5,1,5,11,6,-1,-1,-1},
-	{3,11,6,0,3,6,0,6,5,0,5,9,-1,-1,-1},
-	{6,5,9,6,9,11,11,9,8,-1,-1,-1,-1,-1,-1},
-	{5,10,6,4,7,8,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{4,3,0,4,7,3,6,5,10,-1,-1,-1,-1,-1,-1},
-	{1,9,0,5,10,6,8,4,7,-1,-1,-1,-1,-1,-1},
-	{10,6,5,1,9,7,1,7,3,7,9,4,-1,-1,-1},
-	{6,1,2,6,5,1,4,7,8,-1,-1,-1,-1,-1,-1},
-	{1,2,5,5,2,6,3,0,4,3,4,7,-1,-1,-1},
-	{8,4,7,9,0,5,0,6,5,0,2,6,-1,-1,-1},
-	{7,3,9,7,9,4,3,2,9,5,9,6,2,6,9},
-	{3,11,2,7,8,4,10,6,5,-1,-1,-1,-1,-1,-1},
-	{5,10,6,4,7,2,4,2,0,2,7,11,-1,-1,-1},
-	{0,1,9,4,7,8,2,3,11,5,10,6,-1,-1,-1},
-	{9,2,1,9,11,2,9,4,11,7,11,4,5,10,6},
-	{8,4,7,3,11,5,3,5,1,5,11,6,-1,-1,-1},
-	{5,1,11,5,11,6,1,0,11,7,11,4,0,4,11},
-	{0,5,9,0,6,5,0,3,6,11,6,3,8,4,7},
-	{6,5,9,6,9,11,4,7,9,7,11,9,-1,-1,-1},
-	{10,4,9,6,4,10,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{4,10,6,4,9,10,0,8,3,-1,-1,-1,-1,-1,-1},
-	{10,0,1,10,6,0,6,4,0,-1,-1,-1,-1,-1,-1},
-	{8,3,1,8,1,6,8,6,4,6,1,10,-1,-1,-1},
-	{1,4,9,1,2,4,2,6,4,-1,-1,-1,-1,-1,-1},
-	{3,0,8,1,2,9,2,4,9,2,6,4,-1,-1,-1},
-	{0,2,4,4,2,6,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{8,3,2,8,2,4,4,2,6,-1,-1,-1,-1,-1,-1},
-	{10,4,9,10,6,4,11,2,3,-1,-1,-1,-1,-1,-1},
-	{0,8,2,2,8,11,4,9,10,4,10,6,-1,-1,-1},
-	{3,11,2,0,1,6,0,6,4,6,1,10,-1,-1,-1},
-	{6,4,1,6,1,10,4,8,1,2,1,11,8,11,1},
-	{9,6,4,9,3,6,9,1,3,11,6,3,-1,-1,-1},
-	{8,11,1,8,1,0,11,6,1,9,1,4,6,4,1},
-	{3,11,6,3,6,0,0,6,4,-1,-1,-1,-1,-1,-1},
-	{6,4,8,11,6,8,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{7,10,6,7,8,10,8,9,10,-1,-1,-1,-1,-1,-1},
-	{0,7,3,0,10,7,0,9,10,6,7,10,-1,-1,-1},
-	{10,6,7,1,10,7,1,7,8,1,8,0,-1,-1,-1},
-	{10,6,7,10,7,1,1,7,3,-1,-1,-1,-1,-1,-1},
-	{1,2,6,1,6,8,1,8,9,8,6,7,-1,-1,-1},
-	{2,6,9,2,9,1,6,7,9,0,9,3,7,3,9},
-	{7,8,0,7,0,6,6,0,2,-1,-1,-1,-1,-1,-1},
-	{7,3,2,6,7,2,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{2,3,11,10,6,8,10,8,9,8,6,7,-1,-1,-1},
-	{2,0,7,2,7,11,0,9,7,6,7,10,9,10,7},
-	{1,8,0,1,7,8,1,10,7,6,7,10,2,3,11},
-	{11,2,1,11,1,7,10,6,1,6,7,1,-1,-1,-1},
-	{8,9,6,8,6,7,9,1,6,11,6,3,1,3,6},
-	{0,9,1,11,6,7,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{7,8,0,7,0,6,3,11,0,11,6,0,-1,-1,-1},
-	{7,11,6,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{7,6,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{3,0,8,11,7,6,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{0,1,9,11,7,6,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{8,1,9,8,3,1,11,7,6,-1,-1,-1,-1,-1,-1},
-	{10,1,2,6,11,7,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{1,2,10,3,0,8,6,11,7,-1,-1,-1,-1,-1,-1},
-	{2,9,0,2,10,9,6,11,7,-1,-1,-1,-1,-1,-1},
-	{6,11,7,2,10,3,10,8,3,10,9,8,-1,-1,-1},
-	{7,2,3,6,2,7,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{7,0,8,7,6,0,6,2,0,-1,-1,-1,-1,-1,-1},
-	{2,7,6,2,3,7,0,1,9,-1,-1,-1,-1,-1,-1},
-	{1,6,2,1,8,6,1,9,8,8,7,6,-1,-1,-1},
-	{10,7,6,10,1,7,1,3,7,-1,-1,-1,-1,-1,-1},
-	{10,7,6,1,7,10,1,8,7,1,0,8,-1,-1,-1},
-	{0,3,7,0,7,10,0,10,9,6,10,7,-1,-1,-1},
-	{7,6,10,7,10,8,8,10,9,-1,-1,-1,-1,-1,-1},
-	{6,8,4,11,8,6,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{3,6,11,3,0,6,0,4,6,-1,-1,-1,-1,-1,-1},
-	{8,6,11,8,4,6,9,0,1,-1,-1,-1,-1,-1,-1},
-	{9,4,6,9,6,3,9,3,1,11,3,6,-1,-1,-1},
-	{6,8,4,6,11,8,2,10,1,-1,-1,-1,-1,-1,-1},
-	{1,2,10,3,0,11,0,6,11,0,4,6,-1,-1,-1},
-	{4,11,8,4,6,11,0,2,9,2,10,9,-1,-1,-1},
-	{10,9,3,10,3,2,9,4,3,11,3,6,4,6,3},
-	{8,2,3,8,4,2,4,6,2,-1,-1,-1,-1,-1,-1},
-	{0,4,2,4,6,2,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{1,9,0,2,3,4,2,4,6,4,3,8,-1,-1,-1},
-	{1,9,4,1,4,2,2,4,6,-1,-1,-1,-1,-1,-1},
-	{8,1,3,8,6,1,8,4,6,6,10,1,-1,-1,-1},
-	{10,1,0,10,0,6,6,0,4,-1,-1,-1,-1,-1,-1},
-	{4,6,3,4,3,8,6,10,3,0,3,9,10,9,3},
-	{10,9,4,6,10,4,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{4,9,5,7,6,11,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{0,8,3,4,9,5,11,7,6,-1,-1,-1,-1,-1,-1},
-	{5,0,1,5,4,0,7,6,11,-1,-1,-1,-1,-1,-1},
-	{11,7,6,8,3,4,3,5,4,3,1,5,-1,-1,-1},
-	{9,5,4,10,1,2,7,6,11,-1,-1,-1,-1,-1,-1},
-	{6,11,7,1,2,10,0,8,3,4,9,5,-1,-1,-1},
-	{7,6,11,5,4,10,4,2,10,4,0,2,-1,-1,-1},
-	{3,4,8,3,5,4,3,2,5,10,5,2,11,7,6},
-	{7,2,3,7,6,2,5,4,9,-1,-1,-1,-1,-1,-1},
-	{9,5,4,0,8,6,0,6,2,6,8,7,-1,-1,-1},
-	{3,6,2,3,7,6,1,5,0,5,4,0,-1,-1,-1},
-	{6,2,8,6,8,7,2,1,8,4,8,5,1,5,8},
-	{9,5,4,10,1,6,1,7,6,1,3,7,-1,-1,-1},
-	{1,6,10,1,7,6,1,0,7,8,7,0,9,5,4},
-	{4,0,10,4,10,5,0,3,10,6,10,7,3,7,10},
-	{7,6,10,7,10,8,5,4,10,4,8,10,-1,-1,-1},
-	{6,9,5,6,11,9,11,8,9,-1,-1,-1,-1,-1,-1},
-	{3,6,11,0,6,3,0,5,6,0,9,5,-1,-1,-1},
-	{0,11,8,0,5,11,0,1,5,5,6,11,-1,-1,-1},
-	{6,11,3,6,3,5,5,3,1,-1,-1,-1,-1,-1,-1},
-	{1,2,10,9,5,11,9,11,8,11,5,6,-1,-1,-1},
-	{0,11,3,0,6,11,0,9,6,5,6,9,1,2,10},
-	{11,8,5,11,5,6,8,0,5,10,5,2,0,2,5},
-	{6,11,3,6,3,5,2,10,3,10,5,3,-1,-1,-1},
-	{5,8,9,5,2,8,5,6,2,3,8,2,-1,-1,-1},
-	{9,5,6,9,6,0,0,6,2,-1,-1,-1,-1,-1,-1},
-	{1,5,8,1,8,0,5,6,8,3,8,2,6,2,8},
-	{1,5,6,2,1,6,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{1,3,6,1,6,10,3,8,6,5,6,9,8,9,6},
-	{10,1,0,10,0,6,9,5,0,5,6,0,-1,-1,-1},
-	{0,3,8,5,6,10,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{10,5,6,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{11,5,10,7,5,11,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{11,5,10,11,7,5,8,3,0,-1,-1,-1,-1,-1,-1},
-	{5,11,7,5,10,11,1,9,0,-1,-1,-1,-1,-1,-1},
-	{10,7,5,10,11,7,9,8,1,8,3,1,-1,-1,-1},
-	{11,1,2,11,7,1,7,5,1,-1,-1,-1,-1,-1,-1},
-	{0,8,3,1,2,7,1,7,5,7,2,11,-1,-1,-1},
-	{9,7,5,9,2,7,9,0,2,2,11,7,-1,-1,-1},
-	{7,5,2,7,2,11,5,9,2,3,2,8,9,8,2},
-	{2,5,10,2,3,5,3,7,5,-1,-1,-1,-1,-1,-1},
-	{8,2,0,8,5,2,8,7,5,10,2,5,-1,-1,-1},
-	{9,0,1,5,10,3,5,3,7,3,10,2,-1,-1,-1},
-	{9,8,2,9,2,1,8,7,2,10,2,5,7,5,2},
-	{1,3,5,3,7,5,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{0,8,7,0,7,1,1,7,5,-1,-1,-1,-1,-1,-1},
-	{9,0,3,9,3,5,5,3,7,-1,-1,-1,-1,-1,-1},
-	{9,8,7,5,9,7,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{5,8,4,5,10,8,10,11,8,-1,-1,-1,-1,-1,-1},
-	{5,0,4,5,11,0,5,10,11,11,3,0,-1,-1,-1},
-	{0,1,9,8,4,10,8,10,11,10,4,5,-1,-1,-1},
-	{10,11,4,10,4,5,11,3,4,9,4,1,3,1,4},
-	{2,5,1,2,8,5,2,11,8,4,5,8,-1,-1,-1},
-	{0,4,11,0,11,3,4,5,11,2,11,1,5,1,11},
-	{0,2,5,0,5,9,2,11,5,4,5,8,11,8,5},
-	{9,4,5,2,11,3,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{2,5,10,3,5,2,3,4,5,3,8,4,-1,-1,-1},
-	{5,10,2,5,2,4,4,2,0,-1,-1,-1,-1,-1,-1},
-	{3,10,2,3,5,10,3,8,5,4,5,8,0,1,9},
-	{5,10,2,5,2,4,1,9,2,9,4,2,-1,-1,-1},
-	{8,4,5,8,5,3,3,5,1,-1,-1,-1,-1,-1,-1},
-	{0,4,5,1,0,5,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{8,4,5,8,5,3,9,0,5,0,3,5,-1,-1,-1},
-	{9,4,5,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{4,11,7,4,9,11,9,10,11,-1,-1,-1,-1,-1,-1},
-	{0,8,3,4,9,7,9,11,7,9,10,11,-1,-1,-1},
-	{1,10,11,1,11,4,1,4,0,7,4,11,-1,-1,-1},
-	{3,1,4,3,4,8,1,10,4,7,4,11,10,11,4},
-	{4,11,7,9,11,4,9,2,11,9,1,2,-1,-1,-1},
-	{9,7,4,9,11,7,9,1,11,2,11,1,0,8,3},
-	{11,7,4,11,4,2,2,4,0,-1,-1,-1,-1,-1,-1},
-	{11,7,4,11,4,2,8,3,4,3,2,4,-1,-1,-1},
-	{2,9,10,2,7,9,2,3,7,7,4,9,-1,-1,-1},
-	{9,10,7,9,7,4,10,2,7,8,7,0,2,0,7},
-	{3,7,10,3,10,2,7,4,10,1,10,0,4,0,10},
-	{1,10,2,8,7,4,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{4,9,1,4,1,7,7,1,3,-1,-1,-1,-1,-1,-1},
-	{4,9,1,4,1,7,0,8,1,8,7,1,-1,-1,-1},
-	{4,0,3,7,4,3,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{4,8,7,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{9,10,8,10,11,8,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{3,0,9,3,9,11,11,9,10,-1,-1,-1,-1,-1,-1},
-	{0,1,10,0,10,8,8,10,11,-1,-1,-1,-1,-1,-1},
-	{3,1,10,11,3,10,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{1,2,11,1,11,9,9,11,8,-1,-1,-1,-1,-1,-1},
-	{3,0,9,3,9,11,1,2,9,2,11,9,-1,-1,-1},
-	{0,2,11,8,0,11,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{3,2,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{2,3,8,2,8,10,10,8,9,-1,-1,-1,-1,-1,-1},
-	{9,10,2,0,9,2,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{2,3,8,2,8,10,0,1,8,1,10,8,-1,-1,-1},
-	{1,10,2,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{1,3,8,9,1,8,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{0,9,1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{0,3,8,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	{-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1}
-};
-
-const unsigned int chunk_size = 20;
-const unsigned int chunk_size2 = chunk_size * chunk_size;
-
-float voxel_size = 10.0;
-float threshold = 0.0;
-
-glm::vec3 createVert(glm::vec3 p0, glm::vec3 p1, float d0, float d1)
+inline unsigned int chunk_size = 20;
+inline unsigned int chunk_size2 = chunk_size * chunk_size;
+inline int field_layout = FIELD_LAYOUT_LINEAR;
+
+inline float voxel_size = 10.0;
+
+// Iso-values to extract, all in one pass over the field. Surface k is written to its own vertex stream,
+// k * marchStreamVertices() slots into the vertex buffer
+inline int iso_level_count = 1;
+inline float iso_levels[MAX_ISO_LEVELS] = { 0.0f };
+
+// Edge length of the box vertex positions are quantized against (see PackedVertex)
+inline float mesh_extent = chunk_size * voxel_size;
+
+inline void setMarchGrid(unsigned int size, int layout)
+{
+	chunk_size = size;
+	chunk_size2 = size * size;
+	field_layout = layout;
+	mesh_extent = chunk_size * voxel_size;
+}
+
+inline void setIsoLevels(const float* levels, int count)
+{
+	iso_level_count = std::clamp(count, 1, MAX_ISO_LEVELS);
+	for (int i = 0; i < iso_level_count; i++)
+		iso_levels[i] = levels[i];
+}
+
+// Vertex slots of one surface's stream: 15 per cell
+inline size_t marchStreamVertices()
+{
+	return (size_t)chunk_size2 * chunk_size * 15;
+}
+
+inline glm::vec3 createVert(glm::vec3 p0, glm::vec3 p1, float d0, float d1, float iso)
 {
 	float diff = d1 - d0;
 	if (abs(diff) > 1e-9)
-		return (p1 - p0) * (threshold - d0) / diff + p0;
+		return (p1 - p0) * (iso - d0) / diff + p0;
 	else
 		return (p0 + p1) * 0.5f;
 }
 
-unsigned int contIndex(unsigned int x, unsigned int y, unsigned int z)
+inline size_t contIndex(unsigned int x, unsigned int y, unsigned int z)
 {
-	return chunk_size2 * z + chunk_size * y + x;
+	return fieldIndex(field_layout, x, y, z, chunk_size);
 }
 
-void createVerts(glm::vec3 voxel_index, glm::vec3 pos[12], float vox_data[8])
+// Central-difference field gradient at a cell corner, one-sided on the grid faces. Along each axis one neighbour
+// is another corner of the cell (vox_data), so only the three samples outside the cell are fetched.
+inline float cornerGradientAxis(const float data[], float center, float inner, int coord, bool upper, unsigned int ox, unsigned int oy, unsigned int oz)
+{
+	int outerCoord = upper ? coord + 1 : coord - 1;
+	if (outerCoord < 0 || outerCoord >= static_cast<int>(chunk_size))
+		return upper ? center - inner : inner - center;
+
+	float outer = data[contIndex(ox, oy, oz)];
+	return (upper ? outer - inner : inner - outer) * 0.5f;
+}
+
+inline glm::vec3 cornerGradient(const float data[], const float vox_data[8], unsigned int x, unsigned int y, unsigned int z, int corner)
+{
+	bool ux = cornerOffsetX(corner) == 1;
+	bool uy = cornerOffsetY(corner) == 1;
+	bool uz = cornerOffsetZ(corner) == 1;
+	unsigned int px = x + ux;
+	unsigned int py = y + uy;
+	unsigned int pz = z + uz;
+	float center = vox_data[corner];
+
+	// corner ^ 1, ^ 3 and ^ 4 is the neighbouring corner along x, y and z
+	return glm::vec3(
+		cornerGradientAxis(data, center, vox_data[corner ^ 1], px, ux, ux ? px + 1 : px - 1, py, pz),
+		cornerGradientAxis(data, center, vox_data[corner ^ 3], py, uy, px, uy ? py + 1 : py - 1, pz),
+		cornerGradientAxis(data, center, vox_data[corner ^ 4], pz, uz, px, py, uz ? pz + 1 : pz - 1));
+}
+
+inline void createVerts(glm::vec3 voxel_index, glm::vec3 pos[12], float vox_data[8], float iso)
 {
 	// All corner points of the current cube
 	float x = voxel_index.x * voxel_size;
@@ -301,76 +102,162 @@ void createVerts(glm::vec3 voxel_index, glm::vec3 pos[12], float vox_data[8])
 
 	// Find the 12 edge vertices by interpolating between the corner points,
 	// depending on the values of the field at those corner points:
-	pos[0] = createVert(c0, c1, vox_data[0], vox_data[1]);
-	pos[1] = createVert(c1, c2, vox_data[1], vox_data[2]);
-	pos[2] = createVert(c2, c3, vox_data[2], vox_data[3]);
-	pos[3] = createVert(c3, c0, vox_data[3], vox_data[0]);
-
-	pos[4] = createVert(c4, c5, vox_data[4], vox_data[5]);
-	pos[5] = createVert(c5, c6, vox_data[5], vox_data[6]);
-	pos[6] = createVert(c6, c7, vox_data[6], vox_data[7]);
-	pos[7] = createVert(c7, c4, vox_data[7], vox_data[4]);
-
-	pos[8] = createVert(c0, c4, vox_data[0], vox_data[4]);
-	pos[9] = createVert(c1, c5, vox_data[1], vox_data[5]);
-	pos[10] = createVert(c2, c6, vox_data[2], vox_data[6]);
-	pos[11] = createVert(c3, c7, vox_data[3], vox_data[7]);
+	pos[0] = createVert(c0, c1, vox_data[0], vox_data[1], iso);
+	pos[1] = createVert(c1, c2, vox_data[1], vox_data[2], iso);
+	pos[2] = createVert(c2, c3, vox_data[2], vox_data[3], iso);
+	pos[3] = createVert(c3, c0, vox_data[3], vox_data[0], iso);
+
+	pos[4] = createVert(c4, c5, vox_data[4], vox_data[5], iso);
+	pos[5] = createVert(c5, c6, vox_data[5], vox_data[6], iso);
+	pos[6] = createVert(c6, c7, vox_data[6], vox_data[7], iso);
+	pos[7] = createVert(c7, c4, vox_data[7], vox_data[4], iso);
+
+	pos[8] = createVert(c0, c4, vox_data[0], vox_data[4], iso);
+	pos[9] = createVert(c1, c5, vox_data[1], vox_data[5], iso);
+	pos[10] = createVert(c2, c6, vox_data[2], vox_data[6], iso);
+	pos[11] = createVert(c3, c7, vox_data[3], vox_data[7], iso);
 }
 
 
-Particle march(int gid, int index, float data[]) {
+// Writes the 15 vertex slots of cell (x, y, z) in every iso-level stream; unused slots and border cells get
+// degenerate vertices. vertices points at the cell's slots in stream 0.
+inline void march(unsigned int x, unsigned int y, unsigned int z, float data[], PackedVertex vertices[15]) {
+
+	PackedVertex empty = packVertex(glm::vec3(0, 0, 0), glm::vec3(0, 1, 0), mesh_extent);
+	size_t streamVertices = marchStreamVertices();
 
-	//vertices[contIndex( index.x, index.y, index.z )].pos.w = data[contIndex( index.x, index.y, index.z )];
+	// Make sure this is not a border cell (otherwise neighbor lookup in the next step would fail):
+	if (x >= chunk_size - 1 || y >= chunk_size - 1 || z >= chunk_size - 1) {
+		for (int level = 0; level < iso_level_count; level++)
+			for (int i = 0; i < 15; i++)
+				vertices[level * streamVertices + i] = empty;
+		return;
+	}
 
 	// Retrieve all necessary data from neighboring cells:
 	float vox_data[8];
-	vox_data[0] = data[gid];
-	vox_data[1] = data[gid + 1];
-	vox_data[2] = data[gid + chunk_size + 1];
-	vox_data[3] = data[gid + chunk_size];
-
-	vox_data[4] = data[gid + chunk_size2];
-	vox_data[5] = data[gid + chunk_size2 + 1];
-	vox_data[6] = data[gid + chunk_size2 + chunk_size + 1];
-	vox_data[7] = data[gid + chunk_size2 + chunk_size];
-
-	// Turn this information into a triangle list index:
-	int triangleTypeIndex = 0;
-	int DataSum = 0;
-	for (int i = 0; i < 8; i++)
-		if (vox_data[i] > threshold) {
-			triangleTypeIndex |= 1 << i;
-			DataSum++;
+	vox_data[0] = data[contIndex(x, y, z)];
+	vox_data[1] = data[contIndex(x + 1, y, z)];
+	vox_data[2] = data[contIndex(x + 1, y + 1, z)];
+	vox_data[3] = data[contIndex(x, y + 1, z)];
+
+	vox_data[4] = data[contIndex(x, y, z + 1)];
+	vox_data[5] = data[contIndex(x + 1, y, z + 1)];
+	vox_data[6] = data[contIndex(x + 1, y + 1, z + 1)];
+	vox_data[7] = data[contIndex(x, y + 1, z + 1)];
+
+	// Smooth normals: the field gradient, interpolated along the edge like the position. It points up the field,
+	// the same side as the face normals of the table's winding. Corner gradients do not depend on the iso-value,
+	// so they are computed once per cell for all levels; edge normals once per cell and level.
+	glm::vec3 cornerGradients[8];
+	unsigned int cornerMask = 0;
+
+	auto cachedGradient = [&](int corner) {
+		if (!(cornerMask & (1u << corner))) {
+			cornerGradients[corner] = cornerGradient(data, vox_data, x, y, z, corner);
+			cornerMask |= 1u << corner;
 		}
-	// Set up all neighboring vertices:
-	glm::vec3 verts[12];
-	for (int i = 0; i < 12; i++)
-		verts[i] = glm::vec3(0, 0, 0);
-	createVerts(glm::vec3((gid % chunk_size), (gid / chunk_size) % chunk_size, gid / chunk_size2), verts, vox_data);
-
-	tConnectionTable[triangleTypeIndex];
-	glm::vec3 curNormal = glm::vec3(0, 0, 1);
-	if (index % 3 == 0)
-	{
-		glm::vec3 p1 = verts[tConnectionTable[triangleTypeIndex][index]];
-		glm::vec3 p2 = verts[tConnectionTable[triangleTypeIndex][index + 1]];
-		glm::vec3 p3 = verts[tConnectionTable[triangleTypeIndex][index + 2]];
-		curNormal = normalize(cross((p1 - p2), (p1 - p3)));
-	}
+		return cornerGradients[corner];
+	};
+
+	for (int level = 0; level < iso_level_count; level++) {
+
+		float iso = iso_levels[level];
+		PackedVertex* out = vertices + level * streamVertices;
+
+		// Turn this information into a triangle list index:
+		int triangleTypeIndex = 0;
+		for (int i = 0; i < 8; i++)
+			if (vox_data[i] > iso)
+				triangleTypeIndex |= 1 << i;
+
+		int numTriangles = tTriangleCount[triangleTypeIndex];
+		if (numTriangles == 0) {
+			for (int i = 0; i < 15; i++)
+				out[i] = empty;
+			continue;
+		}
+
+		// Set up all neighboring vertices:
+		glm::vec3 verts[12];
+		createVerts(glm::vec3(x, y, z), verts, vox_data, iso);
+
+		glm::vec3 edgeNormals[12];
+		unsigned int edgeMask = 0;
+
+		auto cachedNormal = [&](int edge) {
+			if (!(edgeMask & (1u << edge))) {
+				int a = edgeCornerA(edge);
+				int b = edgeCornerB(edge);
+				float diff = vox_data[b] - vox_data[a];
+				float t = abs(diff) > 1e-9 ? (iso - vox_data[a]) / diff : 0.5f;
+				edgeNormals[edge] = glm::mix(cachedGradient(a), cachedGradient(b), t);
+				edgeMask |= 1u << edge;
+			}
+			return edgeNormals[edge];
+		};
 
-	unsigned int targetVertIndex = gid * 15 + index;
+		const int* tri_vert_indices = tConnectionTable[triangleTypeIndex];
+		for (int t = 0; t < numTriangles; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				int edge = tri_vert_indices[t * 3 + k];
+				glm::vec3 normal = cachedNormal(edge);
 
-	Particle vertex;
+				// A flat patch of field has no gradient; fall back to the face normal there
+				if (normal == glm::vec3(0.0f)) {
+					glm::vec3 p1 = verts[tri_vert_indices[t * 3]];
+					glm::vec3 p2 = verts[tri_vert_indices[t * 3 + 1]];
+					glm::vec3 p3 = verts[tri_vert_indices[t * 3 + 2]];
+					normal = cross((p1 - p2), (p1 - p3));
+				}
 
-	if (tConnectionTable[triangleTypeIndex][index] > -1)
-	{
-		vertex.pos = glm::vec4(verts[tConnectionTable[triangleTypeIndex][index]], 1.0);
-		vertex.normal = glm::vec4(curNormal, 1.0);
+				// packVertex's octahedral encoding normalizes, so the normal can stay unnormalized
+				out[t * 3 + k] = packVertex(verts[edge], normal, mesh_extent);
+			}
+		}
+		for (int i = numTriangles * 3; i < 15; i++)
+			out[i] = empty;
+
+	}
+
+}
+
+// Number of work units marchUnits splits the grid into: cells for the linear layout,
+// 4x4x4 bricks for the bricked one so a unit's corner fetches stay inside one brick
+inline size_t marchUnitCount()
+{
+	if (field_layout == FIELD_LAYOUT_BRICKED) {
+		size_t bricks = fieldBricksPerAxis(chunk_size);
+		return bricks * bricks * bricks;
 	}
-	else {
-		vertex.pos = glm::vec4(0, 0, 0, 0);
-		vertex.normal = glm::vec4(0, 1, 0, 0);
+	return (size_t)chunk_size2 * chunk_size;
+}
+
+// Calls fn(x, y, z) for every cell in units [begin, end), walking them in field memory order
+template <typename Fn>
+void marchUnits(size_t begin, size_t end, Fn fn)
+{
+	if (field_layout == FIELD_LAYOUT_BRICKED) {
+		size_t bricks = fieldBricksPerAxis(chunk_size);
+		for (size_t b = begin; b < end; b++) {
+			unsigned int bx = static_cast<unsigned int>(b % bricks) * FIELD_BRICK_SIZE;
+			unsigned int by = static_cast<unsigned int>((b / bricks) % bricks) * FIELD_BRICK_SIZE;
+			unsigned int bz = static_cast<unsigned int>(b / (bricks * bricks)) * FIELD_BRICK_SIZE;
+			for (unsigned int i = 0; i < FIELD_BRICK_CELLS; i++) {
+				unsigned int x, y, z;
+				mortonDecode(i, x, y, z);
+				x += bx;
+				y += by;
+				z += bz;
+				if (x < chunk_size && y < chunk_size && z < chunk_size)
+					fn(x, y, z);
+			}
+		}
+		return;
 	}
 
-	return vertex;
-}
\ No newline at end of file
+	for (size_t i = begin; i < end; i++)
+		fn(static_cast<unsigned int>(i % chunk_size), static_cast<unsigned int>((i / chunk_size) % chunk_size), static_cast<unsigned int>(i / chunk_size2));
+}
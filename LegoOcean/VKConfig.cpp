@@ -1,4 +1,7 @@
 #include "VkConfig.h"
+#include "FieldGenerator.h"
+#include "MarchingCubesTables.h"
+#include "TraingleTable.h"
 #include <stdexcept>
 #include <vector>
 #include <iostream>
@@ -7,12 +10,16 @@
 
 std::vector<const char*> VulkanClass::getRequiredExtensions() {
 
-	uint32_t glfwExtentionCount = 0;
-	const char** glfwExtensions;
+	std::vector<const char*> extensions;
 
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtentionCount);
+	if (!headless) {
+		uint32_t glfwExtentionCount = 0;
+		const char** glfwExtensions;
 
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtentionCount);
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtentionCount);
+
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtentionCount);
+	}
 
 	if (enableValidationLayers) {
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -76,7 +83,10 @@ VulkanClass::VulkanClass(GLFWwindow* win) {
 	createCommandPool();
 	createCommandBuffer();
 
+	createMarchTableBuffer();
+
 	createDepthResources();
+	createOcclusionCulling();
 
 	createFramebuffers();
 
@@ -86,6 +96,42 @@ VulkanClass::VulkanClass(GLFWwindow* win) {
 
 }
 
+VulkanClass::VulkanClass(uint32_t width, uint32_t height) {
+
+	// Used for benchmarking, where validation would dominate the timings
+	headless = true;
+	enableValidationLayers = false;
+	deviceExtensions.clear();
+
+	createInstance();
+
+	physicalDevice = findPhysicalDevice();
+	createLogicalDevice();
+
+	createOffscreenImages(width, height);
+	createImageViews();
+
+	createRenderPass();
+	createDescriptorSetLayout();
+	createDescriptorPools();
+
+	createGraphicsPipeline();
+	createComputePipeline();
+
+	createCommandPool();
+	createCommandBuffer();
+
+	createMarchTableBuffer();
+
+	createDepthResources();
+	createOcclusionCulling();
+
+	createFramebuffers();
+
+	createSyncObjects();
+
+}
+
 VulkanClass::~VulkanClass() {
 
 	for (size_t i = 0; i < swapChain.framebuffers.size(); i++) {
@@ -99,30 +145,97 @@ VulkanClass::~VulkanClass() {
 	vkDestroyImage(logicalDevice, depthImage, nullptr);
 	vkFreeMemory(logicalDevice, depthImageMemory, nullptr);
 
-	vkDestroySwapchainKHR(logicalDevice, swapChain.__swapChain, nullptr);
+	destroyDepthPyramid();
+	vkDestroySampler(logicalDevice, depthPyramidSampler, nullptr);
 
-	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
-		vkDestroyBuffer(logicalDevice, transformBuffer[i], nullptr);
-		vkFreeMemory(logicalDevice, transformBufferMemory[i], nullptr);
+	if (headless) {
+		for (size_t i = 0; i < swapChain.images.size(); i++) {
+			vkDestroyImage(logicalDevice, swapChain.images[i], nullptr);
+			vkFreeMemory(logicalDevice, offscreenImageMemory[i], nullptr);
+		}
+	}
+	else {
+		vkDestroySwapchainKHR(logicalDevice, swapChain.__swapChain, nullptr);
+	}
+
+	vkDestroyBuffer(logicalDevice, transformBuffer, nullptr);
+	vkFreeMemory(logicalDevice, transformBufferMemory, nullptr);
+
+	// Tools may tear down before createPosBuffer ran
+	for (size_t i = 0; i < posBuffer.size(); i++) {
 		vkDestroyBuffer(logicalDevice, posBuffer[i], nullptr);
 		vkFreeMemory(logicalDevice, posBufferMemory[i], nullptr);
-		vkDestroyBuffer(logicalDevice, computeUniformBuffer[i], nullptr);
-		vkFreeMemory(logicalDevice, computeUniformBufferMemory[i], nullptr);
 	}
 
+	vkDestroyBuffer(logicalDevice, chunkArenaBuffer, nullptr);
+	vkFreeMemory(logicalDevice, chunkArenaMemory, nullptr);
+
+	for (size_t i = 0; i < drawBuffer.size(); i++) {
+		vkDestroyBuffer(logicalDevice, drawBuffer[i], nullptr);
+		vkFreeMemory(logicalDevice, drawBufferMemory[i], nullptr);
+	}
+
+	vkDestroyBuffer(logicalDevice, tileVisibilityBuffer, nullptr);
+	vkFreeMemory(logicalDevice, tileVisibilityMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, brickBuffer, nullptr);
+	vkFreeMemory(logicalDevice, brickBufferMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, fieldRangeBuffer, nullptr);
+	vkFreeMemory(logicalDevice, fieldRangeBufferMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, splatPointBuffer, nullptr);
+	vkFreeMemory(logicalDevice, splatPointMemory, nullptr);
+	vkDestroyBuffer(logicalDevice, splatDensityBuffer, nullptr);
+	vkFreeMemory(logicalDevice, splatDensityMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, meshReadbackBuffer, nullptr);
+	vkFreeMemory(logicalDevice, meshReadbackMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, marchTableBuffer, nullptr);
+	vkFreeMemory(logicalDevice, marchTableBufferMemory, nullptr);
+
 	delete basicShader;
+	delete brickShader;
+	delete rayMarchShader;
+	delete hizShader;
+	delete cullShader;
+	delete splatShader;
+	delete splatResolveShader;
+
+	vkDestroyDescriptorPool(logicalDevice, occlusionDescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, hizDescriptorSetLayout, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, cullDescriptorSetLayout, nullptr);
+	vkDestroyPipeline(logicalDevice, hizPipeline, nullptr);
+	vkDestroyPipelineLayout(logicalDevice, hizPipelineLayout, nullptr);
+	vkDestroyPipeline(logicalDevice, cullPipeline, nullptr);
+	vkDestroyPipelineLayout(logicalDevice, cullPipelineLayout, nullptr);
+
+	vkDestroyDescriptorPool(logicalDevice, splatDescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, splatDescriptorSetLayout, nullptr);
+	vkDestroyPipeline(logicalDevice, splatPipeline, nullptr);
+	vkDestroyPipeline(logicalDevice, splatResolvePipeline, nullptr);
+	vkDestroyPipelineLayout(logicalDevice, splatPipelineLayout, nullptr);
 
 	vkDestroyDescriptorPool(logicalDevice, computeDescriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(logicalDevice, computeDescriptorSetLayout, nullptr);
 
+	vkDestroyDescriptorPool(logicalDevice, vertexDescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, vertexDescriptorSetLayout, nullptr);
+
 	vkDestroyDescriptorPool(logicalDevice, uniformDescriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(logicalDevice, transformDescriptorSetLayout, nullptr);
 
 	vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
+	vkDestroyPipeline(logicalDevice, brickPipeline, nullptr);
+	vkDestroyPipeline(logicalDevice, rayMarchPipeline, nullptr);
+	vkDestroyPipelineLayout(logicalDevice, rayMarchPipelineLayout, nullptr);
 	vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
 	vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
 
 	vkDestroyPipeline(logicalDevice, computePipeline, nullptr);
+	vkDestroyPipeline(logicalDevice, brickComputePipeline, nullptr);
+	vkDestroyPipeline(logicalDevice, fieldRangePipeline, nullptr);
 	vkDestroyPipelineLayout(logicalDevice, computePipelineLayout, nullptr);
 
 	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
@@ -135,11 +248,14 @@ VulkanClass::~VulkanClass() {
 	}
 
 	vkFreeCommandBuffers(logicalDevice, commandPool, swapChain.MAX_FRAMES_IN_FLIGHT, commandBuffer.data());
+	vkFreeCommandBuffers(logicalDevice, commandPool, swapChain.MAX_FRAMES_IN_FLIGHT, computeCommandBuffer.data());
 	vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
 
 	vkDestroyDevice(logicalDevice, nullptr);
 
-	vkDestroySurfaceKHR(instance, surface, nullptr);
+	if (!headless) {
+		vkDestroySurfaceKHR(instance, surface, nullptr);
+	}
 
 	vkDestroyInstance(instance, nullptr);
 
@@ -205,7 +321,9 @@ bool VulkanClass::findQueueFamilies(VkPhysicalDevice device) {
 		}
 		
 		VkBool32 presentSupport = VK_FALSE;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+		if (surface != VK_NULL_HANDLE) {
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+		}
 
 		if (presentSupport) {
 			QueueFamilyIndex.presentFamily = i;
@@ -243,9 +361,23 @@ bool VulkanClass::checkSwapChainSupport(VkPhysicalDevice device) {
 
 }
 
+static int deviceTypeRank(VkPhysicalDeviceType type) {
+
+	switch (type) {
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return 4;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return 3;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return 2;
+	case VK_PHYSICAL_DEVICE_TYPE_CPU: return 1;
+	default: return 0;
+	}
+
+}
+
 VkPhysicalDevice VulkanClass::findPhysicalDevice() {
 
 	VkPhysicalDevice selectedDevice = NULL;
+	int selectedRank = 0;
+	uint32_t selectedFamily = 0;
 
 	uint32_t numSupportedDevices;
 
@@ -276,7 +408,16 @@ VkPhysicalDevice VulkanClass::findPhysicalDevice() {
 			requiredExtensions.erase(extension.extensionName);
 		}
 
-		if (!findQueueFamilies(device) || !requiredExtensions.empty() || properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU || !checkSwapChainSupport(device)) {
+		if (headless) {
+			// Any device type will do, including software rasterizers such as lavapipe; prefer real GPUs
+			int rank = deviceTypeRank(properties.deviceType);
+			if (!findQueueFamilies(device) || rank <= selectedRank) {
+				continue;
+			}
+			selectedRank = rank;
+			selectedFamily = QueueFamilyIndex.graphicsFamily;
+		}
+		else if (!findQueueFamilies(device) || !requiredExtensions.empty() || properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU || !checkSwapChainSupport(device)) {
 			continue;
 		}
 
@@ -289,6 +430,12 @@ VkPhysicalDevice VulkanClass::findPhysicalDevice() {
 		throw std::runtime_error("Cannot Find Suitable Physical Device\n");
 	}
 
+	if (headless) {
+		// findQueueFamilies ran for every candidate; keep the family of the chosen one
+		QueueFamilyIndex.graphicsFamily = selectedFamily;
+		QueueFamilyIndex.presentFamily = selectedFamily;
+	}
+
 	return selectedDevice;
 
 }
@@ -314,11 +461,30 @@ void VulkanClass::createLogicalDevice() {
 	VkPhysicalDeviceFeatures supportedFeatures{};
 	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
 
+	// None of these are needed by the current pipelines, so only ask for what the device has
 	VkPhysicalDeviceFeatures requiredFeatures{};
-	requiredFeatures.geometryShader = VK_TRUE;
-	requiredFeatures.fillModeNonSolid = VK_TRUE;
-	requiredFeatures.wideLines = VK_TRUE;
-	requiredFeatures.largePoints = VK_TRUE;
+	requiredFeatures.geometryShader = supportedFeatures.geometryShader;
+	requiredFeatures.fillModeNonSolid = supportedFeatures.fillModeNonSolid;
+	requiredFeatures.wideLines = supportedFeatures.wideLines;
+	requiredFeatures.largePoints = supportedFeatures.largePoints;
+
+	// All draws of a frame go through one vkCmdDrawIndirect when the device can; otherwise they are issued one by one
+	requiredFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	requiredFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+	multiDrawIndirect = supportedFeatures.multiDrawIndirect && supportedFeatures.drawIndirectFirstInstance;
+
+	// The occlusion pass packs its survivors for vkCmdDrawIndirectCountKHR when the device has it
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+
+	bool drawIndirectCount = multiDrawIndirect && std::any_of(availableExtensions.begin(), availableExtensions.end(), [](const VkExtensionProperties& extension) {
+		return strcmp(extension.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0;
+	});
+	if (drawIndirectCount) {
+		deviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	}
 
 	VkDeviceCreateInfo logicalDeviceCreateInfo{};
 
@@ -346,6 +512,10 @@ void VulkanClass::createLogicalDevice() {
 	vkGetDeviceQueue(logicalDevice, QueueFamilyIndex.graphicsFamily, 0, &graphicsQueue);
 	vkGetDeviceQueue(logicalDevice, QueueFamilyIndex.presentFamily, 0, &presentQueue);
 
+	if (drawIndirectCount) {
+		cmdDrawIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndirectCountKHR>(vkGetDeviceProcAddr(logicalDevice, "vkCmdDrawIndirectCountKHR"));
+	}
+
 }
 
 VkSurfaceFormatKHR SwapChain::findSwapChainFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
@@ -450,6 +620,20 @@ void VulkanClass::createSwapChain() {
 
 }
 
+void VulkanClass::createOffscreenImages(uint32_t width, uint32_t height) {
+
+	swapChain.format = { VK_FORMAT_R8G8B8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+	swapChain.extent = { width, height };
+
+	swapChain.images.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
+	offscreenImageMemory.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
+
+	for (size_t i = 0; i < swapChain.images.size(); i++) {
+		createImage(width, height, swapChain.format.format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapChain.images[i], offscreenImageMemory[i]);
+	}
+
+}
+
 void VulkanClass::createImageViews() {
 
 	swapChain.imageViews.resize(swapChain.images.size());
@@ -504,6 +688,7 @@ void VulkanClass::recreateSwapChain() {
 	createSwapChain();
 	createImageViews();
 	createDepthResources();
+	createDepthPyramid();
 	createFramebuffers();
 
 }
@@ -516,7 +701,7 @@ void VulkanClass::createRenderPass() {
 	attachmentInfo.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 	attachmentInfo.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	attachmentInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	attachmentInfo.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	attachmentInfo.finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkFormat depthFormat = findSupportedFormat(
 		{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
@@ -528,7 +713,8 @@ void VulkanClass::createRenderPass() {
 	depthAttachment.format = depthFormat;
 	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
 	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	// Kept for the next frame's occlusion pass
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -577,9 +763,9 @@ void VulkanClass::createDescriptorSetLayout() {
 
 	VkDescriptorSetLayoutBinding transformLayoutBinding{};
 	transformLayoutBinding.binding = 0;
-	transformLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	transformLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	transformLayoutBinding.descriptorCount = 1;
-	transformLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	transformLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
 
 	VkDescriptorSetLayoutCreateInfo transformLayoutInfo{};
 	transformLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -590,11 +776,31 @@ void VulkanClass::createDescriptorSetLayout() {
 		throw std::runtime_error("Failed to create Transform Descriptor Set layout\n");
 	}
 
-	std::vector<VkDescriptorSetLayoutBinding> computeLayoutBindings(3);
+	// Vertices and draw origins pulled by shader.vert
+	std::vector<VkDescriptorSetLayoutBinding> vertexLayoutBindings(2);
+	for (uint32_t binding = 0; binding < vertexLayoutBindings.size(); binding++) {
+		vertexLayoutBindings[binding].binding = binding;
+		vertexLayoutBindings[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		vertexLayoutBindings[binding].descriptorCount = 1;
+		vertexLayoutBindings[binding].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo vertexLayoutInfo{};
+	vertexLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	vertexLayoutInfo.bindingCount = static_cast<uint32_t>(vertexLayoutBindings.size());
+	vertexLayoutInfo.pBindings = vertexLayoutBindings.data();
+
+	if (vkCreateDescriptorSetLayout(logicalDevice, &vertexLayoutInfo, nullptr, &vertexDescriptorSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create Vertex Descriptor Set layout\n");
+	}
+
+	// Compute uniforms are push constants, so the compute set only holds the field, vertex, case table, tile
+	// visibility, brick and field range storage buffers. raymarch.frag reads the field and its ranges as well.
+	std::vector<VkDescriptorSetLayoutBinding> computeLayoutBindings(6);
 	computeLayoutBindings[0].binding = 0;
-	computeLayoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	computeLayoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 	computeLayoutBindings[0].descriptorCount = 1;
-	computeLayoutBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	computeLayoutBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
 
 	computeLayoutBindings[1].binding = 1;
 	computeLayoutBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
@@ -606,9 +812,24 @@ void VulkanClass::createDescriptorSetLayout() {
 	computeLayoutBindings[2].descriptorCount = 1;
 	computeLayoutBindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
+	computeLayoutBindings[3].binding = 3;
+	computeLayoutBindings[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	computeLayoutBindings[3].descriptorCount = 1;
+	computeLayoutBindings[3].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	computeLayoutBindings[4].binding = 4;
+	computeLayoutBindings[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	computeLayoutBindings[4].descriptorCount = 1;
+	computeLayoutBindings[4].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	computeLayoutBindings[5].binding = 5;
+	computeLayoutBindings[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	computeLayoutBindings[5].descriptorCount = 1;
+	computeLayoutBindings[5].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
 	VkDescriptorSetLayoutCreateInfo computeLayoutInfo{};
 	computeLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	computeLayoutInfo.bindingCount = 3;
+	computeLayoutInfo.bindingCount = static_cast<uint32_t>(computeLayoutBindings.size());
 	computeLayoutInfo.pBindings = computeLayoutBindings.data();
 
 	if (vkCreateDescriptorSetLayout(logicalDevice, &computeLayoutInfo, nullptr, &computeDescriptorSetLayout) != VK_SUCCESS) {
@@ -633,105 +854,120 @@ uint32_t VulkanClass::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags
 
 void VulkanClass::createTransformBuffer(VkDeviceSize bufferSize) {
 
-	transformBuffer.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
-	transformBufferMemory.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
-	transformBufferMap.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
+	// Every frame in flight gets its own slot, aligned so it can be selected with a dynamic offset
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
-	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
-		VkBufferCreateInfo bufferInfo{};
-		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bufferInfo.size = bufferSize;
-		bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+	transformBufferStride = (bufferSize + alignment - 1) & ~(alignment - 1);
 
-		if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &transformBuffer[i]) != VK_SUCCESS)
-			throw std::runtime_error("Failed To create Transform Uniform Buffer\n");
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = transformBufferStride * swapChain.MAX_FRAMES_IN_FLIGHT;
+	bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-		VkMemoryRequirements memreq;
-		vkGetBufferMemoryRequirements(logicalDevice, transformBuffer[i], &memreq);
+	if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &transformBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed To create Transform Uniform Buffer\n");
 
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memreq.size;
-		allocInfo.memoryTypeIndex = findMemoryType(memreq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	VkMemoryRequirements memreq;
+	vkGetBufferMemoryRequirements(logicalDevice, transformBuffer, &memreq);
 
-		if(vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &transformBufferMemory[i]) != VK_SUCCESS)
-			throw std::runtime_error("Failed to Allocate Transform Uniform Buffer Memory\n6");
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memreq.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memreq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-		vkBindBufferMemory(logicalDevice, transformBuffer[i], transformBufferMemory[i], 0);
+	if(vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &transformBufferMemory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Allocate Transform Uniform Buffer Memory\n6");
 
-		vkMapMemory(logicalDevice, transformBufferMemory[i], 0, bufferSize, 0, &transformBufferMap[i]);
-	}
+	vkBindBufferMemory(logicalDevice, transformBuffer, transformBufferMemory, 0);
+
+	vkMapMemory(logicalDevice, transformBufferMemory, 0, bufferInfo.size, 0, &transformBufferMap);
 
 }
 
 void VulkanClass::createDescriptorPools() {
 
 	VkDescriptorPoolSize poolSize{};
-	poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSize.descriptorCount = static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT);
+	poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSize.descriptorCount = 1;
 
 	VkDescriptorPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.poolSizeCount = 1;
 	poolInfo.pPoolSizes = &poolSize;
-	poolInfo.maxSets = static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT);
+	poolInfo.maxSets = 1;
 
 	if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &uniformDescriptorPool) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to Create Uniform Descriptor Pool\n");
 	}
 
-	std::vector<VkDescriptorPoolSize> poolSizes(2);
-	poolSizes[0] = {};
-	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[0].descriptorCount = static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT);
-	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	poolSizes[1].descriptorCount = static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT * 2);
+	VkDescriptorPoolSize storagePoolSize{};
+	storagePoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	storagePoolSize.descriptorCount = static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT * 6);
 
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolInfo.poolSizeCount = poolSizes.size();
-	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &storagePoolSize;
 	poolInfo.maxSets = static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT);
 
 	if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &computeDescriptorPool) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to Create Compute Descriptor Pool\n");
 	}
 
+	// The vertex sets are written by updateVertexDescriptorSets once the buffers they point at exist
+	uint32_t vertexSets = static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT * 2);
+	storagePoolSize.descriptorCount = vertexSets * 2;
+	poolInfo.maxSets = vertexSets;
+
+	if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &vertexDescriptorPool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Vertex Descriptor Pool\n");
+	}
+
+	std::vector<VkDescriptorSetLayout> vertexLayouts(vertexSets, vertexDescriptorSetLayout);
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = vertexDescriptorPool;
+	allocInfo.descriptorSetCount = vertexSets;
+	allocInfo.pSetLayouts = vertexLayouts.data();
+
+	vertexDescriptorSets.resize(vertexSets);
+
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, vertexDescriptorSets.data()) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Vertex Descriptor Sets\n");
+	}
+
 }
 
 void VulkanClass::createTransformDescriptorSet() {
 
-	std::vector<VkDescriptorSetLayout> layouts(static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT), transformDescriptorSetLayout);
-
 	VkDescriptorSetAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = uniformDescriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT);
-	allocInfo.pSetLayouts = layouts.data();
-
-	transformDescriptorSet.resize(static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT));
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &transformDescriptorSetLayout;
 
-	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, transformDescriptorSet.data()) != VK_SUCCESS) {
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &transformDescriptorSet) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to Create Transform Descriptor Set\n");
 	}
 
-	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
-		VkDescriptorBufferInfo bufferInfo{};
-		bufferInfo.buffer = transformBuffer[i];
-		bufferInfo.offset = 0;
-		bufferInfo.range = sizeof(transform);
+	VkDescriptorBufferInfo bufferInfo{};
+	bufferInfo.buffer = transformBuffer;
+	bufferInfo.offset = 0;
+	bufferInfo.range = sizeof(transform);
 
-		VkWriteDescriptorSet transformWrite{};
-		transformWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		transformWrite.dstSet = transformDescriptorSet[i];
-		transformWrite.dstBinding = 0;
-		transformWrite.dstArrayElement = 0;
-		transformWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		transformWrite.descriptorCount = 1;
-		transformWrite.pBufferInfo = &bufferInfo;
+	VkWriteDescriptorSet transformWrite{};
+	transformWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	transformWrite.dstSet = transformDescriptorSet;
+	transformWrite.dstBinding = 0;
+	transformWrite.dstArrayElement = 0;
+	transformWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	transformWrite.descriptorCount = 1;
+	transformWrite.pBufferInfo = &bufferInfo;
 
-		vkUpdateDescriptorSets(logicalDevice, 1, &transformWrite, 0, nullptr);
-	}
+	vkUpdateDescriptorSets(logicalDevice, 1, &transformWrite, 0, nullptr);
 
 }
 
@@ -739,28 +975,11 @@ void VulkanClass::createGraphicsPipeline() {
 
 	basicShader = new Shader("shader", logicalDevice);
 
-	VkVertexInputBindingDescription bindingDescription{};
-	bindingDescription.binding = 0;
-	bindingDescription.stride = sizeof(Particle);
-	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-	std::vector<VkVertexInputAttributeDescription> attributeDescriptions(2);
-
-	attributeDescriptions[0].binding = 0;
-	attributeDescriptions[0].location = 1;
-	attributeDescriptions[0].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-	attributeDescriptions[0].offset = offsetof(Particle, pos);
-	attributeDescriptions[1].binding = 0;
-	attributeDescriptions[1].location = 2;
-	attributeDescriptions[1].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-	attributeDescriptions[1].offset = offsetof(Particle, normal);
-
+	// shader.vert pulls its vertices and origins from storage buffers, so there is no vertex input
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+	vertexInputInfo.vertexAttributeDescriptionCount = 0;
+	vertexInputInfo.vertexBindingDescriptionCount = 0;
 
 	VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo{};
 	inputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -818,10 +1037,13 @@ void VulkanClass::createGraphicsPipeline() {
 	colorBlendGlobal.attachmentCount = 1;
 	colorBlendGlobal.pAttachments = &colorBlend;
 
+	// Set 1 holds the vertices; bricks.vert only uses set 0
+	VkDescriptorSetLayout setLayouts[] = { transformDescriptorSetLayout, vertexDescriptorSetLayout };
+
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 1;
-	pipelineLayoutInfo.pSetLayouts = &transformDescriptorSetLayout;
+	pipelineLayoutInfo.setLayoutCount = 2;
+	pipelineLayoutInfo.pSetLayouts = setLayouts;
 
 	if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
 		throw std::runtime_error("Failed To Create Pipeline Layout\n");
@@ -849,6 +1071,66 @@ void VulkanClass::createGraphicsPipeline() {
 		throw std::runtime_error("Failed To Create Graphics Pipeline\n");
 	}
 
+	// Brick mode: bricks.vert with the same fragment shader, fed one brick per instance
+	brickShader = new Shader("bricks", logicalDevice, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT);
+	std::vector<VkPipelineShaderStageCreateInfo> brickStages = { brickShader->shaderStageInfos[0], basicShader->shaderStageInfos[1] };
+
+	VkVertexInputBindingDescription brickBinding{};
+	brickBinding.binding = 0;
+	brickBinding.stride = sizeof(glm::uvec2);
+	brickBinding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+	VkVertexInputAttributeDescription brickAttribute{};
+	brickAttribute.binding = 0;
+	brickAttribute.location = 0;
+	brickAttribute.format = VK_FORMAT_R32G32_UINT;
+	brickAttribute.offset = 0;
+
+	vertexInputInfo.vertexBindingDescriptionCount = 1;
+	vertexInputInfo.pVertexBindingDescriptions = &brickBinding;
+	vertexInputInfo.vertexAttributeDescriptionCount = 1;
+	vertexInputInfo.pVertexAttributeDescriptions = &brickAttribute;
+
+	graphicsPipelineInfo.stageCount = static_cast<uint32_t>(brickStages.size());
+	graphicsPipelineInfo.pStages = brickStages.data();
+
+	if (vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1, &graphicsPipelineInfo, nullptr, &brickPipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Failed To Create Brick Pipeline\n");
+	}
+
+	// Ray-march mode: a full-screen triangle without vertex input; the fragment shader reads the field through
+	// the compute set and takes the compute push constants
+	rayMarchShader = new Shader("raymarch", logicalDevice);
+
+	VkDescriptorSetLayout rayMarchSetLayouts[] = { transformDescriptorSetLayout, computeDescriptorSetLayout };
+
+	VkPushConstantRange rayMarchPushConstants{};
+	rayMarchPushConstants.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	rayMarchPushConstants.offset = 0;
+	rayMarchPushConstants.size = sizeof(ComputeUniforms);
+
+	pipelineLayoutInfo.setLayoutCount = 2;
+	pipelineLayoutInfo.pSetLayouts = rayMarchSetLayouts;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &rayMarchPushConstants;
+
+	if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &rayMarchPipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed To Create Ray March Pipeline Layout\n");
+	}
+
+	vertexInputInfo.vertexBindingDescriptionCount = 0;
+	vertexInputInfo.pVertexBindingDescriptions = nullptr;
+	vertexInputInfo.vertexAttributeDescriptionCount = 0;
+	vertexInputInfo.pVertexAttributeDescriptions = nullptr;
+
+	graphicsPipelineInfo.stageCount = static_cast<uint32_t>(rayMarchShader->shaderStageInfos.size());
+	graphicsPipelineInfo.pStages = rayMarchShader->shaderStageInfos.data();
+	graphicsPipelineInfo.layout = rayMarchPipelineLayout;
+
+	if (vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1, &graphicsPipelineInfo, nullptr, &rayMarchPipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Failed To Create Ray March Pipeline\n");
+	}
+
 }
 
 void VulkanClass::createFramebuffers() {
@@ -900,6 +1182,40 @@ void VulkanClass::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t im
 		throw std::runtime_error("Failed To Being Recording Command Buffer\n");
 	}
 
+	// Draw i is instance i, so it reads origin i. Brick and ray-march mode have a single draw of their own.
+	bool bricks = brickMode && !drawChunks;
+	bool rayMarch = rayMarchMode && !drawChunks && !bricks;
+	uint32_t numDraws = bricks || rayMarch ? 0 : static_cast<uint32_t>(std::min(meshDraws.size(), maxDraws));
+	char* drawMap = static_cast<char*>(drawBufferMap[currentFrame]);
+	VkDrawIndirectCommand* commands = reinterpret_cast<VkDrawIndirectCommand*>(drawMap);
+	glm::vec4* origins = reinterpret_cast<glm::vec4*>(drawMap + drawOriginsOffset);
+	bool occlusion = (occlusionCulling || clusterCulling) && occlusionSupported && !bricks && !rayMarch;
+
+	std::vector<uint32_t>& occlusionIds = occlusionIdsInFlight[currentFrame];
+	occlusionIds.clear();
+	occlusionChunksInFlight[currentFrame] = drawChunks;
+
+	if (occlusion) {
+		// cull.comp writes the commands and origins of the draws that pass
+		memcpy(drawMap + drawCandidatesOffset, meshDraws.data(), sizeof(MeshDraw) * numDraws);
+		memset(drawMap + drawVisibilityOffset, 0, sizeof(uint32_t) * ((numDraws + 31) / 32));
+		memset(drawMap + drawCountOffset, 0, sizeof(uint32_t));
+		for (uint32_t i = 0; i < numDraws; i++) {
+			occlusionIds.push_back(meshDraws[i].occlusionId);
+		}
+
+		recordOcclusionCulling(commandBuffer, currentFrame, numDraws);
+	}
+	else {
+		for (uint32_t i = 0; i < numDraws; i++) {
+			commands[i].vertexCount = meshDraws[i].vertexCount;
+			commands[i].instanceCount = 1;
+			commands[i].firstVertex = meshDraws[i].firstVertex;
+			commands[i].firstInstance = i;
+			origins[i] = meshDraws[i].origin;
+		}
+	}
+
 	VkRenderPassBeginInfo renderPassBeginInfo{};
 	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 	renderPassBeginInfo.renderPass = renderPass;
@@ -917,7 +1233,7 @@ void VulkanClass::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t im
 	
 	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, bricks ? brickPipeline : rayMarch ? rayMarchPipeline : graphicsPipeline);
 
 	VkViewport viewport{};
 	viewport.x = 0.0f;
@@ -933,17 +1249,49 @@ void VulkanClass::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t im
 	scissorRect.offset = { 0,0 };
 	//vkCmdSetScissor(commandBuffer, 0, 1, &scissorRect);
 
-	VkDeviceSize offsets[] = { 0 };
+	uint32_t transformOffset = static_cast<uint32_t>(transformBufferStride * currentFrame);
 
-	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &posBuffer[1], offsets);
+	if (rayMarch) {
+		VkDescriptorSet sets[] = { transformDescriptorSet, computeDescriptorSets[currentFrame] };
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, rayMarchPipelineLayout, 0, 2, sets, 1, &transformOffset);
+		vkCmdPushConstants(commandBuffer, rayMarchPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(ComputeUniforms), &computeUniform);
+	}
+	else {
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &transformDescriptorSet, 1, &transformOffset);
+	}
 
-	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &transformDescriptorSet[currentFrame], 0, nullptr);
+	if (rayMarch) {
+		vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+	}
+	else if (bricks) {
+		// The instances follow the draw command bricks.comp filled in
+		VkDeviceSize brickOffset = sizeof(VkDrawIndirectCommand);
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &brickBuffer, &brickOffset);
+		vkCmdDrawIndirect(commandBuffer, brickBuffer, 0, 1, sizeof(VkDrawIndirectCommand));
+	}
+	else {
+		VkDescriptorSet vertexSet = vertexDescriptorSets[currentFrame * 2 + (drawChunks ? 1 : 0)];
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &vertexSet, 0, nullptr);
 
-	vkCmdDraw(commandBuffer, NUM_PARTICLES*15.0, 1, 0, 0);
-	//vkCmdDraw(commandBuffer, 36, 1000, 0, 0);
+		if (occlusion && cmdDrawIndirectCount) {
+			cmdDrawIndirectCount(commandBuffer, drawBuffer[currentFrame], 0, drawBuffer[currentFrame], drawCountOffset, numDraws, sizeof(VkDrawIndirectCommand));
+		}
+		else if (multiDrawIndirect) {
+			vkCmdDrawIndirect(commandBuffer, drawBuffer[currentFrame], 0, numDraws, sizeof(VkDrawIndirectCommand));
+		}
+		else {
+			for (uint32_t i = 0; i < numDraws; i++) {
+				vkCmdDraw(commandBuffer, commands[i].vertexCount, 1, commands[i].firstVertex, i);
+			}
+		}
+	}
 
 	vkCmdEndRenderPass(commandBuffer);
 
+	// The next frame's occlusion pass tests against this frame's depth
+	depthHistoryValid = occlusionSupported;
+	depthHistoryClip = transform.P * transform.V * transform.M;
+
 	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
 		throw std::runtime_error("Failed To Record Command Buffer\n");
 	}
@@ -959,9 +1307,11 @@ void VulkanClass::createCommandBuffer() {
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 
 	commandBuffer.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
+	computeCommandBuffer.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
 
 	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
-		if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer[i]) != VK_SUCCESS) {
+		if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer[i]) != VK_SUCCESS ||
+			vkAllocateCommandBuffers(logicalDevice, &allocInfo, &computeCommandBuffer[i]) != VK_SUCCESS) {
 			throw std::runtime_error("Failed To Allocate Command Buffer\n");
 		}
 	}
@@ -1000,44 +1350,88 @@ void VulkanClass::createSyncObjects() {
 
 }
 
-void VulkanClass::draw(uint32_t imageIndex) {
+bool VulkanClass::acquireFrame(uint32_t currentFrame) {
+
+	// The field and vertex buffers are shared by all frames, so the previous frame's compute pass must be done too
+	uint32_t previousFrame = (currentFrame + swapChain.MAX_FRAMES_IN_FLIGHT - 1) % swapChain.MAX_FRAMES_IN_FLIGHT;
+	VkFence fences[] = { inFlightFence[currentFrame], computeInFlightFences[previousFrame] };
+
+	vkWaitForFences(logicalDevice, 2, fences, VK_TRUE, UINT64_MAX);
 
-	uint32_t index;
+	collectOcclusionResults(currentFrame);
 
-	VkResult result = vkAcquireNextImageKHR(logicalDevice, swapChain.__swapChain, UINT32_MAX, imageAvailableSemaphore[imageIndex], VK_NULL_HANDLE, &index);
+	if (meshReadbackState == MESH_READBACK_COPYING && meshReadbackFrame == currentFrame) {
+		meshReadbackState = MESH_READBACK_READY;
+	}
+
+	if (headless) {
+		acquiredImageIndex = currentFrame;
+		return true;
+	}
+
+	VkResult result = vkAcquireNextImageKHR(logicalDevice, swapChain.__swapChain, UINT32_MAX, imageAvailableSemaphore[currentFrame], VK_NULL_HANDLE, &acquiredImageIndex);
 
 	if (result == VK_ERROR_OUT_OF_DATE_KHR) {
 		recreateSwapChain();
 		std::cout << "NO WORK SUBMITTED\n";
-		return;
+		return false;
 	}
 
-	//std::cout << "WORK SUBMITTED\n";
+	return true;
+
+}
+
+void VulkanClass::waitForPreviousDraw(uint32_t currentFrame) {
+
+	// The fence of a frame that was never submitted is still signalled
+	uint32_t previousFrame = (currentFrame + swapChain.MAX_FRAMES_IN_FLIGHT - 1) % swapChain.MAX_FRAMES_IN_FLIGHT;
+	vkWaitForFences(logicalDevice, 1, &inFlightFence[previousFrame], VK_TRUE, UINT64_MAX);
+
+}
+
+void VulkanClass::recordFrame(uint32_t currentFrame) {
+
+	updateTransform(currentFrame);
 
-	vkResetFences(logicalDevice, 1, &inFlightFence[imageIndex]);
+	vkResetCommandBuffer(computeCommandBuffer[currentFrame], 0);
+	recordComputeCommandBuffer(computeCommandBuffer[currentFrame], currentFrame);
 
-	vkResetCommandBuffer(commandBuffer[imageIndex], 0);
+	vkResetCommandBuffer(commandBuffer[currentFrame], 0);
+	recordCommandBuffer(commandBuffer[currentFrame], acquiredImageIndex, currentFrame);
 
-	recordCommandBuffer(commandBuffer[imageIndex], index, imageIndex);
+}
+
+void VulkanClass::draw(uint32_t currentFrame) {
+
+	//std::cout << "WORK SUBMITTED\n";
+
+	vkResetFences(logicalDevice, 1, &inFlightFence[currentFrame]);
 
 	VkSubmitInfo submitInfo{};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	
-	VkSemaphore waitSemaphores[] = { computeFinishedSemaphores[imageIndex], imageAvailableSemaphore[imageIndex] };
-	VkSemaphore signalSemaphores[] = { renderFinishedSempahore[imageIndex] };
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-	submitInfo.waitSemaphoreCount = 2;
+	VkSemaphore waitSemaphores[] = { computeFinishedSemaphores[currentFrame], imageAvailableSemaphore[currentFrame] };
+	VkSemaphore signalSemaphores[] = { renderFinishedSempahore[currentFrame] };
+	// The brick draw reads its indirect command from the compute pass, the mesh draws pull the vertices it wrote and
+	// the ray-march pass reads the field ranges
+	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	// Offscreen images are owned per frame, there is no acquire semaphore to wait on
+	submitInfo.waitSemaphoreCount = headless ? 1 : 2;
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
 	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer[imageIndex];
+	submitInfo.pCommandBuffers = &commandBuffer[currentFrame];
 	submitInfo.signalSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
-	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFence[imageIndex]) != VK_SUCCESS) {
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFence[currentFrame]) != VK_SUCCESS) {
 		throw std::runtime_error("Failed To Submit Draw Command\n");
 	}
 
+	if (headless) {
+		return;
+	}
+
 	VkPresentInfoKHR presentInfo{};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	presentInfo.waitSemaphoreCount = 1;
@@ -1046,9 +1440,9 @@ void VulkanClass::draw(uint32_t imageIndex) {
 	VkSwapchainKHR swapChains[] = { swapChain.__swapChain };
 	presentInfo.swapchainCount = 1;
 	presentInfo.pSwapchains = swapChains;
-	presentInfo.pImageIndices = &index;
+	presentInfo.pImageIndices = &acquiredImageIndex;
 
-	result = vkQueuePresentKHR(presentQueue, &presentInfo);
+	VkResult result = vkQueuePresentKHR(presentQueue, &presentInfo);
 
 	if (result == VK_ERROR_OUT_OF_DATE_KHR || framebufferResized) {
 		framebufferResized = false;
@@ -1058,11 +1452,10 @@ void VulkanClass::draw(uint32_t imageIndex) {
 
 }
 
-void VulkanClass::updateTransform() {
+void VulkanClass::updateTransform(uint32_t currentFrame) {
 
-	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
-		memcpy(transformBufferMap[i], &transform, sizeof(transform));
-	}
+	// Only the slot of the frame being recorded is written; the caller has waited on its fence
+	memcpy(static_cast<char*>(transformBufferMap) + transformBufferStride * currentFrame, &transform, sizeof(transform));
 
 }
 
@@ -1071,25 +1464,97 @@ float randomFloat()
 	return (float)(rand()) / (float)(RAND_MAX);
 }
 
+void VulkanClass::setGrid(int size, int layout, int isoLevels) {
+
+	// Must be called before createPosBuffer, which sizes the field and vertex buffers from it
+	gridSize = size;
+	gridSize2 = size * size;
+	NUM_PARTICLES = size * gridSize2;
+	fieldLayout = layout;
+	fieldCells = fieldCellCount(layout, size);
+	isoLevelCount = std::clamp(isoLevels, 1, MAX_ISO_LEVELS);
+
+	// Everything is visible until the host culls
+	size_t tiles = (size_t)gridTilesPerAxis() * gridTilesPerAxis();
+	gridTileMeshMask.assign((tiles + 31) / 32, ~0u);
+
+}
+
+void VulkanClass::cullGrid(const Frustum* frustum) {
+
+	int size = gridSize;
+	int tiles = gridTilesPerAxis();
+	int tileCells = FIELD_BRICK_SIZE;
+	bool occlusion = occlusionCulling && occlusionSupported && !occludedChunks;
+	std::vector<bool> inView((size_t)tiles * tiles);
+
+	for (int tz = 0; tz < tiles; tz++) {
+		for (int ty = 0; ty < tiles; ty++) {
+			glm::vec3 boxMin = glm::vec3(0.0f, ty * tileCells, tz * tileCells) * voxel_size;
+			glm::vec3 boxMax = glm::vec3(size, std::min((ty + 1) * tileCells, size), std::min((tz + 1) * tileCells, size)) * voxel_size;
+			uint32_t tile = ty + tiles * tz;
+			inView[tile] = frustum == nullptr || frustumIntersectsBox(*frustum, boxMin, boxMax);
+
+			bool occluded = occlusion && std::binary_search(occludedIds.begin(), occludedIds.end(), tile);
+			if (inView[tile] && !occluded)
+				gridTileMeshMask[tile >> 5] |= 1u << (tile & 31);
+			else
+				gridTileMeshMask[tile >> 5] &= ~(1u << (tile & 31));
+		}
+	}
+
+	// Within a z slab a tile's rows are contiguous, and so are tiles next to each other. Those merge into one draw,
+	// unless the occlusion pass needs every draw to be a single tile.
+	size_t streamVertices = marchStreamVertices();
+	size_t rowVertices = (size_t)size * 15;
+	meshDraws.clear();
+
+	for (int level = 0; level < isoLevelCount; level++) {
+		for (int z = 0; z < size; z++) {
+			for (int ty = 0; ty < tiles; ty++) {
+				uint32_t tile = ty + tiles * (z / tileCells);
+				if (!inView[tile])
+					continue;
+
+				int rows = std::min(tileCells, size - ty * tileCells);
+				MeshDraw draw;
+				draw.origin = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+				draw.boxMin = glm::vec4(glm::vec3(0.0f, ty * tileCells, z) * voxel_size, 0.0f);
+				draw.boxMax = glm::vec4(glm::vec3(size, ty * tileCells + rows, z + 1) * voxel_size, 0.0f);
+				draw.firstVertex = static_cast<uint32_t>(level * streamVertices + ((size_t)z * size + ty * tileCells) * rowVertices);
+				draw.vertexCount = static_cast<uint32_t>(rows * rowVertices);
+				draw.occlusionId = tile;
+
+				MeshDraw* last = meshDraws.empty() ? nullptr : &meshDraws.back();
+				if (!occlusion && last && last->firstVertex + last->vertexCount == draw.firstVertex) {
+					last->vertexCount += draw.vertexCount;
+					last->boxMin = glm::min(last->boxMin, draw.boxMin);
+					last->boxMax = glm::max(last->boxMax, draw.boxMax);
+				}
+				else {
+					meshDraws.push_back(draw);
+				}
+			}
+		}
+	}
+
+}
+
 void VulkanClass::createPosBuffer() {
 
 	VkBufferCreateInfo posBufferCreateInfo{};
 	posBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	posBufferCreateInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	posBufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 	posBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	posBufferCreateInfo.size = sizeof(float) * NUM_PARTICLES;
+	posBufferCreateInfo.size = sizeof(float) * fieldCells;
 
 	posBuffer.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
 	posBufferMemory.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
 	posBufferMap.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
 
-	computeUniformBuffer.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
-	computeUniformBufferMemory.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
-	computeUniformBufferMap.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
-
 	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
 		if (i == 1) {
-			posBufferCreateInfo.size = sizeof(Particle) * NUM_PARTICLES * 15.0;
+			posBufferCreateInfo.size = sizeof(PackedVertex) * vertexCount();
 		}
 
 		if (vkCreateBuffer(logicalDevice, &posBufferCreateInfo, nullptr, &posBuffer[i]) != VK_SUCCESS) {
@@ -1112,27 +1577,6 @@ void VulkanClass::createPosBuffer() {
 		vkBindBufferMemory(logicalDevice, posBuffer[i], posBufferMemory[i], 0);
 
 		vkMapMemory(logicalDevice, posBufferMemory[i], 0, memreq.size, 0, &posBufferMap[i]);
-
-		VkBufferCreateInfo bufferInfo{};
-		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bufferInfo.size = sizeof(ComputeUniforms);
-		bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-		if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &computeUniformBuffer[i]) != VK_SUCCESS)
-			throw std::runtime_error("Failed To create Transform Uniform Buffer\n");
-
-		vkGetBufferMemoryRequirements(logicalDevice, computeUniformBuffer[i], &memreq);
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memreq.size;
-		allocInfo.memoryTypeIndex = findMemoryType(memreq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-		if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &computeUniformBufferMemory[i]) != VK_SUCCESS)
-			throw std::runtime_error("Failed to Allocate Transform Uniform Buffer Memory\n6");
-
-		vkBindBufferMemory(logicalDevice, computeUniformBuffer[i], computeUniformBufferMemory[i], 0);
-
-		vkMapMemory(logicalDevice, computeUniformBufferMemory[i], 0, sizeof(ComputeUniforms), 0, &computeUniformBufferMap[i]);
 	}
 
 	VkBuffer stagingBuffer = nullptr;
@@ -1141,27 +1585,12 @@ void VulkanClass::createPosBuffer() {
 	stagingBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	stagingBufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 	stagingBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	stagingBufferCreateInfo.size = sizeof(float) * NUM_PARTICLES;
+	stagingBufferCreateInfo.size = sizeof(float) * fieldCells;
 
 	std::vector<float> field;
-	std::vector<Particle> particles;
-
-	for (size_t i = 0; i < NUM_PARTICLES; i++)  {
-
-		int cell_x = (i % gridSize) - gridSize/2;
-		int cell_y = (i / gridSize2) - gridSize/2;
-		int cell_z = (i / gridSize)%gridSize - gridSize/2;
+	std::vector<PackedVertex> particles;
 
-		float dist = sqrt(cell_x * cell_x + cell_y * cell_y + cell_z * cell_z);
-
-		float fieldStrength = 1.0f;
-
-		if (dist > 6.0) {
-			fieldStrength = 0.0f;
-		}
-
-		field.push_back(fieldStrength);
-	}
+	sphereField(gridSize, fieldLayout, 6.0f, field);
 
 	//for (size_t i = 0; i < NUM_PARTICLES; i++) {
 	//	
@@ -1176,11 +1605,8 @@ void VulkanClass::createPosBuffer() {
 
 	//}
 
-	for (size_t i = 0; i < NUM_PARTICLES * 15.0; i++) {
-		Particle part;
-
-		part.pos = glm::vec4(1.0f);
-		part.normal = glm::vec4(-1.0f);
+	for (size_t i = 0; i < vertexCount(); i++) {
+		PackedVertex part{};
 
 		particles.push_back(part);
 	}
@@ -1190,7 +1616,7 @@ void VulkanClass::createPosBuffer() {
 	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
 
 		if (i == 1) {
-			stagingBufferCreateInfo.size = sizeof(Particle) * NUM_PARTICLES * 15.0;
+			stagingBufferCreateInfo.size = sizeof(PackedVertex) * vertexCount();
 		}
 
 		vkCreateBuffer(logicalDevice, &stagingBufferCreateInfo, nullptr, &stagingBuffer);
@@ -1210,13 +1636,13 @@ void VulkanClass::createPosBuffer() {
 		void* data = nullptr;
 
 		if (i == 0) {
-			vkMapMemory(logicalDevice, stagingBufferMemory, 0, sizeof(float) * NUM_PARTICLES, 0, &data);
-			memcpy(data, field.data(), (size_t)(sizeof(float) * NUM_PARTICLES));
+			vkMapMemory(logicalDevice, stagingBufferMemory, 0, sizeof(float) * fieldCells, 0, &data);
+			memcpy(data, field.data(), (size_t)(sizeof(float) * fieldCells));
 			vkUnmapMemory(logicalDevice, stagingBufferMemory);
 		}
 		else {
-			vkMapMemory(logicalDevice, stagingBufferMemory, 0, sizeof(Particle) * NUM_PARTICLES * 15.0, 0, &data);
-			memcpy(data, particles.data(), (size_t)(sizeof(Particle) * NUM_PARTICLES * 15.0));
+			vkMapMemory(logicalDevice, stagingBufferMemory, 0, sizeof(PackedVertex) * vertexCount(), 0, &data);
+			memcpy(data, particles.data(), (size_t)(sizeof(PackedVertex) * vertexCount()));
 			vkUnmapMemory(logicalDevice, stagingBufferMemory);
 		}
 
@@ -1237,9 +1663,9 @@ void VulkanClass::createPosBuffer() {
 
 		VkBufferCopy copyRegion{};
 		if (i==0)
-			copyRegion.size = sizeof(float) * NUM_PARTICLES;
+			copyRegion.size = sizeof(float) * fieldCells;
 		else 
-			copyRegion.size = sizeof(Particle) * NUM_PARTICLES * 15.0;
+			copyRegion.size = sizeof(PackedVertex) * vertexCount();
 		copyRegion.srcOffset = 0;
 		copyRegion.dstOffset = 0;
 		vkCmdCopyBuffer(copyCommandBuffer, stagingBuffer, posBuffer[i], 1, &copyRegion);
@@ -1260,60 +1686,592 @@ void VulkanClass::createPosBuffer() {
 	vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
 	vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
 
+	createTileVisibilityBuffer();
+	createBrickBuffer();
+	createFieldRangeBuffer();
+
 }
 
-void VulkanClass::createComputeDescriptorSet() {
+void VulkanClass::createTileVisibilityBuffer() {
 
-	std::vector<VkDescriptorSetLayout> layouts(static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT), computeDescriptorSetLayout);
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
-	VkDescriptorSetAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	allocInfo.descriptorPool = computeDescriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT);
-	allocInfo.pSetLayouts = layouts.data();
+	VkDeviceSize alignment = properties.limits.minStorageBufferOffsetAlignment;
+	tileVisibilityStride = (sizeof(uint32_t) * gridTileMeshMask.size() + alignment - 1) & ~(alignment - 1);
 
-	computeDescriptorSets.resize(static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT));
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = tileVisibilityStride * swapChain.MAX_FRAMES_IN_FLIGHT;
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, computeDescriptorSets.data()) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to Create Compute Descriptor Set\n");
-	}
+	if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &tileVisibilityBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Create Tile Visibility Buffer\n");
 
-	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
+	VkMemoryRequirements memreq;
+	vkGetBufferMemoryRequirements(logicalDevice, tileVisibilityBuffer, &memreq);
 
-		std::vector<VkWriteDescriptorSet> descriptorWrites(3);
-		
-		VkDescriptorBufferInfo uniformBufferInfo{};
-		uniformBufferInfo.buffer = computeUniformBuffer[i];
-		uniformBufferInfo.offset = 0;
-		uniformBufferInfo.range = sizeof(ComputeUniforms);
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memreq.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memreq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-		descriptorWrites[0] = {};
-		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[0].descriptorCount = 1;
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[0].dstBinding = 0;
-		descriptorWrites[0].dstArrayElement = 0;
-		descriptorWrites[0].dstSet = computeDescriptorSets[i];
-		descriptorWrites[0].pBufferInfo = &uniformBufferInfo;
+	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &tileVisibilityMemory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Allocate Tile Visibility Memory\n");
 
-		VkDescriptorBufferInfo shaderStoragePrevFrame{};
-		shaderStoragePrevFrame.buffer = posBuffer[0];
-		shaderStoragePrevFrame.offset = 0;
-		shaderStoragePrevFrame.range = sizeof(float) * NUM_PARTICLES;
+	vkBindBufferMemory(logicalDevice, tileVisibilityBuffer, tileVisibilityMemory, 0);
 
-		descriptorWrites[1] = {};
-		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[1].descriptorCount = 1;
-		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[1].dstBinding = 1;
-		descriptorWrites[1].dstArrayElement = 0;
-		descriptorWrites[1].dstSet = computeDescriptorSets[i];
-		descriptorWrites[1].pBufferInfo = &shaderStoragePrevFrame;
+	vkMapMemory(logicalDevice, tileVisibilityMemory, 0, memreq.size, 0, &tileVisibilityMap);
 
-		VkDescriptorBufferInfo shaderStorageNextFrame{};
-		shaderStorageNextFrame.buffer = posBuffer[1];
+	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
+		memcpy(static_cast<char*>(tileVisibilityMap) + tileVisibilityStride * i, gridTileMeshMask.data(), sizeof(uint32_t) * gridTileMeshMask.size());
+	}
+
+}
+
+void VulkanClass::createBrickBuffer() {
+
+	// At most one brick per grid point
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = sizeof(VkDrawIndirectCommand) + sizeof(glm::uvec2) * NUM_PARTICLES;
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &brickBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Create Brick Buffer\n");
+
+	VkMemoryRequirements memreq;
+	vkGetBufferMemoryRequirements(logicalDevice, brickBuffer, &memreq);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memreq.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memreq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &brickBufferMemory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Allocate Brick Buffer Memory\n");
+
+	vkBindBufferMemory(logicalDevice, brickBuffer, brickBufferMemory, 0);
+
+}
+
+void VulkanClass::createFieldRangeBuffer() {
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	// One (min, max) pair per field brick, padding bricks included
+	size_t bricks = fieldBricksPerAxis(gridSize);
+	VkDeviceSize alignment = properties.limits.minStorageBufferOffsetAlignment;
+	fieldRangeStride = (sizeof(glm::vec2) * bricks * bricks * bricks + alignment - 1) & ~(alignment - 1);
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = fieldRangeStride * swapChain.MAX_FRAMES_IN_FLIGHT;
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &fieldRangeBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Create Field Range Buffer\n");
+
+	VkMemoryRequirements memreq;
+	vkGetBufferMemoryRequirements(logicalDevice, fieldRangeBuffer, &memreq);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memreq.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memreq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &fieldRangeBufferMemory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Allocate Field Range Buffer Memory\n");
+
+	vkBindBufferMemory(logicalDevice, fieldRangeBuffer, fieldRangeBufferMemory, 0);
+
+}
+
+void VulkanClass::createDrawBuffers(size_t draws) {
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	maxDraws = multiDrawIndirect ? std::min(draws, (size_t)properties.limits.maxDrawIndirectCount) : draws;
+
+	// Every section starts at the storage buffer offset alignment, since cull.comp binds them one by one
+	VkDeviceSize alignment = properties.limits.minStorageBufferOffsetAlignment;
+	auto align = [alignment](VkDeviceSize offset) { return (offset + alignment - 1) & ~(alignment - 1); };
+	drawOriginsOffset = align(sizeof(VkDrawIndirectCommand) * maxDraws);
+	drawCandidatesOffset = align(drawOriginsOffset + sizeof(glm::vec4) * maxDraws);
+	drawVisibilityOffset = align(drawCandidatesOffset + sizeof(MeshDraw) * maxDraws);
+	drawCountOffset = align(drawVisibilityOffset + sizeof(uint32_t) * ((maxDraws + 31) / 32));
+	drawBufferSize = drawCountOffset + sizeof(uint32_t);
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = drawBufferSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	drawBuffer.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
+	drawBufferMemory.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
+	drawBufferMap.resize(swapChain.MAX_FRAMES_IN_FLIGHT);
+
+	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
+		if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &drawBuffer[i]) != VK_SUCCESS)
+			throw std::runtime_error("Failed to Create Draw Buffer\n");
+
+		VkMemoryRequirements memreq;
+		vkGetBufferMemoryRequirements(logicalDevice, drawBuffer[i], &memreq);
+
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = memreq.size;
+		allocInfo.memoryTypeIndex = findMemoryType(memreq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &drawBufferMemory[i]) != VK_SUCCESS)
+			throw std::runtime_error("Failed to Allocate Draw Buffer Memory\n");
+
+		vkBindBufferMemory(logicalDevice, drawBuffer[i], drawBufferMemory[i], 0);
+
+		vkMapMemory(logicalDevice, drawBufferMemory[i], 0, memreq.size, 0, &drawBufferMap[i]);
+	}
+
+	occlusionIdsInFlight.assign(swapChain.MAX_FRAMES_IN_FLIGHT, {});
+	occlusionChunksInFlight.assign(swapChain.MAX_FRAMES_IN_FLIGHT, false);
+	updateCullDescriptorSets();
+	updateVertexDescriptorSets();
+
+}
+
+void VulkanClass::createMarchTableBuffer() {
+
+	VkDeviceSize size = sizeof(tPackedCases);
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+
+	if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &stagingBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Create March Table Staging Buffer\n");
+
+	VkMemoryRequirements memreq;
+	vkGetBufferMemoryRequirements(logicalDevice, stagingBuffer, &memreq);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memreq.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memreq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &stagingBufferMemory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Allocate March Table Staging Buffer Memory\n");
+
+	vkBindBufferMemory(logicalDevice, stagingBuffer, stagingBufferMemory, 0);
+
+	void* data = nullptr;
+	vkMapMemory(logicalDevice, stagingBufferMemory, 0, size, 0, &data);
+	memcpy(data, tPackedCases.data(), size);
+	vkUnmapMemory(logicalDevice, stagingBufferMemory);
+
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &marchTableBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Create March Table Buffer\n");
+
+	vkGetBufferMemoryRequirements(logicalDevice, marchTableBuffer, &memreq);
+	allocInfo.allocationSize = memreq.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memreq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &marchTableBufferMemory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Allocate March Table Buffer Memory\n");
+
+	vkBindBufferMemory(logicalDevice, marchTableBuffer, marchTableBufferMemory, 0);
+
+	VkCommandBuffer copyCommandBuffer = beginSingleTimeCommands();
+
+	VkBufferCopy copyRegion{};
+	copyRegion.size = size;
+	vkCmdCopyBuffer(copyCommandBuffer, stagingBuffer, marchTableBuffer, 1, &copyRegion);
+
+	endSingleTimeCommands(copyCommandBuffer);
+
+	vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
+	vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
+
+}
+
+void VulkanClass::createChunkArena(size_t vertices) {
+
+	// The chunk vertex sets are pointed at the arena below, and frames in flight may still be using them
+	vkDeviceWaitIdle(logicalDevice);
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = sizeof(PackedVertex) * vertices;
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &chunkArenaBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Create Chunk Arena Buffer\n");
+
+	VkMemoryRequirements memreq;
+	vkGetBufferMemoryRequirements(logicalDevice, chunkArenaBuffer, &memreq);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memreq.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memreq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &chunkArenaMemory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Allocate Chunk Arena Memory\n");
+
+	vkBindBufferMemory(logicalDevice, chunkArenaBuffer, chunkArenaMemory, 0);
+
+	vkMapMemory(logicalDevice, chunkArenaMemory, 0, memreq.size, 0, &chunkArenaMap);
+
+	updateVertexDescriptorSets();
+
+}
+
+void VulkanClass::createPointSplatting(const float* positions, size_t count) {
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	VkDeviceSize pointBytes = sizeof(float) * 3 * std::max(count, (size_t)1);
+	if (pointBytes > properties.limits.maxStorageBufferRange) {
+		throw std::runtime_error("Point cloud is larger than a storage buffer\n");
+	}
+
+	// The positions are written once, so they stay in host-visible memory
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = pointBytes;
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &splatPointBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Create Point Buffer\n");
+
+	VkMemoryRequirements memreq;
+	vkGetBufferMemoryRequirements(logicalDevice, splatPointBuffer, &memreq);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memreq.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memreq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &splatPointMemory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Allocate Point Buffer Memory\n");
+
+	vkBindBufferMemory(logicalDevice, splatPointBuffer, splatPointMemory, 0);
+
+	void* map;
+	vkMapMemory(logicalDevice, splatPointMemory, 0, memreq.size, 0, &map);
+	memcpy(map, positions, sizeof(float) * 3 * count);
+	vkUnmapMemory(logicalDevice, splatPointMemory);
+
+	// Counters are linear over the grid, without the padding of bricked fields
+	bufferInfo.size = sizeof(uint32_t) * gridSize * gridSize * gridSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &splatDensityBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Create Splat Density Buffer\n");
+
+	vkGetBufferMemoryRequirements(logicalDevice, splatDensityBuffer, &memreq);
+	allocInfo.allocationSize = memreq.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memreq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &splatDensityMemory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to Allocate Splat Density Buffer Memory\n");
+
+	vkBindBufferMemory(logicalDevice, splatDensityBuffer, splatDensityMemory, 0);
+
+	// 0: positions, 1: density counters, 2: the field buffer
+	std::vector<VkDescriptorSetLayoutBinding> bindings(3);
+	for (uint32_t i = 0; i < bindings.size(); i++) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &splatDescriptorSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create Splat Descriptor Set layout\n");
+	}
+
+	VkDescriptorPoolSize poolSize{};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = static_cast<uint32_t>(bindings.size());
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	poolInfo.maxSets = 1;
+
+	if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &splatDescriptorPool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create Splat Descriptor Pool\n");
+	}
+
+	VkDescriptorSetAllocateInfo setInfo{};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setInfo.descriptorPool = splatDescriptorPool;
+	setInfo.descriptorSetCount = 1;
+	setInfo.pSetLayouts = &splatDescriptorSetLayout;
+
+	if (vkAllocateDescriptorSets(logicalDevice, &setInfo, &splatDescriptorSet) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate Splat Descriptor Set\n");
+	}
+
+	VkDescriptorBufferInfo bufferInfos[3] = {
+		{ splatPointBuffer, 0, VK_WHOLE_SIZE },
+		{ splatDensityBuffer, 0, VK_WHOLE_SIZE },
+		{ posBuffer[0], 0, VK_WHOLE_SIZE },
+	};
+
+	std::vector<VkWriteDescriptorSet> writes(3);
+	for (uint32_t i = 0; i < writes.size(); i++) {
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = splatDescriptorSet;
+		writes[i].dstBinding = i;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[i].descriptorCount = 1;
+		writes[i].pBufferInfo = &bufferInfos[i];
+	}
+	vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+	VkPushConstantRange pushConstants{};
+	pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstants.size = sizeof(SplatUniforms);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &splatDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
+
+	if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &splatPipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Splat Pipeline Layout\n");
+	}
+
+	splatShader = new Shader("splat", logicalDevice, VK_SHADER_STAGE_COMPUTE_BIT);
+	splatResolveShader = new Shader("splat_resolve", logicalDevice, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.layout = splatPipelineLayout;
+	pipelineInfo.stage = splatShader->computeShaderStageInfo;
+
+	if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &splatPipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Splat Pipeline\n");
+	}
+
+	pipelineInfo.stage = splatResolveShader->computeShaderStageInfo;
+
+	if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &splatResolvePipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Splat Resolve Pipeline\n");
+	}
+
+}
+
+void VulkanClass::splatPoints(const SplatUniforms& uniforms) {
+
+	splatUniform = uniforms;
+	splatPending = splatPipeline != VK_NULL_HANDLE;
+
+}
+
+void VulkanClass::recordPointSplat(VkCommandBuffer commandBuffer) {
+
+	vkCmdFillBuffer(commandBuffer, splatDensityBuffer, 0, VK_WHOLE_SIZE, 0);
+
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = splatDensityBuffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, splatPipelineLayout, 0, 1, &splatDescriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, splatPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SplatUniforms), &splatUniform);
+
+	// splat.comp loops over the points, so the dispatch only has to stay within the workgroup count limit
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	uint32_t groups = std::max<uint32_t>(std::min<uint32_t>((splatUniform.pointCount + 63) / 64, properties.limits.maxComputeWorkGroupCount[0]), 1);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, splatPipeline);
+	vkCmdDispatch(commandBuffer, groups, 1, 1);
+
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	uint32_t bricks = fieldBricksPerAxis(gridSize);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, splatResolvePipeline);
+	vkCmdDispatch(commandBuffer, bricks, bricks, bricks);
+
+	// The meshing dispatch that follows reads the field, and the host reads it once the frame is done
+	barrier.buffer = posBuffer[0];
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+}
+
+void VulkanClass::recordMeshReadback(VkCommandBuffer commandBuffer, uint32_t currentFrame) {
+
+	// The draws' ranges are packed one after another, empty ones left out. The extent changes with the field mode,
+	// so it is kept with the copy.
+	meshReadbackExtent = computeUniform.meshExtent;
+	meshReadbackDraws.clear();
+	std::vector<VkBufferCopy> regions;
+	size_t vertices = 0;
+	for (const MeshDraw& draw : meshDraws) {
+		if (draw.vertexCount == 0) {
+			continue;
+		}
+		MeshDraw copy = draw;
+		copy.firstVertex = static_cast<uint32_t>(vertices);
+		meshReadbackDraws.push_back(copy);
+		regions.push_back({ sizeof(PackedVertex) * draw.firstVertex, sizeof(PackedVertex) * vertices, sizeof(PackedVertex) * draw.vertexCount });
+		vertices += draw.vertexCount;
+	}
+
+	// Nothing reads the buffer before the state goes back to IDLE, so it can be replaced here
+	if (vertices > meshReadbackCapacity) {
+		vkDestroyBuffer(logicalDevice, meshReadbackBuffer, nullptr);
+		vkFreeMemory(logicalDevice, meshReadbackMemory, nullptr);
+
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = sizeof(PackedVertex) * vertices;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &meshReadbackBuffer) != VK_SUCCESS)
+			throw std::runtime_error("Failed to Create Mesh Readback Buffer\n");
+
+		VkMemoryRequirements memreq;
+		vkGetBufferMemoryRequirements(logicalDevice, meshReadbackBuffer, &memreq);
+
+		// The exporter reads every vertex, which is slow from uncached memory
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = memreq.size;
+		try {
+			allocInfo.memoryTypeIndex = findMemoryType(memreq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+		}
+		catch (const std::runtime_error&) {
+			allocInfo.memoryTypeIndex = findMemoryType(memreq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		}
+
+		if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &meshReadbackMemory) != VK_SUCCESS)
+			throw std::runtime_error("Failed to Allocate Mesh Readback Memory\n");
+
+		vkBindBufferMemory(logicalDevice, meshReadbackBuffer, meshReadbackMemory, 0);
+
+		vkMapMemory(logicalDevice, meshReadbackMemory, 0, memreq.size, 0, &meshReadbackMap);
+		meshReadbackCapacity = vertices;
+	}
+
+	meshReadbackFrame = currentFrame;
+	meshReadbackState = MESH_READBACK_COPYING;
+
+	if (regions.empty()) {
+		return;
+	}
+
+	// After the meshing dispatch; chunk vertices were written by the host before the submit
+	VkBuffer source = drawChunks ? chunkArenaBuffer : posBuffer[1];
+
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = source;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	vkCmdCopyBuffer(commandBuffer, source, meshReadbackBuffer, static_cast<uint32_t>(regions.size()), regions.data());
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	barrier.buffer = meshReadbackBuffer;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+}
+
+void VulkanClass::createComputeDescriptorSet() {
+
+	std::vector<VkDescriptorSetLayout> layouts(static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT), computeDescriptorSetLayout);
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = computeDescriptorPool;
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT);
+	allocInfo.pSetLayouts = layouts.data();
+
+	computeDescriptorSets.resize(static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT));
+
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, computeDescriptorSets.data()) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Compute Descriptor Set\n");
+	}
+
+	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
+
+		std::vector<VkWriteDescriptorSet> descriptorWrites(6);
+
+		VkDescriptorBufferInfo shaderStoragePrevFrame{};
+		shaderStoragePrevFrame.buffer = posBuffer[0];
+		shaderStoragePrevFrame.offset = 0;
+		shaderStoragePrevFrame.range = sizeof(float) * fieldCells;
+
+		descriptorWrites[0] = {};
+		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[0].descriptorCount = 1;
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[0].dstBinding = 0;
+		descriptorWrites[0].dstArrayElement = 0;
+		descriptorWrites[0].dstSet = computeDescriptorSets[i];
+		descriptorWrites[0].pBufferInfo = &shaderStoragePrevFrame;
+
+		VkDescriptorBufferInfo shaderStorageNextFrame{};
+		shaderStorageNextFrame.buffer = posBuffer[1];
 		shaderStorageNextFrame.offset = 0;
-		shaderStorageNextFrame.range = sizeof(Particle) * NUM_PARTICLES * 15.0;
+		shaderStorageNextFrame.range = sizeof(PackedVertex) * vertexCount();
+
+		descriptorWrites[1] = {};
+		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[1].descriptorCount = 1;
+		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[1].dstBinding = 1;
+		descriptorWrites[1].dstArrayElement = 0;
+		descriptorWrites[1].dstSet = computeDescriptorSets[i];
+		descriptorWrites[1].pBufferInfo = &shaderStorageNextFrame;
+
+		VkDescriptorBufferInfo marchTables{};
+		marchTables.buffer = marchTableBuffer;
+		marchTables.offset = 0;
+		marchTables.range = sizeof(tPackedCases);
 
 		descriptorWrites[2] = {};
 		descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -1322,9 +2280,51 @@ void VulkanClass::createComputeDescriptorSet() {
 		descriptorWrites[2].dstBinding = 2;
 		descriptorWrites[2].dstArrayElement = 0;
 		descriptorWrites[2].dstSet = computeDescriptorSets[i];
-		descriptorWrites[2].pBufferInfo = &shaderStorageNextFrame;
-
-		vkUpdateDescriptorSets(logicalDevice, 3, descriptorWrites.data(), 0, 0);
+		descriptorWrites[2].pBufferInfo = &marchTables;
+
+		VkDescriptorBufferInfo tileVisibility{};
+		tileVisibility.buffer = tileVisibilityBuffer;
+		tileVisibility.offset = tileVisibilityStride * i;
+		tileVisibility.range = sizeof(uint32_t) * gridTileMeshMask.size();
+
+		descriptorWrites[3] = {};
+		descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[3].descriptorCount = 1;
+		descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[3].dstBinding = 3;
+		descriptorWrites[3].dstArrayElement = 0;
+		descriptorWrites[3].dstSet = computeDescriptorSets[i];
+		descriptorWrites[3].pBufferInfo = &tileVisibility;
+
+		VkDescriptorBufferInfo bricks{};
+		bricks.buffer = brickBuffer;
+		bricks.offset = 0;
+		bricks.range = VK_WHOLE_SIZE;
+
+		descriptorWrites[4] = {};
+		descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[4].descriptorCount = 1;
+		descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[4].dstBinding = 4;
+		descriptorWrites[4].dstArrayElement = 0;
+		descriptorWrites[4].dstSet = computeDescriptorSets[i];
+		descriptorWrites[4].pBufferInfo = &bricks;
+
+		VkDescriptorBufferInfo fieldRanges{};
+		fieldRanges.buffer = fieldRangeBuffer;
+		fieldRanges.offset = fieldRangeStride * i;
+		fieldRanges.range = fieldRangeStride;
+
+		descriptorWrites[5] = {};
+		descriptorWrites[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[5].descriptorCount = 1;
+		descriptorWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[5].dstBinding = 5;
+		descriptorWrites[5].dstArrayElement = 0;
+		descriptorWrites[5].dstSet = computeDescriptorSets[i];
+		descriptorWrites[5].pBufferInfo = &fieldRanges;
+
+		vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, 0);
 
 	}
 
@@ -1332,10 +2332,17 @@ void VulkanClass::createComputeDescriptorSet() {
 
 void VulkanClass::createComputePipeline() {
 
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(ComputeUniforms);
+
 	VkPipelineLayoutCreateInfo pipelineInfo{};
 	pipelineInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineInfo.setLayoutCount = 1;
 	pipelineInfo.pSetLayouts = &computeDescriptorSetLayout;
+	pipelineInfo.pushConstantRangeCount = 1;
+	pipelineInfo.pPushConstantRanges = &pushConstantRange;
 
 	if (vkCreatePipelineLayout(logicalDevice, &pipelineInfo, nullptr, &computePipelineLayout) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to Create Compute Pipeline Layout\n");
@@ -1350,12 +2357,18 @@ void VulkanClass::createComputePipeline() {
 		throw std::runtime_error("Failed to Create Compute Pipeline\n");
 	}
 
-}
+	// bricks.comp shares the descriptor set and push constants of shader.comp
+	computePipelineInfo.stage = brickShader->computeShaderStageInfo;
 
-void VulkanClass::updateCompute() {
+	if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &computePipelineInfo, nullptr, &brickComputePipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Brick Compute Pipeline\n");
+	}
 
-	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
-		memcpy(computeUniformBufferMap[i], &computeUniform, sizeof(ComputeUniforms));
+	// So does raymarch.comp
+	computePipelineInfo.stage = rayMarchShader->computeShaderStageInfo;
+
+	if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &computePipelineInfo, nullptr, &fieldRangePipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Field Range Compute Pipeline\n");
 	}
 
 }
@@ -1369,10 +2382,63 @@ void VulkanClass::recordComputeCommandBuffer(VkCommandBuffer commandBuffer, uint
 		throw std::runtime_error("Failed to Begin Recording Compute Command Buffer\n");
 	}
 
-	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
+	// The frame's slot of the visibility buffer is free again once its fence was waited for
+	memcpy(static_cast<char*>(tileVisibilityMap) + tileVisibilityStride * imageIndex, gridTileMeshMask.data(), sizeof(uint32_t) * gridTileMeshMask.size());
+
+	if (splatPending) {
+		recordPointSplat(commandBuffer);
+		splatPending = false;
+	}
+
+	if (brickMode && !drawChunks) {
+		// The previous frame may still be drawing from the buffer, both queues being one; its command and instances are
+		// only rewritten once that draw has read them
+		VkBufferMemoryBarrier drawn{};
+		drawn.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		drawn.srcAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+		drawn.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		drawn.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		drawn.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		drawn.buffer = brickBuffer;
+		drawn.offset = 0;
+		drawn.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &drawn, 0, nullptr);
+
+		// bricks.comp counts its instances up from 0
+		VkDrawIndirectCommand command = { 36, 0, 0, 0 };
+		vkCmdUpdateBuffer(commandBuffer, brickBuffer, 0, sizeof(command), &command);
+
+		VkBufferMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = brickBuffer;
+		barrier.offset = 0;
+		barrier.size = sizeof(command);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, brickComputePipeline);
+	}
+	else if (rayMarchMode && !drawChunks) {
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, fieldRangePipeline);
+	}
+	else {
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
+	}
+
 	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &computeDescriptorSets[imageIndex], 0, 0);
+	vkCmdPushConstants(commandBuffer, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputeUniforms), &computeUniform);
 
-	vkCmdDispatch(commandBuffer, NUM_PARTICLES, 1, 1);
+	// One 4x4x4 workgroup per field brick; the shader skips the padding cells
+	uint32_t groups = fieldBricksPerAxis(gridSize);
+	vkCmdDispatch(commandBuffer, groups, groups, groups);
+
+	if (meshReadbackState == MESH_READBACK_REQUESTED) {
+		recordMeshReadback(commandBuffer, imageIndex);
+	}
 
 	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to Record Compute Command Buffer\n");
@@ -1380,29 +2446,48 @@ void VulkanClass::recordComputeCommandBuffer(VkCommandBuffer commandBuffer, uint
 
 }
 
-void VulkanClass::dispatch(uint32_t imageIndex) {
-
-	vkResetFences(logicalDevice, 1, &computeInFlightFences[imageIndex]);
+void VulkanClass::dispatch(uint32_t currentFrame) {
 
-	vkResetCommandBuffer(commandBuffer[imageIndex], 0);
-	recordComputeCommandBuffer(commandBuffer[imageIndex], imageIndex);
+	vkResetFences(logicalDevice, 1, &computeInFlightFences[currentFrame]);
 
 	VkSubmitInfo submitInfo{};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-	VkSemaphore signalSemaphores[] = { computeFinishedSemaphores[imageIndex] };
+	VkSemaphore signalSemaphores[] = { computeFinishedSemaphores[currentFrame] };
 	submitInfo.waitSemaphoreCount = 0;
 	submitInfo.pWaitSemaphores = nullptr;
 	submitInfo.pWaitDstStageMask = nullptr;
 	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer[imageIndex];
+	submitInfo.pCommandBuffers = &computeCommandBuffer[currentFrame];
 	submitInfo.signalSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
-	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, computeInFlightFences[imageIndex]) != VK_SUCCESS) {
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, computeInFlightFences[currentFrame]) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Submit Compute Command\n");
+	}
+
+}
+
+void VulkanClass::runCompute(uint32_t currentFrame) {
+
+	// Compute pass on its own, without the graphics submit that normally consumes computeFinishedSemaphores
+	vkWaitForFences(logicalDevice, 1, &computeInFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+	vkResetFences(logicalDevice, 1, &computeInFlightFences[currentFrame]);
+
+	vkResetCommandBuffer(computeCommandBuffer[currentFrame], 0);
+	recordComputeCommandBuffer(computeCommandBuffer[currentFrame], currentFrame);
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &computeCommandBuffer[currentFrame];
+
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, computeInFlightFences[currentFrame]) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to Submit Compute Command\n");
 	}
 
+	vkWaitForFences(logicalDevice, 1, &computeInFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+
 }
 
 void VulkanClass::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
@@ -1613,13 +2698,511 @@ void VulkanClass::createDepthResources() {
 		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
 	);
 
-	createImage(swapChain.extent.width, swapChain.extent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
+	// Sampled as well when the format allows, by the occlusion pass
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, depthFormat, &formatProperties);
+	depthSampled = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+	this->depthFormat = depthFormat;
+
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (depthSampled ? VK_IMAGE_USAGE_SAMPLED_BIT : 0);
+	createImage(swapChain.extent.width, swapChain.extent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
 	depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
 
 	transitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 
 }
 
+namespace {
+
+	VkImageMemoryBarrier imageBarrier(VkImage image, VkImageAspectFlags aspect, uint32_t baseLevel, uint32_t levels, VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess) {
+
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = aspect;
+		barrier.subresourceRange.baseMipLevel = baseLevel;
+		barrier.subresourceRange.levelCount = levels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		return barrier;
+
+	}
+
+}
+
+void VulkanClass::createOcclusionCulling() {
+
+	occlusionSupported = multiDrawIndirect && depthSampled;
+	if (!occlusionSupported) {
+		return;
+	}
+
+	hizShader = new Shader("hiz", logicalDevice, VK_SHADER_STAGE_COMPUTE_BIT);
+	cullShader = new Shader("cull", logicalDevice, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// hiz.comp reads the depth attachment or the level above and writes one level
+	std::vector<VkDescriptorSetLayoutBinding> hizBindings(2);
+	hizBindings[0].binding = 0;
+	hizBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	hizBindings[0].descriptorCount = 1;
+	hizBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	hizBindings[1].binding = 1;
+	hizBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	hizBindings[1].descriptorCount = 1;
+	hizBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	// cull.comp reads the pyramid, then the sections of the frame's draw buffer and the frame's transform
+	std::vector<VkDescriptorSetLayoutBinding> cullBindings(7);
+	for (uint32_t i = 0; i < cullBindings.size(); i++) {
+		cullBindings[i].binding = i;
+		cullBindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : i == 6 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		cullBindings[i].descriptorCount = 1;
+		cullBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(hizBindings.size());
+	layoutInfo.pBindings = hizBindings.data();
+
+	if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &hizDescriptorSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create Depth Pyramid Descriptor Set layout\n");
+	}
+
+	layoutInfo.bindingCount = static_cast<uint32_t>(cullBindings.size());
+	layoutInfo.pBindings = cullBindings.data();
+
+	if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &cullDescriptorSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create Cull Descriptor Set layout\n");
+	}
+
+	uint32_t frames = static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT);
+
+	std::vector<VkDescriptorPoolSize> poolSizes(4);
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = MAX_DEPTH_PYRAMID_LEVELS + frames;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[1].descriptorCount = MAX_DEPTH_PYRAMID_LEVELS;
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[2].descriptorCount = 5 * frames;
+	poolSizes[3].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[3].descriptorCount = frames;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = MAX_DEPTH_PYRAMID_LEVELS + frames;
+
+	if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &occlusionDescriptorPool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create Occlusion Descriptor Pool\n");
+	}
+
+	std::vector<VkDescriptorSetLayout> hizLayouts(MAX_DEPTH_PYRAMID_LEVELS, hizDescriptorSetLayout);
+	std::vector<VkDescriptorSetLayout> cullLayouts(frames, cullDescriptorSetLayout);
+	hizDescriptorSets.resize(hizLayouts.size());
+	cullDescriptorSets.resize(cullLayouts.size());
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = occlusionDescriptorPool;
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(hizLayouts.size());
+	allocInfo.pSetLayouts = hizLayouts.data();
+
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, hizDescriptorSets.data()) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate Depth Pyramid Descriptor Sets\n");
+	}
+
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(cullLayouts.size());
+	allocInfo.pSetLayouts = cullLayouts.data();
+
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, cullDescriptorSets.data()) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate Cull Descriptor Sets\n");
+	}
+
+	VkPushConstantRange hizPushConstants{};
+	hizPushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	hizPushConstants.size = sizeof(glm::ivec4);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &hizDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &hizPushConstants;
+
+	if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &hizPipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Depth Pyramid Pipeline Layout\n");
+	}
+
+	VkPushConstantRange cullPushConstants{};
+	cullPushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	cullPushConstants.size = sizeof(CullUniforms);
+
+	pipelineLayoutInfo.pSetLayouts = &cullDescriptorSetLayout;
+	pipelineLayoutInfo.pPushConstantRanges = &cullPushConstants;
+
+	if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &cullPipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Cull Pipeline Layout\n");
+	}
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.layout = hizPipelineLayout;
+	pipelineInfo.stage = hizShader->computeShaderStageInfo;
+
+	if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &hizPipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Depth Pyramid Pipeline\n");
+	}
+
+	pipelineInfo.layout = cullPipelineLayout;
+	pipelineInfo.stage = cullShader->computeShaderStageInfo;
+
+	if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &cullPipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Cull Pipeline\n");
+	}
+
+	// The shaders only use texelFetch, the sampler just has to exist
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	if (vkCreateSampler(logicalDevice, &samplerInfo, nullptr, &depthPyramidSampler) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Depth Pyramid Sampler\n");
+	}
+
+	createDepthPyramid();
+
+}
+
+void VulkanClass::createDepthPyramid() {
+
+	if (!occlusionSupported) {
+		return;
+	}
+
+	destroyDepthPyramid();
+	depthHistoryValid = false;
+
+	// Level 0 is half the depth attachment, rounded down, and every further level halves again down to 1x1
+	depthPyramidExtent = { std::max(swapChain.extent.width / 2, 1u), std::max(swapChain.extent.height / 2, 1u) };
+	uint32_t levels = 1;
+	while (levels < MAX_DEPTH_PYRAMID_LEVELS && (std::max(depthPyramidExtent.width, depthPyramidExtent.height) >> levels) > 0) {
+		levels++;
+	}
+
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = VK_FORMAT_R32_SFLOAT;
+	imageInfo.extent = { depthPyramidExtent.width, depthPyramidExtent.height, 1 };
+	imageInfo.mipLevels = levels;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	if (vkCreateImage(logicalDevice, &imageInfo, nullptr, &depthPyramid) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Depth Pyramid\n");
+	}
+
+	VkMemoryRequirements memreq;
+	vkGetImageMemoryRequirements(logicalDevice, depthPyramid, &memreq);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memreq.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memreq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &depthPyramidMemory) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Allocate Depth Pyramid Memory\n");
+	}
+
+	vkBindImageMemory(logicalDevice, depthPyramid, depthPyramidMemory, 0);
+
+	// One view over all levels for cull.comp, and one per level for hiz.comp
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = depthPyramid;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = VK_FORMAT_R32_SFLOAT;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = levels;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+
+	if (vkCreateImageView(logicalDevice, &viewInfo, nullptr, &depthPyramidView) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Depth Pyramid View\n");
+	}
+
+	depthPyramidLevelViews.resize(levels);
+	for (uint32_t level = 0; level < levels; level++) {
+		viewInfo.subresourceRange.baseMipLevel = level;
+		viewInfo.subresourceRange.levelCount = 1;
+		if (vkCreateImageView(logicalDevice, &viewInfo, nullptr, &depthPyramidLevelViews[level]) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to Create Depth Pyramid View\n");
+		}
+	}
+
+	// The pyramid stays in the general layout, written and read by compute only
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+	VkImageMemoryBarrier barrier = imageBarrier(depthPyramid, VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	endSingleTimeCommands(commandBuffer);
+
+	for (uint32_t level = 0; level < levels; level++) {
+		VkDescriptorImageInfo source{};
+		source.sampler = depthPyramidSampler;
+		source.imageView = level == 0 ? depthImageView : depthPyramidLevelViews[level - 1];
+		source.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+		VkDescriptorImageInfo destination{};
+		destination.imageView = depthPyramidLevelViews[level];
+		destination.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		std::vector<VkWriteDescriptorSet> descriptorWrites(2);
+		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[0].dstSet = hizDescriptorSets[level];
+		descriptorWrites[0].dstBinding = 0;
+		descriptorWrites[0].descriptorCount = 1;
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[0].pImageInfo = &source;
+		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[1].dstSet = hizDescriptorSets[level];
+		descriptorWrites[1].dstBinding = 1;
+		descriptorWrites[1].descriptorCount = 1;
+		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		descriptorWrites[1].pImageInfo = &destination;
+
+		vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
+
+	updateCullDescriptorSets();
+
+}
+
+void VulkanClass::destroyDepthPyramid() {
+
+	for (VkImageView view : depthPyramidLevelViews) {
+		vkDestroyImageView(logicalDevice, view, nullptr);
+	}
+	depthPyramidLevelViews.clear();
+
+	vkDestroyImageView(logicalDevice, depthPyramidView, nullptr);
+	vkDestroyImage(logicalDevice, depthPyramid, nullptr);
+	vkFreeMemory(logicalDevice, depthPyramidMemory, nullptr);
+	depthPyramidView = VK_NULL_HANDLE;
+	depthPyramid = VK_NULL_HANDLE;
+	depthPyramidMemory = VK_NULL_HANDLE;
+
+}
+
+void VulkanClass::updateCullDescriptorSets() {
+
+	// Waits for both the pyramid and the draw buffers
+	if (!occlusionSupported || depthPyramidView == VK_NULL_HANDLE || drawBuffer.empty()) {
+		return;
+	}
+
+	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
+
+		VkDescriptorImageInfo pyramid{};
+		pyramid.sampler = depthPyramidSampler;
+		pyramid.imageView = depthPyramidView;
+		pyramid.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		// Candidates, commands, origins, visibility and count, as bound in cull.comp
+		VkDescriptorBufferInfo sections[5] = {
+			{ drawBuffer[i], drawCandidatesOffset, sizeof(MeshDraw) * maxDraws },
+			{ drawBuffer[i], 0, sizeof(VkDrawIndirectCommand) * maxDraws },
+			{ drawBuffer[i], drawOriginsOffset, sizeof(glm::vec4) * maxDraws },
+			{ drawBuffer[i], drawVisibilityOffset, sizeof(uint32_t) * ((maxDraws + 31) / 32) },
+			{ drawBuffer[i], drawCountOffset, sizeof(uint32_t) },
+		};
+
+		// The frame's own slot of the transform buffer, for the frustum and cone tests
+		VkDescriptorBufferInfo frameTransform{ transformBuffer, transformBufferStride * i, sizeof(Transform) };
+
+		std::vector<VkWriteDescriptorSet> descriptorWrites(7);
+		for (uint32_t binding = 0; binding < descriptorWrites.size(); binding++) {
+			descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[binding].dstSet = cullDescriptorSets[i];
+			descriptorWrites[binding].dstBinding = binding;
+			descriptorWrites[binding].descriptorCount = 1;
+			if (binding == 0) {
+				descriptorWrites[binding].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				descriptorWrites[binding].pImageInfo = &pyramid;
+			}
+			else if (binding == 6) {
+				descriptorWrites[binding].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+				descriptorWrites[binding].pBufferInfo = &frameTransform;
+			}
+			else {
+				descriptorWrites[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				descriptorWrites[binding].pBufferInfo = &sections[binding - 1];
+			}
+		}
+
+		vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+	}
+
+}
+
+void VulkanClass::updateVertexDescriptorSets() {
+
+	// Without an ocean there is no chunk arena; its sets then point at the grid, which is never drawn from them
+	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
+		for (size_t source = 0; source < 2; source++) {
+
+			VkBuffer vertexBuffer = source == 1 && chunkArenaBuffer != VK_NULL_HANDLE ? chunkArenaBuffer : posBuffer[1];
+
+			VkDescriptorBufferInfo buffers[2] = {
+				{ vertexBuffer, 0, VK_WHOLE_SIZE },
+				{ drawBuffer[i], drawOriginsOffset, sizeof(glm::vec4) * maxDraws },
+			};
+
+			std::vector<VkWriteDescriptorSet> descriptorWrites(2);
+			for (uint32_t binding = 0; binding < descriptorWrites.size(); binding++) {
+				descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				descriptorWrites[binding].dstSet = vertexDescriptorSets[i * 2 + source];
+				descriptorWrites[binding].dstBinding = binding;
+				descriptorWrites[binding].descriptorCount = 1;
+				descriptorWrites[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				descriptorWrites[binding].pBufferInfo = &buffers[binding];
+			}
+
+			vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+		}
+	}
+
+}
+
+void VulkanClass::recordOcclusionCulling(VkCommandBuffer commandBuffer, uint32_t currentFrame, uint32_t numDraws) {
+
+	uint32_t levels = 0;
+
+	if (occlusionCulling && depthHistoryValid) {
+		levels = static_cast<uint32_t>(depthPyramidLevelViews.size());
+
+		VkImageAspectFlags depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT | (hasStencilComponent(depthFormat) ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
+
+		// The last frame's depth writes before they are read here, and its reads of the pyramid before it is rewritten
+		VkImageMemoryBarrier barriers[2] = {
+			imageBarrier(depthImage, depthAspect, 0, 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT),
+			imageBarrier(depthPyramid, VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+				VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT),
+		};
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, 2, barriers);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hizPipeline);
+
+		VkExtent2D source = swapChain.extent;
+		for (uint32_t level = 0; level < levels; level++) {
+			VkExtent2D destination = { std::max(depthPyramidExtent.width >> level, 1u), std::max(depthPyramidExtent.height >> level, 1u) };
+			glm::ivec4 sizes(source.width, source.height, destination.width, destination.height);
+
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hizPipelineLayout, 0, 1, &hizDescriptorSets[level], 0, nullptr);
+			vkCmdPushConstants(commandBuffer, hizPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sizes), &sizes);
+			vkCmdDispatch(commandBuffer, (destination.width + 7) / 8, (destination.height + 7) / 8, 1);
+
+			// Read by the next level and by cull.comp
+			VkImageMemoryBarrier levelBarrier = imageBarrier(depthPyramid, VK_IMAGE_ASPECT_COLOR_BIT, level, 1, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+				VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &levelBarrier);
+
+			source = destination;
+		}
+
+		// Back to the render pass once the reads are done
+		VkImageMemoryBarrier depthBarrier = imageBarrier(depthImage, depthAspect, 0, 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+			0, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+	}
+
+	if (numDraws > 0) {
+		CullUniforms uniforms;
+		uniforms.clip = depthHistoryClip;
+		uniforms.viewport = glm::vec2(swapChain.extent.width, swapChain.extent.height);
+		uniforms.pyramidLevels = levels;
+		uniforms.drawCount = numDraws;
+		uniforms.compact = cmdDrawIndirectCount != nullptr;
+		uniforms.clusters = clusterCulling;
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullDescriptorSets[currentFrame], 0, nullptr);
+		vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullUniforms), &uniforms);
+		vkCmdDispatch(commandBuffer, (numDraws + 63) / 64, 1, 1);
+	}
+
+	// Commands and origins for the draws, visibility for the host once the frame's fence has signalled
+	VkBufferMemoryBarrier bufferBarrier{};
+	bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	bufferBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	bufferBarrier.buffer = drawBuffer[currentFrame];
+	bufferBarrier.offset = 0;
+	bufferBarrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+		0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+}
+
+void VulkanClass::collectOcclusionResults(uint32_t currentFrame) {
+
+	occludedIds.clear();
+	occlusionCandidates = 0;
+	occlusionSurvivors = 0;
+
+	if (currentFrame >= occlusionIdsInFlight.size() || occlusionIdsInFlight[currentFrame].empty()) {
+		return;
+	}
+
+	const std::vector<uint32_t>& ids = occlusionIdsInFlight[currentFrame];
+	const uint32_t* visible = reinterpret_cast<const uint32_t*>(static_cast<char*>(drawBufferMap[currentFrame]) + drawVisibilityOffset);
+
+	// An id is occluded only when none of its draws survived
+	std::vector<uint32_t> survived;
+	std::vector<uint32_t> culled;
+	for (size_t i = 0; i < ids.size(); i++) {
+		if ((visible[i >> 5] >> (i & 31)) & 1u)
+			survived.push_back(ids[i]);
+		else
+			culled.push_back(ids[i]);
+	}
+
+	occlusionCandidates = ids.size();
+	occlusionSurvivors = survived.size();
+	occludedChunks = occlusionChunksInFlight[currentFrame];
+
+	std::sort(survived.begin(), survived.end());
+	std::sort(culled.begin(), culled.end());
+	culled.erase(std::unique(culled.begin(), culled.end()), culled.end());
+	std::set_difference(culled.begin(), culled.end(), survived.begin(), survived.end(), std::back_inserter(occludedIds));
+
+}
+
 bool hasStencilComponent(VkFormat format) {
 	return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
 }
@@ -11,25 +11,83 @@
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include <vector>
+#include <atomic>
 
 #include "Shaders.h"
+#include "VertexFormat.h"
+#include "FieldLayout.h"
+#include "Frustum.h"
 
 struct Transform {
 	glm::mat4 M;
 	glm::mat4 V;
 	glm::mat4 P;
+	glm::vec4 meshBounds; // xyz origin of the quantized mesh, w its extent
+	glm::vec4 eye;        // camera position in mesh position space
 	int wave;
+	int isoStreamVertices; // vertices per iso-level stream, to colour the surfaces apart
 };
 
-struct Particle {
-	glm::vec4 pos;
-	glm::vec4 normal;
+// One draw of the frame: a vertex range of the grid's vertex buffer or of the chunk arena, scaled by origin.w and
+// placed at origin.xyz. The vertex shader pulls the origin of its draw by instance index, one instance per draw.
+// boxMin/boxMax bound the draw in mesh position space for the occlusion pass, which reports the draws it culled
+// back by occlusionId (a grid tile or a chunk slot). cone is the normal cone of a meshlet (xyz axis, w the sine of
+// its half-angle) for the cluster test; w > 1 leaves the draw to the frustum test. Laid out like MeshDraw in cull.comp.
+struct MeshDraw {
+	glm::vec4 origin;
+	glm::vec4 boxMin;
+	glm::vec4 boxMax;
+	glm::vec4 cone = glm::vec4(0.0f, 0.0f, 0.0f, 2.0f);
+	uint32_t firstVertex;
+	uint32_t vertexCount;
+	uint32_t occlusionId;
+	uint32_t padding = 0;
 };
 
+// Pushed to cull.comp
+struct CullUniforms {
+	glm::mat4 clip;
+	glm::vec2 viewport;
+	uint32_t pyramidLevels;
+	uint32_t drawCount;
+	uint32_t compact;
+	uint32_t clusters;
+};
+
+const int MAX_DEPTH_PYRAMID_LEVELS = 16;
+
+// Most iso-surfaces extracted in one pass; each gets its own stream in the vertex buffer
+const int MAX_ISO_LEVELS = 4;
+
+// Pushed to the compute shader as push constants when the dispatch is recorded
 struct ComputeUniforms {
 	float deltaTime;
 	int first = 1;
 	int fieldMode = 0;
+	float meshExtent;
+	int gridSize;
+	int fieldLayout;
+	int isoLevelCount = 1;
+	float isoLevels[MAX_ISO_LEVELS] = { 0.0f };
+};
+
+enum MeshReadbackState {
+	MESH_READBACK_IDLE = 0,
+	MESH_READBACK_REQUESTED = 1,
+	MESH_READBACK_COPYING = 2,
+	MESH_READBACK_READY = 3,
+	MESH_READBACK_EXPORTING = 4   // the copy is being read; set back to IDLE when done
+};
+
+// Pushed to splat.comp and splat_resolve.comp; see PointCloud.h for the kernels
+struct SplatUniforms {
+	glm::vec3 offset;     // grid point = position * scale + offset
+	float scale;
+	uint32_t pointCount;
+	int gridSize;
+	int fieldLayout;
+	int kernel;
+	float radius;
 };
 
 struct QueueFamily {
@@ -83,29 +141,142 @@ public: //private:
 	VkQueue graphicsQueue;
 	VkQueue presentQueue;
 
-	VkSurfaceKHR surface;
-	GLFWwindow* window;
+	VkSurfaceKHR surface = VK_NULL_HANDLE;
+	GLFWwindow* window = nullptr;
 
 	SwapChain swapChain;
 
+	// Headless mode renders into offscreen images (one per frame in flight) held in swapChain.images;
+	// there is no surface, swapchain or present
+	bool headless = false;
+	std::vector<VkDeviceMemory> offscreenImageMemory;
+
 	VkDescriptorSetLayout transformDescriptorSetLayout;
 	VkDescriptorPool uniformDescriptorPool;
-	std::vector<VkDescriptorSet> transformDescriptorSet;
+	VkDescriptorSet transformDescriptorSet;
 	VkDescriptorSetLayout computeDescriptorSetLayout;
 	VkDescriptorPool computeDescriptorPool;
 	std::vector<VkDescriptorSet> computeDescriptorSets;
 
-	std::vector<VkBuffer> transformBuffer;
-	std::vector<VkDeviceMemory> transformBufferMemory;
-	std::vector<void*> transformBufferMap;
+	// Vertex pulling: shader.vert reads the vertices and draw origins from storage buffers instead of vertex input.
+	// Per frame in flight there is a set over the grid's vertex buffer and one over the chunk arena, at
+	// frame * 2 and frame * 2 + 1, both with the frame's draw origins.
+	VkDescriptorSetLayout vertexDescriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool vertexDescriptorPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> vertexDescriptorSets;
+
+	// One uniform buffer holding a Transform slot per frame in flight, bound with a dynamic offset
+	VkBuffer transformBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory transformBufferMemory = VK_NULL_HANDLE;
+	void* transformBufferMap;
+	VkDeviceSize transformBufferStride;
 
 	std::vector<VkBuffer> posBuffer;
 	std::vector<VkDeviceMemory> posBufferMemory;
 	std::vector<void*> posBufferMap;
 
-	std::vector<VkBuffer> computeUniformBuffer;
-	std::vector<VkDeviceMemory> computeUniformBufferMemory;
-	std::vector<void*> computeUniformBufferMap;
+	// Vertex arena of the ChunkManager, host-visible and persistently mapped; created, after the draw buffers, the first
+	// time the ocean is switched on
+	VkBuffer chunkArenaBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory chunkArenaMemory = VK_NULL_HANDLE;
+
+	// Per frame in flight: the frame's indirect draw commands, one origin per draw, and for the occlusion pass the
+	// candidate MeshDraws, a visibility bit per candidate and the survivor count, at the offsets below
+	std::vector<VkBuffer> drawBuffer;
+	std::vector<VkDeviceMemory> drawBufferMemory;
+	std::vector<void*> drawBufferMap;
+	size_t maxDraws = 0;
+	VkDeviceSize drawOriginsOffset = 0;
+	VkDeviceSize drawCandidatesOffset = 0;
+	VkDeviceSize drawVisibilityOffset = 0;
+	VkDeviceSize drawCountOffset = 0;
+	VkDeviceSize drawBufferSize = 0;
+	bool multiDrawIndirect = false;
+
+	// VK_KHR_draw_indirect_count, so the occlusion pass can pack the survivors instead of zeroing the culled draws
+	PFN_vkCmdDrawIndirectCountKHR cmdDrawIndirectCount = nullptr;
+
+	// Hierarchical-Z occlusion culling. Each frame starts by reducing the previous frame's depth attachment into
+	// depthPyramid (hiz.comp), a farthest-depth mip chain at half resolution, and cull.comp tests the frame's draws
+	// against it. Needs multiDrawIndirect and a depth format that can be sampled.
+	bool occlusionSupported = false;
+	bool depthSampled = false;
+	VkImage depthPyramid = VK_NULL_HANDLE;
+	VkDeviceMemory depthPyramidMemory = VK_NULL_HANDLE;
+	VkImageView depthPyramidView = VK_NULL_HANDLE;
+	std::vector<VkImageView> depthPyramidLevelViews;
+	VkExtent2D depthPyramidExtent{};
+	VkSampler depthPyramidSampler = VK_NULL_HANDLE;
+	bool depthHistoryValid = false;       // the depth attachment holds a frame rendered with depthHistoryClip
+	glm::mat4 depthHistoryClip;
+
+	VkDescriptorSetLayout hizDescriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorSetLayout cullDescriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool occlusionDescriptorPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> hizDescriptorSets;    // one per pyramid level
+	std::vector<VkDescriptorSet> cullDescriptorSets;   // one per frame in flight
+	VkPipelineLayout hizPipelineLayout = VK_NULL_HANDLE;
+	VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline hizPipeline = VK_NULL_HANDLE;
+	VkPipeline cullPipeline = VK_NULL_HANDLE;
+	Shader* hizShader = nullptr;
+	Shader* cullShader = nullptr;
+
+	// Per frame in flight: occlusionId of every candidate the frame submitted, and whether they were chunks
+	std::vector<std::vector<uint32_t>> occlusionIdsInFlight;
+	std::vector<bool> occlusionChunksInFlight;
+
+	// Per frame in flight: gridTileMeshMask for shader.comp, at tileVisibilityStride apart
+	VkBuffer tileVisibilityBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory tileVisibilityMemory = VK_NULL_HANDLE;
+	void* tileVisibilityMap = nullptr;
+	VkDeviceSize tileVisibilityStride = 0;
+
+	// Brick mode: the VkDrawIndirectCommand of the brick draw followed by one instance per brick, written by
+	// bricks.comp and read by bricks.vert, device-local
+	VkBuffer brickBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory brickBufferMemory = VK_NULL_HANDLE;
+	VkPipeline brickPipeline = VK_NULL_HANDLE;
+	VkPipeline brickComputePipeline = VK_NULL_HANDLE;
+	Shader* brickShader = nullptr;
+
+	// Ray-march mode: the (min, max) field value of every field brick, written by raymarch.comp and read by
+	// raymarch.frag, device-local. The full-screen pipeline binds the compute set as set 1 next to the transform.
+	// Per frame in flight, at fieldRangeStride apart, so a frame's ranges are not rewritten while the last one draws.
+	VkBuffer fieldRangeBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory fieldRangeBufferMemory = VK_NULL_HANDLE;
+	VkDeviceSize fieldRangeStride = 0;
+	VkPipelineLayout rayMarchPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline rayMarchPipeline = VK_NULL_HANDLE;
+	VkPipeline fieldRangePipeline = VK_NULL_HANDLE;
+	Shader* rayMarchShader = nullptr;
+
+	// Point-cloud splatting on the GPU: the cloud's positions (host-visible), one fixed-point density counter per
+	// grid point (device-local) and a set over both and the field buffer
+	VkBuffer splatPointBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory splatPointMemory = VK_NULL_HANDLE;
+	VkBuffer splatDensityBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory splatDensityMemory = VK_NULL_HANDLE;
+	VkDescriptorSetLayout splatDescriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool splatDescriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet splatDescriptorSet = VK_NULL_HANDLE;
+	VkPipelineLayout splatPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline splatPipeline = VK_NULL_HANDLE;
+	VkPipeline splatResolvePipeline = VK_NULL_HANDLE;
+	Shader* splatShader = nullptr;
+	Shader* splatResolveShader = nullptr;
+	SplatUniforms splatUniform{};
+	bool splatPending = false;
+
+	// Mesh readback: one frame's meshDraws copied into a host-cached buffer, grown when a copy does not fit
+	VkBuffer meshReadbackBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory meshReadbackMemory = VK_NULL_HANDLE;
+	size_t meshReadbackCapacity = 0;   // in vertices
+	uint32_t meshReadbackFrame = 0;
+
+	// tPackedCases from MarchingCubesTables.h, uploaded once into device-local memory
+	VkBuffer marchTableBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory marchTableBufferMemory = VK_NULL_HANDLE;
 
 	VkRenderPass renderPass;
 	VkPipelineLayout pipelineLayout;
@@ -118,10 +289,14 @@ public: //private:
 
 	VkCommandPool commandPool;
 	std::vector<VkCommandBuffer> commandBuffer;
+	std::vector<VkCommandBuffer> computeCommandBuffer;
+
+	uint32_t acquiredImageIndex;
 
 	VkImage depthImage;
 	VkDeviceMemory depthImageMemory;
 	VkImageView depthImageView;
+	VkFormat depthFormat = VK_FORMAT_UNDEFINED;
 
 public:
 
@@ -129,6 +304,75 @@ public:
 	int gridSize2 = gridSize * gridSize;
 	int NUM_PARTICLES = gridSize*gridSize2;
 
+	// Memory layout of the field buffer (FieldLayout.h); bricked grids are padded to whole bricks.
+	// Grid size and layout are set through setGrid before createPosBuffer
+	int fieldLayout = FIELD_LAYOUT_LINEAR;
+	size_t fieldCells = NUM_PARTICLES;
+
+	// The frame draws meshDraws from the chunk arena when drawChunks is set, from the grid's vertex buffer otherwise
+	void* chunkArenaMap = nullptr;
+	bool drawChunks = false;
+	std::vector<MeshDraw> meshDraws;
+
+	// The grid is culled in tiles of whole x rows, FIELD_BRICK_SIZE rows of y by FIELD_BRICK_SIZE slabs of z, so a
+	// tile's vertices are FIELD_BRICK_SIZE contiguous ranges and its cells are whole compute workgroups.
+	// Bit ty + tiles * tz of gridTileMeshMask is set when the tile is meshed this frame; shader.comp skips the others.
+	std::vector<uint32_t> gridTileMeshMask;
+	int gridTilesPerAxis() const { return static_cast<int>(fieldBricksPerAxis(gridSize)); }
+	bool gridTileMeshed(int ty, int tz) const {
+		int tile = ty + gridTilesPerAxis() * tz;
+		return (gridTileMeshMask[tile >> 5] >> (tile & 31)) & 1u;
+	}
+
+	// Sets gridTileMeshMask and fills meshDraws with the grid's vertex ranges. Tiles outside frustum (none when null)
+	// are neither meshed nor drawn. Tiles in occludedIds are drawn, so the occlusion pass tests them again, but keep
+	// their vertices from before.
+	void cullGrid(const Frustum* frustum);
+
+	// Draws the grid as one instanced cube per occupied grid point instead of the marching cubes mesh. Neither mesher
+	// runs; bricks.comp lists the bricks with a face open to empty space and one indirect draw renders them.
+	bool brickMode = false;
+
+	// Renders the grid by ray-marching the field buffer in a full-screen pass instead of meshing it. Neither mesher
+	// runs; raymarch.comp bounds every field brick so the rays skip the empty ones. Brick mode takes precedence.
+	bool rayMarchMode = false;
+
+	// Uploads a point cloud (x, y, z per point) for splatPoints; call after createPosBuffer
+	void createPointSplatting(const float* positions, size_t count);
+
+	// Splats the uploaded cloud into the field buffer at the start of the next recorded compute pass, before it is
+	// meshed. Host readers of the field (the CPU meshers) see the result once that frame has finished.
+	void splatPoints(const SplatUniforms& uniforms);
+
+	// Copies the mesh of the next recorded frame for export without waiting on the device. Set the state to REQUESTED;
+	// recording the compute pass copies the vertex ranges of meshDraws after meshing and moves it to COPYING, and
+	// acquireFrame moves it to READY once that frame has finished. meshReadbackDraws (firstVertex counted from
+	// meshReadbackMap) and meshReadbackExtent, the mesh extent the copied vertices were packed with, then describe
+	// the copy until the state is set back to IDLE.
+	std::atomic<int> meshReadbackState{ MESH_READBACK_IDLE };
+	std::vector<MeshDraw> meshReadbackDraws;
+	float meshReadbackExtent = 0.0f;
+	void* meshReadbackMap = nullptr;
+
+	// Tests meshDraws against the previous frame's depth on the GPU; has no effect unless occlusionSupported
+	bool occlusionCulling = false;
+
+	// Runs the same pass for the view frustum and the normal cones of chunk meshlets, with or without the depth test;
+	// also needs occlusionSupported. Without it every meshlet is drawn.
+	bool clusterCulling = false;
+
+	// Results of the last finished frame that used the current frame slot, collected by acquireFrame: the sorted
+	// occlusionIds none of whose draws survived the occlusion pass, whether those are chunk slots rather than grid
+	// tiles, and how many draws went in and survived
+	std::vector<uint32_t> occludedIds;
+	bool occludedChunks = false;
+	size_t occlusionCandidates = 0;
+	size_t occlusionSurvivors = 0;
+
+	// The vertex buffer holds one stream of NUM_PARTICLES * 15 vertices per iso-level
+	int isoLevelCount = 1;
+	size_t vertexCount() const { return (size_t)NUM_PARTICLES * 15 * isoLevelCount; }
+
 	bool framebufferResized = false;
 
 	std::vector<VkSemaphore> imageAvailableSemaphore;
@@ -143,6 +387,7 @@ public:
 
 	VulkanClass();
 	VulkanClass(GLFWwindow* win);
+	VulkanClass(uint32_t width, uint32_t height);
 	~VulkanClass();
 
 	std::vector<const char*> getRequiredExtensions();
@@ -150,8 +395,14 @@ public:
 	bool findQueueFamilies(VkPhysicalDevice device);
 	bool checkSwapChainSupport(VkPhysicalDevice device);
 	VkDevice getLogicalDevice() { return logicalDevice; }
-	void draw(uint32_t imageIndex);
-	void dispatch(uint32_t imageIndex);
+	bool acquireFrame(uint32_t currentFrame);
+	// Waits until the frame before currentFrame has finished drawing. acquireFrame only waits for this frame's previous
+	// use and the last compute pass, so the host must call this before it rewrites vertices the last draw may read.
+	void waitForPreviousDraw(uint32_t currentFrame);
+	void recordFrame(uint32_t currentFrame);
+	void draw(uint32_t currentFrame);
+	void dispatch(uint32_t currentFrame);
+	void runCompute(uint32_t currentFrame);
 	int getMaxFramesInFlight() { return swapChain.MAX_FRAMES_IN_FLIGHT; }
 	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
@@ -164,6 +415,15 @@ public:
 	VkImageView createImageView(VkImage image, VkFormat format);
 	VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
 	void createDepthResources();
+	void createOcclusionCulling();
+	void createDepthPyramid();
+	void destroyDepthPyramid();
+	void updateCullDescriptorSets();
+	void updateVertexDescriptorSets();
+	void recordOcclusionCulling(VkCommandBuffer commandBuffer, uint32_t currentFrame, uint32_t numDraws);
+	void recordPointSplat(VkCommandBuffer commandBuffer);
+	void recordMeshReadback(VkCommandBuffer commandBuffer, uint32_t currentFrame);
+	void collectOcclusionResults(uint32_t currentFrame);
 
 	//void initVulkan();
 	void createInstance();
@@ -172,6 +432,7 @@ public:
 	void createSurface();
 
 	void createSwapChain();
+	void createOffscreenImages(uint32_t width, uint32_t height);
 	void createImageViews();
 	void recreateSwapChain();
 
@@ -180,7 +441,14 @@ public:
 	void createDescriptorPools();
 	void createTransformDescriptorSet();
 
+	void setGrid(int size, int layout, int isoLevels = 1);
 	void createPosBuffer();
+	void createMarchTableBuffer();
+	void createChunkArena(size_t vertices);
+	void createTileVisibilityBuffer();
+	void createBrickBuffer();
+	void createFieldRangeBuffer();
+	void createDrawBuffers(size_t draws);
 	void createComputeDescriptorPool();
 	void createComputeDescriptorSet();
 
@@ -197,8 +465,7 @@ public:
 
 	void createSyncObjects();
 
-	void updateTransform();
-	void updateCompute();
+	void updateTransform(uint32_t currentFrame);
 
 	void createVertexBuffer();
 
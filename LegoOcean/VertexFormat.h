@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include "glm/glm.hpp"
+
+// Compact mesh vertex, 8 bytes instead of two vec4s.
+// Position is 16-bit unorm relative to the mesh origin and scaled by the mesh extent,
+// the normal is octahedral-encoded in 2x8-bit snorm. Shaders/vertex_format.glsl packs and unpacks the same layout
+// as a uvec2 on the GPU.
+struct PackedVertex {
+	uint16_t x;
+	uint16_t y;
+	uint16_t z;
+	int8_t nx;
+	int8_t ny;
+};
+
+static_assert(sizeof(PackedVertex) == 8, "PackedVertex must match the uvec2 written by shader.comp");
+
+inline glm::vec2 octEncode(glm::vec3 n) {
+
+	float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (!(sum > 0.0f)) {
+		return glm::vec2(0.0f);
+	}
+
+	n /= sum;
+	if (n.z < 0.0f) {
+		glm::vec2 signs(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+		return (1.0f - glm::abs(glm::vec2(n.y, n.x))) * signs;
+	}
+	return glm::vec2(n.x, n.y);
+
+}
+
+inline glm::vec3 octDecode(glm::vec2 e) {
+
+	glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+	if (n.z < 0.0f) {
+		glm::vec2 signs(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+		glm::vec2 xy = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * signs;
+		n.x = xy.x;
+		n.y = xy.y;
+	}
+	return glm::normalize(n);
+
+}
+
+inline uint16_t quantizeUnorm16(float v) {
+	return static_cast<uint16_t>(std::round(std::clamp(v, 0.0f, 1.0f) * 65535.0f));
+}
+
+inline int8_t quantizeSnorm8(float v) {
+	return static_cast<int8_t>(std::round(std::clamp(v, -1.0f, 1.0f) * 127.0f));
+}
+
+// pos is relative to the mesh origin, extent is the edge length of the mesh bounds
+inline PackedVertex packVertex(glm::vec3 pos, glm::vec3 normal, float extent) {
+
+	PackedVertex vertex;
+	vertex.x = quantizeUnorm16(pos.x / extent);
+	vertex.y = quantizeUnorm16(pos.y / extent);
+	vertex.z = quantizeUnorm16(pos.z / extent);
+
+	glm::vec2 oct = octEncode(normal);
+	vertex.nx = quantizeSnorm8(oct.x);
+	vertex.ny = quantizeSnorm8(oct.y);
+
+	return vertex;
+
+}
+
+inline glm::vec3 unpackPosition(const PackedVertex& vertex, float extent) {
+	return glm::vec3(vertex.x, vertex.y, vertex.z) / 65535.0f * extent;
+}
+
+inline glm::vec3 unpackNormal(const PackedVertex& vertex) {
+	return octDecode(glm::vec2(std::max(vertex.nx / 127.0f, -1.0f), std::max(vertex.ny / 127.0f, -1.0f)));
+}
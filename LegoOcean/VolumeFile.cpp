@@ -0,0 +1,598 @@
+#include "VolumeFile.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <regex>
+#include <stdexcept>
+#include <cctype>
+#include <cstdint>
+
+#ifdef _WIN32
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+namespace {
+
+	size_t pageSize() {
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwPageSize;
+#else
+		return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+	}
+
+	bool hostIsBigEndian() {
+		uint16_t probe = 1;
+		uint8_t first;
+		memcpy(&first, &probe, 1);
+		return first == 0;
+	}
+
+	size_t sampleSize(VolumeSampleType type) {
+		switch (type) {
+		case VOLUME_UINT8: case VOLUME_INT8: return 1;
+		case VOLUME_UINT16: case VOLUME_INT16: return 2;
+		case VOLUME_UINT32: case VOLUME_INT32: case VOLUME_FLOAT32: return 4;
+		default: return 8;
+		}
+	}
+
+	// NRRD type names, and the short names raw files carry
+	bool parseSampleType(std::string name, VolumeSampleType& type) {
+
+		static const std::pair<const char*, VolumeSampleType> names[] = {
+			{ "uchar", VOLUME_UINT8 }, { "unsigned char", VOLUME_UINT8 }, { "uint8", VOLUME_UINT8 }, { "uint8_t", VOLUME_UINT8 },
+			{ "signed char", VOLUME_INT8 }, { "int8", VOLUME_INT8 }, { "int8_t", VOLUME_INT8 },
+			{ "ushort", VOLUME_UINT16 }, { "unsigned short", VOLUME_UINT16 }, { "unsigned short int", VOLUME_UINT16 }, { "uint16", VOLUME_UINT16 }, { "uint16_t", VOLUME_UINT16 },
+			{ "short", VOLUME_INT16 }, { "short int", VOLUME_INT16 }, { "signed short", VOLUME_INT16 }, { "signed short int", VOLUME_INT16 }, { "int16", VOLUME_INT16 }, { "int16_t", VOLUME_INT16 },
+			{ "uint", VOLUME_UINT32 }, { "unsigned int", VOLUME_UINT32 }, { "uint32", VOLUME_UINT32 }, { "uint32_t", VOLUME_UINT32 },
+			{ "int", VOLUME_INT32 }, { "signed int", VOLUME_INT32 }, { "int32", VOLUME_INT32 }, { "int32_t", VOLUME_INT32 },
+			{ "float", VOLUME_FLOAT32 }, { "float32", VOLUME_FLOAT32 },
+			{ "double", VOLUME_FLOAT64 }, { "float64", VOLUME_FLOAT64 },
+		};
+
+		std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		for (const auto& entry : names) {
+			if (name == entry.first) {
+				type = entry.second;
+				return true;
+			}
+		}
+		return false;
+
+	}
+
+	std::string trim(const std::string& s) {
+		size_t first = s.find_first_not_of(" \t\r");
+		size_t last = s.find_last_not_of(" \t\r");
+		return first == std::string::npos ? std::string() : s.substr(first, last - first + 1);
+	}
+
+	std::string directoryOf(const std::string& path) {
+		size_t slash = path.find_last_of("/\\");
+		return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+	}
+
+}
+
+MappedFile::MappedFile(const std::string& path) {
+
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("Failed to open " + path + "\n");
+	}
+
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(file, &fileSize);
+	length = static_cast<size_t>(fileSize.QuadPart);
+
+	mapping = length > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	bytes = mapping ? static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+	if (bytes == nullptr) {
+		if (mapping) {
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+		throw std::runtime_error("Failed to map " + path + "\n");
+	}
+#else
+	fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("Failed to open " + path + "\n");
+	}
+
+	struct stat info;
+	fstat(fd, &info);
+	length = static_cast<size_t>(info.st_size);
+
+	void* map = length > 0 ? mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	if (map == MAP_FAILED) {
+		::close(fd);
+		throw std::runtime_error("Failed to map " + path + "\n");
+	}
+	bytes = static_cast<const uint8_t*>(map);
+#endif
+
+}
+
+MappedFile::~MappedFile() {
+
+#ifdef _WIN32
+	UnmapViewOfFile(bytes);
+	CloseHandle(mapping);
+	CloseHandle(file);
+#else
+	munmap(const_cast<uint8_t*>(bytes), length);
+	::close(fd);
+#endif
+
+}
+
+void MappedFile::release(size_t offset, size_t size) const {
+
+	// Only pages entirely inside the range, so neighbouring data stays resident
+	size_t page = pageSize();
+	size_t begin = (offset + page - 1) / page * page;
+	size_t end = std::min(offset + size, length) / page * page;
+	if (begin >= end) {
+		return;
+	}
+
+#ifdef _WIN32
+	// Unlocking pages that are not locked takes them out of the working set
+	VirtualUnlock(const_cast<uint8_t*>(bytes) + begin, end - begin);
+#else
+	madvise(const_cast<uint8_t*>(bytes) + begin, end - begin, MADV_DONTNEED);
+#endif
+
+}
+
+VolumeFile::VolumeFile(const std::string& path) {
+
+	std::string extension = path.size() >= 5 ? path.substr(path.size() - 5) : std::string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+	if (extension == ".nrrd" || extension == ".nhdr") {
+		openNrrd(path);
+	}
+	else {
+		file.reset(new MappedFile(path));
+		if (file->size() >= sizeof(BrickedVolumeHeader) && memcmp(file->data(), "LOBV", 4) == 0)
+			openBricked();
+		else
+			openRaw(path);
+	}
+
+	sampleBytes = sampleSize(type);
+	if (dims.x <= 0 || dims.y <= 0 || dims.z <= 0 || steps <= 0) {
+		throw std::runtime_error("Volume " + path + " has no samples\n");
+	}
+
+	glm::ivec3 bricks = bricksPerAxis();
+	size_t samples = bricked ? (size_t)bricks.x * bricks.y * bricks.z * FIELD_BRICK_CELLS : (size_t)dims.x * dims.y * dims.z;
+	stepBytes = samples * sampleBytes;
+	if (dataOffset > file->size() || (file->size() - dataOffset) / stepBytes < (size_t)steps) {
+		throw std::runtime_error("Volume " + path + " is shorter than its header says\n");
+	}
+
+}
+
+void VolumeFile::openNrrd(const std::string& path) {
+
+	// The header is short, and ends at the first empty line; an attached data block follows it
+	std::unique_ptr<MappedFile> header(new MappedFile(path));
+	std::string head(reinterpret_cast<const char*>(header->data()), std::min(header->size(), (size_t)1 << 20));
+	size_t end = head.find("\n\n");
+	size_t gap = 2;
+	size_t crlf = head.find("\r\n\r\n");
+	if (crlf != std::string::npos && (end == std::string::npos || crlf < end)) {
+		end = crlf;
+		gap = 4;
+	}
+	if (end == std::string::npos) {
+		end = head.size();
+		gap = 0;
+	}
+	size_t attachedOffset = end + gap;
+
+	std::istringstream lines(head.substr(0, end));
+	std::string line;
+	std::getline(lines, line);
+	if (line.compare(0, 7, "NRRD000") != 0) {
+		throw std::runtime_error(path + " is not a NRRD file\n");
+	}
+
+	int dimension = 0;
+	std::vector<int> sizes;
+	std::string dataFile;
+	long long byteSkip = 0;
+	int lineSkip = 0;
+	bool bigEndian = false;
+	bool typed = false;
+
+	while (std::getline(lines, line)) {
+		line = trim(line);
+		size_t colon = line.find(':');
+		// Comments and key/value pairs (key:=value) carry nothing the loader needs
+		if (line.empty() || line[0] == '#' || colon == std::string::npos || line.compare(colon, 2, ":=") == 0) {
+			continue;
+		}
+
+		std::string field = trim(line.substr(0, colon));
+		std::string value = trim(line.substr(colon + 1));
+
+		if (field == "type") {
+			typed = parseSampleType(value, type);
+			if (!typed) {
+				throw std::runtime_error(path + ": unsupported NRRD type " + value + "\n");
+			}
+		}
+		else if (field == "dimension") {
+			dimension = std::stoi(value);
+		}
+		else if (field == "sizes") {
+			std::istringstream list(value);
+			int size;
+			while (list >> size) {
+				sizes.push_back(size);
+			}
+		}
+		else if (field == "encoding" && value != "raw") {
+			throw std::runtime_error(path + ": only raw NRRD encoding can be mapped, not " + value + "\n");
+		}
+		else if (field == "endian") {
+			bigEndian = value == "big";
+		}
+		else if (field == "data file" || field == "datafile") {
+			if (value.compare(0, 4, "LIST") == 0 || value.find('%') != std::string::npos) {
+				throw std::runtime_error(path + ": NRRD data file lists are not supported, pass the files as a series\n");
+			}
+			dataFile = value;
+		}
+		else if (field == "byte skip" || field == "byteskip") {
+			byteSkip = std::stoll(value);
+		}
+		else if (field == "line skip" || field == "lineskip") {
+			lineSkip = std::stoi(value);
+		}
+	}
+
+	if (!typed || (dimension != 3 && dimension != 4) || sizes.size() != (size_t)dimension) {
+		throw std::runtime_error(path + ": NRRD volumes need a type and 3 or 4 sizes\n");
+	}
+
+	dims = glm::ivec3(sizes[0], sizes[1], sizes[2]);
+	steps = dimension == 4 ? sizes[3] : 1;
+	swapBytes = sampleSize(type) > 1 && bigEndian != hostIsBigEndian();
+
+	if (dataFile.empty()) {
+		file = std::move(header);
+		dataOffset = attachedOffset;
+	}
+	else {
+		bool absolute = dataFile[0] == '/' || dataFile[0] == '\\' || (dataFile.size() > 1 && dataFile[1] == ':');
+		file.reset(new MappedFile(absolute ? dataFile : directoryOf(path) + dataFile));
+		dataOffset = 0;
+	}
+
+	for (int i = 0; i < lineSkip && dataOffset < file->size(); i++) {
+		const void* newline = memchr(file->data() + dataOffset, '\n', file->size() - dataOffset);
+		dataOffset = newline ? static_cast<const uint8_t*>(newline) - file->data() + 1 : file->size();
+	}
+
+	// A byte skip of -1 means the data is the end of the file
+	size_t dataBytes = (size_t)dims.x * dims.y * dims.z * steps * sampleSize(type);
+	if (byteSkip < 0)
+		dataOffset = file->size() >= dataBytes ? file->size() - dataBytes : file->size();
+	else
+		dataOffset += static_cast<size_t>(byteSkip);
+
+}
+
+void VolumeFile::openRaw(const std::string& path) {
+
+	std::string name = path.substr(directoryOf(path).size());
+	std::smatch match;
+	if (!std::regex_search(name, match, std::regex("(\\d+)x(\\d+)x(\\d+)(?:x(\\d+))?"))) {
+		throw std::runtime_error("Raw volume names need the sizes and sample type, e.g. ct_512x512x300_uint16.raw\n");
+	}
+
+	dims = glm::ivec3(std::stoi(match[1]), std::stoi(match[2]), std::stoi(match[3]));
+	steps = match[4].matched ? std::stoi(match[4]) : 1;
+
+	bool typed = false;
+	std::istringstream tokens(std::regex_replace(name, std::regex("[_.\\-]"), " "));
+	std::string token;
+	while (!typed && tokens >> token) {
+		typed = parseSampleType(token, type);
+	}
+	if (!typed) {
+		throw std::runtime_error("Raw volume names need the sizes and sample type, e.g. ct_512x512x300_uint16.raw\n");
+	}
+
+	// Raw samples are taken to be little-endian
+	swapBytes = sampleSize(type) > 1 && hostIsBigEndian();
+	dataOffset = 0;
+
+}
+
+void VolumeFile::openBricked() {
+
+	BrickedVolumeHeader header;
+	memcpy(&header, file->data(), sizeof(header));
+
+	if (header.version != 1 || header.sampleType > VOLUME_FLOAT64) {
+		throw std::runtime_error("Unsupported bricked volume version\n");
+	}
+
+	dims = glm::ivec3(header.size[0], header.size[1], header.size[2]);
+	steps = static_cast<int>(header.timesteps);
+	type = static_cast<VolumeSampleType>(header.sampleType);
+	swapBytes = sampleSize(type) > 1 && hostIsBigEndian();
+	bricked = true;
+	dataOffset = sizeof(header);
+
+}
+
+size_t VolumeFile::sampleOffset(int timestep, int x, int y, int z) const {
+
+	size_t base = dataOffset + (size_t)timestep * stepBytes;
+	if (bricked) {
+		glm::ivec3 bricks = bricksPerAxis();
+		size_t brick = (x >> 2) + bricks.x * ((size_t)(y >> 2) + bricks.y * (size_t)(z >> 2));
+		return base + (brick * FIELD_BRICK_CELLS + mortonEncode(x & 3, y & 3, z & 3)) * sampleBytes;
+	}
+	return base + (x + (size_t)dims.x * (y + (size_t)dims.y * z)) * sampleBytes;
+
+}
+
+float VolumeFile::read(size_t offset) const {
+
+	uint8_t raw[8];
+	memcpy(raw, file->data() + offset, sampleBytes);
+	if (swapBytes) {
+		std::reverse(raw, raw + sampleBytes);
+	}
+
+	switch (type) {
+	case VOLUME_UINT8: return raw[0];
+	case VOLUME_INT8: return static_cast<int8_t>(raw[0]);
+	case VOLUME_UINT16: { uint16_t v; memcpy(&v, raw, 2); return v; }
+	case VOLUME_INT16: { int16_t v; memcpy(&v, raw, 2); return v; }
+	case VOLUME_UINT32: { uint32_t v; memcpy(&v, raw, 4); return static_cast<float>(v); }
+	case VOLUME_INT32: { int32_t v; memcpy(&v, raw, 4); return static_cast<float>(v); }
+	case VOLUME_FLOAT32: { float v; memcpy(&v, raw, 4); return v; }
+	default: { double v; memcpy(&v, raw, 8); return static_cast<float>(v); }
+	}
+
+}
+
+int VolumeFile::strideFor(int gridSize) const {
+
+	int largest = std::max(dims.x, std::max(dims.y, dims.z));
+	if (gridSize < 2 || largest <= gridSize) {
+		return 1;
+	}
+	return (largest - 1 + gridSize - 2) / (gridSize - 1);
+
+}
+
+template <typename Fn>
+void VolumeFile::forEachPoint(int timestep, int gridSize, Fn fn) const {
+
+	int stride = strideFor(gridSize);
+	glm::ivec3 extent = glm::min(glm::ivec3(gridSize), (dims - 1) / stride + 1);
+
+	for (int z = 0; z < extent.z; z++) {
+		for (int y = 0; y < extent.y; y++) {
+			for (int x = 0; x < extent.x; x++) {
+				fn(x, y, z, sampleOffset(timestep, x * stride, y * stride, z * stride));
+			}
+		}
+	}
+
+}
+
+void VolumeFile::sample(int timestep, int gridSize, int layout, float* out) const {
+
+	std::fill(out, out + fieldCellCount(layout, gridSize), 0.0f);
+
+	// Float bricks of a bricked file land in a bricked field as they are
+	if (bricked && layout == FIELD_LAYOUT_BRICKED && type == VOLUME_FLOAT32 && !swapBytes && strideFor(gridSize) == 1) {
+		glm::ivec3 extent = glm::min(glm::ivec3(gridSize), dims);
+		size_t gridBricks = fieldBricksPerAxis(gridSize);
+		glm::ivec3 bricks = (extent + glm::ivec3(FIELD_BRICK_SIZE - 1)) / glm::ivec3(FIELD_BRICK_SIZE);
+		int size = FIELD_BRICK_SIZE;
+
+		for (int bz = 0; bz < bricks.z; bz++) {
+			for (int by = 0; by < bricks.y; by++) {
+				for (int bx = 0; bx < bricks.x; bx++) {
+					float* brick = out + (bx + gridBricks * (by + gridBricks * bz)) * FIELD_BRICK_CELLS;
+					if ((bx + 1) * size <= extent.x && (by + 1) * size <= extent.y && (bz + 1) * size <= extent.z) {
+						memcpy(brick, file->data() + sampleOffset(timestep, bx * size, by * size, bz * size), sizeof(float) * FIELD_BRICK_CELLS);
+						continue;
+					}
+					// Partial bricks at the far faces of the grid or volume, point by point
+					for (uint32_t i = 0; i < FIELD_BRICK_CELLS; i++) {
+						uint32_t x, y, z;
+						mortonDecode(i, x, y, z);
+						glm::ivec3 p = glm::ivec3(bx, by, bz) * size + glm::ivec3(x, y, z);
+						if (p.x < extent.x && p.y < extent.y && p.z < extent.z) {
+							brick[i] = read(sampleOffset(timestep, p.x, p.y, p.z));
+						}
+					}
+				}
+			}
+		}
+		return;
+	}
+
+	forEachPoint(timestep, gridSize, [&](int x, int y, int z, size_t offset) {
+		out[fieldIndex(layout, x, y, z, gridSize)] = read(offset);
+	});
+
+}
+
+void VolumeFile::touch(int timestep, int gridSize) const {
+
+	size_t page = pageSize();
+	size_t lastPage = SIZE_MAX;
+	const volatile uint8_t* bytes = file->data();
+	uint8_t sink = 0;
+
+	forEachPoint(timestep, gridSize, [&](int, int, int, size_t offset) {
+		if (offset / page != lastPage) {
+			sink ^= bytes[offset];
+			lastPage = offset / page;
+		}
+	});
+
+	(void)sink;
+
+}
+
+void VolumeFile::release(int timestep) const {
+
+	file->release(dataOffset + (size_t)timestep * stepBytes, stepBytes);
+
+}
+
+void VolumeFile::writeBricked(const std::string& path) const {
+
+	std::ofstream stream(path, std::ios::binary);
+	if (!stream) {
+		throw std::runtime_error("Failed to create " + path + "\n");
+	}
+
+	BrickedVolumeHeader header{};
+	memcpy(header.magic, "LOBV", 4);
+	header.version = 1;
+	header.size[0] = dims.x;
+	header.size[1] = dims.y;
+	header.size[2] = dims.z;
+	header.timesteps = steps;
+	header.sampleType = type;
+	stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	// One z slab of bricks at a time; the source slices it covers are dropped once it is written
+	glm::ivec3 bricks = bricksPerAxis();
+	int size = FIELD_BRICK_SIZE;
+	bool swapOut = sampleBytes > 1 && hostIsBigEndian();
+	std::vector<uint8_t> slab((size_t)bricks.x * bricks.y * FIELD_BRICK_CELLS * sampleBytes);
+
+	for (int t = 0; t < steps; t++) {
+		for (int bz = 0; bz < bricks.z; bz++) {
+			std::fill(slab.begin(), slab.end(), 0);
+			for (int by = 0; by < bricks.y; by++) {
+				for (int bx = 0; bx < bricks.x; bx++) {
+					uint8_t* brick = &slab[(bx + (size_t)bricks.x * by) * FIELD_BRICK_CELLS * sampleBytes];
+					for (uint32_t i = 0; i < FIELD_BRICK_CELLS; i++) {
+						uint32_t x, y, z;
+						mortonDecode(i, x, y, z);
+						glm::ivec3 p = glm::ivec3(bx, by, bz) * size + glm::ivec3(x, y, z);
+						if (p.x >= dims.x || p.y >= dims.y || p.z >= dims.z) {
+							continue;
+						}
+						uint8_t* sample = brick + i * sampleBytes;
+						memcpy(sample, file->data() + sampleOffset(t, p.x, p.y, p.z), sampleBytes);
+						if (swapBytes != swapOut) {
+							std::reverse(sample, sample + sampleBytes);
+						}
+					}
+				}
+			}
+			stream.write(reinterpret_cast<const char*>(slab.data()), slab.size());
+
+			if (!bricked) {
+				int slices = std::min(size, dims.z - bz * size);
+				file->release(sampleOffset(t, 0, 0, bz * size), (size_t)dims.x * dims.y * slices * sampleBytes);
+			}
+		}
+	}
+
+	if (!stream) {
+		throw std::runtime_error("Failed to write " + path + "\n");
+	}
+
+}
+
+VolumeSeries::VolumeSeries(const std::vector<std::string>& paths, int gridSize) {
+
+	this->gridSize = gridSize;
+
+	for (const std::string& path : paths) {
+		files.emplace_back(new VolumeFile(path));
+		for (int t = 0; t < files.back()->timesteps(); t++) {
+			steps.push_back({ static_cast<int>(files.size()) - 1, t });
+		}
+	}
+
+	if (steps.empty()) {
+		throw std::runtime_error("No volume files given\n");
+	}
+
+	prefetcher = std::thread(&VolumeSeries::prefetchLoop, this);
+
+}
+
+VolumeSeries::~VolumeSeries() {
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	prefetcher.join();
+
+}
+
+void VolumeSeries::read(int timestep, int layout, float* out) {
+
+	const Step& step = steps[timestep];
+	files[step.file]->sample(step.timestep, gridSize, layout, out);
+
+	// With two timesteps or fewer, the one before is also the next one
+	if (steps.size() > 2 && lastRead >= 0 && lastRead != timestep) {
+		files[steps[lastRead].file]->release(steps[lastRead].timestep);
+	}
+	lastRead = timestep;
+
+	if (steps.size() > 1) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			prefetchStep = (timestep + 1) % timesteps();
+		}
+		wake.notify_one();
+	}
+
+}
+
+void VolumeSeries::prefetchLoop() {
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		wake.wait(lock, [this] { return stopping || prefetchStep >= 0; });
+		if (stopping) {
+			return;
+		}
+
+		int step = prefetchStep;
+		prefetchStep = -1;
+
+		lock.unlock();
+		files[steps[step].file]->touch(steps[step].timestep, gridSize);
+		lock.lock();
+	}
+
+}
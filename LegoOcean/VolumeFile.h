@@ -0,0 +1,165 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "glm/glm.hpp"
+#include "FieldLayout.h"
+
+// Read-only memory map of a whole file. Pages are read from disk when first touched and can be handed back,
+// so files far larger than RAM can be mapped.
+class MappedFile {
+
+public:
+
+	explicit MappedFile(const std::string& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const uint8_t* data() const { return bytes; }
+	size_t size() const { return length; }
+
+	// Drops the whole pages in [offset, offset + size) from memory; they are read again when next touched
+	void release(size_t offset, size_t size) const;
+
+private:
+
+	const uint8_t* bytes = nullptr;
+	size_t length = 0;
+
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+
+};
+
+enum VolumeSampleType {
+	VOLUME_UINT8 = 0,
+	VOLUME_INT8 = 1,
+	VOLUME_UINT16 = 2,
+	VOLUME_INT16 = 3,
+	VOLUME_UINT32 = 4,
+	VOLUME_INT32 = 5,
+	VOLUME_FLOAT32 = 6,
+	VOLUME_FLOAT64 = 7
+};
+
+// Header of the bricked volume format (.lobv). It is followed by every timestep in turn, each cut into 4x4x4
+// bricks like FIELD_LAYOUT_BRICKED: bricks in x, y, z order, samples inside a brick in Morton order, and the
+// bricks on the far faces padded. Samples are little-endian.
+struct BrickedVolumeHeader {
+	char magic[4];        // "LOBV"
+	uint32_t version;
+	uint32_t size[3];
+	uint32_t timesteps;
+	uint32_t sampleType;  // VolumeSampleType
+	uint32_t reserved;
+};
+
+static_assert(sizeof(BrickedVolumeHeader) == 32, "BrickedVolumeHeader is written as is");
+
+// A scalar volume, or a time series of them, read straight from a memory-mapped file. The format is picked from
+// the file:
+//  - NRRD (.nrrd, or .nhdr with a detached data file), raw encoding, 3 or 4 dimensions with time last
+//  - the bricked format above, by its magic
+//  - anything else is raw samples in x, y, z, t order, with sizes and type in the name: "ct_512x512x300_uint16.raw",
+//    "flow_256x256x256x40_float.raw"
+// The volume is fitted into the grid by sampling every strideFor(gridSize)-th point, so only the pages holding
+// those points are ever read.
+class VolumeFile {
+
+public:
+
+	explicit VolumeFile(const std::string& path);
+
+	glm::ivec3 size() const { return dims; }
+	int timesteps() const { return steps; }
+	bool isBricked() const { return bricked; }
+
+	// Spacing in volume samples between grid points that fits the whole volume into a gridSize^3 grid
+	int strideFor(int gridSize) const;
+
+	// Fills out, fieldCellCount(layout, gridSize) floats, with the timestep; grid points past the volume are 0
+	void sample(int timestep, int gridSize, int layout, float* out) const;
+
+	// Reads one byte of every page sample() reads, so they are resident when it runs
+	void touch(int timestep, int gridSize) const;
+
+	// Hands the timestep's pages back to the OS
+	void release(int timestep) const;
+
+	// Writes the whole volume at full resolution in the bricked format, one slab of bricks at a time
+	void writeBricked(const std::string& path) const;
+
+private:
+
+	std::unique_ptr<MappedFile> file;
+	glm::ivec3 dims = glm::ivec3(0);
+	int steps = 1;
+	VolumeSampleType type = VOLUME_UINT8;
+	size_t sampleBytes = 1;
+	bool swapBytes = false;
+	bool bricked = false;
+	size_t dataOffset = 0;
+	size_t stepBytes = 0;
+
+	void openNrrd(const std::string& path);
+	void openRaw(const std::string& path);
+	void openBricked();
+
+	glm::ivec3 bricksPerAxis() const { return (dims + glm::ivec3(FIELD_BRICK_SIZE - 1)) / glm::ivec3(FIELD_BRICK_SIZE); }
+	size_t sampleOffset(int timestep, int x, int y, int z) const;
+	float read(size_t offset) const;
+
+	// Calls fn(x, y, z, offset) for the grid points inside the volume, with the file offset of their sample
+	template <typename Fn>
+	void forEachPoint(int timestep, int gridSize, Fn fn) const;
+
+};
+
+// The timesteps of one or more volume files played back in order. Reading timestep t has a prefetch thread page
+// in t + 1 while the caller converts t, and releases t - 1, so about two timesteps are resident however long
+// the series is.
+class VolumeSeries {
+
+public:
+
+	VolumeSeries(const std::vector<std::string>& paths, int gridSize);
+	~VolumeSeries();
+
+	int timesteps() const { return static_cast<int>(steps.size()); }
+
+	// Samples timestep into out (see VolumeFile::sample); called from a single thread
+	void read(int timestep, int layout, float* out);
+
+private:
+
+	struct Step {
+		int file;
+		int timestep;
+	};
+
+	std::vector<std::unique_ptr<VolumeFile>> files;
+	std::vector<Step> steps;
+	int gridSize;
+	int lastRead = -1;
+
+	std::thread prefetcher;
+	std::mutex mutex;
+	std::condition_variable wake;
+	int prefetchStep = -1;
+	bool stopping = false;
+
+	void prefetchLoop();
+
+};
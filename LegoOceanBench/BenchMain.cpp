@@ -0,0 +1,114 @@
+#include "MesherBenchmark.h"
+#include "LayoutBenchmark.h"
+#include "OcclusionBenchmark.h"
+#include "RayMarchBenchmark.h"
+#include "FieldRecording.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+
+// Run from the LegoOcean directory so the compiled shaders under ./Shaders are found.
+//
+//   LegoOceanBench [--out mesher.json] [--frames N] [--sizes 32,64,128,256] [--bricked] [--cpu-only | --gpu-only] [--replay rec.lofr]
+//   LegoOceanBench --layout
+//   LegoOceanBench --validate [--frames N] [--sizes 32,64] [--bricked] [--replay rec.lofr]
+//   LegoOceanBench --occlusion [--out occlusion.json] [--frames N] [--sizes 64,128]
+//   LegoOceanBench --raymarch [--out raymarch.json] [--frames N] [--sizes 32,64,128]
+int main(int argc, char** argv) {
+
+	MesherBenchmarkOptions options;
+	std::string outPath = "mesher_benchmark.json";
+	bool validate = false;
+	bool occlusion = false;
+	bool rayMarch = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--layout") == 0) {
+			return runLayoutBenchmark(std::cout);
+		}
+		if (strcmp(argv[i], "--validate") == 0) {
+			validate = true;
+		}
+		if (strcmp(argv[i], "--occlusion") == 0) {
+			occlusion = true;
+		}
+		if (strcmp(argv[i], "--raymarch") == 0) {
+			rayMarch = true;
+		}
+		if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+			outPath = argv[++i];
+		}
+		if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			options.frames = std::max(atoi(argv[++i]), 1);
+		}
+		if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+			options.sizes.clear();
+			std::stringstream list(argv[++i]);
+			std::string size;
+			while (std::getline(list, size, ',')) {
+				options.sizes.push_back(atoi(size.c_str()));
+			}
+		}
+		if (strcmp(argv[i], "--bricked") == 0) {
+			options.layout = FIELD_LAYOUT_BRICKED;
+		}
+		if (strcmp(argv[i], "--cpu-only") == 0) {
+			options.gpu = false;
+		}
+		if (strcmp(argv[i], "--gpu-only") == 0) {
+			options.cpu = false;
+		}
+		if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			options.replay = argv[++i];
+		}
+	}
+
+	// A recording is meshed at the grid size it was recorded at
+	if (!options.replay.empty()) {
+		try {
+			options.sizes = { FieldReplay(options.replay).gridSize() };
+		}
+		catch (const std::exception& e) {
+			std::cerr << e.what();
+			return 1;
+		}
+	}
+
+	if (validate) {
+		try {
+			return runMeshValidation(options);
+		}
+		catch (const std::exception& e) {
+			std::cerr << e.what();
+			return 1;
+		}
+	}
+
+	std::ofstream json(outPath);
+	if (!json) {
+		std::cerr << "Cannot open " << outPath << "\n";
+		return 1;
+	}
+
+	try {
+		if (occlusion)
+			runOcclusionBenchmark(options, json);
+		else if (rayMarch)
+			runRayMarchBenchmark(options, json);
+		else
+			runMesherBenchmark(options, json);
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what();
+		return 1;
+	}
+
+	std::cout << "Results written to " << outPath << "\n";
+
+	return 0;
+
+}
@@ -0,0 +1,223 @@
+#include "LayoutBenchmark.h"
+#include "TraingleTable.h"
+#include "FieldGenerator.h"
+#include <vector>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+	// Set-associative LRU cache fed with the byte addresses of the field reads
+	class CacheModel {
+
+	public:
+
+		CacheModel(size_t sizeBytes, size_t ways, size_t lineBytes) : ways(ways) {
+
+			while ((size_t(1) << lineShift) < lineBytes) {
+				lineShift++;
+			}
+			numSets = sizeBytes / lineBytes / ways;
+			tags.assign(numSets * ways, UINT64_MAX);
+
+		}
+
+		// Returns true on a miss
+		bool access(uint64_t address) {
+
+			uint64_t line = address >> lineShift;
+			uint64_t* set = &tags[(line % numSets) * ways];
+			accesses++;
+
+			size_t way = 0;
+			while (way < ways && set[way] != line) {
+				way++;
+			}
+
+			bool miss = way == ways;
+			if (miss) {
+				misses++;
+				way = ways - 1;
+			}
+
+			// Most recently used line sits at the front of its set
+			std::move_backward(set, set + way, set + way + 1);
+			set[0] = line;
+
+			return miss;
+
+		}
+
+		uint64_t missCount() const { return misses; }
+
+	private:
+
+		size_t ways;
+		size_t numSets;
+		unsigned int lineShift = 0;
+		std::vector<uint64_t> tags;
+		uint64_t accesses = 0;
+		uint64_t misses = 0;
+
+	};
+
+	// Last-level cache misses from the hardware counters, where the OS exposes them
+	class HardwareCacheCounter {
+
+	public:
+
+		HardwareCacheCounter() {
+
+#ifdef __linux__
+			perf_event_attr attr{};
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.size = sizeof(attr);
+			attr.config = PERF_COUNT_HW_CACHE_MISSES;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+
+		}
+
+		~HardwareCacheCounter() {
+
+#ifdef __linux__
+			if (fd >= 0) {
+				close(fd);
+			}
+#endif
+
+		}
+
+		void start() {
+
+#ifdef __linux__
+			if (fd >= 0) {
+				ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+#endif
+
+		}
+
+		// Misses since start(), or -1 if the counter is unavailable
+		long long stop() {
+
+#ifdef __linux__
+			long long count = 0;
+			if (fd >= 0) {
+				ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+				if (read(fd, &count, sizeof(count)) == sizeof(count)) {
+					return count;
+				}
+			}
+#endif
+			return -1;
+
+		}
+
+	private:
+
+		int fd = -1;
+
+	};
+
+	double elapsedMs(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Keeps the marched vertices observable so the mesher is not optimised away
+	volatile uint64_t sink = 0;
+
+	const char* layoutName(int layout) {
+		return layout == FIELD_LAYOUT_BRICKED ? "bricked" : "linear";
+	}
+
+}
+
+int runLayoutBenchmark(std::ostream& out) {
+
+	const int sizes[] = { 64, 128, 256 };
+	const int layouts[] = { FIELD_LAYOUT_LINEAR, FIELD_LAYOUT_BRICKED };
+
+	out << "FIELD LAYOUT - wave field, single thread, corner fetch simulated through a 32KB/8-way L1 and 1MB/16-way L2\n";
+	out << std::left << std::setw(8) << "size" << std::setw(10) << "layout" << std::right
+		<< std::setw(12) << "gen ms" << std::setw(12) << "march ms" << std::setw(14) << "Mcells/s"
+		<< std::setw(13) << "L1 miss/cell" << std::setw(13) << "L2 miss/cell" << std::setw(16) << "hw misses" << "\n";
+
+	std::vector<float> field;
+
+	for (int size : sizes) {
+
+		size_t cells = (size_t)size * size * size;
+		int reps = static_cast<int>(std::max<size_t>(1, (size_t(1) << 23) / cells));
+
+		for (int layout : layouts) {
+
+			setMarchGrid(size, layout);
+
+			auto start = std::chrono::steady_clock::now();
+			for (int r = 0; r < reps; r++) {
+				waveField(size, layout, r * 0.1, field);
+			}
+			double genMs = elapsedMs(start) / reps;
+
+			// Vertices go to a per-cell scratch array; the full 15-slot buffer would be 2GB at 256^3
+			PackedVertex scratch[15];
+			uint64_t checksum = 0;
+			HardwareCacheCounter counter;
+
+			counter.start();
+			start = std::chrono::steady_clock::now();
+			for (int r = 0; r < reps; r++) {
+				marchUnits(0, marchUnitCount(), [&](unsigned int x, unsigned int y, unsigned int z) {
+					march(x, y, z, field.data(), scratch);
+					checksum += scratch[0].x;
+				});
+			}
+			double marchMs = elapsedMs(start) / reps;
+			long long hwMisses = counter.stop();
+			sink = checksum;
+
+			CacheModel l1(32 * 1024, 8, 64);
+			CacheModel l2(1024 * 1024, 16, 64);
+			marchUnits(0, marchUnitCount(), [&](unsigned int x, unsigned int y, unsigned int z) {
+				if (x >= chunk_size - 1 || y >= chunk_size - 1 || z >= chunk_size - 1) {
+					return;
+				}
+				for (unsigned int corner = 0; corner < 8; corner++) {
+					uint64_t address = contIndex(x + (corner & 1), y + ((corner >> 1) & 1), z + (corner >> 2)) * sizeof(float);
+					if (l1.access(address)) {
+						l2.access(address);
+					}
+				}
+			});
+
+			out << std::left << std::setw(8) << size << std::setw(10) << layoutName(layout) << std::right
+				<< std::fixed << std::setprecision(2)
+				<< std::setw(12) << genMs << std::setw(12) << marchMs << std::setw(14) << cells / (marchMs * 1000.0)
+				<< std::setprecision(4) << std::setw(13) << (double)l1.missCount() / cells << std::setw(13) << (double)l2.missCount() / cells
+				<< std::setw(16);
+			if (hwMisses >= 0) {
+				out << hwMisses / reps;
+			}
+			else {
+				out << "n/a";
+			}
+			out << std::defaultfloat << "\n";
+		}
+	}
+
+	return 0;
+
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <ostream>
+
+// Compares the linear and bricked field layouts at 64^3, 128^3 and 256^3: field generation and
+// CPU marching throughput, plus cache misses of the 8-corner fetch.
+int runLayoutBenchmark(std::ostream& out);
@@ -0,0 +1,539 @@
+#include "MesherBenchmark.h"
+#include "VKConfig.h"
+#include "TraingleTable.h"
+#include "FieldGenerator.h"
+#include "FieldRecording.h"
+#include "TaskGraph.h"
+#include "MeshValidation.h"
+#include "GreedyMesher.h"
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <iomanip>
+
+namespace {
+
+	const char* fieldNames[] = { "sphere", "random", "wave", "growth" };
+	const int NUM_FIELDS = 4;
+
+	struct RunResult {
+		std::string backend;
+		std::string field;
+		int grid = 0;
+		int frames = 0;
+		unsigned int threads = 0;
+		double fieldMs = 0.0;
+		double meshMs = 0.0;
+		size_t triangles = 0;
+		size_t fieldBytes = 0;
+		size_t vertexBytes = 0;
+		std::string skipped;
+	};
+
+	RunResult makeBase(const char* backend, int size, const MesherBenchmarkOptions& options) {
+
+		RunResult base;
+		base.backend = backend;
+		base.grid = size;
+		base.frames = options.frames;
+		base.fieldBytes = sizeof(float) * fieldCellCount(options.layout, size);
+		base.vertexBytes = sizeof(PackedVertex) * (size_t)size * size * size * 15;
+		return base;
+
+	}
+
+	int fieldCount(const MesherBenchmarkOptions& options) {
+		return options.replay.empty() ? NUM_FIELDS : 1;
+	}
+
+	const char* fieldName(const MesherBenchmarkOptions& options, int field) {
+		return options.replay.empty() ? fieldNames[field] : "replay";
+	}
+
+	void addSkipped(std::vector<RunResult>& results, const MesherBenchmarkOptions& options, const RunResult& base, std::string reason) {
+
+		reason.erase(reason.find_last_not_of("\n") + 1);
+		for (int field = 0; field < fieldCount(options); field++) {
+			results.push_back(base);
+			results.back().field = fieldName(options, field);
+			results.back().skipped = reason;
+		}
+
+	}
+
+	// Field for one benchmark frame; the animated fields advance by a 60Hz tick per frame
+	void generateField(int field, int size, int layout, int frame, std::minstd_rand& rng, std::vector<float>& previous, std::vector<float>& out) {
+
+		double time = (frame + 1) / 60.0;
+
+		switch (field) {
+		case 0:
+			sphereField(size, layout, size * 0.2f * (1.0f + std::abs(static_cast<float>(sin(time)))), out);
+			break;
+		case 1:
+			randomField(size, layout, rng, out);
+			break;
+		case 2:
+			waveField(size, layout, time, out);
+			break;
+		case 3:
+			if (previous.size() != fieldCellCount(layout, size)) {
+				previous.assign(fieldCellCount(layout, size), 0.0f);
+			}
+			growthField(size, layout, rng, previous, out);
+			previous = out;
+			break;
+		}
+
+	}
+
+	// The frames of one run: a generated field, or the replay from its first frame, so every backend meshes the same
+	// sequence
+	class FieldSource {
+
+	public:
+
+		FieldSource(const MesherBenchmarkOptions& options, int field) : field(field) {
+			if (!options.replay.empty()) {
+				replay.reset(new FieldReplay(options.replay));
+			}
+		}
+
+		void next(int size, int layout, int frame, std::vector<float>& out) {
+			if (replay) {
+				out.resize(fieldCellCount(layout, size));
+				replay->next(layout, out.data());
+				return;
+			}
+			generateField(field, size, layout, frame, rng, previous, out);
+		}
+
+	private:
+
+		int field;
+		std::minstd_rand rng;
+		std::vector<float> previous;
+		std::unique_ptr<FieldReplay> replay;
+
+	};
+
+	// Triangles whose corners are not all in the same place; empty slots are written as degenerate vertices
+	size_t countTriangles(const PackedVertex* vertices, size_t numVertices) {
+
+		size_t count = 0;
+		for (size_t i = 0; i + 2 < numVertices; i += 3) {
+			const PackedVertex& a = vertices[i];
+			const PackedVertex& b = vertices[i + 1];
+			const PackedVertex& c = vertices[i + 2];
+			bool ab = a.x == b.x && a.y == b.y && a.z == b.z;
+			bool ac = a.x == c.x && a.y == c.y && a.z == c.z;
+			if (!ab || !ac) {
+				count++;
+			}
+		}
+		return count;
+
+	}
+
+	double elapsedMs(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// The CPU path of the app: march() over brick/cell slabs spread across the thread pool
+	void meshOnPool(ThreadPool& pool, float* data, PackedVertex* vertices) {
+
+		size_t units = marchUnitCount();
+		unsigned int numSlabs = pool.size() + 1;
+		std::atomic<unsigned int> done{ 0 };
+
+		for (unsigned int slab = 0; slab < numSlabs; slab++) {
+			pool.submit([=, &done] {
+				marchUnits(units * slab / numSlabs, units * (slab + 1) / numSlabs, [&](unsigned int x, unsigned int y, unsigned int z) {
+					march(x, y, z, data, &vertices[(x + (size_t)chunk_size * (y + (size_t)chunk_size * z)) * 15]);
+				});
+				done++;
+			});
+		}
+
+		pool.helpUntil([&] { return done.load() == numSlabs; });
+
+	}
+
+	void runCpu(const MesherBenchmarkOptions& options, int size, ThreadPool& pool, std::vector<RunResult>& results) {
+
+		size_t cells = (size_t)size * size * size;
+		setMarchGrid(size, options.layout);
+
+		std::vector<float> data;
+		std::vector<PackedVertex> vertices;
+
+		RunResult base = makeBase("cpu", size, options);
+		base.threads = pool.size() + 1;
+
+		try {
+			vertices.resize(cells * 15);
+		}
+		catch (const std::bad_alloc&) {
+			addSkipped(results, options, base, "vertex buffer allocation failed");
+			return;
+		}
+
+		for (int field = 0; field < fieldCount(options); field++) {
+
+			RunResult result = base;
+			result.field = fieldName(options, field);
+
+			FieldSource source(options, field);
+
+			for (int frame = 0; frame < options.frames; frame++) {
+				auto start = std::chrono::steady_clock::now();
+				source.next(size, options.layout, frame, data);
+				result.fieldMs += elapsedMs(start);
+
+				start = std::chrono::steady_clock::now();
+				meshOnPool(pool, data.data(), vertices.data());
+				result.meshMs += elapsedMs(start);
+			}
+
+			result.triangles = countTriangles(vertices.data(), vertices.size());
+			results.push_back(result);
+
+			std::cout << "cpu " << result.field << " " << size << "^3: " << result.meshMs / options.frames << " ms/frame\n";
+		}
+
+	}
+
+	// The app's greedy mode: occupancy slabs, then the six face directions, on the pool; gathered on this thread
+	void greedyOnPool(ThreadPool& pool, GreedyMesher& mesher, int size, const float* data, std::vector<PackedVertex>& vertices) {
+
+		unsigned int numSlabs = pool.size() + 1;
+		std::atomic<unsigned int> done{ 0 };
+
+		for (unsigned int slab = 0; slab < numSlabs; slab++) {
+			pool.submit([=, &mesher, &done] {
+				mesher.buildOccupancy(data, iso_levels[0], size * slab / numSlabs, size * (slab + 1) / numSlabs);
+				done++;
+			});
+		}
+		pool.helpUntil([&] { return done.load() == numSlabs; });
+
+		done = 0;
+		for (int direction = 0; direction < 6; direction++) {
+			pool.submit([=, &mesher, &done] {
+				mesher.meshDirection(direction);
+				done++;
+			});
+		}
+		pool.helpUntil([&] { return done.load() == 6; });
+
+		vertices.resize(mesher.vertexCount());
+		mesher.gather(vertices.data(), vertices.size());
+
+	}
+
+	void runGreedy(const MesherBenchmarkOptions& options, int size, ThreadPool& pool, std::vector<RunResult>& results) {
+
+		std::vector<float> data;
+		std::vector<PackedVertex> vertices;
+		std::unique_ptr<GreedyMesher> mesher;
+
+		RunResult base = makeBase("greedy", size, options);
+		base.threads = pool.size() + 1;
+
+		try {
+			mesher.reset(new GreedyMesher(size, options.layout, voxel_size, size * voxel_size));
+		}
+		catch (const std::bad_alloc&) {
+			addSkipped(results, options, base, "occupancy allocation failed");
+			return;
+		}
+
+		for (int field = 0; field < fieldCount(options); field++) {
+
+			RunResult result = base;
+			result.field = fieldName(options, field);
+
+			FieldSource source(options, field);
+
+			for (int frame = 0; frame < options.frames; frame++) {
+				auto start = std::chrono::steady_clock::now();
+				source.next(size, options.layout, frame, data);
+				result.fieldMs += elapsedMs(start);
+
+				start = std::chrono::steady_clock::now();
+				greedyOnPool(pool, *mesher, size, data.data(), vertices);
+				result.meshMs += elapsedMs(start);
+			}
+
+			// Sized to the mesh rather than 15 vertices per cell
+			result.vertexBytes = sizeof(PackedVertex) * vertices.size();
+			result.triangles = vertices.size() / 3;
+			results.push_back(result);
+
+			std::cout << "greedy " << result.field << " " << size << "^3: " << result.meshMs / options.frames << " ms/frame\n";
+		}
+
+	}
+
+	// Headless device set up for shader.comp at one grid size; reason is set when the grid does not fit
+	std::unique_ptr<VulkanClass> createMeshingDevice(int size, int layout, std::string& deviceName, std::string& reason) {
+
+		// Nothing is drawn, the colour target only has to exist
+		std::unique_ptr<VulkanClass> vk(new VulkanClass(64, 64));
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(vk->physicalDevice, &properties);
+		deviceName = properties.deviceName;
+
+		if (sizeof(PackedVertex) * (size_t)size * size * size * 15 > properties.limits.maxStorageBufferRange) {
+			reason = "vertex buffer exceeds maxStorageBufferRange";
+			return nullptr;
+		}
+
+		vk->setGrid(size, layout);
+		vk->createTransformBuffer(sizeof(Transform));
+		vk->createTransformDescriptorSet();
+		vk->createPosBuffer();
+		vk->createComputeDescriptorSet();
+
+		vk->computeUniform.deltaTime = 0.0f;
+		vk->computeUniform.first = 1;
+		vk->computeUniform.fieldMode = 0;
+		vk->computeUniform.meshExtent = size * voxel_size;
+		vk->computeUniform.gridSize = size;
+		vk->computeUniform.fieldLayout = layout;
+
+		return vk;
+
+	}
+
+	// Upload through the mapped field buffer plus the dispatch, as a frame of the app pays for both
+	void meshOnDevice(VulkanClass& vk, const std::vector<float>& data) {
+
+		memcpy(vk.posBufferMap[0], data.data(), sizeof(float) * data.size());
+		vk.runCompute(0);
+
+	}
+
+	void runGpu(const MesherBenchmarkOptions& options, int size, std::string& deviceName, std::vector<RunResult>& results) {
+
+		size_t cells = (size_t)size * size * size;
+
+		RunResult base = makeBase("gpu", size, options);
+
+		std::string reason;
+		std::unique_ptr<VulkanClass> vk = createMeshingDevice(size, options.layout, deviceName, reason);
+		if (!vk) {
+			addSkipped(results, options, base, reason);
+			return;
+		}
+
+		std::vector<float> data;
+
+		for (int field = 0; field < fieldCount(options); field++) {
+
+			RunResult result = base;
+			result.field = fieldName(options, field);
+
+			FieldSource source(options, field);
+
+			for (int frame = 0; frame < options.frames; frame++) {
+				auto start = std::chrono::steady_clock::now();
+				source.next(size, options.layout, frame, data);
+				result.fieldMs += elapsedMs(start);
+
+				start = std::chrono::steady_clock::now();
+				meshOnDevice(*vk, data);
+				result.meshMs += elapsedMs(start);
+			}
+
+			result.triangles = countTriangles(reinterpret_cast<PackedVertex*>(vk->posBufferMap[1]), cells * 15);
+			results.push_back(result);
+
+			std::cout << "gpu " << result.field << " " << size << "^3: " << result.meshMs / options.frames << " ms/frame\n";
+		}
+
+		vkDeviceWaitIdle(vk->getLogicalDevice());
+
+	}
+
+	std::string jsonString(const std::string& value) {
+
+		std::string out = "\"";
+		for (char c : value) {
+			if (c == '"' || c == '\\') {
+				out += '\\';
+			}
+			out += c;
+		}
+		return out + "\"";
+
+	}
+
+	void writeJson(std::ostream& json, const MesherBenchmarkOptions& options, const std::string& deviceName, const std::vector<RunResult>& results) {
+
+		json << "{\n";
+		json << "  \"benchmark\": \"mesher\",\n";
+		json << "  \"frames\": " << options.frames << ",\n";
+		json << "  \"layout\": " << jsonString(options.layout == FIELD_LAYOUT_BRICKED ? "bricked" : "linear") << ",\n";
+		json << "  \"gpu_device\": " << (deviceName.empty() ? "null" : jsonString(deviceName)) << ",\n";
+		json << "  \"runs\": [\n";
+
+		for (size_t i = 0; i < results.size(); i++) {
+			const RunResult& r = results[i];
+			double cells = (double)r.grid * r.grid * r.grid;
+			double meshSeconds = r.meshMs / 1000.0 / std::max(r.frames, 1);
+
+			json << "    { \"backend\": " << jsonString(r.backend) << ", \"field\": " << jsonString(r.field) << ", \"grid\": " << r.grid;
+			if (r.backend == "cpu") {
+				json << ", \"threads\": " << r.threads;
+			}
+			json << ", \"field_bytes\": " << r.fieldBytes << ", \"vertex_bytes\": " << r.vertexBytes;
+
+			if (!r.skipped.empty()) {
+				json << ", \"skipped\": " << jsonString(r.skipped);
+			}
+			else {
+				json << ", \"field_ms\": " << r.fieldMs / r.frames
+					<< ", \"mesh_ms\": " << r.meshMs / r.frames
+					<< ", \"frame_ms\": " << (r.fieldMs + r.meshMs) / r.frames
+					<< ", \"cells_per_sec\": " << (meshSeconds > 0.0 ? cells / meshSeconds : 0.0)
+					<< ", \"triangles\": " << r.triangles
+					<< ", \"triangles_per_sec\": " << (meshSeconds > 0.0 ? r.triangles / meshSeconds : 0.0);
+			}
+
+			json << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+		}
+
+		json << "  ]\n";
+		json << "}\n";
+
+	}
+
+}
+
+int runMesherBenchmark(const MesherBenchmarkOptions& options, std::ostream& json) {
+
+	std::vector<RunResult> results;
+	std::string deviceName;
+
+	if (options.cpu) {
+		unsigned int numThreads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+		ThreadPool pool(numThreads);
+
+		for (int size : options.sizes) {
+			runCpu(options, size, pool, results);
+			runGreedy(options, size, pool, results);
+		}
+	}
+
+	if (options.gpu) {
+		for (int size : options.sizes) {
+			try {
+				runGpu(options, size, deviceName, results);
+			}
+			catch (const std::exception& e) {
+				// No usable device or not enough memory; keep going so the CPU results are still written
+				std::cout << "gpu " << size << "^3 skipped: " << e.what();
+				addSkipped(results, options, makeBase("gpu", size, options), e.what());
+			}
+		}
+	}
+
+	writeJson(json, options, deviceName, results);
+
+	return 0;
+
+}
+
+int runMeshValidation(const MesherBenchmarkOptions& options) {
+
+	unsigned int numThreads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+	ThreadPool pool(numThreads);
+
+	int mismatches = 0;
+
+	for (int size : options.sizes) {
+
+		// Without a device only the greedy normals are checked
+		std::string deviceName;
+		std::string reason;
+		std::unique_ptr<VulkanClass> vk;
+		try {
+			vk = createMeshingDevice(size, options.layout, deviceName, reason);
+		}
+		catch (const std::exception& e) {
+			reason = e.what();
+			reason.erase(reason.find_last_not_of('\n') + 1);
+		}
+		if (!vk) {
+			std::cout << "validate gpu " << size << "^3 skipped: " << reason << "\n";
+		}
+
+		setMarchGrid(size, options.layout);
+
+		size_t cells = (size_t)size * size * size;
+		std::vector<float> data;
+		std::vector<PackedVertex> vertices(cells * 15);
+		std::vector<PackedVertex> greedyVertices;
+		GreedyMesher greedy(size, options.layout, voxel_size, mesh_extent);
+
+		for (int field = 0; field < fieldCount(options); field++) {
+
+			FieldSource source(options, field);
+
+			for (int frame = 0; frame < options.frames; frame++) {
+				source.next(size, options.layout, frame, data);
+
+				meshOnPool(pool, data.data(), vertices.data());
+				std::vector<MeshTriangle> cpu = canonicalizeMesh(vertices.data(), vertices.size());
+
+				if (vk) {
+					meshOnDevice(*vk, data);
+
+					std::vector<MeshTriangle> gpu = canonicalizeMesh(reinterpret_cast<PackedVertex*>(vk->posBufferMap[1]), cells * 15);
+					MeshComparison comparison = compareMeshes(cpu, gpu);
+
+					std::cout << (comparison.equivalent ? "ok       " : "MISMATCH ") << fieldName(options, field) << " " << size << "^3 frame " << frame
+						<< std::hex << std::setfill('0') << " cpu " << std::setw(16) << meshHash(cpu) << " gpu " << std::setw(16) << meshHash(gpu) << std::dec
+						<< " triangles " << comparison.trianglesA << "/" << comparison.trianglesB;
+					if (comparison.unmatchedA != 0 || comparison.unmatchedB != 0) {
+						std::cout << " unmatched " << comparison.unmatchedA << "/" << comparison.unmatchedB;
+					}
+					std::cout << " max error " << comparison.maxPositionError << " steps, " << comparison.maxNormalErrorDegrees << " deg\n";
+
+					if (!comparison.equivalent) {
+						mismatches++;
+					}
+				}
+
+				// The greedy boxes lie within a cell of the marching cubes surface, and their normals point up the field too
+				greedyOnPool(pool, greedy, size, data.data(), greedyVertices);
+				std::vector<MeshTriangle> boxes = canonicalizeMesh(greedyVertices.data(), greedyVertices.size());
+				NormalSignComparison signs = compareNormalSigns(boxes, cpu, 2 * 65535 / size);
+
+				std::cout << (signs.sameSign ? "ok       " : "MISMATCH ") << fieldName(options, field) << " " << size << "^3 frame " << frame
+					<< " greedy normals agree with cpu on " << signs.agreeing << "/" << signs.compared << " triangles\n";
+
+				if (!signs.sameSign) {
+					mismatches++;
+				}
+			}
+		}
+
+		if (vk) {
+			vkDeviceWaitIdle(vk->getLogicalDevice());
+		}
+
+	}
+
+	std::cout << (mismatches == 0 ? "CPU, GPU and greedy meshes match\n" : std::to_string(mismatches) + " mismatched frames\n");
+
+	return mismatches == 0 ? 0 : 1;
+
+}
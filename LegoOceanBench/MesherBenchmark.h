@@ -0,0 +1,26 @@
+#pragma once
+
+#include <ostream>
+#include <vector>
+#include <string>
+
+#include "FieldLayout.h"
+
+struct MesherBenchmarkOptions {
+	std::vector<int> sizes = { 32, 64, 128, 256 };
+	int frames = 10;
+	int layout = FIELD_LAYOUT_LINEAR;
+	bool cpu = true;
+	bool gpu = true;
+	std::string replay;   // a field recording meshed instead of the generated fields, at its own grid size
+};
+
+// Meshes the sphere, random, wave and growth fields (or the replay) at every grid size, on the CPU march() path
+// (threaded like the app), on the greedy voxel mesher when the CPU runs, and on shader.comp through a headless
+// device. Results are written to json.
+int runMesherBenchmark(const MesherBenchmarkOptions& options, std::ostream& json);
+
+// Meshes the same fields on both backends, frame by frame, and compares the canonicalized triangle sets
+// within the MeshValidation tolerances. Prints both mesh hashes per frame. The greedy mesh of every frame is checked
+// for normals of the same sign as the CPU marching cubes mesh, also without a device. Returns 1 on any mismatch.
+int runMeshValidation(const MesherBenchmarkOptions& options);
@@ -0,0 +1,199 @@
+#include "OcclusionBenchmark.h"
+#include "VKConfig.h"
+#include "TraingleTable.h"
+#include "FieldGenerator.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <bit>
+
+namespace {
+
+	const int WIDTH = 1280;
+	const int HEIGHT = 720;
+	const int GROWTH_STEPS = 100;
+
+	struct OcclusionResult {
+		int grid = 0;
+		bool occlusion = false;
+		bool supported = false;
+		double frameMs = 0.0;
+		double candidates = 0.0;   // per frame, after frustum culling
+		double drawn = 0.0;
+		double meshedTiles = 0.0;  // share of the grid's tiles meshed per frame
+		std::string skipped;
+	};
+
+	// Seeds, then grows the field for a while, so the surface is a tangle of blobs that hide each other
+	void grownField(int size, std::vector<float>& out) {
+
+		std::minstd_rand rng;
+		std::vector<float> previous(fieldCellCount(FIELD_LAYOUT_LINEAR, size), 0.0f);
+		for (int step = 0; step < GROWTH_STEPS; step++) {
+			growthField(size, FIELD_LAYOUT_LINEAR, rng, previous, out);
+			previous.swap(out);
+		}
+		out.swap(previous);
+
+	}
+
+	size_t meshedTileCount(const VulkanClass& vk) {
+
+		size_t count = 0;
+		for (uint32_t word : vk.gridTileMeshMask) {
+			count += std::popcount(word);
+		}
+		return std::min(count, (size_t)vk.gridTilesPerAxis() * vk.gridTilesPerAxis());
+
+	}
+
+	OcclusionResult runOnce(const MesherBenchmarkOptions& options, int size, const std::vector<float>& field, bool occlusion) {
+
+		OcclusionResult result;
+		result.grid = size;
+		result.occlusion = occlusion;
+
+		std::unique_ptr<VulkanClass> vk(new VulkanClass(WIDTH, HEIGHT));
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(vk->physicalDevice, &properties);
+		if (sizeof(PackedVertex) * (size_t)size * size * size * 15 > properties.limits.maxStorageBufferRange) {
+			result.skipped = "vertex buffer exceeds maxStorageBufferRange";
+			return result;
+		}
+
+		result.supported = vk->occlusionSupported;
+		vk->occlusionCulling = occlusion;
+		vk->setGrid(size, FIELD_LAYOUT_LINEAR);
+		vk->createTransformBuffer(sizeof(Transform));
+		vk->createTransformDescriptorSet();
+		vk->createPosBuffer();
+		vk->createComputeDescriptorSet();
+		vk->createDrawBuffers((size_t)vk->isoLevelCount * size * vk->gridTilesPerAxis());
+		setMarchGrid(size, FIELD_LAYOUT_LINEAR);
+
+		vk->computeUniform.deltaTime = 0.0f;
+		vk->computeUniform.fieldMode = 0;
+		vk->computeUniform.meshExtent = mesh_extent;
+		vk->computeUniform.gridSize = size;
+		vk->computeUniform.fieldLayout = FIELD_LAYOUT_LINEAR;
+
+		memcpy(vk->posBufferMap[0], field.data(), sizeof(float) * field.size());
+
+		// The camera circles the grid just outside it, looking at its centre, like the app's M scales it
+		glm::mat4 M = glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+		float extent = mesh_extent * 0.5f;
+		glm::vec3 centre(extent * 0.5f);
+
+		uint32_t frames = vk->getMaxFramesInFlight();
+		int warmup = static_cast<int>(frames) + 1;
+
+		for (int frame = 0; frame < warmup + options.frames; frame++) {
+			uint32_t currentFrame = frame % frames;
+
+			auto start = std::chrono::steady_clock::now();
+
+			vk->acquireFrame(currentFrame);
+
+			float angle = frame * 0.01f;
+			glm::vec3 eye = centre + glm::vec3(std::cos(angle), 0.35f, std::sin(angle)) * extent * 1.2f;
+
+			Transform transform{};
+			transform.M = M;
+			transform.V = glm::lookAt(eye, centre, glm::vec3(0.0f, 1.0f, 0.0f));
+			transform.P = glm::perspective(glm::radians(45.0f), WIDTH / (float)HEIGHT, 0.1f, extent * 4.0f);
+			transform.meshBounds = glm::vec4(0.0f, 0.0f, 0.0f, mesh_extent);
+			transform.eye = glm::inverse(M) * glm::vec4(eye, 1.0f);
+			transform.isoStreamVertices = static_cast<int>(marchStreamVertices());
+			vk->transform = transform;
+
+			Frustum frustum = extractFrustum(transform.P * transform.V * transform.M);
+			vk->cullGrid(&frustum);
+			size_t meshed = meshedTileCount(*vk);
+
+			vk->recordFrame(currentFrame);
+			vk->dispatch(currentFrame);
+			vk->draw(currentFrame);
+
+			// Occlusion results of a frame arrive when its slot comes round again
+			if (frame >= warmup) {
+				result.frameMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				result.meshedTiles += meshed / (double)((size_t)vk->gridTilesPerAxis() * vk->gridTilesPerAxis());
+				result.candidates += vk->meshDraws.size();
+				result.drawn += vk->occlusionCandidates > 0 ? vk->occlusionSurvivors : vk->meshDraws.size();
+			}
+		}
+
+		vkDeviceWaitIdle(vk->getLogicalDevice());
+
+		result.frameMs /= options.frames;
+		result.meshedTiles /= options.frames;
+		result.candidates /= options.frames;
+		result.drawn /= options.frames;
+		return result;
+
+	}
+
+	void writeJson(std::ostream& json, const MesherBenchmarkOptions& options, const std::vector<OcclusionResult>& results) {
+
+		json << "{\n";
+		json << "  \"benchmark\": \"occlusion\",\n";
+		json << "  \"frames\": " << options.frames << ",\n";
+		json << "  \"resolution\": [" << WIDTH << ", " << HEIGHT << "],\n";
+		json << "  \"runs\": [\n";
+
+		for (size_t i = 0; i < results.size(); i++) {
+			const OcclusionResult& r = results[i];
+
+			json << "    { \"grid\": " << r.grid << ", \"occlusion\": " << (r.occlusion ? "true" : "false");
+			if (!r.skipped.empty()) {
+				json << ", \"skipped\": \"" << r.skipped << "\"";
+			}
+			else {
+				json << ", \"supported\": " << (r.supported ? "true" : "false")
+					<< ", \"frame_ms\": " << r.frameMs
+					<< ", \"draws\": " << r.candidates
+					<< ", \"drawn\": " << r.drawn
+					<< ", \"cull_rate\": " << (r.candidates > 0.0 ? 1.0 - r.drawn / r.candidates : 0.0)
+					<< ", \"meshed_tiles\": " << r.meshedTiles;
+			}
+			json << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+		}
+
+		json << "  ]\n";
+		json << "}\n";
+
+	}
+
+}
+
+int runOcclusionBenchmark(const MesherBenchmarkOptions& options, std::ostream& json) {
+
+	std::vector<OcclusionResult> results;
+	std::vector<float> field;
+
+	for (int size : options.sizes) {
+		grownField(size, field);
+
+		for (bool occlusion : { false, true }) {
+			OcclusionResult result = runOnce(options, size, field, occlusion);
+			results.push_back(result);
+
+			if (!result.skipped.empty()) {
+				std::cout << size << "^3: " << result.skipped << "\n";
+				break;
+			}
+			std::cout << size << "^3 occlusion " << (occlusion ? "on" : "off") << ": " << result.frameMs << " ms/frame, "
+				<< result.drawn << " of " << result.candidates << " draws, " << result.meshedTiles * 100.0 << "% of tiles meshed\n";
+		}
+	}
+
+	writeJson(json, options, results);
+	return 0;
+
+}
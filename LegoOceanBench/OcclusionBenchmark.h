@@ -0,0 +1,10 @@
+#pragma once
+
+#include <ostream>
+
+#include "MesherBenchmark.h"
+
+// Renders a grown field through a headless 1280x720 device from an orbiting camera, with the grid meshed on
+// shader.comp every frame, once with only frustum culling and once with Hi-Z occlusion culling on top.
+// Reports frame time, candidate and drawn draws and the share of tiles that were meshed. Results are written to json.
+int runOcclusionBenchmark(const MesherBenchmarkOptions& options, std::ostream& json);
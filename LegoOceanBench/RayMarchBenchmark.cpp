@@ -0,0 +1,180 @@
+#include "RayMarchBenchmark.h"
+#include "VKConfig.h"
+#include "TraingleTable.h"
+#include "FieldGenerator.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <cmath>
+#include <memory>
+
+namespace {
+
+	const int WIDTH = 1280;
+	const int HEIGHT = 720;
+
+	const char* fieldNames[] = { "wave", "random" };
+	const int NUM_FIELDS = 2;
+
+	struct RayMarchResult {
+		int grid = 0;
+		std::string field;
+		bool rayMarch = false;
+		double frameMs = 0.0;
+		std::string skipped;
+	};
+
+	// Field of one benchmark frame; both change every frame
+	void generateField(int field, int size, int frame, std::minstd_rand& rng, std::vector<float>& out) {
+
+		if (field == 0)
+			waveField(size, FIELD_LAYOUT_LINEAR, (frame + 1) / 60.0, out);
+		else
+			randomField(size, FIELD_LAYOUT_LINEAR, rng, out);
+
+	}
+
+	RayMarchResult runOnce(const MesherBenchmarkOptions& options, int size, int field, bool rayMarch, std::string& deviceName) {
+
+		RayMarchResult result;
+		result.grid = size;
+		result.field = fieldNames[field];
+		result.rayMarch = rayMarch;
+
+		std::unique_ptr<VulkanClass> vk(new VulkanClass(WIDTH, HEIGHT));
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(vk->physicalDevice, &properties);
+		deviceName = properties.deviceName;
+		if (sizeof(PackedVertex) * (size_t)size * size * size * 15 > properties.limits.maxStorageBufferRange) {
+			result.skipped = "vertex buffer exceeds maxStorageBufferRange";
+			return result;
+		}
+
+		// Both paths draw the whole grid, so only the way the surface reaches the screen differs
+		vk->occlusionCulling = false;
+		vk->rayMarchMode = rayMarch;
+		vk->setGrid(size, FIELD_LAYOUT_LINEAR);
+		vk->createTransformBuffer(sizeof(Transform));
+		vk->createTransformDescriptorSet();
+		vk->createPosBuffer();
+		vk->createComputeDescriptorSet();
+		vk->createDrawBuffers((size_t)vk->isoLevelCount * size * vk->gridTilesPerAxis());
+		setMarchGrid(size, FIELD_LAYOUT_LINEAR);
+
+		vk->computeUniform.deltaTime = 0.0f;
+		vk->computeUniform.fieldMode = 0;
+		vk->computeUniform.meshExtent = mesh_extent;
+		vk->computeUniform.gridSize = size;
+		vk->computeUniform.fieldLayout = FIELD_LAYOUT_LINEAR;
+
+		// The camera circles the grid just outside it, looking at its centre, like the app's M scales it
+		glm::mat4 M = glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+		float extent = mesh_extent * 0.5f;
+		glm::vec3 centre(extent * 0.5f);
+
+		std::minstd_rand rng;
+		std::vector<float> data;
+
+		uint32_t frames = vk->getMaxFramesInFlight();
+		int warmup = static_cast<int>(frames) + 1;
+
+		for (int frame = 0; frame < warmup + options.frames; frame++) {
+			uint32_t currentFrame = frame % frames;
+
+			// Generated outside the timing; both paths upload the same field
+			generateField(field, size, frame, rng, data);
+
+			auto start = std::chrono::steady_clock::now();
+
+			vk->acquireFrame(currentFrame);
+			memcpy(vk->posBufferMap[0], data.data(), sizeof(float) * data.size());
+
+			float angle = frame * 0.01f;
+			glm::vec3 eye = centre + glm::vec3(std::cos(angle), 0.35f, std::sin(angle)) * extent * 1.2f;
+
+			Transform transform{};
+			transform.M = M;
+			transform.V = glm::lookAt(eye, centre, glm::vec3(0.0f, 1.0f, 0.0f));
+			transform.P = glm::perspective(glm::radians(45.0f), WIDTH / (float)HEIGHT, 0.1f, extent * 4.0f);
+			transform.meshBounds = glm::vec4(0.0f, 0.0f, 0.0f, mesh_extent);
+			transform.eye = glm::inverse(M) * glm::vec4(eye, 1.0f);
+			transform.isoStreamVertices = static_cast<int>(marchStreamVertices());
+			vk->transform = transform;
+
+			vk->cullGrid(nullptr);
+
+			vk->recordFrame(currentFrame);
+			vk->dispatch(currentFrame);
+			vk->draw(currentFrame);
+
+			if (frame >= warmup) {
+				result.frameMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			}
+		}
+
+		// The last frames in flight count too
+		auto start = std::chrono::steady_clock::now();
+		vkDeviceWaitIdle(vk->getLogicalDevice());
+		result.frameMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		result.frameMs /= options.frames;
+		return result;
+
+	}
+
+	void writeJson(std::ostream& json, const MesherBenchmarkOptions& options, const std::string& deviceName, const std::vector<RayMarchResult>& results) {
+
+		json << "{\n";
+		json << "  \"benchmark\": \"raymarch\",\n";
+		json << "  \"device\": \"" << deviceName << "\",\n";
+		json << "  \"frames\": " << options.frames << ",\n";
+		json << "  \"resolution\": [" << WIDTH << ", " << HEIGHT << "],\n";
+		json << "  \"runs\": [\n";
+
+		for (size_t i = 0; i < results.size(); i++) {
+			const RayMarchResult& r = results[i];
+
+			json << "    { \"grid\": " << r.grid << ", \"field\": \"" << r.field << "\", \"path\": \"" << (r.rayMarch ? "raymarch" : "mesh") << "\"";
+			if (!r.skipped.empty()) {
+				json << ", \"skipped\": \"" << r.skipped << "\"";
+			}
+			else {
+				json << ", \"frame_ms\": " << r.frameMs;
+			}
+			json << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+		}
+
+		json << "  ]\n";
+		json << "}\n";
+
+	}
+
+}
+
+int runRayMarchBenchmark(const MesherBenchmarkOptions& options, std::ostream& json) {
+
+	std::vector<RayMarchResult> results;
+	std::string deviceName;
+
+	for (int size : options.sizes) {
+		for (int field = 0; field < NUM_FIELDS; field++) {
+			for (bool rayMarch : { false, true }) {
+				RayMarchResult result = runOnce(options, size, field, rayMarch, deviceName);
+				results.push_back(result);
+
+				if (!result.skipped.empty()) {
+					std::cout << size << "^3: " << result.skipped << "\n";
+					break;
+				}
+				std::cout << fieldNames[field] << " " << size << "^3 " << (rayMarch ? "ray march" : "mesh + raster") << ": " << result.frameMs << " ms/frame\n";
+			}
+		}
+	}
+
+	writeJson(json, options, deviceName, results);
+	return 0;
+
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <ostream>
+
+#include "MesherBenchmark.h"
+
+// Renders the animated wave and random fields through a headless 1280x720 device from an orbiting camera, once
+// meshed on shader.comp and rasterized, and once ray-marched straight from the field buffer. The field changes
+// every frame, as it does in the app. Reports frame time per path and grid size; results are written to json.
+int runRayMarchBenchmark(const MesherBenchmarkOptions& options, std::ostream& json);